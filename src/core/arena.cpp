@@ -0,0 +1,18 @@
+#include "core/arena.h"
+
+void *Arena::allocate(size_t size, size_t align)
+{
+  uintptr_t base = reinterpret_cast<uintptr_t>(storage);
+  uintptr_t start = (base + used_ + align - 1) & ~(static_cast<uintptr_t>(align) - 1);
+  size_t end = start - base + size;
+  if (size == 0 || end > capacity_)
+  {
+    failures_++;
+    return nullptr;
+  }
+
+  used_ = end;
+  if (used_ > highWater_)
+    highWater_ = used_;
+  return reinterpret_cast<void *>(start);
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#ifndef RECORDER_MODEL_ARENA_SIZE
+#define RECORDER_MODEL_ARENA_SIZE 65536 // bytes for the on-device models (blob, activations, window)
+#endif
+
+// Bump allocator over a caller-owned region, for buffers that live until
+// reboot. Nothing is freed individually; a failed setup rewinds to a mark.
+// Exhaustion is counted, never fatal: the caller gets nullptr and degrades.
+//
+// Not thread-safe, allocate from one task (in practice during setup).
+class Arena
+{
+public:
+  Arena(uint8_t *storage, size_t capacity) : storage(storage), capacity_(capacity) {}
+
+  void *allocate(size_t size, size_t align = alignof(max_align_t));
+
+  template <typename T>
+  T *allocate(size_t count) { return static_cast<T *>(allocate(count * sizeof(T), alignof(T))); }
+
+  size_t mark() const { return used_; }
+  void rewind(size_t mark) { used_ = mark < used_ ? mark : used_; }
+
+  size_t used() const { return used_; }
+  size_t capacity() const { return capacity_; }
+  size_t highWater() const { return highWater_; }
+  uint32_t failures() const { return failures_; }
+
+private:
+  uint8_t *storage;
+  size_t capacity_;
+  size_t used_ = 0;
+  size_t highWater_ = 0;
+  uint32_t failures_ = 0;
+};
+
+// Arena with its storage inline, sized at compile time.
+template <size_t N>
+class StaticArena : public Arena
+{
+public:
+  StaticArena() : Arena(buffer, N) {}
+
+private:
+  alignas(max_align_t) uint8_t buffer[N == 0 ? 1 : N];
+};
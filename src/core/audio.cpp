@@ -2,8 +2,8 @@
 
 #include <cstdint>
 #include <driver/i2s.h>
-#include <vector>
 
+#include "core/metrics.h"
 #include "core/utils.h"
 
 createTag(RECORDER);
@@ -30,73 +30,48 @@ void Recorder::begin(uint32_t sampleRate)
                                  (i2s_mode_t)(I2S_MODE_MASTER | I2S_MODE_RX),
                              .sample_rate = sampleRate,
                              .bits_per_sample = AudioConfig::bitsPerSample,
-                             // bro this is stupid, PIO framework library for arduino-esp32 is outdated!!!
-                             // this is a bug from older i2s driver:
-                             // https://github.com/espressif/esp-idf/issues/6625
-                             .channel_format = I2S_CHANNEL_FMT_ONLY_RIGHT,
+                             .channel_format = AudioConfig::channelFormat,
                              .communication_format = I2S_COMM_FORMAT_STAND_I2S,
                              .intr_alloc_flags = ESP_INTR_FLAG_LEVEL1,
-                             .dma_buf_count = 8,
-                             .dma_buf_len = 1024,
+                             .dma_buf_count = dmaBufferCount,
+                             .dma_buf_len = dmaBufferLength,
                              .use_apll = true};
 
-  i2s_driver_install(deviceIndex, &i2s_config, 0, NULL);
+  // The event queue is the only way to learn that the DMA ring overflowed
+  // while i2s_read was not being called.
+  i2s_driver_install(deviceIndex, &i2s_config, RECORDER_I2S_EVENT_QUEUE,
+                     RECORDER_I2S_EVENT_QUEUE > 0 ? &events : NULL);
   i2s_set_pin(deviceIndex, &i2s_pin_config);
 }
 
-void Recorder::end() { i2s_driver_uninstall(deviceIndex); }
-
-void writeSamples(
-    size_t bytesRead,
-    const int32_t *samplingBuffer,
-    size_t &bytesWritten, // caller-maintained write position
-    uint8_t *fsBuffer,
-    size_t fsBufferSize, // MUST be actual capacity of fsBuffer
-    File &file)
+void Recorder::end()
 {
-  if (AudioConfig::bytesPerSample == 0)
-    return;
-
-  size_t numOfSamples = bytesRead / AudioConfig::bytesPerSample;
-  if (numOfSamples == 0)
-    return;
+  i2s_driver_uninstall(deviceIndex);
+  events = nullptr;
+}
 
-  for (size_t s = 0; s < numOfSamples; ++s)
+AudioOverrun Recorder::takeOverruns()
+{
+  AudioOverrun overrun{0, 0};
+  if (!events)
+    return overrun;
+
+  // RX_DONE events come once per DMA buffer. The driver drops the oldest
+  // event when the queue is full, so a recent overflow is never lost.
+  i2s_event_t event;
+  while (xQueueReceive(events, &event, 0) == pdTRUE)
   {
-    // Ensure enough room, otherwise flush
-    if (bytesWritten + AudioConfig::validBytesPerSample > fsBufferSize)
-    {
-      file.write(fsBuffer, bytesWritten);
-      bytesWritten = 0;
-    }
-
-    // Work with the raw unsigned bit-pattern to avoid sign-extension issues
-    // when shifting. The microphone's 24 valid bits live either left-justified
-    // (top 24 bits of the 32-bit word) or right-justified; shift accordingly.
-    uint32_t raw = static_cast<uint32_t>(samplingBuffer[s]);
-    uint32_t u;
-    uint8_t b0, b1, b2;
+    if (event.type != I2S_EVENT_RX_Q_OVF)
+      continue;
 
-    if (AudioConfig::isLeftJustified)
-    {
-      // left-justified: valid 24 bits are in bits [31:8]
-      u = (raw >> 8) & 0x00FFFFFFu;
-    }
-    else
-    {
-      // right-justified: valid 24 bits are in bits [23:0]
-      u = raw & 0x00FFFFFFu;
-    }
-
-    // LSB-first for WAV 24-bit file (three bytes little-endian)
-    b0 = static_cast<uint8_t>(u & 0xFFu);
-    b1 = static_cast<uint8_t>((u >> 8) & 0xFFu);
-    b2 = static_cast<uint8_t>((u >> 16) & 0xFFu);
-
-    fsBuffer[bytesWritten++] = b0;
-    fsBuffer[bytesWritten++] = b1;
-    fsBuffer[bytesWritten++] = b2;
+    size_t bytes = event.size != 0 ? event.size : dmaBufferLength * AudioConfig::bytesPerSample;
+    overrun.events++;
+    overrun.lostFrames += bytes / AudioConfig::bytesPerSample;
   }
+
+  if (overrun.events != 0)
+    Metrics::add(Metrics::Counter::I2S_OVERRUNS, overrun.events);
+  return overrun;
 }
 
 esp_err_t Recorder::read(int32_t *buffer, const size_t bufferSize, size_t *bytesRead)
@@ -107,11 +82,12 @@ esp_err_t Recorder::read(int32_t *buffer, const size_t bufferSize, size_t *bytes
     return ESP_ERR_INVALID_ARG;
   }
 
+  metricsTimer(I2S_READ);
   return i2s_read(deviceIndex, buffer, bufferSize, bytesRead,
                   portMAX_DELAY);
 }
 
-bool Recorder::readFor(unsigned long durationMs, size_t bufferSize, RecordingCallback callback)
+bool Recorder::readFor(unsigned long durationMs, int32_t *buffer, size_t bufferSize, RecordingCallback callback)
 {
   if (bufferSize % AudioConfig::bytesPerSample != 0)
   {
@@ -120,7 +96,6 @@ bool Recorder::readFor(unsigned long durationMs, size_t bufferSize, RecordingCal
   }
 
   size_t bytesRead = 0;
-  std::vector<int32_t> samplingBuffer(bufferSize / AudioConfig::bytesPerSample);
 
   const size_t totalSamples = (static_cast<size_t>(sampleRate) * durationMs) / 1000;
   const size_t loops = totalSamples * AudioConfig::bytesPerSample / bufferSize;
@@ -132,7 +107,7 @@ bool Recorder::readFor(unsigned long durationMs, size_t bufferSize, RecordingCal
 
   for (size_t i = 0; i < loops; i++)
   {
-    esp_err_t r = i2s_read(deviceIndex, samplingBuffer.data(), bufferSize, &bytesRead,
+    esp_err_t r = i2s_read(deviceIndex, buffer, bufferSize, &bytesRead,
                            portMAX_DELAY);
     if (r != ESP_OK)
     {
@@ -142,7 +117,7 @@ bool Recorder::readFor(unsigned long durationMs, size_t bufferSize, RecordingCal
 
     if (callback)
     {
-      callback(samplingBuffer.data());
+      callback(buffer);
     }
 
     yield();
@@ -151,7 +126,7 @@ bool Recorder::readFor(unsigned long durationMs, size_t bufferSize, RecordingCal
   return true;
 }
 
-void Recorder::writeWavHeader(uint8_t *header, size_t actualTargetBytes)
+void Recorder::writeWavHeader(uint8_t *header, uint32_t actualTargetBytes)
 {
   memcpy(header, "RIFF", 4);
   *(uint32_t *)(header + 4) = actualTargetBytes + 36;
@@ -159,7 +134,8 @@ void Recorder::writeWavHeader(uint8_t *header, size_t actualTargetBytes)
 
   memcpy(header + 12, "fmt ", 4);
   *(uint32_t *)(header + 16) = 16;
-  *(uint16_t *)(header + 20) = 1;
+  // Audio format, PCM or IEEE float
+  *(uint16_t *)(header + 20) = AudioConfig::OutputFormat::wavFormat;
   // Num channels
   *(uint16_t *)(header + 22) = AudioConfig::channelMode;
   // Sample rate
@@ -169,7 +145,7 @@ void Recorder::writeWavHeader(uint8_t *header, size_t actualTargetBytes)
   // Block align (bytes per sample frame)
   *(uint16_t *)(header + 32) = AudioConfig::validBytesPerSample;
   // Bits per sample (per channel)
-  *(uint16_t *)(header + 34) = AudioConfig::hardwareBitsPerSample;
+  *(uint16_t *)(header + 34) = AudioConfig::outputBitsPerSample;
 
   memcpy(header + 36, "data", 4);
   *(uint32_t *)(header + 40) = actualTargetBytes;
@@ -1,20 +1,66 @@
 #pragma once
 
-#include <SPIFFS.h>
+#include <functional>
 #include <driver/i2s.h>
 
-namespace AudioConfig
+#include "core/format.h"
+
+#ifndef RECORDER_OUTPUT_FORMAT
+#define RECORDER_OUTPUT_FORMAT Pcm24 // Pcm16, Pcm24, Pcm32 or Float32, see core/format.h
+#endif
+
+#ifndef RECORDER_INPUT_FORMAT
+#define RECORDER_INPUT_FORMAT LeftJustified // LeftJustified or RightJustified
+#endif
+
+#ifndef RECORDER_CHANNELS
+#define RECORDER_CHANNELS 1 // 1 (mono) or 2 (stereo)
+#endif
+
+#ifndef RECORDER_I2S_EVENT_QUEUE
+#define RECORDER_I2S_EVENT_QUEUE 8 // I2S driver events kept between reads, 0 to not detect overruns
+#endif
+
+// Compile-time recording configuration. I2S always delivers 32-bit slots,
+// `Output` decides what is sent (and how the WAV header describes it) and
+// `Input` where the microphone puts its 24 valid bits inside the slot.
+template <typename Output, typename Input, i2s_channel_t Channels>
+struct AudioConfigOf
 {
-  constexpr i2s_channel_t channelMode = I2S_CHANNEL_MONO;
-  constexpr i2s_bits_per_sample_t bitsPerSample = I2S_BITS_PER_SAMPLE_32BIT;
-  constexpr i2s_bits_per_sample_t hardwareBitsPerSample = I2S_BITS_PER_SAMPLE_24BIT;
-  constexpr uint8_t bytesPerSample = bitsPerSample / 8 * channelMode; // (bitsPerSample / 8) * channelMode
-  constexpr uint8_t validBytesPerSample = hardwareBitsPerSample / 8 * channelMode;
-  constexpr bool isLeftJustified = true; // INMP441 is left-justified in 32-bit word
-}
+  using OutputFormat = Output;
+  using InputFormat = Input;
+
+  static constexpr i2s_channel_t channelMode = Channels;
+  static constexpr i2s_bits_per_sample_t bitsPerSample = I2S_BITS_PER_SAMPLE_32BIT;
+  static constexpr i2s_bits_per_sample_t hardwareBitsPerSample = I2S_BITS_PER_SAMPLE_24BIT;
+  // bytes per I2S frame, (bitsPerSample / 8) * channelMode
+  static constexpr uint8_t bytesPerSample = bitsPerSample / 8 * channelMode;
+  // bytes per output frame
+  static constexpr uint8_t validBytesPerSample = Output::bytesPerSample * channelMode;
+  static constexpr uint16_t outputBitsPerSample = Output::bitsPerSample;
+  static constexpr bool isLeftJustified = Input::isLeftJustified;
+
+  // bro this is stupid, PIO framework library for arduino-esp32 is outdated!!!
+  // this is a bug from older i2s driver:
+  // https://github.com/espressif/esp-idf/issues/6625
+  static constexpr i2s_channel_fmt_t channelFormat =
+      Channels == I2S_CHANNEL_STEREO ? I2S_CHANNEL_FMT_RIGHT_LEFT : I2S_CHANNEL_FMT_ONLY_RIGHT;
+};
+
+using AudioConfig = AudioConfigOf<
+    AudioFormat::RECORDER_OUTPUT_FORMAT,
+    AudioInput::RECORDER_INPUT_FORMAT,
+    static_cast<i2s_channel_t>(RECORDER_CHANNELS)>;
 
 using RecordingCallback = std::function<void(const int32_t *data)>;
 
+// Audio the DMA ring dropped because nobody read it in time.
+struct AudioOverrun
+{
+  uint32_t events;     // I2S_EVENT_RX_Q_OVF, one per dropped DMA buffer
+  uint32_t lostFrames; // I2S frames (one sample per channel) lost
+};
+
 class Recorder
 {
 public:
@@ -24,11 +70,21 @@ public:
   void end();
 
   esp_err_t read(int32_t *buffer, const size_t bufferSize, size_t *bytesRead);
-  bool readFor(unsigned long durationMs, size_t bufferSize, RecordingCallback callback = nullptr);
+  // Reads `durationMs` of audio through the caller's `buffer`, invoking
+  // `callback` after every `bufferSize` bytes.
+  bool readFor(unsigned long durationMs, int32_t *buffer, size_t bufferSize, RecordingCallback callback = nullptr);
+
+  // Drains the driver events without blocking and returns the overruns
+  // since the previous call. Always empty with RECORDER_I2S_EVENT_QUEUE 0.
+  AudioOverrun takeOverruns();
+
+  void writeWavHeader(uint8_t *buf, uint32_t actualTargetBytes);
 
-  void writeWavHeader(uint8_t *buf, uint32_t totalSamples);
+  static constexpr int dmaBufferCount = 8;
+  static constexpr int dmaBufferLength = 1024; // I2S frames
 
 private:
+  QueueHandle_t events = nullptr;
   i2s_port_t deviceIndex;
   uint32_t sampleRate;
   i2s_pin_config_t i2s_pin_config;
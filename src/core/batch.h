@@ -0,0 +1,106 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#ifndef MQTT_COALESCE
+#define MQTT_COALESCE 1 // 0 sends every audio fragment as its own message
+#endif
+
+#ifndef MQTT_COALESCE_MIN
+#define MQTT_COALESCE_MIN 0 // smallest batch target in bytes, below one fragment bodies go straight out
+#endif
+
+#ifndef MQTT_COALESCE_DEADLINE_MS
+#define MQTT_COALESCE_DEADLINE_MS 100 // oldest body a batch holds before it goes out
+#endif
+
+#ifndef MQTT_COALESCE_SLOW_US
+#define MQTT_COALESCE_SLOW_US 20000 // mean publish time above which batches grow
+#endif
+
+// Coalesces consecutive audio bodies of a session into one message of up to
+// `Capacity` bytes, with a batch size that follows the link.
+//
+// A batch goes out before a body that would overflow the current target or
+// once its oldest body is MQTT_COALESCE_DEADLINE_MS old, checked whenever a
+// body comes in; other session messages flush it first. Every publish time
+// feeds a moving mean: above MQTT_COALESCE_SLOW_US the link is congested and
+// the target doubles, so the same audio takes fewer messages and TCP
+// segments. Under a quarter of it the target halves back towards
+// MQTT_COALESCE_MIN, trading the overhead back for latency. Below twice the
+// body size the target means no batching at all.
+//
+// No I/O, the owner sends data() and calls sent(). Single task.
+template <size_t Capacity>
+class BodyBatch
+{
+public:
+  static constexpr size_t capacity = Capacity;
+
+  size_t target() const { return target_; }
+  size_t size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+  const uint8_t *data() const { return buffer; }
+  // Bodies in the batch, and the I2S frames they carry.
+  uint32_t count() const { return count_; }
+  uint32_t frames() const { return frames_; }
+  uint32_t meanUs() const { return meanUs_; }
+
+  // Whether the pending batch must go out before a `size` body arriving at
+  // `now` (milliseconds).
+  bool due(size_t size, unsigned long now) const
+  {
+    return size_ != 0 && (size_ + size > target_ || now - startedAt >= MQTT_COALESCE_DEADLINE_MS);
+  }
+
+  // Whether a `size` body skips the batch, which is then empty.
+  bool bypass(size_t size) const { return size_ == 0 && (target_ < 2 * size || size > Capacity); }
+
+  void append(const uint8_t *body, size_t size, uint32_t frames, unsigned long now)
+  {
+    if (size_ == 0)
+      startedAt = now;
+    memcpy(buffer + size_, body, size);
+    size_ += size;
+    count_++;
+    frames_ += frames;
+  }
+
+  void clear()
+  {
+    size_ = 0;
+    count_ = 0;
+    frames_ = 0;
+  }
+
+  // Adapts the target to a publish of `size` bytes that blocked for `us`.
+  void sent(size_t size, uint32_t us)
+  {
+    last = size;
+    meanUs_ = meanUs_ == 0 ? us : meanUs_ - meanUs_ / 8 + us / 8;
+
+    if (meanUs_ > MQTT_COALESCE_SLOW_US)
+    {
+      size_t grown = target_ < 2 * last ? 2 * last : 2 * target_;
+      target_ = grown < Capacity ? grown : Capacity;
+    }
+    else if (meanUs_ < MQTT_COALESCE_SLOW_US / 4)
+    {
+      target_ /= 2;
+      if (target_ < MQTT_COALESCE_MIN)
+        target_ = MQTT_COALESCE_MIN;
+    }
+  }
+
+private:
+  uint8_t buffer[Capacity];
+  size_t size_ = 0;
+  size_t target_ = Capacity; // starts batching, a fast link shrinks it
+  size_t last = 0; // latest published size
+  uint32_t count_ = 0;
+  uint32_t frames_ = 0;
+  uint32_t meanUs_ = 0;
+  unsigned long startedAt = 0;
+};
@@ -0,0 +1,108 @@
+#include "core/config.h"
+#include "core/utils.h"
+
+#include <Preferences.h>
+#include <esp_rom_crc.h>
+
+#include <cstring>
+
+createTag(CONFIG);
+
+namespace ConfigStore
+{
+  namespace
+  {
+    struct Header
+    {
+      uint16_t version;
+      uint16_t size;
+      uint32_t crc;
+    };
+
+    uint32_t crcOf(const void *value, size_t size)
+    {
+      return esp_rom_crc32_le(0, static_cast<const uint8_t *>(value), size);
+    }
+  }
+
+  bool load(const char *key, uint16_t version, void *value, size_t size)
+  {
+    if (size > CONFIG_MAX_RECORD)
+      return false;
+
+    Preferences preferences;
+    if (!preferences.begin(CONFIG_NAMESPACE, true))
+      return false;
+
+    uint8_t record[sizeof(Header) + CONFIG_MAX_RECORD];
+    size_t length = preferences.getBytesLength(key);
+    size_t read = length <= sizeof(record) ? preferences.getBytes(key, record, length) : 0;
+    preferences.end();
+
+    if (read == 0)
+    {
+      ESP_LOGI(TAG, "No %s config stored", key);
+      return false;
+    }
+
+    Header header;
+    memcpy(&header, record, sizeof(header));
+    if (read != sizeof(Header) + size || header.version != version || header.size != size)
+    {
+      ESP_LOGW(TAG, "Ignoring %s config v%u (%u bytes), expecting v%u (%u bytes)",
+               key, header.version, header.size, version, size);
+      return false;
+    }
+
+    const uint8_t *payload = record + sizeof(Header);
+    if (crcOf(payload, size) != header.crc)
+    {
+      ESP_LOGE(TAG, "Ignoring corrupted %s config", key);
+      return false;
+    }
+
+    memcpy(value, payload, size);
+    return true;
+  }
+
+  bool store(const char *key, uint16_t version, const void *value, size_t size)
+  {
+    if (size > CONFIG_MAX_RECORD)
+    {
+      ESP_LOGE(TAG, "Config %s (%u bytes) is larger than CONFIG_MAX_RECORD", key, size);
+      return false;
+    }
+
+    uint8_t record[sizeof(Header) + CONFIG_MAX_RECORD];
+    Header header{version, static_cast<uint16_t>(size), crcOf(value, size)};
+    memcpy(record, &header, sizeof(header));
+    memcpy(record + sizeof(Header), value, size);
+
+    Preferences preferences;
+    if (!preferences.begin(CONFIG_NAMESPACE, false))
+    {
+      ESP_LOGE(TAG, "Failed to open the config store");
+      return false;
+    }
+
+    size_t written = preferences.putBytes(key, record, sizeof(Header) + size);
+    preferences.end();
+    if (written != sizeof(Header) + size)
+    {
+      ESP_LOGE(TAG, "Failed to store %s config", key);
+      return false;
+    }
+    return true;
+  }
+
+  bool remove(const char *key)
+  {
+    Preferences preferences;
+    if (!preferences.begin(CONFIG_NAMESPACE, false))
+      return false;
+
+    bool removed = preferences.remove(key);
+    preferences.end();
+    return removed;
+  }
+}
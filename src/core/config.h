@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+
+#ifndef CONFIG_NAMESPACE
+#define CONFIG_NAMESPACE "config" // NVS namespace of the config store
+#endif
+
+#ifndef CONFIG_MAX_RECORD
+#define CONFIG_MAX_RECORD 256 // largest record payload, in bytes
+#endif
+
+// Typed configuration records in NVS, so boot reads its settings without
+// mounting SPIFFS.
+//
+// Each record is one NVS blob under its own key:
+//   VERSION 2B, SIZE 2B, CRC32 4B (of the payload), PAYLOAD
+// NVS replaces a blob atomically, so after a power cut a record is either the
+// old or the new one, and the CRC catches anything else. A record with
+// another version or size loads as missing, callers migrate from there.
+namespace ConfigStore
+{
+  bool load(const char *key, uint16_t version, void *value, size_t size);
+  bool store(const char *key, uint16_t version, const void *value, size_t size);
+  bool remove(const char *key);
+
+  template <typename T>
+  bool load(const char *key, uint16_t version, T &value)
+  {
+    static_assert(std::is_trivially_copyable<T>::value, "Config records are stored as raw bytes");
+    return load(key, version, &value, sizeof(T));
+  }
+
+  template <typename T>
+  bool store(const char *key, uint16_t version, const T &value)
+  {
+    static_assert(std::is_trivially_copyable<T>::value, "Config records are stored as raw bytes");
+    return store(key, version, &value, sizeof(T));
+  }
+}
@@ -0,0 +1,282 @@
+#include "core/connection.h"
+#include "core/metrics.h"
+#include "core/utils.h"
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/event_groups.h>
+#include <freertos/task.h>
+
+#include <Arduino.h>
+#include <WiFi.h>
+
+#include <cstring>
+
+createTag(LINK);
+
+namespace Connection
+{
+  namespace
+  {
+    constexpr EventBits_t upBit = 1;
+
+    // Settings are written by configure() on any task and copied out by the
+    // link task right before use.
+    portMUX_TYPE settingsLock = portMUX_INITIALIZER_UNLOCKED;
+    WiFiConfig wifiSettings = {};
+    MqttConfig mqttSettings = {};
+
+    Mqtt *mqtt = nullptr;
+
+    struct Driver
+    {
+      bool configured()
+      {
+        portENTER_CRITICAL(&settingsLock);
+        bool ready = wifiSettings.ssid[0] != '\0' && mqttSettings.host[0] != '\0';
+        portEXIT_CRITICAL(&settingsLock);
+        return ready;
+      }
+
+      void reset()
+      {
+        mqtt->markUp(false);
+        mqtt->stop();
+        WiFi.disconnect();
+      }
+
+      bool wifiUp() { return WiFi.status() == WL_CONNECTED; }
+
+      bool join()
+      {
+        WiFiConfig config;
+        portENTER_CRITICAL(&settingsLock);
+        config = wifiSettings;
+        portEXIT_CRITICAL(&settingsLock);
+
+        auto &network = config.network;
+        auto &address = config.address;
+        bool fast = WIFI_FAST_JOIN && network.channel != 0;
+        if (address.localIp != 0)
+        {
+          WiFi.config(IPAddress(address.localIp), IPAddress(address.gateway),
+                      IPAddress(address.subnet), IPAddress(address.dns));
+        }
+        else
+        {
+          // all zero switches back to DHCP
+          WiFi.config(IPAddress(), IPAddress(), IPAddress());
+        }
+
+        if (fast)
+        {
+          ESP_LOGI(TAG, "Joining Wi-Fi %s on channel %d with the cached network", config.ssid, network.channel);
+          WiFi.begin(config.ssid, config.password, network.channel, network.bssid);
+        }
+        else
+        {
+          ESP_LOGI(TAG, "Joining Wi-Fi %s", config.ssid);
+          WiFi.begin(config.ssid, config.password);
+        }
+        return fast;
+      }
+
+      void joined(bool fast, unsigned long elapsedMs)
+      {
+        ESP_LOGI(TAG, "Wi-Fi connected in %lu ms (%s), IP: %s", elapsedMs,
+                 fast ? "fast" : "scan", WiFi.localIP().toString().c_str());
+        Metrics::add(Metrics::Counter::WIFI_JOINS);
+        Metrics::add(Metrics::Counter::WIFI_JOIN_MS, elapsedMs);
+        if (fast)
+          Metrics::add(Metrics::Counter::WIFI_FAST_JOINS);
+
+        WiFiNetwork network = {};
+        memcpy(network.bssid, WiFi.BSSID(), sizeof(network.bssid));
+        network.channel = WiFi.channel();
+
+        WiFiConfig config;
+        portENTER_CRITICAL(&settingsLock);
+        bool changed = memcmp(&wifiSettings.network, &network, sizeof(network)) != 0;
+        wifiSettings.network = network;
+        config = wifiSettings;
+        portEXIT_CRITICAL(&settingsLock);
+
+        // flash is only written when the access point moved
+        if (changed)
+          WiFiConfigurer::store(config);
+      }
+
+      void forgetNetwork()
+      {
+        ESP_LOGW(TAG, "Cached Wi-Fi network did not work, scanning next time");
+        portENTER_CRITICAL(&settingsLock);
+        wifiSettings.network = {};
+        portEXIT_CRITICAL(&settingsLock);
+        WiFi.disconnect();
+      }
+
+      bool connect()
+      {
+        MqttConfig config;
+        portENTER_CRITICAL(&settingsLock);
+        config = mqttSettings;
+        portEXIT_CRITICAL(&settingsLock);
+
+        ESP_LOGI(TAG, "Connecting to %s:%d with SSL: %d", config.host, config.port, (int)config.useSsl);
+        if (mqtt->connect(config.host, config.port, config.useSsl))
+          return true;
+
+        ESP_LOGE(TAG, "MQTT connection failed with code: %d", mqtt->client->connectError());
+        return false;
+      }
+
+      bool subscribe() { return mqtt->resubscribe(); }
+
+      uint32_t random(uint32_t bound) { return ::random(bound); }
+    };
+
+    Driver driver;
+    Link<Driver> link(driver);
+
+    EventGroupHandle_t events = nullptr;
+    StaticEventGroup_t eventsBuffer;
+
+    TaskHandle_t task = nullptr;
+    StaticTask_t taskBuffer;
+    StackType_t taskStack[LINK_STACK];
+
+    // loop task only
+    LinkState lastSeen = LinkState::IDLE;
+    unsigned long startedAt = 0;
+    unsigned long wifiUpAt = 0;
+    bool phasesRecorded = false;
+
+    void linkTask(void *)
+    {
+      auto last = LinkState::IDLE;
+      for (;;)
+      {
+        auto state = link.step(millis());
+        if (state != last)
+        {
+          ESP_LOGI(TAG, "Link %s -> %s (failures: %u)", linkStateName(last), linkStateName(state), link.failures());
+          if (state == LinkState::UP)
+          {
+            mqtt->markUp(true);
+            xEventGroupSetBits(events, upBit);
+          }
+          else if (last == LinkState::UP)
+          {
+            mqtt->markUp(false);
+            xEventGroupClearBits(events, upBit);
+          }
+          last = state;
+        }
+
+        // a restart or a drop wakes the task early
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(LINK_PERIOD_MS));
+      }
+    }
+
+    void dropped()
+    {
+      // only the first to notice hands the client back
+      if (!mqtt->markUp(false))
+        return;
+
+      ESP_LOGW(TAG, "MQTT connection dropped");
+      xEventGroupClearBits(events, upBit);
+      link.dropped();
+      xTaskNotifyGive(task);
+    }
+
+    void restart()
+    {
+      link.restart();
+      if (task)
+        xTaskNotifyGive(task);
+    }
+  }
+
+  void configure(const WiFiConfig &config)
+  {
+    portENTER_CRITICAL(&settingsLock);
+    // what the link learned is newer than the caller's copy
+    auto network = wifiSettings.network;
+    bool sameNetwork = strcmp(wifiSettings.ssid, config.ssid) == 0 && network.channel != 0;
+    wifiSettings = config;
+    if (sameNetwork)
+      wifiSettings.network = network;
+    portEXIT_CRITICAL(&settingsLock);
+    restart();
+  }
+
+  void configure(const MqttConfig &config)
+  {
+    portENTER_CRITICAL(&settingsLock);
+    mqttSettings = config;
+    portEXIT_CRITICAL(&settingsLock);
+    restart();
+  }
+
+  void begin(Mqtt &client)
+  {
+    if (task)
+      return;
+
+    mqtt = &client;
+    startedAt = millis();
+    events = xEventGroupCreateStatic(&eventsBuffer);
+    task = xTaskCreateStaticPinnedToCore(
+        linkTask, "mqtt_link", LINK_STACK, nullptr,
+        LINK_PRIORITY, taskStack, &taskBuffer, LINK_CORE);
+    if (!task)
+    {
+      ESP_LOGE(TAG, "Failed to create link task");
+      return;
+    }
+    Metrics::watch(task);
+  }
+
+  LinkState state() { return link.state(); }
+
+  void poll(std::function<void(LinkState state)> onChange)
+  {
+    if (!mqtt)
+      return;
+
+    if (!mqtt->poll())
+      dropped();
+
+    auto state = link.state();
+    if (state == lastSeen)
+      return;
+    lastSeen = state;
+
+    // boot phases, from the first time the link gets there
+    if (!phasesRecorded)
+    {
+      bool wifiUp = state == LinkState::CONNECTING || state == LinkState::SUBSCRIBING || state == LinkState::UP;
+      if (wifiUp && wifiUpAt == 0)
+        wifiUpAt = Metrics::phase(Metrics::Phase::WIFI, startedAt);
+      if (state == LinkState::UP)
+      {
+        Metrics::phase(Metrics::Phase::MQTT, wifiUpAt ? wifiUpAt : startedAt);
+        phasesRecorded = true;
+      }
+    }
+
+    if (onChange)
+      onChange(state);
+  }
+
+  bool waitUntilUp(TickType_t ticks)
+  {
+    if (!mqtt || !events)
+      return false;
+    if (mqtt->isConnected())
+      return true;
+
+    dropped();
+    return (xEventGroupWaitBits(events, upBit, pdFALSE, pdTRUE, ticks) & upBit) != 0;
+  }
+}
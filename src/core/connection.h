@@ -0,0 +1,53 @@
+#pragma once
+
+#include "core/link.h"
+#include "core/mqtt.h"
+#include "core/wifi.h"
+
+#include <freertos/FreeRTOS.h>
+#include <functional>
+
+#ifndef LINK_PERIOD_MS
+#define LINK_PERIOD_MS 100 // how often the link task steps its state machine
+#endif
+
+#ifndef LINK_PRIORITY
+#define LINK_PRIORITY 1
+#endif
+
+#ifndef LINK_CORE
+#define LINK_CORE 0 // next to the WiFi stack
+#endif
+
+#ifndef LINK_STACK
+#define LINK_STACK 6144 // bytes, statically allocated, TLS handshakes run here
+#endif
+
+// WiFi and MQTT connection manager, see Link for the states.
+//
+// Joining, the TCP connect, the CONNACK wait and resubscribing all run on
+// their own low-priority task, so a dead broker or access point never stalls
+// loop() or the recording tasks. Everything else keeps running while the
+// link recovers: publishes fail fast, and the sender can hold a fragment with
+// waitUntilUp() while capture keeps filling the pipeline.
+namespace Connection
+{
+  // Hands new settings to the link, which reconnects with them. Safe before
+  // begin().
+  void configure(const WiFiConfig &config);
+  void configure(const MqttConfig &config);
+
+  // Starts the link task for `mqtt` (once).
+  void begin(Mqtt &mqtt);
+
+  LinkState state();
+
+  // Loop task only. Handles incoming messages and notices a dropped
+  // connection, calling `onChange` when the link state changed since the
+  // previous call.
+  void poll(std::function<void(LinkState state)> onChange = nullptr);
+
+  // Waits up to `ticks` for the link to be up, returns whether it is. A
+  // connection the caller saw failing is handed back to the link task first.
+  bool waitUntilUp(TickType_t ticks);
+}
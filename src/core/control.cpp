@@ -1,5 +1,5 @@
 #include "core/control.h"
-#include "core/remotexy.h"
+#include "core/ui.h"
 #include "core/utils.h"
 
 namespace RemoteXYConfigurer
@@ -49,6 +49,13 @@ namespace RemoteXYConfigurer
     password.trim();
     host.trim();
 
+    // the cached network and the static address belong to the previous
+    // access point
+    if (strcmp(wifiConfig.ssid, ssid.c_str()) != 0)
+    {
+      wifiConfig.network = {};
+      wifiConfig.address = {};
+    }
     sprintf(wifiConfig.ssid, ssid.c_str());
     sprintf(wifiConfig.password, password.c_str());
 
@@ -101,26 +108,26 @@ namespace RemoteXYConfigurer
   {
     createTag(REMOTEXY);
 
-    sprintf(RemoteXY.value_config_status, "Configuring...");
-    RemoteXY_Handler();
+    sprintf(Ui::state().value_config_status, "Configuring...");
+    Ui::commit();
 
     ESP_LOGI(TAG, "Storing configuration");
     auto res = storeConfig(wifiConfig, mqttConfig);
     if (res == RemoteXYConfigCode::MISSING_WIFI_SSID)
     {
-      sprintf(RemoteXY.value_config_status, "Missing WiFi SSID");
+      sprintf(Ui::state().value_config_status, "Missing WiFi SSID");
     }
     else if (res == RemoteXYConfigCode::MISSING_WIFI_PASSWORD)
     {
-      sprintf(RemoteXY.value_config_status, "Missing WiFi Password");
+      sprintf(Ui::state().value_config_status, "Missing WiFi Password");
     }
     else if (res == RemoteXYConfigCode::MISSING_MQTT_HOST)
     {
-      sprintf(RemoteXY.value_config_status, "Missing MQTT Host");
+      sprintf(Ui::state().value_config_status, "Missing MQTT Host");
     }
     else if (res == RemoteXYConfigCode::MISSING_MQTT_PORT)
     {
-      sprintf(RemoteXY.value_config_status, "Missing MQTT Port");
+      sprintf(Ui::state().value_config_status, "Missing MQTT Port");
     }
 
     if (res != RemoteXYConfigCode::OK)
@@ -130,32 +137,44 @@ namespace RemoteXYConfigurer
     }
 
     ESP_LOGI(TAG, "Configuration stored.");
-    auto wifiError = WiFiConfigurer::reconnect(wifiConfig);
-    if (wifiError != ESP_OK)
-    {
-      ESP_LOGI(TAG, "Fail to store configure WiFi, caused by: %d", wifiError);
-      sprintf(RemoteXY.value_config_status, "WiFi Error. Check SSID/Password");
-      return;
-    }
+    WiFiConfigurer::reconnect(wifiConfig);
+    MqttConfigurer::reconnect(mqttConfig, mqtt);
 
-    auto mqttError = MqttConfigurer::reconnect(mqttConfig, mqtt);
-    if (mqttError != ESP_OK)
-    {
-      ESP_LOGI(TAG, "Fail to store configure MQTT, caused by: %d", mqttError);
-      sprintf(RemoteXY.value_config_status, "MQTT Error. Check Host/Port");
-      return;
-    }
+    // the link reports its progress through showLink()
+    sprintf(Ui::state().value_config_status, "Connecting...");
+  }
 
-    sprintf(RemoteXY.value_config_status, "Connected");
-    ESP_LOGI(TAG, "WiFi and MQTT successfully configured");
+  void showLink(LinkState state)
+  {
+    switch (state)
+    {
+    case LinkState::IDLE:
+      sprintf(Ui::state().value_config_status, "Not configured");
+      break;
+    case LinkState::WIFI_DOWN:
+    case LinkState::WIFI_JOINING:
+      sprintf(Ui::state().value_config_status, "Joining WiFi...");
+      break;
+    case LinkState::CONNECTING:
+    case LinkState::SUBSCRIBING:
+      sprintf(Ui::state().value_config_status, "Connecting MQTT...");
+      break;
+    case LinkState::UP:
+      sprintf(Ui::state().value_config_status, "Connected");
+      break;
+    case LinkState::DROPPED:
+    case LinkState::BACKOFF:
+      sprintf(Ui::state().value_config_status, "Disconnected. Retrying...");
+      break;
+    }
   }
 
   void resetVerifyResult()
   {
-    sprintf(RemoteXY.value_recorder_command, "-");
-    sprintf(RemoteXY.value_recorder_reference, "-");
-    sprintf(RemoteXY.value_recorder_similarity_status, "-");
-    sprintf(RemoteXY.value_recorder_transcription, "-");
-    sprintf(RemoteXY.value_recorder_verified_status, "-");
+    sprintf(Ui::state().value_recorder_command, "-");
+    sprintf(Ui::state().value_recorder_reference, "-");
+    sprintf(Ui::state().value_recorder_similarity_status, "-");
+    sprintf(Ui::state().value_recorder_transcription, "-");
+    sprintf(Ui::state().value_recorder_verified_status, "-");
   }
 }
\ No newline at end of file
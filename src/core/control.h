@@ -1,5 +1,6 @@
 #include "core/wifi.h"
 #include "core/mqtt.h"
+#include "core/link.h"
 
 namespace RemoteXYConfigurer
 {
@@ -19,5 +20,7 @@ namespace RemoteXYConfigurer
   RemoteXYConfigCode storeConfig(WiFiConfig &wifiConfig, MqttConfig &mqttConfig);
   int updateConfigToRemote(WiFiConfig &wifiConfig, MqttConfig &mqttConfig);
   void configureNetwork(WiFiConfig &wifiConfig, MqttConfig &mqttConfig, Mqtt &mqtt);
+  // Shows the connection progress in the config status.
+  void showLink(LinkState state);
   void resetVerifyResult();
 }
\ No newline at end of file
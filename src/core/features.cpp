@@ -0,0 +1,54 @@
+#include "core/features.h"
+
+#include <cstring>
+
+bool FeatureWindow::begin(Arena &arena, size_t frames)
+{
+  window = arena.allocate<uint8_t>(frames * Mel::bins);
+  this->frames = window ? frames : 0;
+  reset();
+  return window != nullptr;
+}
+
+void FeatureWindow::push(const uint8_t *block, size_t size)
+{
+  if (!window || size < Mel::blockHeaderSize || block[1] != Mel::bins)
+    return;
+
+  size_t count = block[0];
+  if (Mel::blockHeaderSize + count * Mel::bins > size)
+    return;
+
+  for (size_t f = 0; f < count; f++)
+  {
+    memcpy(window + head * Mel::bins, block + Mel::blockHeaderSize + f * Mel::bins, Mel::bins);
+    head = (head + 1) % frames;
+    if (filled < frames)
+      filled++;
+  }
+  fresh += count;
+}
+
+void FeatureWindow::take(int8_t *dest, uint8_t zero)
+{
+  fresh = 0;
+
+  // When full, `head` is the oldest frame.
+  size_t start = filled == frames ? head : 0;
+  for (size_t f = 0; f < frames; f++)
+  {
+    const uint8_t *frame = window + ((start + f) % frames) * Mel::bins;
+    for (size_t b = 0; b < Mel::bins; b++)
+    {
+      int value = f < filled ? frame[b] - zero : -zero;
+      *dest++ = static_cast<int8_t>(value < -128 ? -128 : (value > 127 ? 127 : value));
+    }
+  }
+}
+
+void FeatureWindow::reset()
+{
+  head = 0;
+  filled = 0;
+  fresh = 0;
+}
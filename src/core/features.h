@@ -0,0 +1,42 @@
+#pragma once
+
+#include "core/arena.h"
+
+#include "dsp/mel.h"
+
+#include <cstddef>
+#include <cstdint>
+
+// Sliding window of the last `frames` log-mel frames, fed with the Mel
+// blocks that the capture task attaches to every fragment. Shared by the
+// on-device models (keyword gate, speaker pre-screen); each owns one sized
+// for its own input.
+class FeatureWindow
+{
+public:
+  // Takes room for `frames` frames from `arena`, returns false when it is
+  // exhausted.
+  bool begin(Arena &arena, size_t frames);
+
+  // Appends the frames of one Mel block, oldest frames fall out.
+  void push(const uint8_t *block, size_t size);
+
+  bool full() const { return frames != 0 && filled == frames; }
+  size_t size() const { return frames; }
+
+  // Frames pushed since the last take(), reset by it.
+  size_t pending() const { return fresh; }
+
+  // Writes the window oldest frame first as int8 model input, shifted by
+  // `zero`, and clears pending().
+  void take(int8_t *dest, uint8_t zero);
+
+  void reset();
+
+private:
+  uint8_t *window = nullptr;
+  size_t frames = 0;
+  size_t head = 0;
+  size_t filled = 0;
+  size_t fresh = 0;
+};
@@ -1,3 +1,6 @@
+#include "core/filesystem.h"
+#include "core/metrics.h"
+
 #include <stdio.h>
 #include <string.h>
 #include <esp_log.h>
@@ -7,8 +10,14 @@ static const char *TAG = "SPIFFS";
 
 namespace FileSystem
 {
+  static bool mounted = false;
+
   int setup()
   {
+    if (mounted)
+      return ESP_OK;
+
+    auto startMs = millis();
     esp_vfs_spiffs_conf_t conf = {
         .base_path = "/spiffs",
         .partition_label = NULL,
@@ -16,6 +25,12 @@ namespace FileSystem
         .format_if_mount_failed = true};
 
     esp_err_t ret = esp_vfs_spiffs_register(&conf);
+    // another task mounted it in the meantime
+    if (ret == ESP_ERR_INVALID_STATE)
+    {
+      mounted = true;
+      return ESP_OK;
+    }
     if (ret != ESP_OK)
     {
       if (ret == ESP_FAIL)
@@ -42,11 +57,16 @@ namespace FileSystem
     }
 
     ESP_LOGI(TAG, "SPIFFS total: %d, used: %d", total, used);
+    mounted = true;
+    Metrics::phase(Metrics::Phase::SPIFFS, startMs);
     return ESP_OK;
   }
 
   bool store(const char *path, uint8_t *address, size_t size)
   {
+    if (setup() != ESP_OK)
+      return false;
+
     FILE *file = fopen(path, "w");
     if (!file)
     {
@@ -68,6 +88,9 @@ namespace FileSystem
 
   bool load(const char *path, uint8_t *address, size_t size)
   {
+    if (setup() != ESP_OK)
+      return false;
+
     FILE *file = fopen(path, "rb"); // open for reading in binary mode
     if (!file)
     {
@@ -86,4 +109,20 @@ namespace FileSystem
     fclose(file);
     return true;
   };
+
+  long size(const char *path)
+  {
+    if (setup() != ESP_OK)
+      return -1;
+
+    FILE *file = fopen(path, "rb");
+    if (!file)
+      return -1;
+
+    long size = -1;
+    if (fseek(file, 0, SEEK_END) == 0)
+      size = ftell(file);
+    fclose(file);
+    return size;
+  }
 }
@@ -5,7 +5,10 @@
 
 namespace FileSystem
 {
+  // Mounts SPIFFS once, the other calls do it on first use.
   int setup();
   bool store(const char *path, uint8_t *address, size_t size);
   bool load(const char *path, uint8_t *address, size_t size);
+  // Size of the file at `path` in bytes, -1 when it cannot be opened.
+  long size(const char *path);
 }
\ No newline at end of file
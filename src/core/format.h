@@ -0,0 +1,149 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+// Output sample format policies. Every policy receives signed 24-bit samples
+// (as produced by the input policy) and knows how to store them, one at a
+// time or four at a time with word-wide stores. The WAV header constants are
+// derived from the same policy so the two can never disagree.
+namespace AudioFormat
+{
+  inline void store32(uint8_t *dest, uint32_t word, bool aligned)
+  {
+    if (aligned)
+      *reinterpret_cast<uint32_t *>(dest) = word;
+    else
+      memcpy(dest, &word, 4);
+  }
+
+  struct Pcm16
+  {
+    static constexpr uint16_t wavFormat = 1; // WAVE_FORMAT_PCM
+    static constexpr uint16_t bitsPerSample = 16;
+    static constexpr uint8_t bytesPerSample = 2;
+
+    static inline void store(uint8_t *dest, int32_t s)
+    {
+      dest[0] = static_cast<uint8_t>(s >> 8);
+      dest[1] = static_cast<uint8_t>(s >> 16);
+    }
+
+    static inline void store4(uint8_t *dest, int32_t s0, int32_t s1, int32_t s2, int32_t s3, bool aligned)
+    {
+      uint32_t u0 = (static_cast<uint32_t>(s0) >> 8) & 0xFFFFu;
+      uint32_t u1 = (static_cast<uint32_t>(s1) >> 8) & 0xFFFFu;
+      uint32_t u2 = (static_cast<uint32_t>(s2) >> 8) & 0xFFFFu;
+      uint32_t u3 = (static_cast<uint32_t>(s3) >> 8) & 0xFFFFu;
+      store32(dest + 0, u0 | (u1 << 16), aligned);
+      store32(dest + 4, u2 | (u3 << 16), aligned);
+    }
+  };
+
+  struct Pcm24
+  {
+    static constexpr uint16_t wavFormat = 1; // WAVE_FORMAT_PCM
+    static constexpr uint16_t bitsPerSample = 24;
+    static constexpr uint8_t bytesPerSample = 3;
+
+    static inline void store(uint8_t *dest, int32_t s)
+    {
+      dest[0] = static_cast<uint8_t>(s);
+      dest[1] = static_cast<uint8_t>(s >> 8);
+      dest[2] = static_cast<uint8_t>(s >> 16);
+    }
+
+    static inline void store4(uint8_t *dest, int32_t s0, int32_t s1, int32_t s2, int32_t s3, bool aligned)
+    {
+      uint32_t u0 = static_cast<uint32_t>(s0) & 0x00FFFFFFu;
+      uint32_t u1 = static_cast<uint32_t>(s1) & 0x00FFFFFFu;
+      uint32_t u2 = static_cast<uint32_t>(s2) & 0x00FFFFFFu;
+      uint32_t u3 = static_cast<uint32_t>(s3) & 0x00FFFFFFu;
+
+      // |u0 u0 u0 u1|u1 u1 u2 u2|u2 u3 u3 u3| (little-endian)
+      store32(dest + 0, u0 | (u1 << 24), aligned);
+      store32(dest + 4, (u1 >> 8) | (u2 << 16), aligned);
+      store32(dest + 8, (u2 >> 16) | (u3 << 8), aligned);
+    }
+  };
+
+  struct Pcm32
+  {
+    static constexpr uint16_t wavFormat = 1; // WAVE_FORMAT_PCM
+    static constexpr uint16_t bitsPerSample = 32;
+    static constexpr uint8_t bytesPerSample = 4;
+
+    static inline void store(uint8_t *dest, int32_t s)
+    {
+      store32(dest, static_cast<uint32_t>(s) << 8, false);
+    }
+
+    static inline void store4(uint8_t *dest, int32_t s0, int32_t s1, int32_t s2, int32_t s3, bool aligned)
+    {
+      store32(dest + 0, static_cast<uint32_t>(s0) << 8, aligned);
+      store32(dest + 4, static_cast<uint32_t>(s1) << 8, aligned);
+      store32(dest + 8, static_cast<uint32_t>(s2) << 8, aligned);
+      store32(dest + 12, static_cast<uint32_t>(s3) << 8, aligned);
+    }
+  };
+
+  struct Float32
+  {
+    static constexpr uint16_t wavFormat = 3; // WAVE_FORMAT_IEEE_FLOAT
+    static constexpr uint16_t bitsPerSample = 32;
+    static constexpr uint8_t bytesPerSample = 4;
+
+    static inline uint32_t bits(int32_t s)
+    {
+      float f = static_cast<float>(s) * (1.0f / 8388608.0f);
+      uint32_t u;
+      memcpy(&u, &f, 4);
+      return u;
+    }
+
+    static inline void store(uint8_t *dest, int32_t s)
+    {
+      store32(dest, bits(s), false);
+    }
+
+    static inline void store4(uint8_t *dest, int32_t s0, int32_t s1, int32_t s2, int32_t s3, bool aligned)
+    {
+      store32(dest + 0, bits(s0), aligned);
+      store32(dest + 4, bits(s1), aligned);
+      store32(dest + 8, bits(s2), aligned);
+      store32(dest + 12, bits(s3), aligned);
+    }
+  };
+}
+
+// Input (microphone) policies: where the 24 valid bits sit in the 32-bit I2S slot.
+namespace AudioInput
+{
+  // INMP441 and most MEMS mics: valid 24 bits are in bits [31:8]
+  struct LeftJustified
+  {
+    static constexpr bool isLeftJustified = true;
+
+    static inline int32_t normalize(int32_t raw) { return raw >> 8; }
+  };
+
+  // samples that already went through normalize(), e.g. after in-place filtering
+  struct Normalized
+  {
+    static constexpr bool isLeftJustified = false;
+
+    static inline int32_t normalize(int32_t sample) { return sample; }
+  };
+
+  // valid 24 bits are in bits [23:0], sign-extend them
+  struct RightJustified
+  {
+    static constexpr bool isLeftJustified = false;
+
+    static inline int32_t normalize(int32_t raw)
+    {
+      return static_cast<int32_t>(static_cast<uint32_t>(raw) << 8) >> 8;
+    }
+  };
+}
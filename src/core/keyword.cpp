@@ -0,0 +1,127 @@
+#include "core/keyword.h"
+#include "core/filesystem.h"
+#include "core/record.h"
+#include "core/utils.h"
+
+#include "mqtt/protocol.h"
+
+#include <Arduino.h>
+#include <cstring>
+
+createTag(KEYWORD);
+
+bool KeywordGate::begin(Arena &memory, const char *path)
+{
+  if (ready)
+    return true;
+
+  long size = FileSystem::size(path);
+  if (size <= 0)
+  {
+    ESP_LOGW(TAG, "No keyword model at %s, keyword gate disabled", path);
+    return false;
+  }
+
+  size_t mark = memory.mark();
+  blob = memory.allocate<uint8_t>(size);
+  if (!blob)
+  {
+    ESP_LOGE(TAG, "Keyword model (%ld bytes) does not fit the model arena (%u/%u used)", size, memory.used(), memory.capacity());
+    return false;
+  }
+
+  if (!FileSystem::load(path, blob, size) || !model.parse(blob, size))
+  {
+    ESP_LOGE(TAG, "Invalid keyword model at %s, keyword gate disabled", path);
+    memory.rewind(mark);
+    return false;
+  }
+
+  const Nn::Shape &input = model.input();
+  if (input.width != Mel::bins || input.channels != 1)
+  {
+    ESP_LOGE(TAG, "Keyword model expects %u bins, features have %u", input.width, Mel::bins);
+    memory.rewind(mark);
+    return false;
+  }
+
+  arena = memory.allocate<int8_t>(input.size() + 2 * model.arenaSize());
+  if (!arena || !window.begin(memory, input.height))
+  {
+    ESP_LOGE(TAG, "Keyword model activations do not fit the model arena (%u/%u used)", memory.used(), memory.capacity());
+    memory.rewind(mark);
+    return false;
+  }
+
+  size_t matched = 0;
+  for (size_t i = 0; i < model.labelCount(); i++)
+  {
+    commands[i] = nullptr;
+    for (size_t c = 0; MqttControllerCommandList[c]; c++)
+    {
+      if (strcmp(model.label(i), MqttControllerCommandList[c]) == 0)
+      {
+        commands[i] = MqttControllerCommandList[c];
+        matched++;
+      }
+    }
+  }
+
+  auto layout = Mel::layoutFor(RECORDER_SAMPLE_RATE);
+  strideFrames = RECORDER_KWS_STRIDE_MS * RECORDER_SAMPLE_RATE / 1000 / layout.hop;
+  strideFrames = strideFrames == 0 ? 1 : strideFrames;
+
+  ESP_LOGI(TAG, "Keyword model loaded: %u frames, %u labels (%u commands), arena %u",
+           window.size(), model.labelCount(), matched, model.arenaSize());
+  ready = true;
+  reset();
+  return true;
+}
+
+void KeywordGate::push(const uint8_t *block, size_t size)
+{
+  if (ready)
+    window.push(block, size);
+}
+
+const char *KeywordGate::detect()
+{
+  if (ready && !detected && window.full() && window.pending() >= strideFrames)
+    infer();
+  return detected;
+}
+
+void KeywordGate::reset()
+{
+  window.reset();
+  detected = nullptr;
+}
+
+void KeywordGate::infer()
+{
+  window.take(arena, model.inputZero());
+
+  float probabilities[Nn::maxLabels];
+  int8_t *activations = arena + model.input().size();
+  auto start = micros();
+  model.invoke(arena, activations, activations + model.arenaSize(), probabilities);
+  auto elapsed = micros() - start;
+
+  size_t best = model.labelCount();
+  for (size_t i = 0; i < model.labelCount(); i++)
+  {
+    if (commands[i] && probabilities[i] >= RECORDER_KWS_THRESHOLD &&
+        (best == model.labelCount() || probabilities[i] > probabilities[best]))
+      best = i;
+  }
+
+  if (best < model.labelCount())
+  {
+    detected = commands[best];
+    ESP_LOGI(TAG, "Keyword '%s' (p=%.2f) in %lu us", detected, probabilities[best], elapsed);
+  }
+  else
+  {
+    ESP_LOGD(TAG, "No keyword in %lu us", elapsed);
+  }
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include "core/features.h"
+
+#include "dsp/nn.h"
+
+#include <cstddef>
+#include <cstdint>
+
+#ifndef RECORDER_KWS
+#define RECORDER_KWS 0 // 1 to gate realtime streams on a keyword-spotting model
+#endif
+
+#ifndef RECORDER_KWS_MODEL_PATH
+#define RECORDER_KWS_MODEL_PATH "/spiffs/kws.bin"
+#endif
+
+#ifndef RECORDER_KWS_THRESHOLD
+#define RECORDER_KWS_THRESHOLD 0.6 // probability of a command label to open a stream
+#endif
+
+#ifndef RECORDER_KWS_STRIDE_MS
+#define RECORDER_KWS_STRIDE_MS 200 // run the network at most this often
+#endif
+
+// Keyword-spotting gate for realtime streams. It keeps a sliding window of
+// log-mel frames (fed from the capture task through the fragments) and runs
+// a Nn::Model over it, looking for labels that are controller commands.
+//
+// The model is read from SPIFFS once; when the file is missing or invalid
+// the gate stays disabled and streams are opened on voice activity alone.
+class KeywordGate
+{
+public:
+  // Loads the model into `memory`, returns false (and leaves the gate disabled)
+  // on failure, giving the memory back.
+  bool begin(Arena &memory, const char *path = RECORDER_KWS_MODEL_PATH);
+  bool enabled() const { return ready; }
+
+  // Appends the frames of one Mel block to the window.
+  void push(const uint8_t *block, size_t size);
+
+  // Runs the model when enough new frames arrived. Returns the command that
+  // was detected since the last reset(), or nullptr.
+  const char *detect();
+
+  // Forgets the window and the detection, once its stream is over.
+  void reset();
+
+private:
+  void infer();
+
+  Nn::Model model;
+  bool ready = false;
+
+  uint8_t *blob = nullptr;
+  int8_t *arena = nullptr; // input, then two activation buffers
+  FeatureWindow window;
+  size_t strideFrames = 1;
+
+  const char *commands[Nn::maxLabels] = {};
+  const char *detected = nullptr;
+};
@@ -0,0 +1,226 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+#ifndef MQTT_BACKOFF_MIN_MS
+#define MQTT_BACKOFF_MIN_MS 500 // first retry delay, doubled per failure
+#endif
+
+#ifndef MQTT_BACKOFF_MAX_MS
+#define MQTT_BACKOFF_MAX_MS 30000
+#endif
+
+#ifndef WIFI_JOIN_TIMEOUT_MS
+#define WIFI_JOIN_TIMEOUT_MS 10000 // a join still pending after this counts as failed
+#endif
+
+#ifndef WIFI_FAST_JOIN_TIMEOUT_MS
+#define WIFI_FAST_JOIN_TIMEOUT_MS 3000 // a fast join still pending after this falls back to a scan
+#endif
+
+enum class LinkState : uint8_t
+{
+  IDLE,         // nothing to connect to yet
+  WIFI_DOWN,    // about to (re)join the access point
+  WIFI_JOINING, // join requested, waiting for an IP
+  CONNECTING,   // TCP connect and CONNACK wait
+  SUBSCRIBING,  // restoring the topic subscriptions
+  UP,           // connected and subscribed
+  DROPPED,      // the client owner saw the connection go away
+  BACKOFF,      // waiting out the retry delay
+};
+
+inline const char *linkStateName(LinkState state)
+{
+  switch (state)
+  {
+  case LinkState::IDLE:
+    return "idle";
+  case LinkState::WIFI_DOWN:
+    return "wifi down";
+  case LinkState::WIFI_JOINING:
+    return "wifi joining";
+  case LinkState::CONNECTING:
+    return "connecting";
+  case LinkState::SUBSCRIBING:
+    return "subscribing";
+  case LinkState::UP:
+    return "up";
+  case LinkState::DROPPED:
+    return "dropped";
+  case LinkState::BACKOFF:
+    return "backoff";
+  }
+  return "?";
+}
+
+// Connection state machine, with exponential backoff and jitter between
+// failed attempts. It does no I/O itself, `Driver` does, so it runs on host
+// against a fake driver:
+//
+//   bool configured();         WiFi and broker settings are present
+//   void reset();              drops the WiFi and MQTT connections
+//   bool wifiUp();             the station has an IP
+//   bool join();               starts joining the access point, never blocks,
+//                              returns whether it used the cached network
+//   void joined(bool fast, unsigned long elapsedMs);
+//                              the join finished, the network can be cached
+//   void forgetNetwork();      the cached network did not work, drops the
+//                              WiFi so the next join scans
+//   bool connect();            TCP connect and CONNACK, bounded by a timeout
+//   bool subscribe();          restores the subscriptions
+//   uint32_t random(uint32_t); uniform in [0, bound)
+//
+// step() runs on one task only (the link task), which owns the client
+// outside UP. dropped() and restart() may be called from any task.
+template <typename Driver>
+class Link
+{
+public:
+  explicit Link(Driver &driver) : driver(driver) {}
+
+  LinkState state() const { return state_.load(std::memory_order_acquire); }
+  uint32_t failures() const { return failures_; }
+
+  // Does at most one transition at `now` (milliseconds) and returns the
+  // resulting state.
+  LinkState step(unsigned long now)
+  {
+    if (restartRequested.exchange(false, std::memory_order_acq_rel))
+    {
+      driver.reset();
+      failures_ = 0;
+      set(LinkState::IDLE);
+    }
+
+    switch (state())
+    {
+    case LinkState::IDLE:
+      if (driver.configured())
+        set(LinkState::WIFI_DOWN);
+      break;
+
+    case LinkState::WIFI_DOWN:
+      if (driver.wifiUp())
+      {
+        set(LinkState::CONNECTING);
+        break;
+      }
+      fastJoin = driver.join();
+      joinStartedAt = now;
+      set(LinkState::WIFI_JOINING);
+      break;
+
+    case LinkState::WIFI_JOINING:
+      if (driver.wifiUp())
+      {
+        driver.joined(fastJoin, now - joinStartedAt);
+        set(LinkState::CONNECTING);
+      }
+      else if (now - joinStartedAt >= (fastJoin ? WIFI_FAST_JOIN_TIMEOUT_MS : WIFI_JOIN_TIMEOUT_MS))
+      {
+        if (fastJoin)
+          forget(); // straight to a full scan, no backoff
+        else
+          fail(now);
+      }
+      break;
+
+    case LinkState::CONNECTING:
+      if (!driver.wifiUp())
+      {
+        set(LinkState::WIFI_DOWN);
+      }
+      else if (driver.connect())
+      {
+        fastJoin = false;
+        set(LinkState::SUBSCRIBING);
+      }
+      else
+      {
+        // the cached access point may not route to the broker, rescan next time
+        if (fastJoin)
+          forget();
+        fail(now);
+      }
+      break;
+
+    case LinkState::SUBSCRIBING:
+      if (driver.subscribe())
+      {
+        failures_ = 0;
+        set(LinkState::UP);
+      }
+      else
+      {
+        fail(now);
+      }
+      break;
+
+    case LinkState::UP:
+      if (!driver.wifiUp())
+        fail(now);
+      break;
+
+    case LinkState::DROPPED:
+      fail(now);
+      break;
+
+    case LinkState::BACKOFF:
+      if (static_cast<long>(now - retryAt) >= 0)
+        set(LinkState::WIFI_DOWN);
+      break;
+    }
+
+    return state();
+  }
+
+  // Hands the client back to the link task after it went away while UP.
+  void dropped()
+  {
+    auto expected = LinkState::UP;
+    state_.compare_exchange_strong(expected, LinkState::DROPPED, std::memory_order_acq_rel);
+  }
+
+  // Starts over on the next step without backoff, e.g. after new settings.
+  void restart() { restartRequested.store(true, std::memory_order_release); }
+
+  // Retry delay after `failures` consecutive failures, before jitter.
+  static uint32_t backoff(uint32_t failures)
+  {
+    uint32_t delay = MQTT_BACKOFF_MIN_MS;
+    for (uint32_t i = 1; i < failures && delay < MQTT_BACKOFF_MAX_MS; i++)
+      delay *= 2;
+    return delay < MQTT_BACKOFF_MAX_MS ? delay : MQTT_BACKOFF_MAX_MS;
+  }
+
+private:
+  Driver &driver;
+  std::atomic<LinkState> state_{LinkState::IDLE};
+  std::atomic<bool> restartRequested{false};
+
+  // written by the link task only
+  uint32_t failures_ = 0;
+  unsigned long joinStartedAt = 0;
+  unsigned long retryAt = 0;
+  bool fastJoin = false;
+
+  void set(LinkState state) { state_.store(state, std::memory_order_release); }
+
+  void forget()
+  {
+    driver.forgetNetwork();
+    fastJoin = false;
+    set(LinkState::WIFI_DOWN);
+  }
+
+  void fail(unsigned long now)
+  {
+    failures_++;
+    // half fixed, half random, so devices dropped together spread out
+    uint32_t delay = backoff(failures_);
+    retryAt = now + delay / 2 + driver.random(delay / 2 + 1);
+    set(LinkState::BACKOFF);
+  }
+};
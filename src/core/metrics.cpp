@@ -0,0 +1,145 @@
+#include "core/metrics.h"
+#include "core/mqtt.h"
+#include "core/utils.h"
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+#include <atomic>
+#include <cstring>
+
+createTag(METRICS);
+
+namespace Metrics
+{
+  namespace
+  {
+    struct TimerSlot
+    {
+      uint32_t calls;
+      uint64_t cycles;
+      uint32_t max;
+    };
+
+    portMUX_TYPE lock = portMUX_INITIALIZER_UNLOCKED;
+    TimerSlot timers[static_cast<size_t>(Timer::COUNT)];
+    std::atomic<uint32_t> counters[static_cast<size_t>(Counter::COUNT)];
+    uint32_t phases[static_cast<size_t>(Phase::COUNT)];
+
+    TaskHandle_t tasks[METRICS_MAX_TASKS];
+    size_t taskCount = 0;
+
+    unsigned long lastReport = 0;
+
+    inline uint8_t *put32(uint8_t *dest, uint32_t v)
+    {
+      dest[0] = static_cast<uint8_t>(v);
+      dest[1] = static_cast<uint8_t>(v >> 8);
+      dest[2] = static_cast<uint8_t>(v >> 16);
+      dest[3] = static_cast<uint8_t>(v >> 24);
+      return dest + 4;
+    }
+  }
+
+  void record(Timer timer, uint32_t elapsedCycles)
+  {
+    auto &slot = timers[static_cast<size_t>(timer)];
+    portENTER_CRITICAL(&lock);
+    slot.calls++;
+    slot.cycles += elapsedCycles;
+    if (elapsedCycles > slot.max)
+      slot.max = elapsedCycles;
+    portEXIT_CRITICAL(&lock);
+  }
+
+  void add(Counter counter, uint32_t amount)
+  {
+    counters[static_cast<size_t>(counter)].fetch_add(amount, std::memory_order_relaxed);
+  }
+
+  unsigned long phase(Phase phase, unsigned long startMs)
+  {
+    auto now = millis();
+    phases[static_cast<size_t>(phase)] = now - startMs;
+    ESP_LOGI(TAG, "Boot phase %s took %lu ms", MqttTelemetryPhaseList[static_cast<size_t>(phase)], now - startMs);
+    return now;
+  }
+
+  void watch(TaskHandle_t task)
+  {
+    if (!task || taskCount == METRICS_MAX_TASKS)
+      return;
+    for (size_t i = 0; i < taskCount; i++)
+    {
+      if (tasks[i] == task)
+        return;
+    }
+    tasks[taskCount++] = task;
+  }
+
+  size_t encode(uint8_t *dest, size_t capacity)
+  {
+    if (capacity < maxReportSize)
+      return 0;
+
+    TimerSlot snapshot[static_cast<size_t>(Timer::COUNT)];
+    portENTER_CRITICAL(&lock);
+    memcpy(snapshot, timers, sizeof(timers));
+    memset(timers, 0, sizeof(timers));
+    portEXIT_CRITICAL(&lock);
+
+    uint8_t *out = dest;
+    *out++ = version;
+    out = put32(out, millis());
+    out = put32(out, ESP.getFreeHeap());
+    out = put32(out, ESP.getMinFreeHeap());
+    out = put32(out, ESP.getMaxAllocHeap());
+
+    *out++ = static_cast<uint8_t>(Phase::COUNT);
+    for (auto ms : phases)
+      out = put32(out, ms);
+
+    *out++ = static_cast<uint8_t>(Counter::COUNT);
+    for (auto &counter : counters)
+      out = put32(out, counter.load(std::memory_order_relaxed));
+
+    // cycles to microseconds once per report, never on the hot path
+    uint32_t cyclesPerUs = ESP.getCpuFreqMHz();
+    *out++ = static_cast<uint8_t>(Timer::COUNT);
+    for (auto &slot : snapshot)
+    {
+      out = put32(out, slot.calls);
+      out = put32(out, static_cast<uint32_t>(slot.cycles / cyclesPerUs));
+      out = put32(out, slot.max / cyclesPerUs);
+    }
+
+    *out++ = static_cast<uint8_t>(taskCount);
+    for (size_t i = 0; i < taskCount; i++)
+    {
+      const char *name = pcTaskGetName(tasks[i]);
+      size_t length = strnlen(name, maxTaskName);
+      *out++ = static_cast<uint8_t>(length);
+      memcpy(out, name, length);
+      out += length;
+      // ESP32 stacks are counted in bytes
+      out = put32(out, uxTaskGetStackHighWaterMark(tasks[i]));
+    }
+
+    return out - dest;
+  }
+
+  void poll(Mqtt &mqtt)
+  {
+#if USE_METRICS
+    if (millis() - lastReport < METRICS_PERIOD_MS || !mqtt.isConnected())
+      return;
+    lastReport = millis();
+
+    uint8_t report[maxReportSize];
+    size_t size = encode(report, sizeof(report));
+    auto res = mqtt.publishMessage(MqttTopic::TELEMETRY, report, size);
+    if (res != 0)
+      ESP_LOGW(TAG, "Failed to publish telemetry: %d", res);
+#endif
+  }
+}
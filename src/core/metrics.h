@@ -0,0 +1,108 @@
+#pragma once
+
+#include "mqtt/protocol.h"
+
+#include <Arduino.h>
+#include <cstddef>
+#include <cstdint>
+
+#ifndef USE_METRICS
+#define USE_METRICS 1 // 0 compiles the hot-path timers out and never publishes
+#endif
+
+#ifndef METRICS_PERIOD_MS
+#define METRICS_PERIOD_MS 30000 // telemetry report interval
+#endif
+
+#ifndef METRICS_MAX_TASKS
+#define METRICS_MAX_TASKS 6 // tasks whose stack watermark is reported
+#endif
+
+class Mqtt;
+
+// Lightweight metrics registry, published as a binary report on
+// MqttTopic::TELEMETRY every METRICS_PERIOD_MS.
+//
+// Timers accumulate CPU cycles around the hot calls (see the
+// MQTT_TELEMETRY_TIMER list) and are reset by every report, counters grow
+// from boot. Boot phases are recorded once, and heap and stack figures are
+// sampled when the report is built. Recording is a handful of cycles under a
+// spinlock, so it is safe from any task on either core.
+//
+// Report layout, little endian:
+//   VERSION     1B
+//   UPTIME_MS   4B
+//   HEAP_FREE   4B, HEAP_MIN_FREE 4B, HEAP_LARGEST_BLOCK 4B
+//   PHASES      1B count, count x 4B milliseconds
+//   COUNTERS    1B count, count x 4B
+//   TIMERS      1B count, count x (CALLS 4B, TOTAL_US 4B, MAX_US 4B)
+//   TASKS       1B count, count x (NAMELEN 1B, NAME, STACK_FREE 4B bytes)
+// Phases, counters and timers are in their protocol list order.
+namespace Metrics
+{
+#define _MQX(name, value) name,
+  enum class Phase : uint8_t
+  {
+    MQTT_TELEMETRY_PHASE_LIST COUNT
+  };
+
+  enum class Counter : uint8_t
+  {
+    MQTT_TELEMETRY_COUNTER_LIST COUNT
+  };
+
+  enum class Timer : uint8_t
+  {
+    MQTT_TELEMETRY_TIMER_LIST COUNT
+  };
+#undef _MQX
+
+  constexpr uint8_t version = 1;
+  constexpr size_t maxTaskName = 16;
+  constexpr size_t maxReportSize =
+      1 + 4 + 12 +
+      1 + 4 * static_cast<size_t>(Phase::COUNT) +
+      1 + 4 * static_cast<size_t>(Counter::COUNT) +
+      1 + 12 * static_cast<size_t>(Timer::COUNT) +
+      1 + (1 + maxTaskName + 4) * METRICS_MAX_TASKS;
+
+  inline uint32_t cycles() { return ESP.getCycleCount(); }
+
+  void record(Timer timer, uint32_t elapsedCycles);
+  void add(Counter counter, uint32_t amount = 1);
+
+  // Records the duration of a boot phase that started at `startMs`, returns
+  // now so phases can be chained.
+  unsigned long phase(Phase phase, unsigned long startMs);
+
+  // Reports the stack watermark of `task`, ignored once METRICS_MAX_TASKS
+  // tasks are watched.
+  void watch(TaskHandle_t task);
+
+  // Builds a report into `dest` and resets the timers, returns its size.
+  size_t encode(uint8_t *dest, size_t capacity);
+
+  // Publishes a report every METRICS_PERIOD_MS while connected.
+  void poll(Mqtt &mqtt);
+
+  // Times its own scope into `timer`.
+  class Scope
+  {
+  public:
+    explicit Scope(Timer timer) : timer(timer), start(cycles()) {}
+    ~Scope() { record(timer, cycles() - start); }
+
+    Scope(const Scope &) = delete;
+    Scope &operator=(const Scope &) = delete;
+
+  private:
+    Timer timer;
+    uint32_t start;
+  };
+}
+
+#if USE_METRICS
+#define metricsTimer(name) Metrics::Scope __metricsScope__(Metrics::Timer::name)
+#else
+#define metricsTimer(name)
+#endif
@@ -1,52 +1,92 @@
 #include "core/mqtt.h"
+#include "core/config.h"
+#include "core/connection.h"
 #include "core/filesystem.h"
+#include "core/metrics.h"
 #include "core/serial.h"
+#include "core/spool.h"
+#include "mqtt/frame.h"
 #include "mqtt/protocol.h"
 
 #include <Arduino.h>
 #include <MqttClient.h>
 #include <WiFi.h>
-#include <WiFiClientSecure.h>
 #include <esp_log.h>
 
 #include <cstring>
 #include <functional>
 
-#define MQTT_CONFIG_PATH "/spiffs/mqtt.bin"
+#define MQTT_CONFIG_KEY "mqtt"
+#define MQTT_CONFIG_PATH "/spiffs/mqtt.bin" // before the config store, migrated once
 
 static const char *TAG = "MQTT";
 
-#define isClientReady                                                    \
-  if (!client)                                                           \
-  {                                                                      \
-    Serial.println("MQTT client is not initialized, please setup mqtt"); \
-    return false;                                                        \
+// Bumped whenever MqttConfig changes layout.
+static constexpr uint16_t mqttConfigVersion = 1;
+
+#define isClientReady                                     \
+  if (!client || !up.load(std::memory_order_acquire))     \
+  {                                                       \
+    ESP_LOGD(TAG, "MQTT link is down, refusing to send"); \
+    return -1;                                            \
   }
 
-Mqtt::Mqtt(const char *identifier)
-    : identifier(identifier), stampSize(strlen(identifier))
+namespace
 {
-  secureClient.setInsecure();
+  // Holds the send lock for one use of the client. It is recursive: a
+  // message sent from a subscription callback runs inside poll().
+  struct Sending
+  {
+    SemaphoreHandle_t lock;
+    Sending(SemaphoreHandle_t lock) : lock(lock) { xSemaphoreTakeRecursive(lock, portMAX_DELAY); }
+    ~Sending() { xSemaphoreGiveRecursive(lock); }
+  };
 }
 
-bool Mqtt::connect(const char *host, uint16_t port, bool secure)
+// Uplink topic `topic` is published on, short in the short-topic mode.
+static const char *wireTopic(const char *topic)
 {
-  if (secure)
-  {
-    client.reset(new MqttClient(secureClient));
-  }
-  else
-  {
-    client.reset(new MqttClient(insecureClient));
-  }
+#if MQTT_SHORT_TOPICS
+#define _MQX(name, value)                  \
+  if (strcmp(topic, MqttTopic::name) == 0) \
+    return MqttShortTopic::name;
+
+  MQTT_SHORT_TOPIC_LIST
+
+#undef _MQX
+#endif
+  return topic;
+}
 
-  if (!client->connect(host, port))
+// Static copy of `topic` for the resend ring, nullptr for an unknown one.
+static const char *knownTopic(const char *topic)
+{
+  for (size_t i = 0; MqttTopicList[i]; i++)
   {
-    return false;
+    if (strcmp(topic, MqttTopicList[i]) == 0)
+      return MqttTopicList[i];
   }
+  return nullptr;
+}
+
+Mqtt::Mqtt(const char *identifier)
+    : identifier(identifier), stampSize(strlen(identifier)),
+      device(MQTT_COMPACT_FRAMING ? Frame::identifierIndex(identifier) : -1),
+      insecureMqtt(insecureClient), secureMqtt(secureClient)
+{
+  sendLock = xSemaphoreCreateRecursiveMutexStatic(&sendLockBuffer);
+  insecureMqtt.setConnectionTimeout(MQTT_CONNECT_TIMEOUT_MS);
+  secureMqtt.setConnectionTimeout(MQTT_CONNECT_TIMEOUT_MS);
+}
+
+bool Mqtt::connect(const char *host, uint16_t port, bool secure)
+{
+  Sending sending(sendLock);
+  client = secure ? &secureMqtt : &insecureMqtt;
 
+  // the will goes out with CONNECT, so it has to be set first
   publishWill(MqttTopic::RECORDER, MqttHeader::WILL);
-  return true;
+  return client->connect(host, port);
 }
 
 bool Mqtt::connect(MqttConfig &config)
@@ -54,40 +94,47 @@ bool Mqtt::connect(MqttConfig &config)
   return connect(config.host, config.port, config.useSsl);
 }
 
-void Mqtt::poll(std::function<void()> connectCallback)
+void Mqtt::stop()
 {
+  Sending sending(sendLock);
   if (client)
-  {
-    if (!client->connected())
-    {
-      if (connectCallback)
-      {
-        ESP_LOGI(TAG, "MQTT client not connected, calling connect callback");
-        connectCallback();
-      }
-      else
-      {
-        return;
-      }
-    }
+    client->stop();
+}
 
-    client->poll();
-  }
+bool Mqtt::poll()
+{
+  if (!isConnected())
+    return false;
+
+  // the spool drain task may be replaying on the same client
+  Sending sending(sendLock);
+  client->poll();
+  resendRequested();
+  return true;
 }
 
 bool Mqtt::isConnected()
 {
-  if (!client)
+  if (!client || !up.load(std::memory_order_acquire))
     return false;
+
+  // a TLS client reads pending records to tell
+  Sending sending(sendLock);
   return client->connected();
 }
 
+bool Mqtt::markUp(bool value)
+{
+  return up.exchange(value, std::memory_order_acq_rel);
+}
+
 int Mqtt::publishWill(const char *topic, const char *message)
 {
-  isClientReady;
+  if (!client)
+    return -1;
 
-  client->beginWill(topic, false, 0);
-  stamp(MqttMessageType::MESSAGE);
+  client->beginWill(wireTopic(topic), false, 0);
+  stamp(MqttMessageType::MESSAGE, 0, 0, nullptr, 0);
   client->print(MqttHeader::WILL);
   client->endWill();
 
@@ -95,69 +142,259 @@ int Mqtt::publishWill(const char *topic, const char *message)
 };
 
 int Mqtt::publishMessage(const char *topic, const char *message)
+{
+  return publishMessage(topic, reinterpret_cast<const uint8_t *>(message), strlen(message));
+};
+
+int Mqtt::publishMessage(const char *topic, const uint8_t *message, size_t size)
 {
   isClientReady;
+  Sending sending(sendLock);
+  return send(topic, MqttMessageType::MESSAGE, message, size);
+};
 
-  client->beginMessage(topic);
-  stamp(MqttMessageType::MESSAGE);
-  client->print(message);
-  client->endMessage();
+int Mqtt::publishFragmentHeader(const char *topic, const char *header, const char *codec, const char *flag)
+{
+  // what is left of the previous session would land in the new one
+  batch.clear();
 
-  return 0;
+  // HEADER [\0 CODEC [\0 FLAG]]
+  uint8_t payload[64];
+  size_t size = 0;
+  auto append = [&](const char *token)
+  {
+    size_t length = strnlen(token, sizeof(payload) - size - 1);
+    memcpy(payload + size, token, length);
+    size += length;
+  };
+
+  append(header);
+  if (codec || flag)
+  {
+    payload[size++] = '\0';
+    append(codec ? codec : MqttAudioCodec::PCM);
+  }
+  if (flag)
+  {
+    payload[size++] = '\0';
+    append(flag);
+  }
+  return publishFragment(topic, MqttMessageType::FRAGMENT_HEADER, payload, size);
 };
 
-int Mqtt::publishFragmentHeader(const char *topic, const char *header)
+int Mqtt::publishFragmentBody(const char *topic, const uint8_t *body,
+                              size_t size, bool coalesce, uint32_t frames)
 {
-  isClientReady;
+  metricsTimer(PUBLISH);
+  auto now = millis();
+  if (!batch.empty() && (!coalesce || topic != batchTopic || batch.due(size, now)))
+  {
+    auto res = flushBatch();
+    if (res != 0)
+      return res;
+  }
 
-  client->beginMessage(topic);
-  stamp(MqttMessageType::FRAGMENT_HEADER);
-  client->print(header);
-  client->endMessage();
+  if (!MQTT_COALESCE || !coalesce || batch.bypass(size))
+    return sendBody(topic, body, size, frames);
 
+  batchTopic = topic;
+  batch.append(body, size, frames, now);
   return 0;
 };
 
-int Mqtt::publishFragmentBody(const char *topic, const uint8_t *body,
-                              size_t size)
+int Mqtt::publishFragmentTrailer(const char *topic, const uint8_t *body, size_t size)
 {
-  isClientReady;
+  auto res = flushBatch();
+  if (res != 0)
+    return res;
+  return publishFragment(topic, MqttMessageType::FRAGMENT_TRAILER, body, body ? size : 0);
+};
 
-  client->beginMessage(topic);
-  stamp(MqttMessageType::FRAGMENT_BODY);
-  client->write(body, size);
-  client->endMessage();
+int Mqtt::publishFragmentCancel(const char *topic, const uint8_t *body, size_t size)
+{
+  // the server drops the session anyway
+  batch.clear();
+  return publishFragment(topic, MqttMessageType::FRAGMENT_CANCEL, body, body ? size : 0);
+};
 
-  return 0;
+int Mqtt::publishFragmentGap(const char *topic, uint32_t lostFrames)
+{
+  uint8_t body[4] = {
+      static_cast<uint8_t>(lostFrames),
+      static_cast<uint8_t>(lostFrames >> 8),
+      static_cast<uint8_t>(lostFrames >> 16),
+      static_cast<uint8_t>(lostFrames >> 24),
+  };
+
+  auto res = flushBatch();
+  if (res != 0)
+    return res;
+  return publishFragment(topic, MqttMessageType::FRAGMENT_GAP, body, sizeof(body), lostFrames);
 };
 
-int Mqtt::publishFragmentTrailer(const char *topic)
+int Mqtt::replayFragment(const char *topic, const char *type, const uint8_t *payload, size_t size, uint32_t generation)
 {
   isClientReady;
+  Sending sending(sendLock);
+  // a live session went out since the replay began, and the server dropped
+  // the replayed part when its header came in
+  if (SessionSpool::generation() != generation)
+    return 1;
+  return sendInSession(topic, type, payload, size, replayed);
+}
 
-  client->beginMessage(topic);
-  stamp(MqttMessageType::FRAGMENT_TRAILER);
-  client->endMessage();
+int Mqtt::sendBody(const char *topic, const uint8_t *body, size_t size, uint32_t frames)
+{
+  auto startedAt = micros();
+  auto res = publishFragment(topic, MqttMessageType::FRAGMENT_BODY, body, size, frames);
+  if (res == 0)
+    batch.sent(size, micros() - startedAt);
+  return res;
+}
 
+int Mqtt::flushBatch()
+{
+  if (batch.empty())
+    return 0;
+
+  auto res = sendBody(batchTopic, batch.data(), batch.size(), batch.frames());
+  if (res != 0)
+    return res;
+
+  if (batch.count() > 1)
+    Metrics::add(Metrics::Counter::COALESCED_BODIES, batch.count() - 1);
+  batch.clear();
   return 0;
-};
+}
 
-int Mqtt::stamp(const char *protocol)
+int Mqtt::publishFragment(const char *topic, const char *type, const uint8_t *payload, size_t size, uint32_t frames)
 {
+  int res;
+  if (SessionSpool::intercept(topic, type, payload, size, frames, isConnected(), res))
+    return res;
+
   isClientReady;
+  Sending sending(sendLock);
+  return sendInSession(topic, type, payload, size, live);
+}
 
-  client->print(protocol);
-  client->write(stampSize);
-  client->write(reinterpret_cast<const uint8_t *>(identifier), stampSize);
+int Mqtt::sendInSession(const char *topic, const char *type, const uint8_t *payload, size_t size, SessionStream &stream)
+{
+  if (strncmp(type, MqttMessageType::FRAGMENT_HEADER, 4) == 0)
+    stream = SessionStream{++sessions, 0};
+
+  auto res = send(topic, type, payload, size, stream.id, stream.next);
+  if (res != 0)
+    return res;
 
+  resendRing.keep(knownTopic(topic), type, stream.id, stream.next, payload, size);
+  stream.next++;
   return 0;
+}
+
+int Mqtt::send(const char *topic, const char *type, const uint8_t *payload, size_t size,
+               uint32_t session, uint32_t sequence)
+{
+  client->beginMessage(wireTopic(topic));
+  size_t stamped = stamp(type, session, sequence, payload, size);
+  if (size != 0)
+    client->write(payload, size);
+
+  if (!client->endMessage())
+  {
+    Metrics::add(Metrics::Counter::PUBLISH_FAILED);
+    return -1;
+  }
+
+  Metrics::add(Metrics::Counter::BYTES_SENT, stamped + size);
+  return 0;
+}
+
+size_t Mqtt::stamp(const char *type, uint32_t session, uint32_t sequence, const uint8_t *payload, size_t size)
+{
+  if (device >= 0)
+  {
+    uint32_t crc = session != 0 ? Frame::crc32(payload, size) : 0;
+    uint8_t compact[Frame::maxCompactStampSize];
+    size_t stamped = Frame::writeCompactStamp(compact, type, device, session, sequence, crc);
+    if (stamped != 0)
+      return client->write(compact, stamped);
+  }
+
+  client->print(type);
+  client->write(stampSize);
+  client->write(reinterpret_cast<const uint8_t *>(identifier), stampSize);
+  return 5 + stampSize;
 };
 
+void Mqtt::requestResend(const uint8_t *message, size_t size)
+{
+  if (size < 8)
+  {
+    ESP_LOGI(TAG, "Resend request is too short: %d", size);
+    return;
+  }
+
+  auto readU32 = [&](size_t offset)
+  {
+    return message[offset] | message[offset + 1] << 8 | message[offset + 2] << 16 |
+           static_cast<uint32_t>(message[offset + 3]) << 24;
+  };
+
+  // a newer request replaces one not served yet, the server asks again
+  resendSession = readU32(0);
+  resendCount = 0;
+  for (size_t offset = 4; offset + 4 <= size && resendCount < MQTT_NACK_MAX; offset += 4)
+    resendSequences[resendCount++] = readU32(offset);
+}
+
+void Mqtt::resendRequested()
+{
+  if (resendCount == 0)
+    return;
+
+  Sending sending(sendLock);
+  for (size_t i = 0; i < resendCount; i++)
+  {
+    const uint8_t *payload;
+    auto fragment = resendRing.find(resendSession, resendSequences[i], payload);
+    if (!fragment)
+    {
+      ESP_LOGW(TAG, "Message %u of session %u is no longer kept, not resending it",
+               resendSequences[i], resendSession);
+      continue;
+    }
+
+    char type[5] = {0};
+    memcpy(type, fragment->type, 4);
+    if (send(fragment->topic, type, payload, fragment->size, fragment->session, fragment->sequence) != 0)
+      break;
+    Metrics::add(Metrics::Counter::FRAGMENTS_RESENT);
+  }
+  resendCount = 0;
+}
+
 int Mqtt::subscribe(const char *topic,
                     std::function<void(const char *message, size_t size)> cb)
 {
-  isClientReady;
+  size_t slot = 0;
+  while (slot < subscriptionCount && strcmp(subscriptions[slot].topic, topic) != 0)
+    slot++;
+  if (slot == maxSubscriptions)
+  {
+    ESP_LOGE(TAG, "Too many MQTT subscriptions, dropping topic: %s", topic);
+    return -1;
+  }
 
+  subscriptions[slot] = Subscription{topic, cb};
+  if (slot == subscriptionCount)
+    subscriptionCount++;
+
+  // Otherwise the link subscribes once it is up.
+  if (!isConnected())
+    return true;
+
+  Sending sending(sendLock);
   auto res = client->subscribe(topic, 0);
   if (res != 1)
   {
@@ -165,9 +402,37 @@ int Mqtt::subscribe(const char *topic,
     return res;
   }
 
+  return true;
+}
+
+bool Mqtt::resubscribe()
+{
+  if (!client)
+    return false;
+
+  Sending sending(sendLock);
+  // The client only keeps one handler, route by topic from there.
   client->onMessage(
-      [cb](MqttClient *mqttClient, int messageSize)
+      [this](MqttClient *mqttClient, int messageSize)
       {
+        dispatch(mqttClient, messageSize);
+      });
+
+  for (size_t i = 0; i < subscriptionCount; i++)
+  {
+    auto res = client->subscribe(subscriptions[i].topic, 0);
+    if (res != 1)
+    {
+      ESP_LOGE(TAG, "Failed to subscribe to MQTT server (topic: %s) with code: %d", subscriptions[i].topic, res);
+      return false;
+    }
+  }
+
+  return true;
+}
+
+void Mqtt::dispatch(MqttClient *mqttClient, int messageSize)
+{
 #define __assert_read(into, size)                                                 \
   read = mqttClient->read(into, size);                                            \
   if (read != size)                                                               \
@@ -176,52 +441,91 @@ int Mqtt::subscribe(const char *topic,
              size, read);                                                         \
     return;                                                                       \
   }
-        int read;
+  int read;
 
-        if (messageSize < 6)
-        {
-          ESP_LOGI(TAG, "Received MQTT message that is too short");
-          return;
-        }
+  auto topic = mqttClient->messageTopic();
+  const Subscription *subscription = nullptr;
+  for (size_t i = 0; i < subscriptionCount; i++)
+  {
+    if (topic == subscriptions[i].topic)
+      subscription = &subscriptions[i];
+  }
 
-        if (messageSize == 6)
-        {
-          ESP_LOGI(TAG, "Receiving empty MQTT message");
-          cb("", 0);
-          return;
-        }
+  if (!subscription)
+  {
+    ESP_LOGI(TAG, "Received MQTT message on unsubscribed topic: %s", topic.c_str());
+    return;
+  }
 
-        char messageType[5] = {0};
-        __assert_read(reinterpret_cast<uint8_t *>(messageType), 4);
+  auto &cb = subscription->cb;
 
-        if (strncmp(messageType, MqttMessageType::MESSAGE, 4) != 0)
-        {
-          ESP_LOGI(TAG, "Receiving non-message type MQTT message: %s\n", messageType);
-          return;
-        }
+  if (messageSize < 6)
+  {
+    ESP_LOGI(TAG, "Received MQTT message that is too short");
+    return;
+  }
 
-        uint8_t idSize;
-        __assert_read(&idSize, 1);
+  if (messageSize == 6)
+  {
+    ESP_LOGI(TAG, "Receiving empty MQTT message");
+    cb("", 0);
+    return;
+  }
+
+  char messageType[5] = {0};
+  __assert_read(reinterpret_cast<uint8_t *>(messageType), 4);
 
-        char id[idSize + 1] = {0};
-        __assert_read(reinterpret_cast<uint8_t *>(id), idSize);
+  if (strncmp(messageType, MqttMessageType::MESSAGE, 4) != 0)
+  {
+    ESP_LOGI(TAG, "Receiving non-message type MQTT message: %s\n", messageType);
+    return;
+  }
 
-        if (strncmp(id, MqttIdentifier::SERVER, idSize) != 0)
-        {
-          ESP_LOGI(TAG, "Received MQTT message from source other than server: %s\n", id);
-          return;
-        }
+  uint8_t idSize;
+  __assert_read(&idSize, 1);
+  if (idSize > maxIdentifierSize)
+  {
+    ESP_LOGI(TAG, "Received MQTT message with an identifier too long: %d", idSize);
+    return;
+  }
 
-        size_t payloadSize = messageSize - 5 - idSize;
-        char payload[payloadSize + 1] = {0};
-        __assert_read(reinterpret_cast<uint8_t *>(payload), payloadSize);
+  char id[maxIdentifierSize + 1] = {0};
+  __assert_read(reinterpret_cast<uint8_t *>(id), idSize);
 
-        ESP_LOGI(TAG, "Receiving MQTT message of size %d from %s with content:\n%s\n", payloadSize, id, payload);
-        cb(payload, payloadSize);
+  if (strncmp(id, MqttIdentifier::SERVER, idSize) != 0)
+  {
+    ESP_LOGI(TAG, "Received MQTT message from source other than server: %s\n", id);
+    return;
+  }
+
+  size_t payloadSize = messageSize - 5 - idSize;
+  if (payloadSize > MQTT_INBOX_SIZE)
+  {
+    oversized++;
+    ESP_LOGW(TAG, "Dropping MQTT message of size %d, larger than MQTT_INBOX_SIZE (%d)", payloadSize, MQTT_INBOX_SIZE);
+    return;
+  }
+
+  char *payload = inbox;
+  __assert_read(reinterpret_cast<uint8_t *>(payload), payloadSize);
+  payload[payloadSize] = '\0';
+
+  ESP_LOGI(TAG, "Receiving MQTT message of size %d from %s on %s", payloadSize, id, topic.c_str());
+  cb(payload, payloadSize);
 
 #undef __assert_read
-      });
+}
+
+// Reads the configuration from its SPIFFS file, written before the config
+// store, and moves it over.
+static bool migrate(MqttConfig &config)
+{
+  if (FileSystem::size(MQTT_CONFIG_PATH) != static_cast<long>(sizeof(MqttConfig)) ||
+      !FileSystem::load(MQTT_CONFIG_PATH, reinterpret_cast<unsigned char *>(&config), sizeof(MqttConfig)))
+    return false;
 
+  ESP_LOGI(TAG, "Migrating Mqtt configuration from SPIFFS");
+  MqttConfigurer::store(config);
   return true;
 }
 
@@ -230,8 +534,7 @@ namespace MqttConfigurer
   int store(MqttConfig &config)
   {
     ESP_LOGI(TAG, "Saving Mqtt configuration to flash");
-    if (FileSystem::store(MQTT_CONFIG_PATH, reinterpret_cast<unsigned char *>(&config),
-                          sizeof(config)))
+    if (ConfigStore::store(MQTT_CONFIG_KEY, mqttConfigVersion, config))
     {
       ESP_LOGI(TAG, "Mqtt configuration saved");
       return 0;
@@ -251,24 +554,17 @@ namespace MqttConfigurer
       return 1;
     }
 
+    // The link task connects in the background, see core/connection.h.
     ESP_LOGI(TAG, "Connecting to %s:%d with SSL: %d", config.host,
              config.port, (int)config.useSsl);
-    if (!mqtt.connect(config.host, config.port, config.useSsl))
-    {
-      auto code = mqtt.client->connectError();
-      ESP_LOGE(TAG, "MQTT connection failed with code: %d", code);
-      return code;
-    }
-
-    ESP_LOGI(TAG, "Connected");
+    Connection::configure(config);
     return ESP_OK;
   };
 
   int setup(MqttConfig &config, Mqtt &mqtt)
   {
     ESP_LOGI(TAG, "Loading Mqtt configuration from flash");
-    if (FileSystem::load(MQTT_CONFIG_PATH, reinterpret_cast<unsigned char *>(&config),
-                         sizeof(MqttConfig)))
+    if (ConfigStore::load(MQTT_CONFIG_KEY, mqttConfigVersion, config) || migrate(config))
     {
       ESP_LOGI(TAG, "Mqtt configuration loaded");
       MqttConfigurer::reconnect(config, mqtt);
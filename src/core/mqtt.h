@@ -1,9 +1,15 @@
 #pragma once
 
+#include "core/batch.h"
+#include "core/resend.h"
+#include "core/tls.h"
+
 #include <Arduino.h>
 #include <MqttClient.h>
 #include <WiFi.h>
-#include <WiFiClientSecure.h>
+#include <atomic>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
 #include <cstddef>
 #include <cstdint>
 #include <functional>
@@ -15,6 +21,26 @@
     return code;                                                   \
   }
 
+#ifndef MQTT_INBOX_SIZE
+#define MQTT_INBOX_SIZE 1536 // largest server payload, bigger messages are dropped
+#endif
+
+#ifndef TX_PAYLOAD_BUFFER_SIZE
+#define TX_PAYLOAD_BUFFER_SIZE 256 // ArduinoMqttClient's default, the largest message it buffers
+#endif
+
+#ifndef MQTT_COMPACT_FRAMING
+#define MQTT_COMPACT_FRAMING 1 // compact stamps (see mqtt/frame.h), 0 for the legacy ASCII ones
+#endif
+
+#ifndef MQTT_SHORT_TOPICS
+#define MQTT_SHORT_TOPICS 0 // publish on the MqttShortTopic uplink topics
+#endif
+
+#ifndef MQTT_CONNECT_TIMEOUT_MS
+#define MQTT_CONNECT_TIMEOUT_MS 5000 // CONNACK wait of a connection attempt
+#endif
+
 struct MqttConfig
 {
   char host[64];
@@ -25,33 +51,148 @@ struct MqttConfig
 class Mqtt
 {
 public:
-  std::unique_ptr<MqttClient> client;
+  // Client of the current connection, nullptr before the first one. Both
+  // clients are members, reconnecting never allocates.
+  MqttClient *client = nullptr;
   Mqtt(const char *identifier);
 
   bool connect(MqttConfig &config);
   bool connect(const char *host, uint16_t port, bool secure);
 
+  // Closes the connection of the current client, if any.
+  void stop();
+
+  // Whether the link is up (see core/connection.h) and the client connected.
   bool isConnected();
 
-  void poll(std::function<void()> connectCallback = nullptr);
+  // Sets whether the link is up, returns the previous value. Publishing is
+  // refused while it is down, the link task owns the client then.
+  bool markUp(bool up);
+
+  // Handles incoming messages, returns false if the connection went away.
+  bool poll();
 
   int publishWill(const char *topic, const char *message);
   int publishMessage(const char *topic, const char *message);
-  int publishFragmentHeader(const char *topic, const char *header);
-  int publishFragmentBody(const char *topic, const uint8_t *body, size_t size);
-  int publishFragmentTrailer(const char *topic);
+  int publishMessage(const char *topic, const uint8_t *message, size_t size);
+  int publishFragmentHeader(const char *topic, const char *header, const char *codec = nullptr, const char *flag = nullptr);
+  // A `coalesce`d body may wait in a batch for the next ones (see
+  // core/batch.h), any other session message sends the batch first. Audio
+  // bodies give the I2S `frames` they carry, see SessionSpool::divert.
+  int publishFragmentBody(const char *topic, const uint8_t *body, size_t size, bool coalesce = false, uint32_t frames = 0);
+  int publishFragmentTrailer(const char *topic, const uint8_t *body = nullptr, size_t size = 0);
+  // Ends a fragmented message that the server should discard.
+  int publishFragmentCancel(const char *topic, const uint8_t *body = nullptr, size_t size = 0);
+  // Marks `lostFrames` I2S frames missing between the previous and the next
+  // fragment body.
+  int publishFragmentGap(const char *topic, uint32_t lostFrames);
+
+  // Sends a spooled fragment message (see core/spool.h) as it was recorded.
+  // Returns 1 without sending when a live session started after
+  // `generation`, which makes the server drop the replayed session.
+  int replayFragment(const char *topic, const char *type, const uint8_t *payload, size_t size, uint32_t generation);
 
+  // Takes a NACK from the server: SESSION 4B, then SEQUENCE 4B for every
+  // message to send again, all little-endian. They go out on the next
+  // poll(), as they were first sent.
+  void requestResend(const uint8_t *message, size_t size);
+
+  // Subscribes `cb` to server messages on `topic`, now if connected and on
+  // every later connection. Subscribing again to the same topic replaces its
+  // callback.
   int subscribe(const char *topic,
                 std::function<void(const char *message, size_t size)> cb);
 
+  // Subscribes the current connection to every known topic.
+  bool resubscribe();
+
+  // Server messages dropped for not fitting MQTT_INBOX_SIZE.
+  uint32_t oversizedMessages() const { return oversized; }
+
 private:
+  static constexpr size_t maxSubscriptions = 4;
+  static constexpr size_t maxIdentifierSize = 32;
+  // Body payload that still fits TX_PAYLOAD_BUFFER_SIZE behind the stamp.
+  static constexpr size_t batchCapacity = TX_PAYLOAD_BUFFER_SIZE - 5 - maxIdentifierSize;
+  static_assert(TX_PAYLOAD_BUFFER_SIZE > 5 + maxIdentifierSize, "TX_PAYLOAD_BUFFER_SIZE cannot hold a stamp");
+
+  struct Subscription
+  {
+    const char *topic;
+    std::function<void(const char *message, size_t size)> cb;
+  };
+
   const char *identifier;
   uint8_t stampSize;
+  // Index in MqttIdentifier for the compact stamp, -1 falls back to legacy.
+  int device;
+
+  // A session on the wire: its id in the compact stamp, one per fragment
+  // header, and the sequence of its next message.
+  struct SessionStream
+  {
+    uint32_t id = 0;
+    uint32_t next = 0;
+  };
+
+  // Live and replayed sessions count apart, the drain runs on its own task.
+  std::atomic<uint32_t> sessions{0};
+  SessionStream live;
+  SessionStream replayed;
+
+  // Sent session messages, under the send lock.
+  ResendRing<MQTT_RESEND_SLOTS, batchCapacity> resendRing;
+
+  // Latest NACK, only touched by the task polling the client.
+  uint32_t resendSession = 0;
+  uint32_t resendSequences[MQTT_NACK_MAX];
+  size_t resendCount = 0;
+
+  Subscription subscriptions[maxSubscriptions];
+  size_t subscriptionCount = 0;
+
+  // Payload of the message being dispatched, received messages never
+  // allocate.
+  char inbox[MQTT_INBOX_SIZE + 1];
+  uint32_t oversized = 0;
+
+  void dispatch(MqttClient *mqttClient, int messageSize);
 
   WiFiClient insecureClient;
-  WiFiClientSecure secureClient;
+  TlsClient secureClient;
+  MqttClient insecureMqtt;
+  MqttClient secureMqtt;
+
+  std::atomic<bool> up{false};
+
+  // Taken around every use of the client: messages, polling, connecting
+  // and closing. The spool drain and the link task never interleave with
+  // the recorder's publishes, neither the MQTT nor the TLS state is
+  // re-entrant.
+  SemaphoreHandle_t sendLock;
+  StaticSemaphore_t sendLockBuffer;
+
+  BodyBatch<batchCapacity> batch;
+  const char *batchTopic = nullptr;
 
-  int stamp(const char *protocol);
+  // Writes the stamp in front of a message, returns its size.
+  size_t stamp(const char *type, uint32_t session, uint32_t sequence, const uint8_t *payload, size_t size);
+  // Sends a body, timing it for the batch size.
+  int sendBody(const char *topic, const uint8_t *body, size_t size, uint32_t frames);
+  // Sends the pending batch, which stays pending when that fails.
+  int flushBatch();
+  // Fragment messages go through the spool first, with the I2S `frames`
+  // they stand for.
+  int publishFragment(const char *topic, const char *type, const uint8_t *payload, size_t size, uint32_t frames = 0);
+  // Sends the next message of `stream`, keeping it for a resend. A failed
+  // message keeps its sequence, the retry takes it.
+  int sendInSession(const char *topic, const char *type, const uint8_t *payload, size_t size, SessionStream &stream);
+  // Sends one message, send lock held. Returns -1 when the client failed to
+  // send it.
+  int send(const char *topic, const char *type, const uint8_t *payload, size_t size,
+           uint32_t session = 0, uint32_t sequence = 0);
+  // Sends the messages of the latest NACK that are still kept.
+  void resendRequested();
 };
 
 namespace MqttConfigurer
@@ -0,0 +1,80 @@
+#pragma once
+
+#include "core/format.h"
+
+#include <cstddef>
+#include <cstdint>
+
+// Sample packing kernels shared by the realtime and file recording paths.
+// Everything here is header-only so the detector inlines into the loop.
+namespace Pack
+{
+  struct NullDetector
+  {
+    inline void operator()(int32_t) const {}
+  };
+
+  // Tracks the absolute peak of the normalized (24-bit, signed) samples.
+  struct PeakDetector
+  {
+    int32_t peak = 0;
+
+    inline void operator()(int32_t sample)
+    {
+      int32_t absolute = sample < 0 ? -sample : sample;
+      if (absolute > peak)
+        peak = absolute;
+    }
+  };
+
+  // Packs `count` raw I2S words into `Output` samples, 4 at a time with
+  // word-wide stores, and returns the number of bytes written. `dest` may
+  // alias `src` (in-place packing) since every group is loaded before it is
+  // stored and no output format is wider than the 32-bit input word.
+  template <typename Output, typename Input, typename Detector>
+  inline size_t packSamples(const int32_t *src, size_t count, uint8_t *dest, Detector &&detector)
+  {
+    const bool aligned = (reinterpret_cast<uintptr_t>(dest) & 3u) == 0;
+    size_t groups = count / 4;
+
+    for (size_t g = 0; g < groups; g++)
+    {
+      int32_t s0 = Input::normalize(src[0]);
+      int32_t s1 = Input::normalize(src[1]);
+      int32_t s2 = Input::normalize(src[2]);
+      int32_t s3 = Input::normalize(src[3]);
+      detector(s0);
+      detector(s1);
+      detector(s2);
+      detector(s3);
+
+      Output::store4(dest, s0, s1, s2, s3, aligned);
+
+      src += 4;
+      dest += 4 * Output::bytesPerSample;
+    }
+
+    for (size_t i = groups * 4; i < count; i++)
+    {
+      int32_t sample = Input::normalize(*src++);
+      detector(sample);
+      Output::store(dest, sample);
+      dest += Output::bytesPerSample;
+    }
+
+    return count * Output::bytesPerSample;
+  }
+
+  // Normalizes `count` raw I2S words into signed 24-bit samples in place, for
+  // stages (codecs, filters) that work on samples rather than packed bytes.
+  template <typename Input, typename Detector>
+  inline void normalizeInPlace(int32_t *samples, size_t count, Detector &&detector)
+  {
+    for (size_t i = 0; i < count; i++)
+    {
+      int32_t sample = Input::normalize(samples[i]);
+      detector(sample);
+      samples[i] = sample;
+    }
+  }
+}
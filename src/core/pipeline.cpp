@@ -0,0 +1,309 @@
+#include "core/pipeline.h"
+#include "core/metrics.h"
+#include "core/utils.h"
+
+#include <Arduino.h>
+
+createTag(PIPELINE);
+
+static constexpr bool conditioning = RECORDER_HIGHPASS_HZ > 0 || RECORDER_AGC;
+// Stages that need normalized samples before the codec gets them.
+static constexpr bool normalizeFirst = conditioning || RECORDER_FEATURES;
+
+namespace
+{
+  // Gathers the peak, the VAD statistics and clipping in the packing pass.
+  struct FrameDetector
+  {
+    Pack::PeakDetector peak;
+    Vad::Accumulator vad;
+    Quality::ClipCounter clip;
+
+    explicit FrameDetector(const Vad::State &state) : vad(state) {}
+
+    inline void operator()(int32_t sample)
+    {
+      peak(sample);
+      vad(sample);
+      clip(sample);
+    }
+  };
+}
+
+CapturePipeline::CapturePipeline()
+    : recorder(nullptr), freeQueue(nullptr), readyQueue(nullptr), stopped(nullptr), task(nullptr),
+      active(false), running(false), remaining(0), bounded(false), codec(AudioCodec::PCM),
+      captured(0), dropped(0), readErrors(0), overruns(0), lostFrames(0), queueHighWater(0)
+{
+}
+
+RecorderCode CapturePipeline::begin(Recorder &recorder, size_t fragmentCount, AudioCodec codec)
+{
+  end();
+
+  if (!freeQueue)
+  {
+    freeQueue = xQueueCreateStatic(RECORDER_PIPELINE_DEPTH, sizeof(AudioFragment *), freeQueueStorage, &freeQueueBuffer);
+    readyQueue = xQueueCreateStatic(RECORDER_PIPELINE_DEPTH + 1, sizeof(AudioFragment *), readyQueueStorage, &readyQueueBuffer);
+    stopped = xSemaphoreCreateBinaryStatic(&stoppedBuffer);
+  }
+
+  xQueueReset(freeQueue);
+  xQueueReset(readyQueue);
+  for (size_t i = 0; i < RECORDER_PIPELINE_DEPTH; i++)
+  {
+    AudioFragment *fragment = &pool[i];
+    xQueueSend(freeQueue, &fragment, 0);
+  }
+
+  this->recorder = &recorder;
+  this->bounded = fragmentCount != 0;
+  this->remaining = fragmentCount;
+  this->codec = codec;
+  this->adpcmState = Adpcm::State();
+  this->vadConfig = Vad::defaultConfig(1000 * RECORDER_BUFFER_SIZE / AudioConfig::bytesPerSample / RECORDER_SAMPLE_RATE);
+  this->vadState = Vad::State();
+  this->highPass = Filter::highPass(RECORDER_HIGHPASS_HZ, RECORDER_SAMPLE_RATE);
+  for (auto &state : highPassState)
+    state = Filter::BiquadState();
+  this->agcConfig = Filter::defaultAgcConfig();
+  this->agcState = Filter::AgcState();
+  if (codec == AudioCodec::MEL)
+    mel.begin(RECORDER_SAMPLE_RATE);
+#if RECORDER_FEATURES
+  features.begin(RECORDER_SAMPLE_RATE);
+#endif
+
+  if (!task)
+  {
+    task = xTaskCreateStaticPinnedToCore(
+        captureTask, "audio_capture", RECORDER_CAPTURE_STACK, this,
+        RECORDER_CAPTURE_PRIORITY, taskStack, &taskBuffer, RECORDER_CAPTURE_CORE);
+    if (!task)
+    {
+      ESP_LOGE(TAG, "Failed to create capture task");
+      return RecorderCode::AUDIO_QUEUE_ALLOC_FAILED;
+    }
+    Metrics::watch(task);
+  }
+
+  running = true;
+  active = true;
+  xTaskNotifyGive(task);
+  return RecorderCode::OK;
+}
+
+void CapturePipeline::end()
+{
+  if (!active)
+    return;
+
+  running = false;
+  // The capture task is at most one i2s_read away from noticing.
+  xSemaphoreTake(stopped, portMAX_DELAY);
+  active = false;
+
+  // Hand back whatever the consumer did not pick up.
+  AudioFragment *fragment;
+  while (xQueueReceive(readyQueue, &fragment, 0) == pdTRUE)
+  {
+    if (fragment)
+      xQueueSend(freeQueue, &fragment, 0);
+  }
+}
+
+bool CapturePipeline::isRunning() const { return active && running; }
+
+bool CapturePipeline::receive(AudioFragment *&fragment, TickType_t timeout)
+{
+  if (!readyQueue)
+    return false;
+  return xQueueReceive(readyQueue, &fragment, timeout) == pdTRUE;
+}
+
+void CapturePipeline::release(AudioFragment *fragment)
+{
+  if (fragment)
+    xQueueSend(freeQueue, &fragment, 0);
+}
+
+PipelineStats CapturePipeline::stats() const
+{
+  return PipelineStats{captured, dropped, readErrors, overruns, lostFrames, queueHighWater};
+}
+
+void CapturePipeline::resetStats()
+{
+  captured = 0;
+  dropped = 0;
+  readErrors = 0;
+  overruns = 0;
+  lostFrames = 0;
+  queueHighWater = 0;
+}
+
+// High-pass per channel, then AGC, on normalized samples.
+void CapturePipeline::condition(int32_t *samples, size_t count)
+{
+  if (RECORDER_HIGHPASS_HZ > 0)
+  {
+    for (size_t channel = 0; channel < RECORDER_CHANNELS && channel < count; channel++)
+      Filter::process(highPass, highPassState[channel], samples + channel, count - channel, RECORDER_CHANNELS);
+  }
+
+  if (RECORDER_AGC)
+    Filter::agc(agcConfig, agcState, samples, count);
+}
+
+// Packs or encodes one DMA buffer into `fragment`, returns the payload size.
+size_t CapturePipeline::encode(int32_t *samples, size_t bytesRead, AudioFragment *fragment)
+{
+  size_t count = bytesRead / sizeof(int32_t);
+  if (!normalizeFirst)
+    return encodeAs<AudioConfig::InputFormat>(samples, count, fragment);
+
+  // Clipping is a property of the input, count it before the AGC hides it.
+  Quality::ClipCounter clip;
+  Pack::normalizeInPlace<AudioConfig::InputFormat>(samples, count, clip);
+  if (conditioning)
+    condition(samples, count);
+#if RECORDER_FEATURES
+  fragment->featureSize = features.process(samples, count, fragment->features, sizeof(fragment->features));
+#endif
+  size_t size = encodeAs<AudioInput::Normalized>(samples, count, fragment);
+  fragment->quality.clipped = clip.clipped;
+  return size;
+}
+
+template <typename Input>
+size_t CapturePipeline::encodeAs(int32_t *samples, size_t count, AudioFragment *fragment)
+{
+  FrameDetector detector(vadState);
+  size_t size = 0;
+
+  switch (codec)
+  {
+  case AudioCodec::IMA_ADPCM:
+    Pack::normalizeInPlace<Input>(samples, count, detector);
+    size = Adpcm::encodeBlock(adpcmState, samples, count, fragment->data);
+    break;
+  case AudioCodec::LOSSLESS:
+    Pack::normalizeInPlace<Input>(samples, count, detector);
+    size = Lossless::encodeBlock(samples, count, fragment->data);
+    break;
+  case AudioCodec::MEL:
+    Pack::normalizeInPlace<Input>(samples, count, detector);
+    size = mel.process(samples, count, fragment->data, sizeof(fragment->data));
+    break;
+  case AudioCodec::PCM:
+  default:
+    size = Pack::packSamples<AudioConfig::OutputFormat, Input>(samples, count, fragment->data, detector);
+    break;
+  }
+
+  auto decision = Vad::update(vadState, vadConfig, detector.vad);
+  fragment->peak = detector.peak.peak;
+  fragment->voiced = decision.voiced;
+  fragment->quality.samples = count;
+  fragment->quality.clipped = detector.clip.clipped;
+  fragment->quality.speech = decision.speech;
+  fragment->quality.levelQ8 = decision.levelQ8;
+  fragment->quality.floorQ8 = decision.floorQ8;
+  return size;
+}
+
+void CapturePipeline::captureTask(void *arg)
+{
+  auto self = static_cast<CapturePipeline *>(arg);
+  int32_t samples[RECORDER_BUFFER_SIZE / sizeof(int32_t)];
+
+  for (;;)
+  {
+    // Parked until begin() hands us the next capture.
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    uint32_t sequence = 0;
+    uint32_t gap = 0; // I2S frames lost since the last queued fragment
+    uint32_t failedReads = 0; // in a row
+
+    // Whatever overflowed while nobody was capturing is not part of this one.
+    self->recorder->takeOverruns();
+
+    ESP_LOGI(TAG, "Capture started on core %d", xPortGetCoreID());
+
+    while (self->running && (!self->bounded || self->remaining > 0))
+    {
+      size_t bytesRead = 0;
+      auto res = self->recorder->read(samples, RECORDER_BUFFER_SIZE, &bytesRead);
+      if (self->bounded)
+        self->remaining--;
+
+      if (res != ESP_OK)
+      {
+        // The buffer is lost like a dropped one, and a bounded capture
+        // still ends on time.
+        uint32_t frames = RECORDER_BUFFER_SIZE / AudioConfig::bytesPerSample;
+        self->readErrors++;
+        self->lostFrames += frames;
+        gap += frames;
+        sequence++;
+
+        if (++failedReads >= RECORDER_READ_ERROR_LIMIT)
+        {
+          ESP_LOGE(TAG, "I2S read failed %u times in a row (%s), stopping the capture",
+                   failedReads, esp_err_to_name(res));
+          break;
+        }
+        vTaskDelay(pdMS_TO_TICKS(RECORDER_READ_ERROR_BACKOFF_MS << (failedReads - 1)));
+        continue;
+      }
+      failedReads = 0;
+
+      auto overrun = self->recorder->takeOverruns();
+      if (overrun.events != 0)
+      {
+        ESP_LOGW(TAG, "I2S DMA overrun: %u buffers, %u frames lost", overrun.events, overrun.lostFrames);
+        self->overruns += overrun.events;
+        self->lostFrames += overrun.lostFrames;
+        gap += overrun.lostFrames;
+      }
+
+      AudioFragment *fragment;
+      if (xQueueReceive(self->freeQueue, &fragment, 0) != pdTRUE)
+      {
+        // Consumer is behind, keep the DMA ring drained rather than waiting.
+        uint32_t frames = bytesRead / AudioConfig::bytesPerSample;
+        self->dropped++;
+        self->lostFrames += frames;
+        gap += frames;
+        sequence++;
+        continue;
+      }
+
+      {
+        metricsTimer(PACK);
+        fragment->size = self->encode(samples, bytesRead, fragment);
+      }
+      fragment->sequence = sequence++;
+      fragment->frames = bytesRead / AudioConfig::bytesPerSample;
+      fragment->gapBefore = gap;
+      fragment->quality.lost = gap * RECORDER_CHANNELS;
+      gap = 0;
+
+      xQueueSend(self->readyQueue, &fragment, 0);
+      self->captured++;
+
+      UBaseType_t depth = uxQueueMessagesWaiting(self->readyQueue);
+      if (depth > self->queueHighWater)
+        self->queueHighWater = depth;
+    }
+
+    if (self->bounded)
+    {
+      AudioFragment *endMarker = nullptr;
+      xQueueSend(self->readyQueue, &endMarker, portMAX_DELAY);
+    }
+
+    self->running = false;
+    xSemaphoreGive(self->stopped);
+  }
+}
@@ -0,0 +1,218 @@
+#pragma once
+
+#include "core/audio.h"
+#include "core/keyword.h"
+#include "core/record.h"
+#include "core/speaker.h"
+#include "dsp/adpcm.h"
+#include "dsp/filter.h"
+#include "dsp/lossless.h"
+#include "dsp/mel.h"
+#include "dsp/quality.h"
+#include "dsp/vad.h"
+
+#include <atomic>
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
+
+// Fragments carry log-mel features for the on-device models.
+#define RECORDER_FEATURES (RECORDER_KWS || RECORDER_SPEAKER_SCREEN)
+
+#ifndef RECORDER_PIPELINE_DEPTH
+#define RECORDER_PIPELINE_DEPTH 8 // fragments in flight between capture and sender
+#endif
+
+#ifndef RECORDER_CAPTURE_CORE
+#define RECORDER_CAPTURE_CORE 0
+#endif
+
+#ifndef RECORDER_SENDER_CORE
+#define RECORDER_SENDER_CORE 1
+#endif
+
+#ifndef RECORDER_CAPTURE_PRIORITY
+#define RECORDER_CAPTURE_PRIORITY 5
+#endif
+
+#ifndef RECORDER_SENDER_PRIORITY
+#define RECORDER_SENDER_PRIORITY 2
+#endif
+
+#ifndef RECORDER_CAPTURE_STACK
+#define RECORDER_CAPTURE_STACK 4096 // bytes, statically allocated
+#endif
+
+#ifndef RECORDER_SENDER_STACK
+#define RECORDER_SENDER_STACK 4096 // bytes, statically allocated
+#endif
+
+#ifndef RECORDER_READ_ERROR_LIMIT
+#define RECORDER_READ_ERROR_LIMIT 8 // failed I2S reads in a row before the capture gives up
+#endif
+
+#ifndef RECORDER_READ_ERROR_BACKOFF_MS
+#define RECORDER_READ_ERROR_BACKOFF_MS 5 // wait after a failed read, doubled for each one in a row
+#endif
+
+#ifndef RECORDER_LINK_HOLD_MS
+#define RECORDER_LINK_HOLD_MS 10000 // how long the sender waits for a dropped link before failing
+#endif
+
+// Largest payload a single DMA buffer can turn into, whatever the codec.
+constexpr size_t fragmentCapacity()
+{
+  constexpr size_t samples = RECORDER_BUFFER_SIZE / sizeof(int32_t);
+  constexpr size_t sizes[] = {
+      RECORDER_ACTUAL_BUFFER_SIZE,
+      Adpcm::encodedSize(samples),
+      Lossless::maxEncodedSize(samples),
+      Mel::maxEncodedSize(samples, Mel::layoutFor(RECORDER_SAMPLE_RATE).hop),
+  };
+
+  size_t largest = 0;
+  for (size_t size : sizes)
+    largest = size > largest ? size : largest;
+  return largest;
+}
+
+// One packed DMA buffer, ready to be published as a fragment body.
+struct AudioFragment
+{
+  uint8_t data[fragmentCapacity()];
+  size_t size;
+  int32_t peak;
+  bool voiced; // voice activity detector state after this buffer
+  Quality::Frame quality;
+  uint32_t sequence;
+  uint32_t frames;    // I2S frames of this buffer
+  uint32_t gapBefore; // I2S frames lost right before this buffer, see CapturePipeline
+#if RECORDER_FEATURES
+  // Mel block for the on-device models, whatever the stream codec is.
+  uint8_t features[Mel::maxEncodedSize(RECORDER_BUFFER_SIZE / sizeof(int32_t), Mel::layoutFor(RECORDER_SAMPLE_RATE).hop)];
+  size_t featureSize;
+#endif
+};
+
+// Fixed ring of the last N fragments, oldest first. Pushing into a full ring
+// overwrites the oldest fragment. Statically sized, it never allocates.
+template <size_t N>
+class FragmentRing
+{
+public:
+  void push(const AudioFragment *fragment)
+  {
+    if (N == 0)
+      return;
+
+    slots[(head + count) % slotCount] = *fragment;
+
+    if (count < N)
+      count++;
+    else
+      head = (head + 1) % slotCount;
+  }
+
+  const AudioFragment &at(size_t index) const { return slots[(head + index) % slotCount]; }
+  size_t size() const { return count; }
+  void clear() { head = count = 0; }
+
+private:
+  static constexpr size_t slotCount = N == 0 ? 1 : N;
+
+  AudioFragment slots[slotCount];
+  size_t head = 0;
+  size_t count = 0;
+};
+
+struct PipelineStats
+{
+  uint32_t captured;
+  uint32_t dropped; // fragment pool exhausted, the buffer was read and discarded
+  uint32_t readErrors;
+  uint32_t overruns;    // DMA buffers the I2S driver dropped, see Recorder::takeOverruns
+  uint32_t lostFrames;  // I2S frames lost to overruns and to drops
+  UBaseType_t queueHighWater;
+};
+
+// Capture task pinned to RECORDER_CAPTURE_CORE. It reads I2S, packs every
+// buffer into a fragment from a fixed pool, runs the voice activity detector
+// on it and queues it for the consumer. With RECORDER_HIGHPASS_HZ or
+// RECORDER_AGC set, samples are conditioned in place before packing, and
+// with RECORDER_KWS or RECORDER_SPEAKER_SCREEN every fragment also carries
+// log-mel features for the on-device models.
+// When the consumer falls behind the pool runs dry and the buffer is dropped
+// (and counted) instead of stalling i2s_read. Audio lost that way, or to a
+// DMA overrun while the task was starved, is reported on the next fragment
+// (gapBefore) so the stream can mark the gap.
+//
+// Everything (pool, queues, task stack) is static, so starting and stopping
+// captures never touches the heap. The task is created on the first begin()
+// and then parks between captures instead of being deleted.
+class CapturePipeline
+{
+public:
+  CapturePipeline();
+
+  // Starts capturing `fragmentCount` fragments, or until end() when 0,
+  // encoding every fragment with `codec`.
+  RecorderCode begin(Recorder &recorder, size_t fragmentCount = 0, AudioCodec codec = AudioCodec::PCM);
+  void end();
+  bool isRunning() const;
+
+  // Returns false on timeout. A nullptr fragment marks the end of a bounded capture.
+  bool receive(AudioFragment *&fragment, TickType_t timeout);
+  void release(AudioFragment *fragment);
+
+  PipelineStats stats() const;
+  void resetStats();
+
+private:
+  static void captureTask(void *arg);
+  size_t encode(int32_t *samples, size_t bytesRead, AudioFragment *fragment);
+  template <typename Input>
+  size_t encodeAs(int32_t *samples, size_t count, AudioFragment *fragment);
+  void condition(int32_t *samples, size_t count);
+
+  Recorder *recorder;
+  QueueHandle_t freeQueue;
+  QueueHandle_t readyQueue;
+  SemaphoreHandle_t stopped;
+  TaskHandle_t task;
+  bool active; // between begin() and end()
+
+  std::atomic<bool> running;
+  size_t remaining;
+  bool bounded;
+  AudioCodec codec;
+  Adpcm::State adpcmState;
+  Vad::Config vadConfig;
+  Vad::State vadState;
+  Filter::Biquad highPass;
+  Filter::BiquadState highPassState[RECORDER_CHANNELS];
+  Filter::AgcConfig agcConfig;
+  Filter::AgcState agcState;
+  Mel::Extractor mel;
+#if RECORDER_FEATURES
+  Mel::Extractor features;
+#endif
+
+  std::atomic<uint32_t> captured;
+  std::atomic<uint32_t> dropped;
+  std::atomic<uint32_t> readErrors;
+  std::atomic<uint32_t> overruns;
+  std::atomic<uint32_t> lostFrames;
+  std::atomic<UBaseType_t> queueHighWater;
+
+  AudioFragment pool[RECORDER_PIPELINE_DEPTH];
+
+  StaticQueue_t freeQueueBuffer;
+  StaticQueue_t readyQueueBuffer;
+  uint8_t freeQueueStorage[RECORDER_PIPELINE_DEPTH * sizeof(AudioFragment *)];
+  // one extra slot so the end-of-capture marker always fits
+  uint8_t readyQueueStorage[(RECORDER_PIPELINE_DEPTH + 1) * sizeof(AudioFragment *)];
+  StaticSemaphore_t stoppedBuffer;
+  StaticTask_t taskBuffer;
+  StackType_t taskStack[RECORDER_CAPTURE_STACK];
+};
@@ -1,17 +1,18 @@
 #include "core/record.h"
+#include "core/connection.h"
 #include "core/mqtt.h"
 #include "core/led.h"
-#include "core/buffer.h"
+#include "core/metrics.h"
+#include "core/pipeline.h"
+#include "core/spool.h"
 #include "core/utils.h"
-#include "core/remotexy.h"
+#include "core/ui.h"
 
 #include "mqtt/protocol.h"
 
 #include <Arduino.h>
-#include <vector>
 #include <cstring>
 
-#define WAV_FILE_PATH "/recording.wav"
 #define RECORDER_DURATION 5000
 
 ESP_STATIC_ASSERT(
@@ -20,54 +21,293 @@ ESP_STATIC_ASSERT(
 
 createTag(RECORD);
 
+ESP_STATIC_ASSERT(
+    AudioCodec::RECORDER_STREAM_CODEC == AudioCodec::PCM || AudioConfig::channelMode == I2S_CHANNEL_MONO,
+    "Encoded streaming codecs only support mono recordings");
+
+ESP_STATIC_ASSERT(
+    AudioCodec::RECORDER_SAMPLE_CODEC == AudioCodec::PCM || AudioConfig::channelMode == I2S_CHANNEL_MONO,
+    "Encoded sample codecs only support mono recordings");
+
+static CapturePipeline pipeline;
+
+// Fragments covering RECORDER_PREROLL_MS, flushed when a realtime stream starts.
+static constexpr size_t prerollFragments =
+    (static_cast<uint64_t>(RECORDER_PREROLL_MS) * RECORDER_SAMPLE_RATE * AudioConfig::bytesPerSample / 1000 +
+     RECORDER_BUFFER_SIZE - 1) /
+    RECORDER_BUFFER_SIZE;
+static FragmentRing<prerollFragments> preroll;
+
+#if RECORDER_FEATURES
+// Models, their activations and feature windows, loaded once and kept.
+static StaticArena<RECORDER_MODEL_ARENA_SIZE> modelArena;
+#endif
+
+#if RECORDER_KWS
+static KeywordGate keywordGate;
+#endif
+
+// Whether a fragment may open a realtime stream as far as the keyword gate
+// is concerned. Always true without RECORDER_KWS or without a model.
+static bool keywordAccepted(const AudioFragment *fragment)
+{
+#if RECORDER_KWS
+  keywordGate.push(fragment->features, fragment->featureSize);
+  return !keywordGate.enabled() || (fragment->voiced && keywordGate.detect() != nullptr);
+#else
+  return true;
+#endif
+}
+
+#if RECORDER_SPEAKER_SCREEN
+static SpeakerScreen speakerScreen;
+#endif
+
+// Set when the pre-screen rejected the current voice, which then stays off
+// the network until the VAD drops it.
+static bool screenedOut = false;
+
+// Keeps the speaker pre-screen window on the idle audio, so that it holds
+// the voice that opens the next stream.
+static void speakerObserve(const AudioFragment *fragment)
+{
+#if RECORDER_SPEAKER_SCREEN
+  speakerScreen.push(fragment->features, fragment->featureSize);
+#endif
+}
+
+static SpeakerMatch screenSpeaker()
+{
+#if RECORDER_SPEAKER_SCREEN
+  return speakerScreen.screen();
+#else
+  return SpeakerMatch{SpeakerVerdict::UNSURE, 0.0f, nullptr};
+#endif
+}
+
+static const char *audioCodecName(AudioCodec codec)
+{
+  switch (codec)
+  {
+  case AudioCodec::IMA_ADPCM:
+    return MqttAudioCodec::IMA_ADPCM;
+  case AudioCodec::LOSSLESS:
+    return MqttAudioCodec::LOSSLESS;
+  case AudioCodec::MEL:
+    return MqttAudioCodec::MEL;
+  case AudioCodec::PCM:
+  default:
+    return MqttAudioCodec::PCM;
+  }
+}
+
+ESP_STATIC_ASSERT(Mel::descriptorSize <= 44, "Feature descriptor must fit in the WAV header slot");
+
+// First body fragment of a session: the WAV header, or the feature
+// descriptor when the session carries log-mel frames instead of audio.
+static size_t writeStreamHeader(Recorder &recorder, AudioCodec codec, uint8_t *dest, uint32_t actualSize)
+{
+  if (codec == AudioCodec::MEL)
+    return Mel::writeDescriptor(Mel::layoutFor(RECORDER_SAMPLE_RATE), dest);
+
+  recorder.writeWavHeader(dest, actualSize);
+  return 44;
+}
+
+// Whether a publish that failed with `res` is worth sending again, after
+// waiting up to `hold` for the link to come back.
+static bool relinked(int res, TickType_t hold)
+{
+  return res != 0 && hold != 0 && Connection::waitUntilUp(hold);
+}
+
+// Sends one session message with `publish`. A publish lost to a dropped link
+// goes again once it recovers within `hold`, and failing that the rest of
+// the session moves to the spool (see core/spool.h).
+template <typename Publish>
+static int deliver(TickType_t hold, Publish publish)
+{
+  auto res = publish();
+  if (relinked(res, hold))
+    res = publish();
+  if (res != 0 && SessionSpool::divert())
+    res = publish();
+  return res;
+}
+
+static const Quality::Config qualityConfig = Quality::defaultConfig();
+
+// Scores of the session being sent, fed with every fragment that goes out.
+static Quality::Tracker sessionQuality;
+
+static const char *qualityReason(uint8_t flags)
+{
+  if (flags & Quality::GAPPED)
+    return "audio lost";
+  if (flags & Quality::CLIPPED)
+    return "clipped";
+  if (flags & Quality::SHORT)
+    return "too short";
+  if (flags & Quality::NOISY)
+    return "too noisy";
+  return "ok";
+}
+
+// Ends the session with its quality scores: the trailer, or a cancel when
+// RECORDER_QUALITY_GATE drops hopeless audio.
+static int publishSessionEnd(Mqtt &mqtt, Quality::Score &score)
+{
+  score = sessionQuality.score(qualityConfig, RECORDER_SAMPLE_RATE * RECORDER_CHANNELS);
+  ESP_LOGI(TAG, "Session quality: clipping %u/1000, SNR %.1f dB, voiced %u ms, lost %u ms (%s)",
+           score.clippingPermille, score.snrQ8 / 256.0f, score.voicedMs, score.lostMs, qualityReason(score.flags));
+
+  uint8_t payload[Quality::encodedSize];
+  size_t size = Quality::encode(score, payload);
+  if (RECORDER_QUALITY_GATE && !score.passed())
+    return deliver(0, [&]
+                   { return mqtt.publishFragmentCancel(MqttTopic::RECORDER, payload, size); });
+  return deliver(0, [&]
+                 { return mqtt.publishFragmentTrailer(MqttTopic::RECORDER, payload, size); });
+}
+
+// Publishes one captured fragment of the session, preceded by a gap marker
+// when audio was lost right before it. The `opening` fragment of a realtime
+// stream ignores its gap, which happened before the stream. See deliver()
+// for `hold`.
+static int streamFragment(Mqtt &mqtt, const char *topic, const AudioFragment *fragment, bool opening = false, TickType_t hold = 0)
+{
+  Quality::Frame quality = fragment->quality;
+  if (opening)
+  {
+    quality.lost = 0;
+  }
+  else if (fragment->gapBefore != 0)
+  {
+    auto res = deliver(hold, [&]
+                       { return mqtt.publishFragmentGap(topic, fragment->gapBefore); });
+    if (res != 0)
+      return res;
+  }
+
+  sessionQuality.add(quality);
+  return deliver(hold, [&]
+                 { return mqtt.publishFragmentBody(topic, fragment->data, fragment->size, true, fragment->frames); });
+}
+
+// Result of a session that ended with `score`, see publishSessionEnd.
+static RecorderCode sessionCode(const Quality::Score &score)
+{
+  if (score.flags & Quality::GAPPED)
+    return RecorderCode::AUDIO_OVERRUN;
+  if (RECORDER_QUALITY_GATE && !score.passed())
+    return RecorderCode::QUALITY_REJECTED;
+  return RecorderCode::OK;
+}
+
 struct MqttSenderTaskContext
 {
-  QueueHandle_t *queue;
+  CapturePipeline *pipeline;
   Mqtt *mqtt;
   const char *topic;
   MqttTransmissionResult *result;
 
-  bool *finished;
-  size_t bufferSize;
+  size_t totalPackets;
 };
 
-namespace Record
+// Static sender task, created on the first recording and parked between
+// recordings like the capture task, so recordings never touch the heap.
+struct MqttSender
 {
-#define __assertMqttReady                                               \
-  if (!mqtt.client)                                                     \
-  {                                                                     \
-    ESP_LOGI(TAG, "MQTT client is not initialized, please setup mqtt"); \
-    RecorderResult result{RecorderCode::MQTT_NOT_READY};                \
-    return result;                                                      \
-  }
+  TaskHandle_t task = nullptr;
+  SemaphoreHandle_t finished = nullptr;
+  MqttSenderTaskContext *context = nullptr;
+
+  StaticSemaphore_t finishedBuffer;
+  StaticTask_t taskBuffer;
+  StackType_t stack[RECORDER_SENDER_STACK];
+};
 
-  void normalizeSamples(const int32_t *data, const size_t dataSize, uint8_t *dest, NormalizationCallback cb)
+static MqttSender sender;
+
+// Sender half of the pipeline, pinned to RECORDER_SENDER_CORE so a publish
+// blocking on TCP never delays the next i2s_read on the capture core.
+static void mqttSenderTask(void *arg)
+{
+  for (;;)
   {
-    size_t actualBufferSize = RECORDER_BUFFER_SIZE * AudioConfig::validBytesPerSample / AudioConfig::bytesPerSample;
-    size_t bytesWritten = 0;
-    size_t loops = RECORDER_BUFFER_SIZE / AudioConfig::bytesPerSample;
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    auto context = sender.context;
+    size_t packetNumber = 0;
 
-    for (size_t i = 0; i < loops; i++)
+    AudioFragment *fragment;
+    while (context->pipeline->receive(fragment, portMAX_DELAY) && fragment != nullptr)
     {
-      auto sample = data[i];
-      if (AudioConfig::isLeftJustified)
-        sample = sample >> 8;
-      if (cb)
-        cb(sample);
-
-      auto v = reinterpret_cast<uint8_t *>(&sample);
-      dest[bytesWritten++] = v[0];
-      dest[bytesWritten++] = v[1];
-      dest[bytesWritten++] = v[2];
+      // Holding the fragment through a reconnect leaves capture running, it
+      // queues up in the pipeline and counts a gap once the pool runs dry.
+      auto res = streamFragment(*context->mqtt, context->topic, fragment, false,
+                                pdMS_TO_TICKS(RECORDER_LINK_HOLD_MS));
+      context->pipeline->release(fragment);
+
+      if (res != 0)
+      {
+        ESP_LOGE(TAG, "Fail to send packet with res: %d", res);
+        context->result->code = res;
+        context->result->packetNumber = packetNumber;
+      }
+      else
+      {
+        ESP_LOGI(TAG, "Fragment packet (%d/%d) sent", packetNumber + 1, context->totalPackets);
+      }
+
+      packetNumber++;
     }
+
+    xSemaphoreGive(sender.finished);
   }
+}
 
-  RecorderResult start(Recorder &recorder, Mqtt &mqtt, uint8_t blinkingPin)
+// Hands `context` to the sender task, creating it on first use.
+static bool startSender(MqttSenderTaskContext *context)
+{
+  if (!sender.task)
+  {
+    sender.finished = xSemaphoreCreateBinaryStatic(&sender.finishedBuffer);
+    sender.task = xTaskCreateStaticPinnedToCore(
+        mqttSenderTask, "mqtt_sender", RECORDER_SENDER_STACK, nullptr,
+        RECORDER_SENDER_PRIORITY, sender.stack, &sender.taskBuffer, RECORDER_SENDER_CORE);
+    if (!sender.task)
+      return false;
+    Metrics::watch(sender.task);
+  }
+
+  sender.context = context;
+  xTaskNotifyGive(sender.task);
+  return true;
+}
+
+static void logPipelineStats(const char *label)
+{
+  auto stats = pipeline.stats();
+  ESP_LOGI(TAG, "%s pipeline: captured %u, dropped %u, read errors %u, overruns %u (%u frames lost), queue high-water %u/%d",
+           label, stats.captured, stats.dropped, stats.readErrors, stats.overruns, stats.lostFrames,
+           stats.queueHighWater, RECORDER_PIPELINE_DEPTH);
+}
+
+namespace Record
+{
+#define __assertMqttReady                                                    \
+  if (!mqtt.isConnected() && !SessionSpool::available())                     \
+  {                                                                          \
+    ESP_LOGI(TAG, "MQTT link is down and the spool is full, not recording"); \
+    RecorderResult result{RecorderCode::MQTT_NOT_READY};                     \
+    return result;                                                           \
+  }
+
+  RecorderResult start(Recorder &recorder, Mqtt &mqtt, uint8_t blinkingPin, AudioCodec codec)
   {
     RecorderResult result{RecorderCode::OK};
     __assertMqttReady;
 
-    bool finished = false;
     MqttTransmissionResult mqttResult{0, 0};
 
     size_t actualBufferSize = RECORDER_BUFFER_SIZE * AudioConfig::validBytesPerSample / AudioConfig::bytesPerSample;
@@ -76,8 +316,9 @@ namespace Record
     ESP_LOGI(TAG, "Free heap: %d, actual size: %d, buffer size: %d", xPortGetFreeHeapSize(), actualSize, actualBufferSize);
 
     uint8_t header[44];
-    recorder.writeWavHeader(header, actualSize);
-    auto res = mqtt.publishFragmentBody(MqttTopic::RECORDER, header, 44);
+    size_t headerSize = writeStreamHeader(recorder, codec, header, actualSize);
+    auto res = deliver(0, [&]
+                       { return mqtt.publishFragmentBody(MqttTopic::RECORDER, header, headerSize); });
     if (res != ESP_OK)
     {
       mqttResult.code = res;
@@ -86,38 +327,38 @@ namespace Record
       result.mqttError.emplace(mqttResult);
     }
 
-    RemoteXY_Handler();
+    Ui::commit();
 
-    auto lastHandle = millis();
-    size_t packetNumber = 0;
+    sessionQuality.reset();
+    pipeline.resetStats();
+    auto pipelineCode = pipeline.begin(recorder, totalPackets, codec);
+    if (pipelineCode != RecorderCode::OK)
+    {
+      result.code = pipelineCode;
+      return result;
+    }
+
+    MqttSenderTaskContext context{&pipeline, &mqtt, MqttTopic::RECORDER, &mqttResult, totalPackets};
+    if (!startSender(&context))
+    {
+      ESP_LOGE(TAG, "Failed to create MQTT sender task");
+      pipeline.end();
+      result.code = RecorderCode::AUDIO_QUEUE_ALLOC_FAILED;
+      return result;
+    }
+
+    // Both halves run on their own tasks (and the UI on its own), this one
+    // blinks and polls the client, so the server's NACKs are served while
+    // the session is still going out. A dropped connection is left to the
+    // sender, which hands it back to the link.
     auto blink = createBlinker(blinkingPin);
-    recorder.readFor(
-        RECORDER_DURATION,
-        RECORDER_BUFFER_SIZE,
-        [blink, actualBufferSize, &mqtt, &mqttResult, &packetNumber, totalPackets, &lastHandle](const int32_t *data)
-        {
-          blink(0);
-          timedFor(lastHandle, 1000, {
-            RemoteXY_Handler();
-          });
-
-          uint8_t buf[actualBufferSize];
-          normalizeSamples(data, RECORDER_BUFFER_SIZE, buf);
-
-          auto res = mqtt.publishFragmentBody(MqttTopic::RECORDER, buf, actualBufferSize);
-          if (res != 0)
-          {
-            ESP_LOGE(TAG, "Fail to send packet with res: %d", res);
-            mqttResult.code = res;
-            mqttResult.packetNumber = packetNumber;
-          }
-          else
-          {
-            ESP_LOGI(TAG, "Fragment packet (%d/%d) sent", packetNumber + 1, totalPackets);
-          }
-
-          packetNumber++;
-        });
+    while (xSemaphoreTake(sender.finished, pdMS_TO_TICKS(50)) != pdTRUE)
+    {
+      blink(0);
+      mqtt.poll();
+    }
+    pipeline.end();
+    logPipelineStats("Recording");
 
     blink(1);
 
@@ -132,7 +373,7 @@ namespace Record
 #define __returnMqttError(mqttCode, status)                                 \
   if (res != ESP_OK)                                                        \
   {                                                                         \
-    RemoteXY.led_recorder = LOW;                                            \
+    Ui::state().led_recorder = LOW;                                         \
     ESP_LOGE(TAG, "Fail to transmit MQTT packet with error: %d", mqttCode); \
     sprintf(status, "MQTT Transmission Error: %d", res);                    \
     RecorderResult result{RecorderCode::MQTT_TRANSMISSION_FAILED};          \
@@ -145,14 +386,16 @@ namespace Record
   {
     __assertMqttReady;
 
-    RemoteXY.led_recorder = HIGH;
-    sprintf(RemoteXY.value_recorder_status, "Recording...");
-    RemoteXY_Handler();
+    Ui::state().led_recorder = HIGH;
+    sprintf(Ui::state().value_recorder_status, "Recording...");
+    Ui::commit();
 
-    auto res = mqtt.publishFragmentHeader(MqttTopic::RECORDER, MqttHeader::VERIFY);
-    __returnMqttError(res, RemoteXY.value_recorder_status);
+    auto codec = AudioCodec::RECORDER_STREAM_CODEC;
+    auto res = deliver(0, [&]
+                       { return mqtt.publishFragmentHeader(MqttTopic::RECORDER, MqttHeader::VERIFY, audioCodecName(codec)); });
+    __returnMqttError(res, Ui::state().value_recorder_status);
 
-    auto recordingResult = start(recorder, mqtt, blinkingPin);
+    auto recordingResult = start(recorder, mqtt, blinkingPin, codec);
     if (recordingResult.code != RecorderCode::OK)
     {
       if (recordingResult.code == RecorderCode::MQTT_TRANSMISSION_FAILED && recordingResult.mqttError.has_value())
@@ -163,7 +406,7 @@ namespace Record
             recordingResult.mqttError->code,
             recordingResult.mqttError->packetNumber);
         sprintf(
-            RemoteXY.value_recorder_status,
+            Ui::state().value_recorder_status,
             "MQTT Transmission error: %d - %d",
             recordingResult.mqttError->code,
             recordingResult.mqttError->packetNumber);
@@ -172,16 +415,24 @@ namespace Record
       else
       {
         ESP_LOGE(TAG, "Fail when recording with error code: %d", recordingResult.code);
-        sprintf(RemoteXY.value_recorder_status, "Recording error: %d", recordingResult.code);
+        sprintf(Ui::state().value_recorder_status, "Recording error: %d", recordingResult.code);
       }
     }
 
-    res = mqtt.publishFragmentTrailer(MqttTopic::RECORDER);
-    __returnMqttError(res, RemoteXY.value_recorder_status);
+    Quality::Score score;
+    res = publishSessionEnd(mqtt, score);
+    __returnMqttError(res, Ui::state().value_recorder_status);
 
-    RemoteXY.led_recorder = LOW;
-    sprintf(RemoteXY.value_recorder_status, "Recording complete");
-    RemoteXY_Handler();
+    Ui::state().led_recorder = LOW;
+    auto code = sessionCode(score);
+    if (code != RecorderCode::OK)
+    {
+      sprintf(Ui::state().value_recorder_status, "Recording rejected: %s", qualityReason(score.flags));
+      Ui::commit();
+      return RecorderResult{code};
+    }
+    sprintf(Ui::state().value_recorder_status, SessionSpool::spooled() ? "Recording spooled" : "Recording complete");
+    Ui::commit();
 
     return RecorderResult{RecorderCode::OK};
   };
@@ -191,17 +442,20 @@ namespace Record
   {
     __assertMqttReady;
 
-    RemoteXY.led_sampler = HIGH;
-    sprintf(RemoteXY.value_sampler_status, "Recording...");
-    RemoteXY_Handler();
+    Ui::state().led_sampler = HIGH;
+    sprintf(Ui::state().value_sampler_status, "Recording...");
+    Ui::commit();
 
-    auto res = mqtt.publishFragmentHeader(MqttTopic::RECORDER, MqttHeader::SAMPLE);
-    __returnMqttError(res, RemoteXY.value_sampler_status);
+    auto codec = AudioCodec::RECORDER_SAMPLE_CODEC;
+    auto res = deliver(0, [&]
+                       { return mqtt.publishFragmentHeader(MqttTopic::RECORDER, MqttHeader::SAMPLE, audioCodecName(codec)); });
+    __returnMqttError(res, Ui::state().value_sampler_status);
 
-    res = mqtt.publishFragmentBody(MqttTopic::RECORDER, reinterpret_cast<const uint8_t *>(sampleName), std::strlen(sampleName) + 1);
-    __returnMqttError(res, RemoteXY.value_sampler_status);
+    res = deliver(0, [&]
+                  { return mqtt.publishFragmentBody(MqttTopic::RECORDER, reinterpret_cast<const uint8_t *>(sampleName), std::strlen(sampleName) + 1); });
+    __returnMqttError(res, Ui::state().value_sampler_status);
 
-    auto recordingResult = start(recorder, mqtt, blinkingPin);
+    auto recordingResult = start(recorder, mqtt, blinkingPin, codec);
     if (recordingResult.code != RecorderCode::OK)
     {
       if (recordingResult.code == RecorderCode::MQTT_TRANSMISSION_FAILED && recordingResult.mqttError.has_value())
@@ -212,7 +466,7 @@ namespace Record
             recordingResult.mqttError->code,
             recordingResult.mqttError->packetNumber);
         sprintf(
-            RemoteXY.value_sampler_status,
+            Ui::state().value_sampler_status,
             "MQTT Transmission error: %d - %d",
             recordingResult.mqttError->code,
             recordingResult.mqttError->packetNumber);
@@ -221,77 +475,162 @@ namespace Record
       else
       {
         ESP_LOGE(TAG, "Fail when recording with error code: %d", recordingResult.code);
-        sprintf(RemoteXY.value_sampler_status, "Recording error: %d", recordingResult.code);
+        sprintf(Ui::state().value_sampler_status, "Recording error: %d", recordingResult.code);
       }
     }
 
-    res = mqtt.publishFragmentTrailer(MqttTopic::RECORDER);
-    __returnMqttError(res, RemoteXY.value_sampler_status);
+    Quality::Score score;
+    res = publishSessionEnd(mqtt, score);
+    __returnMqttError(res, Ui::state().value_sampler_status);
 
-    RemoteXY.led_sampler = LOW;
-    sprintf(RemoteXY.value_sampler_status, "Recording complete");
-    RemoteXY_Handler();
+    Ui::state().led_sampler = LOW;
+    auto code = sessionCode(score);
+    if (code != RecorderCode::OK)
+    {
+      sprintf(Ui::state().value_sampler_status, "Recording rejected: %s", qualityReason(score.flags));
+      Ui::commit();
+      return RecorderResult{code};
+    }
+    sprintf(Ui::state().value_sampler_status, SessionSpool::spooled() ? "Recording spooled" : "Recording complete");
+    Ui::commit();
 
     return RecorderResult{RecorderCode::OK};
   };
 
-  RecorderResult poll(
-      Recorder &recorder, Mqtt &mqtt,
-      int32_t *buffer, size_t &bytesRead,
-      u_long &lastPeakHit, u_long &lastRecordingStart,
+  static RecorderResult processFragment(
+      Mqtt &mqtt, Recorder &recorder, const AudioFragment *fragment,
+      u_long &lastRecordingStart,
       bool &isRecording,
       uint8_t indicatorPin)
   {
-    recorder.read(buffer, RECORDER_BUFFER_SIZE, &bytesRead);
-    int32_t peakAmplitude = 0;
-    Record::normalizeSamples(
-        buffer, RECORDER_BUFFER_SIZE, reinterpret_cast<uint8_t *>(buffer),
-        [&peakAmplitude](int32_t sample)
-        {
-          int32_t absolute = abs(sample);
-          if (absolute > peakAmplitude)
-          {
-            peakAmplitude = absolute;
-          }
-        });
-
-    auto normalizedPeakAmplitude = (float)peakAmplitude / (float)0x7FFFFF;
-    RemoteXY.recorder_peak_graph = normalizedPeakAmplitude;
-    if (normalizedPeakAmplitude >= RECORDER_AMP_THRESHOLD)
-      lastPeakHit = millis();
-    bool shouldSendRecording = millis() - lastPeakHit < RECORDER_TIME_OFFSET && (isRecording == false ||
-                                                                                 millis() - lastRecordingStart < RECORDER_MAX_RECORD_TIME);
+    auto normalizedPeakAmplitude = (float)fragment->peak / (float)0x7FFFFF;
+    Ui::state().recorder_peak_graph = normalizedPeakAmplitude;
+    if (!isRecording)
+      speakerObserve(fragment);
+    if (!fragment->voiced)
+      screenedOut = false;
+
+    // The VAD already applies onset and hangover, see dsp/vad.h
+    bool keyword = isRecording || keywordAccepted(fragment);
+    bool shouldSendRecording = fragment->voiced && keyword && !screenedOut &&
+                               (isRecording == false || millis() - lastRecordingStart < RECORDER_MAX_RECORD_TIME);
+
+    SpeakerMatch speaker{SpeakerVerdict::UNSURE, 0.0f, nullptr};
+    if (isRecording == false && shouldSendRecording == true)
+    {
+      speaker = screenSpeaker();
+      if (speaker.verdict == SpeakerVerdict::REJECT)
+      {
+        ESP_LOGI(TAG, "Speaker pre-screen dropped voice, closest '%s' (%.2f)", speaker.name, speaker.similarity);
+        screenedOut = true;
+        shouldSendRecording = false;
+#if RECORDER_KWS
+        keywordGate.reset();
+#endif
+      }
+    }
 
     if (isRecording == false && shouldSendRecording == true)
     {
       lastRecordingStart = millis();
       isRecording = true;
       digitalWrite(indicatorPin, HIGH);
-      auto res = mqtt.publishFragmentHeader(MqttTopic::RECORDER, MqttHeader::VERIFY);
-      __returnMqttError(res, RemoteXY.value_sampler_status);
+      pipeline.resetStats();
+      sessionQuality.reset();
+      auto flag = speaker.verdict == SpeakerVerdict::PRIORITY ? MqttHeaderFlag::PRIORITY : nullptr;
+      auto res = deliver(0, [&]
+                         { return mqtt.publishFragmentHeader(MqttTopic::RECORDER, MqttHeader::VERIFY, audioCodecName(AudioCodec::RECORDER_STREAM_CODEC), flag); });
+      __returnMqttError(res, Ui::state().value_sampler_status);
 
       uint8_t header[44];
-      recorder.writeWavHeader(header, 0);
-      res = mqtt.publishFragmentBody(MqttTopic::RECORDER, header, 44);
-      __returnMqttError(res, RemoteXY.value_sampler_status);
+      size_t headerSize = writeStreamHeader(recorder, AudioCodec::RECORDER_STREAM_CODEC, header, 0);
+      res = deliver(0, [&]
+                    { return mqtt.publishFragmentBody(MqttTopic::RECORDER, header, headerSize); });
+      __returnMqttError(res, Ui::state().value_sampler_status);
+
+      // Speech onset: the buffers right before the trigger, then the trigger itself.
+      for (size_t i = 0; i < preroll.size(); i++)
+      {
+        res = streamFragment(mqtt, MqttTopic::RECORDER, &preroll.at(i), i == 0);
+        __returnMqttError(res, Ui::state().value_sampler_status);
+      }
+
+      bool opening = preroll.size() == 0;
+      preroll.clear();
+
+      res = streamFragment(mqtt, MqttTopic::RECORDER, fragment, opening);
+      __returnMqttError(res, Ui::state().value_sampler_status);
     }
     else if (isRecording == true && shouldSendRecording == false)
     {
       isRecording = false;
       digitalWrite(indicatorPin, LOW);
-      auto res = mqtt.publishFragmentTrailer(MqttTopic::RECORDER);
-      __returnMqttError(res, RemoteXY.value_sampler_status);
+#if RECORDER_KWS
+      keywordGate.reset();
+#endif
+      Quality::Score score;
+      auto res = publishSessionEnd(mqtt, score);
+      logPipelineStats("Realtime");
+      __returnMqttError(res, Ui::state().value_sampler_status);
+      return RecorderResult{sessionCode(score)};
     }
     else if (isRecording)
     {
-      RemoteXY.led_recorder = HIGH;
-      auto res = mqtt.publishFragmentBody(MqttTopic::RECORDER, reinterpret_cast<const uint8_t *>(buffer), RECORDER_ACTUAL_BUFFER_SIZE);
-      __returnMqttError(res, RemoteXY.value_sampler_status);
+      Ui::state().led_recorder = HIGH;
+      auto res = streamFragment(mqtt, MqttTopic::RECORDER, fragment);
+      __returnMqttError(res, Ui::state().value_sampler_status);
     }
     else
     {
-      RemoteXY.led_recorder = LOW;
+      Ui::state().led_recorder = LOW;
+      preroll.push(fragment);
+    }
+    return RecorderResult{RecorderCode::OK};
+  }
+
+  void updateSpeakerTemplates(const uint8_t *payload, size_t size)
+  {
+#if RECORDER_SPEAKER_SCREEN
+    speakerScreen.setTemplates(payload, size);
+#endif
+  }
+
+  RecorderResult poll(
+      Recorder &recorder, Mqtt &mqtt,
+      u_long &lastRecordingStart,
+      bool &isRecording,
+      uint8_t indicatorPin)
+  {
+    if (!pipeline.isRunning())
+    {
+#if RECORDER_KWS
+      keywordGate.begin(modelArena);
+#endif
+#if RECORDER_SPEAKER_SCREEN
+      speakerScreen.begin(modelArena);
+#endif
+#if RECORDER_FEATURES
+      ESP_LOGI(TAG, "Model arena: %u/%u bytes used, %u failed allocations",
+               modelArena.used(), modelArena.capacity(), modelArena.failures());
+#endif
+      auto code = pipeline.begin(recorder, 0, AudioCodec::RECORDER_STREAM_CODEC);
+      if (code != RecorderCode::OK)
+        return RecorderResult{code};
     }
+
+    // Wait for at most a couple of DMA buffers, then drain whatever the
+    // capture task queued while we were busy with the UI or the network.
+    AudioFragment *fragment;
+    TickType_t timeout = pdMS_TO_TICKS(2 * 1000 * RECORDER_BUFFER_SIZE / AudioConfig::bytesPerSample / RECORDER_SAMPLE_RATE);
+    while (pipeline.receive(fragment, timeout))
+    {
+      timeout = 0;
+      auto result = processFragment(mqtt, recorder, fragment, lastRecordingStart, isRecording, indicatorPin);
+      pipeline.release(fragment);
+      if (result.code != RecorderCode::OK)
+        return result;
+    }
+
     return RecorderResult{RecorderCode::OK};
   }
 
@@ -2,6 +2,7 @@
 
 #include "core/audio.h"
 #include "core/mqtt.h"
+#include "core/pack.h"
 #include <optional>
 
 #ifndef RECORDER_SAMPLE_RATE
@@ -12,20 +13,33 @@
 #define RECORDER_BUFFER_SIZE 512
 #endif
 
-#ifndef RECORDER_AMP_THRESHOLD
-#define RECORDER_AMP_THRESHOLD 0.005
+#ifndef RECORDER_MAX_RECORD_TIME
+#define RECORDER_MAX_RECORD_TIME 4000 // ms
 #endif
 
-#ifndef RECORDER_TIME_OFFSET
-#define RECORDER_TIME_OFFSET 500 // ms
+#ifndef RECORDER_PREROLL_MS
+#define RECORDER_PREROLL_MS 300 // audio kept from before the trigger, 0 to disable
 #endif
 
-#ifndef RECORDER_MAX_RECORD_TIME
-#define RECORDER_MAX_RECORD_TIME 4000 // ms
+#ifndef RECORDER_STREAM_CODEC
+#define RECORDER_STREAM_CODEC PCM // PCM, IMA_ADPCM, LOSSLESS or MEL, see AudioCodec
+#endif
+
+#ifndef RECORDER_SAMPLE_CODEC
+#define RECORDER_SAMPLE_CODEC PCM // codec of enrollment (sample) sessions
 #endif
 
 #define RECORDER_ACTUAL_BUFFER_SIZE RECORDER_BUFFER_SIZE *AudioConfig::validBytesPerSample / AudioConfig::bytesPerSample
 
+// Payload codec of a recording session, announced in the fragment header.
+enum class AudioCodec
+{
+  PCM,
+  IMA_ADPCM,
+  LOSSLESS,
+  MEL // log-mel features instead of audio, see dsp/mel.h
+};
+
 struct MqttTransmissionResult
 {
   size_t packetNumber;
@@ -37,7 +51,9 @@ enum class RecorderCode
   OK,
   MQTT_NOT_READY,
   AUDIO_QUEUE_ALLOC_FAILED,
-  MQTT_TRANSMISSION_FAILED
+  MQTT_TRANSMISSION_FAILED,
+  QUALITY_REJECTED, // cancelled by the quality gate, see dsp/quality.h
+  AUDIO_OVERRUN     // more than RECORDER_QUALITY_MAX_LOST_MS of audio was lost
 };
 
 struct RecorderResult
@@ -46,19 +62,28 @@ struct RecorderResult
   std::optional<MqttTransmissionResult> mqttError;
 };
 
-using NormalizationCallback = std::function<void(int32_t sample)>;
-
 namespace Record
 {
 #if USE_REALTIME_RECORDING == 0
   RecorderResult verify(Recorder &recorder, Mqtt &mqtt, uint8_t blinkingPin);
 #endif
   RecorderResult sample(Recorder &recorder, Mqtt &mqtt, uint8_t blinkingPin, const char *sampleName);
-  void normalizeSamples(const int32_t *data, const size_t dataSize, uint8_t *dest, NormalizationCallback cb = nullptr);
+
+  // Packs `dataSize` bytes of raw I2S words into `dest`, feeding every
+  // normalized sample to `detector`. Returns the number of bytes written.
+  template <typename Detector = Pack::NullDetector>
+  size_t normalizeSamples(const int32_t *data, const size_t dataSize, uint8_t *dest, Detector &&detector = Detector())
+  {
+    return Pack::packSamples<AudioConfig::OutputFormat, AudioConfig::InputFormat>(
+        data, dataSize / sizeof(int32_t), dest, detector);
+  }
+
+  // Replaces the speaker pre-screen templates, see core/speaker.h.
+  void updateSpeakerTemplates(const uint8_t *payload, size_t size);
+
   RecorderResult poll(
       Recorder &recorder, Mqtt &mqtt,
-      int32_t *buffer, size_t &bytesRead,
-      u_long &lastPeakHit, u_long &lastRecordingStart,
+      u_long &lastRecordingStart,
       bool &isRecording,
       uint8_t indicatorPin);
 }
\ No newline at end of file
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#ifndef MQTT_RESEND_SLOTS
+#define MQTT_RESEND_SLOTS 8 // latest session messages kept for the server's NACKs, 0 keeps none
+#endif
+
+#ifndef MQTT_NACK_MAX
+#define MQTT_NACK_MAX 16 // sequences one NACK may ask for, the rest are ignored
+#endif
+
+// One session message as it went out.
+struct SentFragment
+{
+  const char *topic; // static, one of MqttTopic
+  char type[4];      // MqttMessageType
+  uint32_t session;
+  uint32_t sequence;
+  uint16_t size;
+};
+
+// The latest `Slots` sequenced messages, for selective retransmission.
+//
+// Every session message carries its sequence number (see mqtt/frame.h). The
+// server asks again for the ones it missed, and they are found here by
+// session and sequence. Messages larger than `SlotSize` are not kept, and
+// the oldest slot is overwritten first, so a NACK that comes too late finds
+// nothing and the server gives the session up.
+//
+// No I/O and no lock, the owner holds its send lock around every call.
+template <size_t Slots, size_t SlotSize>
+class ResendRing
+{
+public:
+  static constexpr size_t slots = Slots;
+
+  void keep(const char *topic, const char *type, uint32_t session, uint32_t sequence,
+            const uint8_t *payload, size_t size)
+  {
+    if (Slots == 0 || !topic || size > SlotSize)
+      return;
+
+    Slot &slot = ring[next];
+    next = (next + 1) % capacity;
+    if (count_ < capacity)
+      count_++;
+
+    slot.fragment.topic = topic;
+    memcpy(slot.fragment.type, type, 4);
+    slot.fragment.session = session;
+    slot.fragment.sequence = sequence;
+    slot.fragment.size = static_cast<uint16_t>(size);
+    if (size != 0)
+      memcpy(slot.payload, payload, size);
+  }
+
+  // The kept message, nullptr when it was never kept or was overwritten.
+  // `payload` points into the ring until the next keep().
+  const SentFragment *find(uint32_t session, uint32_t sequence, const uint8_t *&payload) const
+  {
+    for (size_t i = 0; i < count_; i++)
+    {
+      const Slot &slot = ring[i];
+      if (slot.fragment.session == session && slot.fragment.sequence == sequence)
+      {
+        payload = slot.payload;
+        return &slot.fragment;
+      }
+    }
+    return nullptr;
+  }
+
+  size_t count() const { return count_; }
+
+private:
+  static constexpr size_t capacity = Slots ? Slots : 1;
+  static_assert(SlotSize <= 0xFFFF, "Resent messages carry a 16-bit size");
+
+  struct Slot
+  {
+    SentFragment fragment;
+    uint8_t payload[SlotSize];
+  };
+
+  Slot ring[capacity];
+  size_t next = 0;
+  size_t count_ = 0;
+};
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+// Double-buffered snapshot of a trivially copyable T, for one writer and one
+// reader that must never wait on each other.
+//
+// The writer fills the back buffer and publishes it with a single atomic
+// store of (generation << 1 | index). The reader copies the front buffer and
+// retries when a publish happened meanwhile, since the writer may then be
+// refilling the buffer it was copying.
+template <typename T>
+class Snapshot
+{
+public:
+  void publish(const T &value)
+  {
+    uint32_t current = state.load(std::memory_order_relaxed);
+    uint32_t back = (current & 1) ^ 1;
+    buffers[back] = value;
+    state.store((((current >> 1) + 1) << 1) | back, std::memory_order_release);
+  }
+
+  // Copies the latest value into `out` if it was published after `seen`
+  // (0 before the first read), returns false and leaves `out` alone if not.
+  bool read(T &out, uint32_t &seen) const
+  {
+    for (;;)
+    {
+      uint32_t before = state.load(std::memory_order_acquire);
+      if (before == seen)
+        return false;
+
+      out = buffers[before & 1];
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (state.load(std::memory_order_relaxed) == before)
+      {
+        seen = before;
+        return true;
+      }
+    }
+  }
+
+private:
+  T buffers[2] = {};
+  std::atomic<uint32_t> state{0};
+};
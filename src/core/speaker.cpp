@@ -0,0 +1,164 @@
+#include "core/speaker.h"
+#include "core/filesystem.h"
+#include "core/utils.h"
+
+#include <Arduino.h>
+#include <cstring>
+
+createTag(SPEAKER);
+
+bool SpeakerScreen::begin(Arena &memory, const char *path)
+{
+  if (ready)
+    return true;
+
+  long size = FileSystem::size(path);
+  if (size <= 0)
+  {
+    ESP_LOGW(TAG, "No speaker model at %s, speaker pre-screen disabled", path);
+    return false;
+  }
+
+  size_t mark = memory.mark();
+  blob = memory.allocate<uint8_t>(size);
+  if (!blob)
+  {
+    ESP_LOGE(TAG, "Speaker model (%ld bytes) does not fit the model arena (%u/%u used)", size, memory.used(), memory.capacity());
+    return false;
+  }
+
+  if (!FileSystem::load(path, blob, size) || !model.parse(blob, size))
+  {
+    ESP_LOGE(TAG, "Invalid speaker model at %s, speaker pre-screen disabled", path);
+    memory.rewind(mark);
+    return false;
+  }
+
+  const Nn::Shape &input = model.input();
+  if (input.width != Mel::bins || input.channels != 1 || model.outputSize() > RECORDER_SPEAKER_MAX_DIMS)
+  {
+    ESP_LOGE(TAG, "Speaker model expects %u bins and outputs %u dims, features have %u bins and templates %u dims",
+             input.width, model.outputSize(), Mel::bins, RECORDER_SPEAKER_MAX_DIMS);
+    memory.rewind(mark);
+    return false;
+  }
+
+  arena = memory.allocate<int8_t>(input.size() + 2 * model.arenaSize());
+  if (!arena || !window.begin(memory, input.height))
+  {
+    ESP_LOGE(TAG, "Speaker model activations do not fit the model arena (%u/%u used)", memory.used(), memory.capacity());
+    memory.rewind(mark);
+    return false;
+  }
+
+  ESP_LOGI(TAG, "Speaker model loaded: %u frames, %u dims, arena %u",
+           window.size(), model.outputSize(), model.arenaSize());
+  if (count > 0 && dims != model.outputSize())
+    ESP_LOGW(TAG, "Speaker templates have %u dims, model outputs %u", dims, model.outputSize());
+
+  ready = true;
+  return true;
+}
+
+bool SpeakerScreen::setTemplates(const uint8_t *payload, size_t size)
+{
+  if (size < 3)
+  {
+    ESP_LOGW(TAG, "Speaker templates message is too short: %u", size);
+    return false;
+  }
+
+  size_t templateCount = payload[0];
+  size_t templateDims = payload[1] | (payload[2] << 8);
+  if (templateCount > RECORDER_SPEAKER_MAX_TEMPLATES || templateDims > RECORDER_SPEAKER_MAX_DIMS)
+  {
+    ESP_LOGE(TAG, "Too many speaker templates: %u x %u dims, at most %d x %d",
+             templateCount, templateDims, RECORDER_SPEAKER_MAX_TEMPLATES, RECORDER_SPEAKER_MAX_DIMS);
+    return false;
+  }
+
+  // Validate everything first, a malformed message keeps the old templates.
+  size_t index = 3;
+  for (size_t t = 0; t < templateCount; t++)
+  {
+    if (index >= size || index + 1 + payload[index] + templateDims > size)
+    {
+      ESP_LOGE(TAG, "Speaker templates message is truncated at template %u", t);
+      return false;
+    }
+    index += 1 + payload[index] + templateDims;
+  }
+
+  index = 3;
+  for (size_t t = 0; t < templateCount; t++)
+  {
+    size_t nameLength = payload[index++];
+    size_t copied = nameLength < maxNameLength ? nameLength : maxNameLength;
+    memcpy(names[t], payload + index, copied);
+    names[t][copied] = '\0';
+    index += nameLength;
+
+    memcpy(templates[t], payload + index, templateDims);
+    norms[t] = Speaker::norm(templates[t], templateDims);
+    index += templateDims;
+  }
+
+  count = templateCount;
+  dims = templateDims;
+  ESP_LOGI(TAG, "Received %u speaker templates of %u dims", count, dims);
+  if (ready && count > 0 && dims != model.outputSize())
+    ESP_LOGW(TAG, "Speaker templates have %u dims, model outputs %u", dims, model.outputSize());
+  return true;
+}
+
+void SpeakerScreen::push(const uint8_t *block, size_t size)
+{
+  if (ready)
+    window.push(block, size);
+}
+
+SpeakerMatch SpeakerScreen::screen()
+{
+  SpeakerMatch match{SpeakerVerdict::UNSURE, 0.0f, nullptr};
+  if (!enabled() || !window.full())
+    return match;
+
+  window.take(arena, model.inputZero());
+
+  int8_t *activations = arena + model.input().size();
+  auto start = micros();
+  const int8_t *embedding = model.run(arena, activations, activations + model.arenaSize());
+  float embeddingNorm = Speaker::norm(embedding, dims);
+
+  size_t best = count;
+  float bestSimilarity = -1.0f;
+  for (size_t t = 0; t < count && embeddingNorm > 0.0f; t++)
+  {
+    if (norms[t] == 0.0f)
+      continue;
+
+    float similarity = Speaker::similarity(embedding, embeddingNorm, templates[t], norms[t], dims);
+    if (similarity > bestSimilarity)
+    {
+      best = t;
+      bestSimilarity = similarity;
+    }
+  }
+  auto elapsed = micros() - start;
+
+  if (best == count)
+  {
+    ESP_LOGD(TAG, "Silent speaker embedding in %lu us", elapsed);
+    return match;
+  }
+
+  match.similarity = bestSimilarity;
+  match.name = names[best];
+  if (bestSimilarity < RECORDER_SPEAKER_REJECT)
+    match.verdict = SpeakerVerdict::REJECT;
+  else if (bestSimilarity >= RECORDER_SPEAKER_PRIORITY)
+    match.verdict = SpeakerVerdict::PRIORITY;
+
+  ESP_LOGI(TAG, "Closest speaker '%s' (%.2f) in %lu us", match.name, match.similarity, elapsed);
+  return match;
+}
@@ -0,0 +1,123 @@
+#pragma once
+
+#include "core/features.h"
+
+#include "dsp/nn.h"
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+
+#ifndef RECORDER_SPEAKER_SCREEN
+#define RECORDER_SPEAKER_SCREEN 0 // 1 to pre-screen voices against enrolled speaker templates
+#endif
+
+#ifndef RECORDER_SPEAKER_MODEL_PATH
+#define RECORDER_SPEAKER_MODEL_PATH "/spiffs/speaker.bin"
+#endif
+
+#ifndef RECORDER_SPEAKER_REJECT
+#define RECORDER_SPEAKER_REJECT 0.3 // best cosine similarity below this drops the voice on the device
+#endif
+
+#ifndef RECORDER_SPEAKER_PRIORITY
+#define RECORDER_SPEAKER_PRIORITY 0.75 // similarity that flags the stream as a priority
+#endif
+
+#ifndef RECORDER_SPEAKER_MAX_TEMPLATES
+#define RECORDER_SPEAKER_MAX_TEMPLATES 8
+#endif
+
+#ifndef RECORDER_SPEAKER_MAX_DIMS
+#define RECORDER_SPEAKER_MAX_DIMS 128
+#endif
+
+namespace Speaker
+{
+  // L2 norm of an int8 embedding or template.
+  inline float norm(const int8_t *vector, size_t size)
+  {
+    int32_t sum = 0;
+    for (size_t i = 0; i < size; i++)
+      sum += vector[i] * vector[i];
+    return sqrtf(static_cast<float>(sum));
+  }
+
+  // Cosine similarity the screen scores an embedding with, given both
+  // (non-zero) norms.
+  inline float similarity(const int8_t *embedding, float embeddingNorm,
+                          const int8_t *reference, float referenceNorm, size_t size)
+  {
+    int32_t dot = 0;
+    for (size_t i = 0; i < size; i++)
+      dot += embedding[i] * reference[i];
+    return dot / (embeddingNorm * referenceNorm);
+  }
+}
+
+enum class SpeakerVerdict
+{
+  UNSURE,  // no decision, or not confident either way: let the server decide
+  REJECT,  // clearly none of the enrolled speakers
+  PRIORITY // confident match with an enrolled speaker
+};
+
+struct SpeakerMatch
+{
+  SpeakerVerdict verdict;
+  float similarity;
+  const char *name; // best template, nullptr without one
+};
+
+// Speaker pre-screen for realtime streams. A small embedding network
+// (Nn::Model without labels) runs over the last log-mel frames when a voice
+// opens a stream, and its output is compared with the templates the server
+// computed with the same model for every enrolled speaker.
+//
+// Templates arrive on MqttTopic::SPEAKER_TEMPLATES (retained), after the
+// stamp:
+//
+//   COUNT    | 1B
+//   DIMS     | 2B   LE, must match the model output
+//   TEMPLATE | COUNT times:
+//     NAME_LEN | 1B
+//     NAME     | NAME_LEN characters
+//     VECTOR   | DIMS int8
+//
+// Until both the model and matching templates are present every verdict is
+// UNSURE, so streams behave as without the screen. Templates are replaced
+// from the MQTT callback, which runs on the same loop task as screen().
+class SpeakerScreen
+{
+public:
+  static constexpr size_t maxNameLength = 23;
+
+  // Loads the model into `memory`, returns false (and leaves the screen disabled)
+  // on failure, giving the memory back.
+  bool begin(Arena &memory, const char *path = RECORDER_SPEAKER_MODEL_PATH);
+  bool enabled() const { return ready && count > 0 && dims == model.outputSize(); }
+
+  // Replaces the templates with a MqttTopic::SPEAKER_TEMPLATES payload.
+  // An empty template list is valid and disables the screen.
+  bool setTemplates(const uint8_t *payload, size_t size);
+
+  // Appends the frames of one Mel block to the window.
+  void push(const uint8_t *block, size_t size);
+
+  // Embeds the current window and compares it with every template.
+  SpeakerMatch screen();
+
+private:
+  Nn::Model model;
+  bool ready = false;
+
+  uint8_t *blob = nullptr;
+  int8_t *arena = nullptr; // input, then two activation buffers
+  FeatureWindow window;
+
+  size_t count = 0;
+  size_t dims = 0;
+  char names[RECORDER_SPEAKER_MAX_TEMPLATES][maxNameLength + 1];
+  int8_t templates[RECORDER_SPEAKER_MAX_TEMPLATES][RECORDER_SPEAKER_MAX_DIMS];
+  float norms[RECORDER_SPEAKER_MAX_TEMPLATES];
+};
@@ -0,0 +1,506 @@
+#include "core/spool.h"
+#include "core/config.h"
+#include "core/filesystem.h"
+#include "core/metrics.h"
+#include "core/mqtt.h"
+#include "core/utils.h"
+
+#include "mqtt/protocol.h"
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
+
+#include <Arduino.h>
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+
+#define SPOOL_PATH "/spiffs/spool%u.bin"
+#define SPOOL_PENDING_KEY "spool"
+
+createTag(SPOOL);
+
+namespace SessionSpool
+{
+  namespace
+  {
+    // One pre-allocated SPIFFS file per segment. The last file stays open,
+    // which is the one the writer appends to for a whole session.
+    struct SpiffsFlash
+    {
+      FILE *file = nullptr;
+      size_t fileSegment = 0;
+
+      static void pathOf(size_t segment, char *path, size_t size)
+      {
+        snprintf(path, size, SPOOL_PATH, static_cast<unsigned>(segment));
+      }
+
+      FILE *open(size_t segment)
+      {
+        if (file && fileSegment == segment)
+          return file;
+        if (file)
+          fclose(file);
+
+        char path[32];
+        pathOf(segment, path, sizeof(path));
+        file = fopen(path, "r+b");
+        fileSegment = segment;
+        if (!file)
+          ESP_LOGE(TAG, "Failed to open %s", path);
+        return file;
+      }
+
+      bool prepare(size_t segment, size_t size)
+      {
+        char path[32];
+        pathOf(segment, path, sizeof(path));
+        if (FileSystem::size(path) == static_cast<long>(size))
+          return true;
+
+        ESP_LOGI(TAG, "Allocating %s (%u bytes)", path, size);
+        if (file && fileSegment == segment)
+        {
+          fclose(file);
+          file = nullptr;
+        }
+
+        FILE *created = fopen(path, "wb");
+        if (!created)
+          return false;
+
+        uint8_t zeros[256] = {};
+        size_t written = 0;
+        while (written < size)
+        {
+          size_t chunk = std::min(sizeof(zeros), size - written);
+          if (fwrite(zeros, 1, chunk, created) != chunk)
+            break;
+          written += chunk;
+        }
+        fclose(created);
+
+        if (written != size)
+        {
+          ESP_LOGE(TAG, "Not enough room on SPIFFS for %s", path);
+          remove(path);
+          return false;
+        }
+        return true;
+      }
+
+      bool read(size_t segment, size_t offset, void *dest, size_t size)
+      {
+        FILE *f = open(segment);
+        return f && fseek(f, offset, SEEK_SET) == 0 && fread(dest, 1, size, f) == size;
+      }
+
+      bool write(size_t segment, size_t offset, const void *src, size_t size)
+      {
+        FILE *f = open(segment);
+        return f && fseek(f, offset, SEEK_SET) == 0 && fwrite(src, 1, size, f) == size && fflush(f) == 0;
+      }
+    };
+
+    SpiffsFlash flash;
+    Spool<SpiffsFlash> spool(flash);
+
+    SemaphoreHandle_t lock = nullptr;
+    StaticSemaphore_t lockBuffer;
+
+    TaskHandle_t task = nullptr;
+    StaticTask_t taskBuffer;
+    StackType_t taskStack[SPOOL_STACK];
+
+    Mqtt *mqtt = nullptr;
+
+    // The spool is prepared the first time a session needs it, or at boot
+    // when the NVS flag says sealed sessions are waiting, so an ordinary
+    // boot never mounts SPIFFS for it.
+    enum class Status : uint8_t
+    {
+      STOPPED, // no drain task
+      DEFERRED,
+      READY,
+      FAILED,
+    };
+    std::atomic<Status> status{Status::STOPPED};
+    bool flagged = false; // copy of the NVS flag, lock held
+
+    // shared between the session writers and the drain task
+    std::atomic<uint32_t> liveGeneration{0};
+    std::atomic<bool> liveOpen{false};
+    std::atomic<unsigned long> lastLiveAt{0};
+
+    // Current session, written by the task publishing it (the loop and the
+    // sender take turns, never at the same time).
+    struct Session
+    {
+      const char *topic = nullptr;
+      bool diverted = false;
+      bool keeping = false; // still copying opening messages into the preamble
+      bool spooled = false;
+      size_t preambleSize = 0;
+      size_t lastKept = SIZE_MAX; // where the latest message starts in the preamble, if it is there
+      uint8_t preamble[SPOOL_PREAMBLE_SIZE];
+      // Live messages past the preamble, which the spooled session misses:
+      // the I2S frames they carried, and how many carried none.
+      uint32_t liveFrames = 0;
+      size_t opaque = 0;
+      uint32_t lastFrames = 0; // of the latest message
+    };
+
+    Session session;
+
+    // Payload of the record being replayed.
+    uint8_t replayBuffer[SPOOL_MAX_RECORD];
+
+    struct Locked
+    {
+      Locked() { xSemaphoreTake(lock, portMAX_DELAY); }
+      ~Locked() { xSemaphoreGive(lock); }
+    };
+
+    void flagPending(bool pending)
+    {
+      if (flagged == pending)
+        return;
+      uint8_t value = pending;
+      if (ConfigStore::store(SPOOL_PENDING_KEY, 1, value))
+        flagged = pending;
+    }
+
+    // Mounts SPIFFS and allocates the segments, once. Lock held.
+    bool prepare()
+    {
+      if (status.load(std::memory_order_acquire) != Status::DEFERRED)
+        return status.load(std::memory_order_acquire) == Status::READY;
+
+      if (!spool.begin())
+      {
+        ESP_LOGE(TAG, "Failed to prepare the spool, sessions go live only");
+        status.store(Status::FAILED, std::memory_order_release);
+        return false;
+      }
+
+      if (spool.discarded() != 0)
+        Metrics::add(Metrics::Counter::SPOOL_DROPPED, spool.discarded());
+      ESP_LOGI(TAG, "Spool ready, %u sessions pending, %u unfinished dropped", spool.pending(), spool.discarded());
+      flagPending(spool.pending() != 0);
+      status.store(Status::READY, std::memory_order_release);
+      xTaskNotifyGive(task);
+      return true;
+    }
+
+    bool usable()
+    {
+      Status now = status.load(std::memory_order_acquire);
+      return now == Status::DEFERRED || now == Status::READY;
+    }
+
+    bool isType(const char *type, const char *expected)
+    {
+      return strncmp(type, expected, 4) == 0;
+    }
+
+    // Opening messages use the spool record layout, so divert() copies them
+    // over as they are.
+    void keep(const char *type, const uint8_t *payload, size_t size)
+    {
+      session.lastKept = SIZE_MAX;
+      if (!session.keeping)
+        return;
+      if (session.preambleSize + 6 + size > sizeof(session.preamble))
+      {
+        session.keeping = false;
+        return;
+      }
+
+      session.lastKept = session.preambleSize;
+      uint8_t *record = session.preamble + session.preambleSize;
+      memcpy(record, type, 4);
+      record[4] = static_cast<uint8_t>(size);
+      record[5] = static_cast<uint8_t>(size >> 8);
+      memcpy(record + 6, payload, size);
+      session.preambleSize += 6 + size;
+    }
+
+    // Opens the spooled session with the preamble, then a gap standing for
+    // the `lostFrames` that went out live after it. Lock held.
+    bool openSession(uint32_t lostFrames = 0)
+    {
+      if (!spool.open(session.topic))
+        return false;
+
+      for (size_t offset = 0; offset < session.preambleSize;)
+      {
+        const uint8_t *record = session.preamble + offset;
+        size_t size = record[4] | record[5] << 8;
+        if (!spool.append(reinterpret_cast<const char *>(record), record + 6, size))
+        {
+          spool.abandon();
+          return false;
+        }
+        offset += 6 + size;
+      }
+
+      uint8_t gap[4] = {
+          static_cast<uint8_t>(lostFrames),
+          static_cast<uint8_t>(lostFrames >> 8),
+          static_cast<uint8_t>(lostFrames >> 16),
+          static_cast<uint8_t>(lostFrames >> 24),
+      };
+      if (lostFrames != 0 && !spool.append(MqttMessageType::FRAGMENT_GAP, gap, sizeof(gap)))
+      {
+        spool.abandon();
+        return false;
+      }
+      return true;
+    }
+
+    bool idle()
+    {
+      return !liveOpen.load(std::memory_order_acquire) ||
+             millis() - lastLiveAt.load(std::memory_order_relaxed) >= SPOOL_IDLE_MS;
+    }
+
+    // Sends one sealed session, false when it was cut short by the link or
+    // by a live session and has to go again from the start.
+    bool replay(int segment)
+    {
+      uint32_t generation = liveGeneration.load(std::memory_order_acquire);
+      char topic[Spool<SpiffsFlash>::topicSize];
+      {
+        Locked locked;
+        strcpy(topic, spool.topic(segment));
+      }
+
+      uint32_t offset = 0;
+      SpoolRecord record;
+      for (;;)
+      {
+        bool more;
+        {
+          Locked locked;
+          more = spool.read(segment, offset, record, replayBuffer, sizeof(replayBuffer));
+        }
+        if (!more)
+          return true;
+
+        if (mqtt->replayFragment(topic, record.type, replayBuffer, record.size, generation) != 0)
+          return false;
+
+        // rate limit, so the replay leaves the link to live traffic
+        TickType_t pause = pdMS_TO_TICKS(static_cast<uint64_t>(record.size) * 1000 / SPOOL_DRAIN_RATE);
+        vTaskDelay(pause > 0 ? pause : 1);
+      }
+    }
+
+    void drainTask(void *)
+    {
+      uint8_t pending = 0;
+      {
+        Locked locked;
+        flagged = ConfigStore::load(SPOOL_PENDING_KEY, 1, pending) && pending != 0;
+        if (flagged)
+          prepare();
+      }
+
+      for (;;)
+      {
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(SPOOL_DRAIN_PERIOD_MS));
+        Status now = status.load(std::memory_order_acquire);
+        if (now == Status::FAILED)
+          vTaskSuspend(nullptr);
+        if (now != Status::READY)
+          continue;
+
+        while (mqtt->isConnected() && idle())
+        {
+          int segment;
+          {
+            Locked locked;
+            segment = spool.oldest();
+          }
+          if (segment < 0)
+            break;
+
+          ESP_LOGI(TAG, "Replaying spooled session %d", segment);
+          if (!replay(segment))
+          {
+            ESP_LOGI(TAG, "Replay of session %d interrupted, retrying later", segment);
+            break;
+          }
+
+          Locked locked;
+          spool.release(segment);
+          Metrics::add(Metrics::Counter::SPOOL_REPLAYED);
+          if (spool.pending() == 0)
+            flagPending(false);
+        }
+      }
+    }
+  }
+
+  void begin(Mqtt &client)
+  {
+    if (task)
+      return;
+
+    mqtt = &client;
+    lock = xSemaphoreCreateMutexStatic(&lockBuffer);
+    task = xTaskCreateStaticPinnedToCore(
+        drainTask, "mqtt_spool", SPOOL_STACK, nullptr,
+        SPOOL_PRIORITY, taskStack, &taskBuffer, SPOOL_CORE);
+    if (!task)
+    {
+      ESP_LOGE(TAG, "Failed to create spool task");
+      return;
+    }
+    Metrics::watch(task);
+    status.store(Status::DEFERRED, std::memory_order_release);
+  }
+
+  bool available()
+  {
+    if (session.diverted)
+      return true;
+    if (!usable())
+      return false;
+    Locked locked;
+    return prepare() && spool.hasRoom();
+  }
+
+  bool intercept(const char *topic, const char *type, const uint8_t *payload, size_t size, uint32_t frames, bool linkUp, int &res)
+  {
+    if (!usable())
+      return false;
+
+    bool header = isType(type, MqttMessageType::FRAGMENT_HEADER);
+    bool cancel = isType(type, MqttMessageType::FRAGMENT_CANCEL);
+    bool end = cancel || isType(type, MqttMessageType::FRAGMENT_TRAILER);
+
+    if (header)
+    {
+      if (session.diverted)
+      {
+        Locked locked;
+        spool.abandon();
+      }
+      session.topic = topic;
+      session.diverted = false;
+      session.keeping = true;
+      session.spooled = false;
+      session.preambleSize = 0;
+      session.liveFrames = 0;
+      session.opaque = 0;
+    }
+    keep(type, payload, size);
+    session.lastFrames = frames;
+
+    if (header && !linkUp)
+    {
+      Locked locked;
+      session.diverted = prepare() && openSession();
+      if (session.diverted)
+        ESP_LOGI(TAG, "Link is down, spooling the session");
+    }
+
+    if (!session.diverted)
+    {
+      if (header)
+        liveGeneration.fetch_add(1, std::memory_order_acq_rel);
+      if (end)
+        session.topic = nullptr;
+      if (session.lastKept == SIZE_MAX)
+      {
+        session.liveFrames += frames;
+        session.opaque += frames == 0;
+      }
+      lastLiveAt.store(millis(), std::memory_order_relaxed);
+      liveOpen.store(!end, std::memory_order_release);
+      return false;
+    }
+
+    bool stored;
+    {
+      Locked locked;
+      stored = spool.append(type, payload, size);
+      if (stored && cancel)
+        spool.abandon();
+      else if (stored && end)
+        stored = spool.seal();
+      if (stored && end && !cancel)
+        flagPending(true);
+      else if (!stored)
+        spool.abandon();
+    }
+
+    if (!stored)
+    {
+      ESP_LOGE(TAG, "Session does not fit the spool, dropping it");
+      Metrics::add(Metrics::Counter::SPOOL_DROPPED);
+      session.diverted = false;
+      session.topic = nullptr;
+      res = -1;
+      return true;
+    }
+
+    if (end)
+    {
+      session.diverted = false;
+      session.topic = nullptr;
+      session.spooled = !cancel;
+      if (session.spooled)
+        Metrics::add(Metrics::Counter::SPOOLED_SESSIONS);
+    }
+    res = 0;
+    return true;
+  }
+
+  bool divert()
+  {
+    if (session.diverted)
+      return true;
+    if (!session.topic || !usable())
+      return false;
+
+    // the caller sends the failed message again, into the spool
+    uint32_t lostFrames = session.liveFrames;
+    size_t opaque = session.opaque;
+    if (session.lastKept != SIZE_MAX)
+    {
+      session.preambleSize = session.lastKept;
+    }
+    else
+    {
+      lostFrames -= session.lastFrames;
+      opaque -= session.lastFrames == 0;
+    }
+    session.keeping = false;
+
+    // a gap can only stand for audio, any other message lost makes the
+    // spooled session unusable
+    if (opaque != 0)
+    {
+      ESP_LOGW(TAG, "Link lost mid-session after %u messages past the preamble, not spooling it", opaque);
+      return false;
+    }
+
+    Locked locked;
+    session.diverted = prepare() && openSession(lostFrames);
+    if (session.diverted)
+    {
+      ESP_LOGI(TAG, "Link lost mid-session, spooling the rest of it behind a %u frame gap", lostFrames);
+      liveOpen.store(false, std::memory_order_release);
+    }
+    return session.diverted;
+  }
+
+  bool spooled() { return session.spooled; }
+
+  uint32_t generation() { return liveGeneration.load(std::memory_order_acquire); }
+}
@@ -0,0 +1,359 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#ifndef SPOOL_SEGMENTS
+#define SPOOL_SEGMENTS 4 // sessions the spool holds, 0 disables spooling
+#endif
+
+#ifndef SPOOL_SEGMENT_SIZE
+#define SPOOL_SEGMENT_SIZE 98304 // bytes per session, pre-allocated on the SPIFFS partition
+#endif
+
+#ifndef SPOOL_MAX_RECORD
+#define SPOOL_MAX_RECORD 2048 // largest message payload a spooled session may carry
+#endif
+
+#ifndef SPOOL_PREAMBLE_SIZE
+#define SPOOL_PREAMBLE_SIZE 192 // opening messages of a live session kept to restart it in the spool
+#endif
+
+#ifndef SPOOL_DRAIN_RATE
+#define SPOOL_DRAIN_RATE 16384 // bytes per second replayed once the link is back
+#endif
+
+#ifndef SPOOL_IDLE_MS
+#define SPOOL_IDLE_MS 2000 // quiet time after a live session before replaying
+#endif
+
+#ifndef SPOOL_DRAIN_PERIOD_MS
+#define SPOOL_DRAIN_PERIOD_MS 1000 // how often the drain task looks for work
+#endif
+
+#ifndef SPOOL_PRIORITY
+#define SPOOL_PRIORITY 1
+#endif
+
+#ifndef SPOOL_CORE
+#define SPOOL_CORE 0
+#endif
+
+#ifndef SPOOL_STACK
+#define SPOOL_STACK 4096 // bytes, statically allocated
+#endif
+
+// One message of a spooled session.
+struct SpoolRecord
+{
+  char type[5]; // MqttMessageType
+  uint16_t size;
+};
+
+// Bounded store-and-forward spool of fragmented sessions.
+//
+// Every session gets a segment of its own. Segments are pre-allocated once
+// and rewritten in place, so the spool never grows or fragments the
+// partition:
+//   HEADER: MAGIC 4B, SEQUENCE 4B, LENGTH 4B, STATE 1B, reserved 3B, TOPIC 48B
+//   RECORD: TYPE 4B, SIZE 2B, PAYLOAD
+// Records are appended after the header and the header is only rewritten
+// when the session is sealed, so a segment cut short by a reset stays open
+// and is dropped by the next begin(). Sealed segments replay oldest first.
+//
+// It does no I/O itself, `Flash` does, so it runs on host against a file:
+//   bool prepare(size_t segment, size_t size); the segment exists with `size` bytes
+//   bool read(size_t segment, size_t offset, void *dest, size_t size);
+//   bool write(size_t segment, size_t offset, const void *src, size_t size);
+//
+// Not thread-safe, callers hold a lock around every call.
+template <typename Flash>
+class Spool
+{
+public:
+  static constexpr size_t segments = SPOOL_SEGMENTS;
+  static constexpr size_t segmentSize = SPOOL_SEGMENT_SIZE;
+  static constexpr size_t topicSize = 48;
+
+  explicit Spool(Flash &flash) : flash(flash) {}
+
+  // Prepares every segment and picks up the sessions sealed before a reset.
+  bool begin()
+  {
+    ready_ = false;
+    current = -1;
+    discarded_ = 0;
+    nextSequence = 1;
+    for (size_t i = 0; i < segments; i++)
+    {
+      state[i] = FREE;
+      if (!flash.prepare(i, segmentSize))
+        return false;
+
+      Header header;
+      if (!flash.read(i, 0, &header, sizeof(header)) || header.magic != magic)
+        continue;
+
+      if (header.state == OPEN)
+      {
+        discarded_++;
+      }
+      else if (header.state == SEALED && header.length <= segmentSize - sizeof(Header))
+      {
+        state[i] = SEALED;
+        sequence[i] = header.sequence;
+        length[i] = header.length;
+        memcpy(topics[i], header.topic, topicSize);
+        topics[i][topicSize - 1] = '\0';
+      }
+
+      if (header.sequence >= nextSequence)
+        nextSequence = header.sequence + 1;
+    }
+    ready_ = true;
+    return true;
+  }
+
+  bool ready() const { return ready_; }
+
+  // Sessions left unsealed by a reset, dropped by begin().
+  size_t discarded() const { return discarded_; }
+
+  // Sealed sessions waiting to be replayed.
+  size_t pending() const
+  {
+    size_t count = 0;
+    for (size_t i = 0; i < segments; i++)
+      count += state[i] == SEALED;
+    return count;
+  }
+
+  // Whether a new session can be opened. A full spool keeps its oldest
+  // sessions and refuses new ones.
+  bool hasRoom() const { return ready_ && current < 0 && freeSegment() >= 0; }
+
+  bool isOpen() const { return current >= 0; }
+
+  // Starts a session for `topic` in a free segment.
+  bool open(const char *topic)
+  {
+    if (!hasRoom() || strlen(topic) >= topicSize)
+      return false;
+
+    int segment = freeSegment();
+    Header header = {};
+    header.magic = magic;
+    header.sequence = nextSequence;
+    header.state = OPEN;
+    strncpy(header.topic, topic, topicSize - 1);
+    if (!flash.write(segment, 0, &header, sizeof(header)))
+      return false;
+
+    current = segment;
+    state[segment] = OPEN;
+    sequence[segment] = nextSequence++;
+    length[segment] = 0;
+    memcpy(topics[segment], header.topic, topicSize);
+    return true;
+  }
+
+  // Appends one message to the open session, false when it does not fit.
+  bool append(const char *type, const uint8_t *payload, size_t size)
+  {
+    if (current < 0 || size > SPOOL_MAX_RECORD)
+      return false;
+
+    size_t offset = sizeof(Header) + length[current];
+    if (offset + recordHeaderSize + size > segmentSize)
+      return false;
+
+    uint8_t head[recordHeaderSize];
+    memcpy(head, type, 4);
+    head[4] = static_cast<uint8_t>(size);
+    head[5] = static_cast<uint8_t>(size >> 8);
+    if (!flash.write(current, offset, head, sizeof(head)) ||
+        (size != 0 && !flash.write(current, offset + sizeof(head), payload, size)))
+      return false;
+
+    length[current] += recordHeaderSize + size;
+    return true;
+  }
+
+  // Completes the open session, which is then ready to replay.
+  bool seal()
+  {
+    if (current < 0)
+      return false;
+
+    Header header = {};
+    header.magic = magic;
+    header.sequence = sequence[current];
+    header.length = length[current];
+    header.state = SEALED;
+    memcpy(header.topic, topics[current], topicSize);
+    if (!flash.write(current, 0, &header, sizeof(header)))
+    {
+      abandon();
+      return false;
+    }
+
+    state[current] = SEALED;
+    current = -1;
+    return true;
+  }
+
+  // Drops the open session.
+  void abandon()
+  {
+    if (current < 0)
+      return;
+    clear(current);
+    current = -1;
+  }
+
+  // Oldest sealed session, -1 when there is none.
+  int oldest() const
+  {
+    int found = -1;
+    for (size_t i = 0; i < segments; i++)
+    {
+      if (state[i] == SEALED && (found < 0 || sequence[i] < sequence[found]))
+        found = i;
+    }
+    return found;
+  }
+
+  const char *topic(int segment) const { return topics[segment]; }
+
+  // Reads the record at `offset` of a sealed session into `payload` (of
+  // `capacity` bytes) and moves `offset` past it. False at the end of the
+  // session, or when the record is damaged.
+  bool read(int segment, uint32_t &offset, SpoolRecord &record, uint8_t *payload, size_t capacity)
+  {
+    if (state[segment] != SEALED || offset + recordHeaderSize > length[segment])
+      return false;
+
+    uint8_t head[recordHeaderSize];
+    if (!flash.read(segment, sizeof(Header) + offset, head, sizeof(head)))
+      return false;
+
+    memcpy(record.type, head, 4);
+    record.type[4] = '\0';
+    record.size = head[4] | head[5] << 8;
+    if (record.size > capacity || offset + recordHeaderSize + record.size > length[segment])
+      return false;
+    if (record.size != 0 && !flash.read(segment, sizeof(Header) + offset + recordHeaderSize, payload, record.size))
+      return false;
+
+    offset += recordHeaderSize + record.size;
+    return true;
+  }
+
+  // Frees a replayed session.
+  bool release(int segment)
+  {
+    if (state[segment] != SEALED)
+      return false;
+    return clear(segment);
+  }
+
+private:
+  enum : uint8_t
+  {
+    FREE,
+    OPEN,
+    SEALED,
+  };
+
+  struct Header
+  {
+    uint32_t magic;
+    uint32_t sequence;
+    uint32_t length; // record bytes after the header
+    uint8_t state;
+    uint8_t reserved[3];
+    char topic[topicSize];
+  };
+
+  static constexpr uint32_t magic = 0x4c4f5053; // "SPOL"
+  static constexpr size_t recordHeaderSize = 6;
+
+  static_assert(segments > 0, "The spool needs at least one segment");
+  static_assert(segmentSize > sizeof(Header) + recordHeaderSize, "Spool segments are too small");
+  static_assert(SPOOL_MAX_RECORD <= 0xFFFF, "Spool records carry a 16-bit size");
+
+  Flash &flash;
+  bool ready_ = false;
+  size_t discarded_ = 0;
+  int current = -1;
+  uint32_t nextSequence = 1;
+
+  uint8_t state[segments] = {};
+  uint32_t sequence[segments] = {};
+  uint32_t length[segments] = {};
+  char topics[segments][topicSize] = {};
+
+  bool clear(int segment)
+  {
+    Header header = {};
+    header.magic = magic;
+    header.sequence = sequence[segment];
+    header.state = FREE;
+    state[segment] = FREE;
+    return flash.write(segment, 0, &header, sizeof(header));
+  }
+
+  int freeSegment() const
+  {
+    for (size_t i = 0; i < segments; i++)
+    {
+      if (state[i] == FREE)
+        return i;
+    }
+    return -1;
+  }
+};
+
+class Mqtt;
+
+// The recorder's spool on SPIFFS and its drain task.
+//
+// Mqtt hands every fragment message to intercept() first. A session whose
+// header finds the link down goes to the spool whole, and a session that
+// loses the link midway moves there with divert(), behind its opening
+// messages and a FRAGMENT_GAP standing for the audio that went out live
+// (which the server conceals as it does any gap). Only complete sessions
+// are replayed: a cancelled or overflowing
+// one is dropped. The drain task replays sealed sessions oldest first at
+// SPOOL_DRAIN_RATE, and only while no live session is in flight, so replay
+// never interleaves with live capture. A live session starting mid-replay
+// makes the server drop the replayed part, which is then sent again.
+namespace SessionSpool
+{
+  // Starts the drain task. SPIFFS is mounted and the spool prepared the
+  // first time a session needs it, or here when sessions from an earlier
+  // boot wait in it. Without it every session goes live.
+  void begin(Mqtt &mqtt);
+
+  // Whether the session can go on without the link: it is already spooling,
+  // or a new one would fit.
+  bool available();
+
+  // Called by Mqtt for every fragment message before sending it, with the
+  // I2S `frames` it stands for (audio bodies and gaps). Returns true with
+  // the publish result in `res` when the spool took the message.
+  bool intercept(const char *topic, const char *type, const uint8_t *payload, size_t size, uint32_t frames, bool linkUp, int &res);
+
+  // Moves the rest of the current session to the spool, returns whether
+  // its messages now go there. A session that sent anything but audio
+  // past its preamble live cannot be, and fails as it would without the
+  // spool.
+  bool divert();
+
+  // Whether the last session that ended went to the spool.
+  bool spooled();
+
+  // Changes whenever a live session starts, see Mqtt::replayFragment.
+  uint32_t generation();
+}
@@ -0,0 +1,369 @@
+#include "core/tls.h"
+#include "core/filesystem.h"
+#include "core/metrics.h"
+#include "core/utils.h"
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <mbedtls/error.h>
+
+#include <cstring>
+
+createTag(TLS);
+
+namespace
+{
+  int hexValue(char c)
+  {
+    if (c >= '0' && c <= '9')
+      return c - '0';
+    if (c >= 'a' && c <= 'f')
+      return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+      return c - 'A' + 10;
+    return -1;
+  }
+
+  // Decodes the hex `text` into `dest`, returns its size or 0 when it is
+  // not hex or does not fit.
+  size_t decodeHex(const char *text, uint8_t *dest, size_t capacity)
+  {
+    size_t length = strlen(text);
+    if (length == 0 || length % 2 != 0 || length / 2 > capacity)
+      return 0;
+
+    for (size_t i = 0; i < length / 2; i++)
+    {
+      int high = hexValue(text[2 * i]);
+      int low = hexValue(text[2 * i + 1]);
+      if (high < 0 || low < 0)
+        return 0;
+      dest[i] = static_cast<uint8_t>(high << 4 | low);
+    }
+    return length / 2;
+  }
+
+  bool pending(int code)
+  {
+    return code == MBEDTLS_ERR_SSL_WANT_READ || code == MBEDTLS_ERR_SSL_WANT_WRITE;
+  }
+}
+
+TlsClient::TlsClient()
+{
+  mbedtls_net_init(&net);
+  mbedtls_entropy_init(&entropy);
+  mbedtls_ctr_drbg_init(&drbg);
+  mbedtls_x509_crt_init(&ca);
+  mbedtls_ssl_config_init(&conf);
+  mbedtls_ssl_init(&ssl);
+  mbedtls_ssl_session_init(&session);
+}
+
+TlsClient::~TlsClient()
+{
+  stop();
+  mbedtls_ssl_session_free(&session);
+  mbedtls_ssl_free(&ssl);
+  mbedtls_ssl_config_free(&conf);
+  mbedtls_x509_crt_free(&ca);
+  mbedtls_ctr_drbg_free(&drbg);
+  mbedtls_entropy_free(&entropy);
+}
+
+bool TlsClient::prepare()
+{
+  if (prepared)
+    return true;
+
+  static const unsigned char personalization[] = "mqtt_tls";
+  int res = mbedtls_ctr_drbg_seed(&drbg, mbedtls_entropy_func, &entropy, personalization, sizeof(personalization) - 1);
+  if (res == 0)
+    res = mbedtls_ssl_config_defaults(&conf, MBEDTLS_SSL_IS_CLIENT, MBEDTLS_SSL_TRANSPORT_STREAM, MBEDTLS_SSL_PRESET_DEFAULT);
+  if (res != 0)
+  {
+    fail("setup", res);
+    return false;
+  }
+  mbedtls_ssl_conf_rng(&conf, mbedtls_ctr_drbg_random, &drbg);
+  mbedtls_ssl_conf_session_tickets(&conf, MBEDTLS_SSL_SESSION_TICKETS_ENABLED);
+
+  uint8_t psk[maxPskSize];
+  size_t pskSize = decodeHex(MQTT_TLS_PSK, psk, sizeof(psk));
+  if (MQTT_TLS_PSK[0] != '\0' && (pskSize == 0 || MQTT_TLS_PSK_IDENTITY[0] == '\0'))
+  {
+    ESP_LOGE(TAG, "MQTT_TLS_PSK needs MQTT_TLS_PSK_IDENTITY and up to %u hex bytes", maxPskSize);
+    return false;
+  }
+
+  if (pskSize != 0)
+  {
+    res = mbedtls_ssl_conf_psk(&conf, psk, pskSize,
+                               reinterpret_cast<const unsigned char *>(MQTT_TLS_PSK_IDENTITY), strlen(MQTT_TLS_PSK_IDENTITY));
+    if (res != 0)
+    {
+      fail("PSK", res);
+      return false;
+    }
+    ESP_LOGI(TAG, "Using the pre-shared key of %s", MQTT_TLS_PSK_IDENTITY);
+  }
+  else if (FileSystem::size(MQTT_TLS_CA_PATH) > 0)
+  {
+    res = mbedtls_x509_crt_parse_file(&ca, MQTT_TLS_CA_PATH);
+    if (res != 0)
+    {
+      fail("CA " MQTT_TLS_CA_PATH, res);
+      return false;
+    }
+    mbedtls_ssl_conf_ca_chain(&conf, &ca, nullptr);
+    mbedtls_ssl_conf_authmode(&conf, MBEDTLS_SSL_VERIFY_REQUIRED);
+    ESP_LOGI(TAG, "Verifying the broker against %s", MQTT_TLS_CA_PATH);
+  }
+  else
+  {
+    mbedtls_ssl_conf_authmode(&conf, MBEDTLS_SSL_VERIFY_NONE);
+    ESP_LOGW(TAG, "No CA at %s and no PSK, the broker is not verified", MQTT_TLS_CA_PATH);
+  }
+
+  res = mbedtls_ssl_setup(&ssl, &conf);
+  if (res != 0)
+  {
+    fail("setup", res);
+    return false;
+  }
+
+  prepared = true;
+  return true;
+}
+
+int TlsClient::connect(IPAddress ip, uint16_t port)
+{
+  return connect(ip.toString().c_str(), port);
+}
+
+int TlsClient::connect(const char *host, uint16_t port)
+{
+  stop();
+  if (!prepare())
+    return 0;
+
+  if (!tcp.connect(host, port, MQTT_TLS_TIMEOUT_MS))
+    return 0;
+
+  if (!handshake(host, port))
+  {
+    tcp.stop();
+    return 0;
+  }
+
+  open = true;
+  return 1;
+}
+
+bool TlsClient::handshake(const char *host, uint16_t port)
+{
+  net.fd = tcp.fd();
+  mbedtls_net_set_nonblock(&net);
+
+  int res = mbedtls_ssl_session_reset(&ssl);
+  if (res == 0)
+    res = mbedtls_ssl_set_hostname(&ssl, host);
+
+  bool offered = MQTT_TLS_RESUME && hasSession && port == sessionPort && strcmp(host, sessionHost) == 0;
+  if (res == 0 && offered)
+    res = mbedtls_ssl_set_session(&ssl, &session);
+  if (res != 0)
+  {
+    fail("session setup", res);
+    return false;
+  }
+  mbedtls_ssl_set_bio(&ssl, &net, mbedtls_net_send, mbedtls_net_recv, nullptr);
+
+  auto startedAt = millis();
+  {
+    metricsTimer(TLS_HANDSHAKE);
+    while ((res = mbedtls_ssl_handshake(&ssl)) != 0)
+    {
+      if (!pending(res) || millis() - startedAt >= MQTT_TLS_TIMEOUT_MS)
+        break;
+      vTaskDelay(1);
+    }
+  }
+  handshakeMs_ = millis() - startedAt;
+
+  if (res != 0)
+  {
+    // the kept session may be what the broker refused
+    if (offered)
+      forgetSession();
+    fail("handshake", res);
+    return false;
+  }
+
+  remember(host, port, offered);
+  ESP_LOGI(TAG, "%s handshake with %s:%u in %lu ms, %s %s",
+           resumed_ ? "Resumed" : "Full", host, port, handshakeMs_,
+           mbedtls_ssl_get_version(&ssl), mbedtls_ssl_get_ciphersuite(&ssl));
+  return true;
+}
+
+void TlsClient::remember(const char *host, uint16_t port, bool offered)
+{
+  mbedtls_ssl_session fresh;
+  mbedtls_ssl_session_init(&fresh);
+  if (mbedtls_ssl_get_session(&ssl, &fresh) != 0)
+  {
+    mbedtls_ssl_session_free(&fresh);
+    resumed_ = false;
+    return;
+  }
+
+  // only a resumed session keeps its master secret
+  resumed_ = offered && memcmp(fresh.master, session.master, sizeof(session.master)) == 0;
+  if (resumed_)
+    Metrics::add(Metrics::Counter::TLS_RESUMED);
+
+  mbedtls_ssl_session_free(&session);
+  session = fresh;
+  hasSession = true;
+  strncpy(sessionHost, host, sizeof(sessionHost) - 1);
+  sessionPort = port;
+}
+
+void TlsClient::forgetSession()
+{
+  mbedtls_ssl_session_free(&session);
+  mbedtls_ssl_session_init(&session);
+  hasSession = false;
+}
+
+void TlsClient::fail(const char *what, int code)
+{
+  char reason[96];
+  mbedtls_strerror(code, reason, sizeof(reason));
+  ESP_LOGE(TAG, "TLS %s failed: -0x%04x %s", what, -code, reason);
+  if (open)
+  {
+    open = false;
+    peeked = -1;
+    tcp.stop();
+  }
+}
+
+size_t TlsClient::write(uint8_t b)
+{
+  return write(&b, 1);
+}
+
+size_t TlsClient::write(const uint8_t *buf, size_t size)
+{
+  if (!open)
+    return 0;
+
+  size_t written = 0;
+  auto progressAt = millis();
+  while (written < size)
+  {
+    int res = mbedtls_ssl_write(&ssl, buf + written, size - written);
+    if (res > 0)
+    {
+      written += res;
+      progressAt = millis();
+      continue;
+    }
+    if (!pending(res) || millis() - progressAt >= MQTT_TLS_TIMEOUT_MS)
+    {
+      fail("write", res);
+      break;
+    }
+    vTaskDelay(1);
+  }
+  return written;
+}
+
+int TlsClient::available()
+{
+  if (!open)
+    return 0;
+
+  size_t buffered = mbedtls_ssl_get_bytes_avail(&ssl);
+  if (buffered == 0)
+  {
+    // processes a record that came in, without waiting for one
+    int res = mbedtls_ssl_read(&ssl, nullptr, 0);
+    if (res < 0 && !pending(res))
+    {
+      if (res == MBEDTLS_ERR_SSL_PEER_CLOSE_NOTIFY)
+        stop();
+      else
+        fail("read", res);
+      return peeked >= 0;
+    }
+    buffered = mbedtls_ssl_get_bytes_avail(&ssl);
+  }
+  return buffered + (peeked >= 0);
+}
+
+int TlsClient::read()
+{
+  uint8_t b;
+  return read(&b, 1) == 1 ? b : -1;
+}
+
+int TlsClient::read(uint8_t *buf, size_t size)
+{
+  if (size == 0)
+    return 0;
+
+  size_t taken = 0;
+  if (peeked >= 0)
+  {
+    buf[taken++] = static_cast<uint8_t>(peeked);
+    peeked = -1;
+  }
+  if (!open || taken == size)
+    return taken ? taken : -1;
+
+  int res = mbedtls_ssl_read(&ssl, buf + taken, size - taken);
+  if (res > 0)
+    return taken + res;
+
+  if (res == 0 || res == MBEDTLS_ERR_SSL_PEER_CLOSE_NOTIFY)
+    stop();
+  else if (!pending(res))
+    fail("read", res);
+  return taken ? taken : -1;
+}
+
+int TlsClient::peek()
+{
+  if (peeked < 0)
+    peeked = read();
+  return peeked;
+}
+
+void TlsClient::stop()
+{
+  if (open)
+  {
+    mbedtls_ssl_close_notify(&ssl);
+    open = false;
+  }
+  peeked = -1;
+  tcp.stop();
+}
+
+uint8_t TlsClient::connected()
+{
+  if (!open)
+    return peeked >= 0;
+  if (!tcp.connected())
+  {
+    // what is left of the last records can still be read
+    if (available() > 0)
+      return 1;
+    stop();
+    return 0;
+  }
+  return 1;
+}
@@ -0,0 +1,107 @@
+#pragma once
+
+#include <Arduino.h>
+#include <WiFi.h>
+#include <mbedtls/ctr_drbg.h>
+#include <mbedtls/entropy.h>
+#include <mbedtls/net_sockets.h>
+#include <mbedtls/ssl.h>
+#include <mbedtls/x509_crt.h>
+
+#include <cstddef>
+#include <cstdint>
+
+#ifndef MQTT_TLS_CA_PATH
+#define MQTT_TLS_CA_PATH "/spiffs/mqtt_ca.pem" // CA the broker must chain to, when the file exists
+#endif
+
+#ifndef MQTT_TLS_PSK_IDENTITY
+#define MQTT_TLS_PSK_IDENTITY "" // with MQTT_TLS_PSK, a pre-shared key replaces certificates
+#endif
+
+#ifndef MQTT_TLS_PSK
+#define MQTT_TLS_PSK "" // hex, up to 64 bytes
+#endif
+
+#ifndef MQTT_TLS_RESUME
+#define MQTT_TLS_RESUME 1 // 0 makes every connection a full handshake
+#endif
+
+#ifndef MQTT_TLS_TIMEOUT_MS
+#define MQTT_TLS_TIMEOUT_MS 10000 // longest handshake, and longest a write may stall
+#endif
+
+// TLS client for the MQTT connection that resumes its previous session.
+//
+// A full handshake costs the ESP32 seconds of public-key math. The session
+// of every connection (its ID, and the ticket when the broker issues one)
+// is kept and offered again to the same host, so a reconnect only exchanges
+// a few hashes when the broker still knows it. A broker that does not
+// falls back to a full handshake by itself.
+//
+// The broker is trusted by the first of:
+//   - MQTT_TLS_PSK and MQTT_TLS_PSK_IDENTITY, a pre-shared key,
+//   - the CA at MQTT_TLS_CA_PATH, which its certificate must chain to,
+//   - nothing: it is not verified, as WiFiClientSecure::setInsecure() did.
+// The mbedtls contexts are set up on the first connection and kept, so an
+// insecure setup never pays for them. Handshakes are timed in the
+// TLS_HANDSHAKE timer and resumed ones counted in TLS_RESUMED.
+class TlsClient : public Client
+{
+public:
+  TlsClient();
+  ~TlsClient();
+
+  int connect(IPAddress ip, uint16_t port) override;
+  int connect(const char *host, uint16_t port) override;
+  size_t write(uint8_t b) override;
+  size_t write(const uint8_t *buf, size_t size) override;
+  int available() override;
+  int read() override;
+  int read(uint8_t *buf, size_t size) override;
+  int peek() override;
+  void flush() override {}
+  void stop() override;
+  uint8_t connected() override;
+  operator bool() override { return connected(); }
+
+  // Whether the latest handshake resumed a session, and how long it took.
+  bool resumed() const { return resumed_; }
+  unsigned long handshakeMs() const { return handshakeMs_; }
+
+  // Drops the kept session, the next connection is a full handshake.
+  void forgetSession();
+
+private:
+  static constexpr size_t maxHostSize = 64;
+  static constexpr size_t maxPskSize = 64;
+
+  WiFiClient tcp;
+  mbedtls_net_context net;
+  mbedtls_entropy_context entropy;
+  mbedtls_ctr_drbg_context drbg;
+  mbedtls_x509_crt ca;
+  mbedtls_ssl_config conf;
+  mbedtls_ssl_context ssl;
+
+  bool prepared = false;
+  bool open = false;
+  int peeked = -1;
+
+  mbedtls_ssl_session session;
+  bool hasSession = false;
+  char sessionHost[maxHostSize] = {0};
+  uint16_t sessionPort = 0;
+
+  bool resumed_ = false;
+  unsigned long handshakeMs_ = 0;
+
+  // Sets up the contexts and the trust, once. False when the configured
+  // trust cannot be loaded, which never falls back to insecure.
+  bool prepare();
+  bool handshake(const char *host, uint16_t port);
+  // Keeps the session of the connection that just opened.
+  void remember(const char *host, uint16_t port, bool offered);
+  // Closes the connection after an mbedtls error.
+  void fail(const char *what, int code);
+};
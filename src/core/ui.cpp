@@ -0,0 +1,85 @@
+#include "core/ui.h"
+#include "core/snapshot.h"
+#include "core/metrics.h"
+#include "core/utils.h"
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+#include <cstring>
+
+createTag(UI);
+
+namespace Ui
+{
+  namespace
+  {
+    UiOutputs draft = {};
+    Snapshot<UiOutputs> snapshot;
+
+    TaskHandle_t task = nullptr;
+    StaticTask_t taskBuffer;
+    StackType_t taskStack[UI_STACK];
+
+#define __copyOutput(field) memcpy(RemoteXY.field, outputs.field, sizeof(RemoteXY.field))
+
+    void apply(const UiOutputs &outputs)
+    {
+      RemoteXY.led_recorder = outputs.led_recorder;
+      RemoteXY.led_sampler = outputs.led_sampler;
+#if USE_REALTIME_RECORDING == 0
+      __copyOutput(value_recorder_status);
+#else
+      RemoteXY.recorder_peak_graph = outputs.recorder_peak_graph;
+#endif
+      __copyOutput(value_recorder_command);
+      __copyOutput(value_recorder_transcription);
+      __copyOutput(value_recorder_similarity_status);
+      __copyOutput(value_recorder_verified_status);
+      __copyOutput(value_recorder_reference);
+      __copyOutput(value_sampler_status);
+      __copyOutput(value_config_status);
+    }
+
+#undef __copyOutput
+
+    void uiTask(void *)
+    {
+      UiOutputs shown;
+      uint32_t seen = 0;
+
+      for (;;)
+      {
+        if (snapshot.read(shown, seen))
+          apply(shown);
+
+        {
+          metricsTimer(REMOTEXY);
+          RemoteXY_Handler();
+        }
+        vTaskDelay(pdMS_TO_TICKS(UI_PERIOD_MS));
+      }
+    }
+  }
+
+  void begin()
+  {
+    commit();
+    if (task)
+      return;
+
+    task = xTaskCreateStaticPinnedToCore(
+        uiTask, "remotexy_ui", UI_STACK, nullptr,
+        UI_PRIORITY, taskStack, &taskBuffer, UI_CORE);
+    if (!task)
+    {
+      ESP_LOGE(TAG, "Failed to create UI task");
+      return;
+    }
+    Metrics::watch(task);
+  }
+
+  UiOutputs &state() { return draft; }
+
+  void commit() { snapshot.publish(draft); }
+}
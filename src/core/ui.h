@@ -0,0 +1,58 @@
+#pragma once
+
+#include "core/remotexy.h"
+
+#include <cstddef>
+#include <cstdint>
+
+#ifndef UI_PERIOD_MS
+#define UI_PERIOD_MS 20 // how often the UI task services RemoteXY
+#endif
+
+#ifndef UI_PRIORITY
+#define UI_PRIORITY 1 // below the capture and sender tasks
+#endif
+
+#ifndef UI_CORE
+#define UI_CORE 1
+#endif
+
+#ifndef UI_STACK
+#define UI_STACK 4096 // bytes, statically allocated
+#endif
+
+// Everything the devices show on RemoteXY, both layouts of RemoteXY_t.
+struct UiOutputs
+{
+  uint8_t led_recorder;
+  uint8_t led_sampler;
+  float recorder_peak_graph;
+  char value_recorder_status[65];
+  char value_recorder_command[sizeof(RemoteXY_t::value_recorder_command)];
+  char value_recorder_transcription[sizeof(RemoteXY_t::value_recorder_transcription)];
+  char value_recorder_similarity_status[sizeof(RemoteXY_t::value_recorder_similarity_status)];
+  char value_recorder_verified_status[sizeof(RemoteXY_t::value_recorder_verified_status)];
+  char value_recorder_reference[sizeof(RemoteXY_t::value_recorder_reference)];
+  char value_sampler_status[sizeof(RemoteXY_t::value_sampler_status)];
+  char value_config_status[sizeof(RemoteXY_t::value_config_status)];
+};
+
+// RemoteXY servicing on its own low-priority task, so the Bluetooth work
+// never runs on the recording or publishing paths.
+//
+// The loop task edits a draft of the outputs (state()) and publishes it with
+// commit(), a copy and one atomic swap into a Snapshot. The UI task picks up
+// the latest snapshot, copies it into RemoteXY and runs RemoteXY_Handler
+// every UI_PERIOD_MS. Inputs (buttons and text fields) are still read
+// straight from RemoteXY.
+namespace Ui
+{
+  // Starts the UI task (once), publishing the current draft first.
+  void begin();
+
+  // Draft of the outputs. Only the loop task may touch it.
+  UiOutputs &state();
+
+  // Makes the draft visible to the UI task, never blocks.
+  void commit();
+}
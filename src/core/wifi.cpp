@@ -1,59 +1,110 @@
 #include "core/wifi.h"
+#include "core/config.h"
+#include "core/connection.h"
 #include "core/filesystem.h"
 #include "core/serial.h"
 
 #include <Arduino.h>
-#include <Preferences.h>
 #include <WiFi.h>
 #include <esp_log.h>
 
-#define WAITING_TIME_BEFORE_GIVE_UP 5000
-#define WIFI_CONFIG_PATH "/spiffs/wifi.bin"
+#include <cstddef>
+#include <cstring>
 
-static const char *TAG = "WIFI";
+#define WIFI_CONFIG_KEY "wifi"
+#define WIFI_CONFIG_PATH "/spiffs/wifi.bin" // before the config store, migrated once
 
-int connectWiFi(String ssid, String password)
-{
-  WiFi.disconnect(true);
-  WiFi.begin(ssid, password);
+static const char *TAG = "WIFI";
 
-  ESP_LOGI(TAG, "Connecting to Wi-Fi %s", ssid);
+// Bumped whenever WiFiConfig changes layout.
+static constexpr uint16_t wifiConfigVersion = 2;
 
-  const int wait_delay = 300;
-  int wait_time = 0;
-  while (WiFi.status() != WL_CONNECTED)
+// Version 1 cached the last DHCP lease with the network and reused it as a
+// static address, which outlives the lease.
+struct WiFiConfigV1
+{
+  char ssid[33];
+  char password[65];
+  struct
   {
-    Serial.print(".");
-
-    delay(wait_delay);
-    wait_time += wait_delay;
-
-    if (wait_time >= WAITING_TIME_BEFORE_GIVE_UP)
-    {
-      Serial.println();
-      ESP_LOGI(TAG, "Cannot connect to WiFi. Check the inputted password.");
-      WiFi.disconnect(true);
-      return 1;
-    }
-  }
-
-  Serial.println();
-  ESP_LOGI(TAG, "Connected with IP: %s", WiFi.localIP().toString());
-  return ESP_OK;
+    uint8_t bssid[6];
+    uint8_t channel;
+    uint32_t localIp;
+    uint32_t gateway;
+    uint32_t subnet;
+    uint32_t dns;
+  } network;
 };
 
-int connectWiFi(WiFiConfig config)
+// Keeps the credentials and the access point of an older layout, the cached
+// lease is dropped so the next join asks DHCP again.
+static void upgrade(const WiFiConfigV1 &old, WiFiConfig &config)
 {
-  return connectWiFi(String(config.ssid), String(config.password));
-};
+  config = {};
+  memcpy(config.ssid, old.ssid, sizeof(config.ssid));
+  memcpy(config.password, old.password, sizeof(config.password));
+  memcpy(config.network.bssid, old.network.bssid, sizeof(config.network.bssid));
+  config.network.channel = old.network.channel;
+}
+
+// Reads the configuration from the config store in the previous layout.
+static bool migrateRecord(WiFiConfig &config)
+{
+  WiFiConfigV1 old;
+  if (!ConfigStore::load(WIFI_CONFIG_KEY, 1, old))
+    return false;
+
+  ESP_LOGI(TAG, "Upgrading WiFi configuration, the cached DHCP lease is dropped");
+  upgrade(old, config);
+  WiFiConfigurer::store(config);
+  return true;
+}
+
+// Reads the configuration from its SPIFFS file, written before the config
+// store, and moves it over.
+static bool migrate(WiFiConfig &config)
+{
+  // configurations stored before the network cache end right before it
+  WiFiConfigV1 old = {};
+  size_t size = sizeof(old);
+  long stored = FileSystem::size(WIFI_CONFIG_PATH);
+  if (stored < 0)
+    return false;
+  if (stored == static_cast<long>(offsetof(WiFiConfigV1, network)))
+    size = offsetof(WiFiConfigV1, network);
+
+  if (!FileSystem::load(WIFI_CONFIG_PATH, reinterpret_cast<unsigned char *>(&old), size))
+    return false;
+
+  ESP_LOGI(TAG, "Migrating WiFi configuration from SPIFFS");
+  upgrade(old, config);
+  WiFiConfigurer::store(config);
+  return true;
+}
+
+// Reads an IPv4 address from the serial console into `address`, leaving it
+// alone and returning false when the line is empty or invalid.
+static bool promptAddress(const char *label, uint32_t &address)
+{
+  Serial.print(label);
+  auto line = blockingReadStringUntil();
+  line.trim();
+  Serial.print(line);
+  Serial.println();
+
+  IPAddress parsed;
+  if (line.length() == 0 || !parsed.fromString(line))
+    return false;
+  address = parsed;
+  return true;
+}
 
 namespace WiFiConfigurer
 {
   int store(WiFiConfig &config)
   {
     ESP_LOGI(TAG, "Saving WiFi configuration to flash");
-    if (FileSystem::store(WIFI_CONFIG_PATH, reinterpret_cast<unsigned char *>(&config),
-                          sizeof(WiFiConfig)))
+    if (ConfigStore::store(WIFI_CONFIG_KEY, wifiConfigVersion, config))
     {
       ESP_LOGI(TAG, "WiFi configuration saved");
       return 0;
@@ -68,11 +119,10 @@ namespace WiFiConfigurer
   int setup(WiFiConfig &config)
   {
     ESP_LOGI(TAG, "Loading WiFi configuration from flash");
-    if (FileSystem::load(WIFI_CONFIG_PATH, reinterpret_cast<unsigned char *>(&config),
-                         sizeof(WiFiConfig)))
+    if (ConfigStore::load(WIFI_CONFIG_KEY, wifiConfigVersion, config) || migrateRecord(config) || migrate(config))
     {
       ESP_LOGI(TAG, "WiFi configuration loaded");
-      connectWiFi(config);
+      reconnect(config);
     }
 
     return ESP_OK;
@@ -93,21 +143,43 @@ namespace WiFiConfigurer
     ssid.trim();
     password.trim();
 
+    if (strcmp(config.ssid, ssid.c_str()) != 0)
+      config.network = {};
     strncpy(config.ssid, ssid.c_str(), sizeof(config.ssid) - 1);
     strncpy(config.password, password.c_str(), sizeof(config.password) - 1);
 
+    WiFiAddress address = {};
+    if (promptAddress("Static IP (empty for DHCP): ", address.localIp))
+    {
+      promptAddress("Gateway: ", address.gateway);
+      if (!promptAddress("Subnet mask (empty for 255.255.255.0): ", address.subnet))
+        address.subnet = IPAddress(255, 255, 255, 0);
+      if (!promptAddress("DNS (empty for the gateway): ", address.dns))
+        address.dns = address.gateway;
+    }
+    config.address = address;
+
     auto res = store(config);
     if (res != ESP_OK)
     {
       return res;
     }
 
-    connectWiFi(config);
+    reconnect(config);
     return ESP_OK;
   }
 
   int reconnect(WiFiConfig &config)
   {
-    return connectWiFi(config);
+    if (config.ssid[0] == '\0')
+    {
+      ESP_LOGI(TAG, "WiFi SSID is not set, skipping reconnect");
+      return 1;
+    }
+
+    // The link task joins in the background, see core/connection.h.
+    ESP_LOGI(TAG, "Connecting to Wi-Fi %s", config.ssid);
+    Connection::configure(config);
+    return ESP_OK;
   }
 }
\ No newline at end of file
@@ -1,9 +1,34 @@
 #pragma once
 
+#include <cstdint>
+
+#ifndef WIFI_FAST_JOIN
+#define WIFI_FAST_JOIN 1 // rejoin the last access point directly, 0 always scans
+#endif
+
+// Last network joined, learned after every join so the next one can skip
+// the scan. A zero channel means unknown.
+struct WiFiNetwork
+{
+  uint8_t bssid[6];
+  uint8_t channel;
+};
+
+// Static address set by the user, all zero for DHCP.
+struct WiFiAddress
+{
+  uint32_t localIp;
+  uint32_t gateway;
+  uint32_t subnet;
+  uint32_t dns;
+};
+
 struct WiFiConfig
 {
   char ssid[33];
   char password[65];
+  WiFiNetwork network;
+  WiFiAddress address;
 };
 
 namespace WiFiConfigurer
@@ -12,4 +37,4 @@ namespace WiFiConfigurer
   int setup(WiFiConfig &config);
   int serialPrompt(WiFiConfig &config);
   int reconnect(WiFiConfig &config);
-}
\ No newline at end of file
+}
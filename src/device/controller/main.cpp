@@ -7,12 +7,14 @@
 #define REMOTEXY_BLUETOOTH_NAME "ESP32Controller"
 #include "core/remotexy.h"
 
+#include "core/connection.h"
+#include "core/metrics.h"
 #include "core/mqtt.h"
 #include "core/wifi.h"
 #include "mqtt/protocol.h"
-#include "core/filesystem.h"
 #include "core/utils.h"
 #include "core/control.h"
+#include "core/ui.h"
 
 #include "device/controller/controller.h"
 
@@ -34,22 +36,27 @@ void setup()
   pinMode(FAN_SWITCH_PIN, OUTPUT);
 
   int code;
-  ensureSetup(code, FileSystem::setup(), "SPIFFS");
+  // Only loads the settings from NVS, the link task connects (and times the
+  // WiFi and MQTT phases). SPIFFS is mounted when something first needs it.
+  auto phaseStart = millis();
   ensureSetup(code, WiFiConfigurer::setup(wifiConfig), "WiFi");
   ensureSetup(code, MqttConfigurer::setup(mqttConfig, mqtt), "MQTT");
+  Metrics::phase(Metrics::Phase::CONFIG, phaseStart);
+  Metrics::watch(xTaskGetCurrentTaskHandle());
   subscribeToCommand(mqtt, LAMP_SWITCH_PIN, FAN_SWITCH_PIN);
+  Connection::begin(mqtt);
 
   RemoteXYConfigurer::updateConfigToRemote(wifiConfig, mqttConfig);
 
   taskMutex = xSemaphoreCreateMutex();
+
+  Ui::begin();
 }
 
-auto lastReconnectAttempt = millis();
 auto lastConfig = millis();
 
 void loop()
 {
-  RemoteXY_Handler();
   if (RemoteXY.button_store_config != LOW)
   {
     controlledTask(taskMutex, lastConfig, 1000, {
@@ -57,12 +64,8 @@ void loop()
     });
   }
 
-  mqtt.poll(
-      []
-      {
-        controlledTask(taskMutex, lastReconnectAttempt, 1000, {
-          MqttConfigurer::reconnect(mqttConfig, mqtt);
-          subscribeToCommand(mqtt, LAMP_SWITCH_PIN, FAN_SWITCH_PIN);
-        });
-      });
+  Connection::poll(RemoteXYConfigurer::showLink);
+
+  Metrics::poll(mqtt);
+  Ui::commit();
 }
\ No newline at end of file
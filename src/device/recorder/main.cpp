@@ -12,12 +12,15 @@
 #define REMOTEXY_BLUETOOTH_NAME "ESP32Recorder"
 #include "core/remotexy.h"
 
+#include "core/connection.h"
+#include "core/metrics.h"
 #include "core/mqtt.h"
 #include "core/record.h"
+#include "core/spool.h"
 #include "core/wifi.h"
-#include "core/filesystem.h"
 #include "core/utils.h"
 #include "core/control.h"
+#include "core/ui.h"
 
 #include "device/recorder/recorder.h"
 
@@ -40,31 +43,34 @@ void setup()
   recorder.begin(RECORDER_SAMPLE_RATE);
 
   int code;
-  ensureSetup(code, FileSystem::setup(), "SPIFFS");
+  // Only loads the settings from NVS, the link task connects (and times the
+  // WiFi and MQTT phases). SPIFFS is mounted when something first needs it.
+  auto phaseStart = millis();
   ensureSetup(code, WiFiConfigurer::setup(wifiConfig), "WiFi");
   ensureSetup(code, MqttConfigurer::setup(mqttConfig, mqtt), "MQTT");
+  Metrics::phase(Metrics::Phase::CONFIG, phaseStart);
+  Metrics::watch(xTaskGetCurrentTaskHandle());
   subscribeToVerifyResult(mqtt);
+  subscribeToSpeakerTemplates(mqtt);
+  subscribeToRetransmit(mqtt);
+  Connection::begin(mqtt);
+  SessionSpool::begin(mqtt);
 
   RemoteXYConfigurer::updateConfigToRemote(wifiConfig, mqttConfig);
   RemoteXYConfigurer::resetVerifyResult();
+
+  Ui::begin();
 }
 
-auto lastReconnectAttempt = millis();
 auto lastConfig = millis();
 auto lastRecording = millis();
 auto lastSampling = millis();
 auto lastSamplingTry = millis();
-auto lastPeakHit = millis();
 auto lastRecordingStart = millis();
 
-size_t bytesRead;
-size_t actualBufferSize = RECORDER_BUFFER_SIZE * AudioConfig::validBytesPerSample / AudioConfig::bytesPerSample;
-int32_t realtimeBuffer[RECORDER_BUFFER_SIZE];
 bool isSendingRecorder = false;
 void loop()
 {
-  RemoteXY_Handler();
-
 #if USE_REALTIME_RECORDING == 0
   if (RemoteXY.button_recorder != LOW)
   {
@@ -77,8 +83,7 @@ void loop()
   {
     Record::poll(
         recorder, mqtt,
-        realtimeBuffer, bytesRead,
-        lastPeakHit, lastRecordingStart,
+        lastRecordingStart,
         isSendingRecorder,
         BUILTIN_LED_PIN);
   }
@@ -94,27 +99,32 @@ void loop()
   if (RemoteXY.button_sampler != LOW)
   {
     timedFor(lastSamplingTry, 300, {
-      auto sampleName = String(RemoteXY.input_voice_name);
-      sampleName.trim();
-      if (sampleName.charAt(0) != '\0')
+      // trimmed copy on the stack, the recording path never touches the heap
+      char sampleName[sizeof(RemoteXY.input_voice_name)];
+      const char *start = RemoteXY.input_voice_name;
+      while (isspace(*start))
+        start++;
+      size_t length = strnlen(start, sizeof(sampleName) - 1);
+      while (length > 0 && isspace(start[length - 1]))
+        length--;
+      memcpy(sampleName, start, length);
+      sampleName[length] = '\0';
+
+      if (sampleName[0] != '\0')
       {
         timedFor(lastSampling, 6000, {
-          Record::sample(recorder, mqtt, BUILTIN_LED_PIN, sampleName.c_str());
+          Record::sample(recorder, mqtt, BUILTIN_LED_PIN, sampleName);
         });
       }
       else
       {
-        sprintf(RemoteXY.value_sampler_status, "Empty sample name");
+        sprintf(Ui::state().value_sampler_status, "Empty sample name");
       }
     });
   }
 
-  mqtt.poll(
-      []
-      {
-        timedFor(lastReconnectAttempt, 1000, {
-          MqttConfigurer::reconnect(mqttConfig, mqtt);
-          subscribeToVerifyResult(mqtt);
-        });
-      });
+  Connection::poll(RemoteXYConfigurer::showLink);
+
+  Metrics::poll(mqtt);
+  Ui::commit();
 }
\ No newline at end of file
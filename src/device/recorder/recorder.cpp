@@ -1,7 +1,9 @@
 #include "device/recorder/recorder.h"
 
+#include "core/record.h"
+#include "core/speaker.h"
 #include "core/utils.h"
-#include "core/remotexy.h"
+#include "core/ui.h"
 
 #include "mqtt/protocol.h"
 
@@ -27,20 +29,20 @@ void subscribeToVerifyResult(Mqtt &mqtt)
         index += 4;
 
         uint8_t referenceSize = msg[index++];
-        referenceSize = min(referenceSize, static_cast<uint8_t>(sizeof(RemoteXY.value_recorder_reference) - 1));
-        char reference[referenceSize + 1] = {0};
+        referenceSize = min(referenceSize, static_cast<uint8_t>(sizeof(UiOutputs::value_recorder_reference) - 1));
+        char reference[sizeof(UiOutputs::value_recorder_reference)] = {0};
         memcpy(&reference, &msg[index], referenceSize);
         index += referenceSize;
 
         uint8_t transcriptionSize = msg[index++];
-        transcriptionSize = min(transcriptionSize, static_cast<uint8_t>(sizeof(RemoteXY.value_recorder_transcription) - 1));
-        char transcription[transcriptionSize + 1] = {0};
+        transcriptionSize = min(transcriptionSize, static_cast<uint8_t>(sizeof(UiOutputs::value_recorder_transcription) - 1));
+        char transcription[sizeof(UiOutputs::value_recorder_transcription)] = {0};
         memcpy(&transcription, &msg[index], transcriptionSize);
         index += transcriptionSize;
 
         uint8_t commandSize = msg[index++];
-        commandSize = min(commandSize, static_cast<uint8_t>(sizeof(RemoteXY.value_recorder_command) - 1));
-        char command[commandSize + 1] = {0};
+        commandSize = min(commandSize, static_cast<uint8_t>(sizeof(UiOutputs::value_recorder_command) - 1));
+        char command[sizeof(UiOutputs::value_recorder_command)] = {0};
         memcpy(&command, &msg[index], commandSize);
 
         ESP_LOGI(
@@ -59,16 +61,38 @@ void subscribeToVerifyResult(Mqtt &mqtt)
 
         if (verified)
         {
-          sprintf(RemoteXY.value_recorder_verified_status, "Terverifikasi");
+          sprintf(Ui::state().value_recorder_verified_status, "Terverifikasi");
         }
         else
         {
-          sprintf(RemoteXY.value_recorder_verified_status, "Tidak terverifikasi");
+          sprintf(Ui::state().value_recorder_verified_status, "Tidak terverifikasi");
         }
 
-        sprintf(RemoteXY.value_recorder_similarity_status, "%f%", similarity * 100);
-        sprintf(RemoteXY.value_recorder_reference, reference);
-        sprintf(RemoteXY.value_recorder_transcription, transcription);
-        sprintf(RemoteXY.value_recorder_command, command);
+        sprintf(Ui::state().value_recorder_similarity_status, "%f%", similarity * 100);
+        sprintf(Ui::state().value_recorder_reference, reference);
+        sprintf(Ui::state().value_recorder_transcription, transcription);
+        sprintf(Ui::state().value_recorder_command, command);
+      });
+}
+
+void subscribeToSpeakerTemplates(Mqtt &mqtt)
+{
+#if RECORDER_SPEAKER_SCREEN
+  mqtt.subscribe(
+      MqttTopic::SPEAKER_TEMPLATES,
+      [](auto msg, auto size)
+      {
+        Record::updateSpeakerTemplates(reinterpret_cast<const uint8_t *>(msg), size);
+      });
+#endif
+}
+
+void subscribeToRetransmit(Mqtt &mqtt)
+{
+  mqtt.subscribe(
+      MqttTopic::RETRANSMIT,
+      [&mqtt](auto msg, auto size)
+      {
+        mqtt.requestResend(reinterpret_cast<const uint8_t *>(msg), size);
       });
 }
\ No newline at end of file
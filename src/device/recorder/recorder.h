@@ -2,4 +2,6 @@
 
 #define RECORDER_IDENTIFIER "recorder"
 
-void subscribeToVerifyResult(Mqtt &mqtt);
\ No newline at end of file
+void subscribeToVerifyResult(Mqtt &mqtt);
+void subscribeToSpeakerTemplates(Mqtt &mqtt);
+void subscribeToRetransmit(Mqtt &mqtt);
\ No newline at end of file
@@ -0,0 +1,138 @@
+#include "dsp/adpcm.h"
+
+namespace Adpcm
+{
+  static const int16_t stepTable[89] = {
+      7, 8, 9, 10, 11, 12, 13, 14, 16, 17,
+      19, 21, 23, 25, 28, 31, 34, 37, 41, 45,
+      50, 55, 60, 66, 73, 80, 88, 97, 107, 118,
+      130, 143, 157, 173, 190, 209, 230, 253, 279, 307,
+      337, 371, 408, 449, 494, 544, 598, 658, 724, 796,
+      876, 963, 1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066,
+      2272, 2499, 2749, 3024, 3327, 3660, 4026, 4428, 4871, 5358,
+      5894, 6484, 7132, 7845, 8630, 9493, 10442, 11487, 12635, 13899,
+      15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794, 32767};
+
+  static const int8_t indexTable[16] = {
+      -1, -1, -1, -1, 2, 4, 6, 8,
+      -1, -1, -1, -1, 2, 4, 6, 8};
+
+  static inline int32_t clamp16(int32_t v)
+  {
+    return v < -32768 ? -32768 : (v > 32767 ? 32767 : v);
+  }
+
+  // Shared by encoder and decoder so both track the exact same predictor.
+  static inline void step(State &state, uint8_t code)
+  {
+    int32_t s = stepTable[state.index];
+    int32_t diff = s >> 3;
+    if (code & 4)
+      diff += s;
+    if (code & 2)
+      diff += s >> 1;
+    if (code & 1)
+      diff += s >> 2;
+
+    state.predictor = clamp16(code & 8 ? state.predictor - diff : state.predictor + diff);
+    state.index += indexTable[code];
+    state.index = state.index < 0 ? 0 : (state.index > 88 ? 88 : state.index);
+  }
+
+  static inline uint8_t quantize(State &state, int32_t sample)
+  {
+    int32_t diff = sample - state.predictor;
+    uint8_t code = 0;
+    if (diff < 0)
+    {
+      code = 8;
+      diff = -diff;
+    }
+
+    int32_t s = stepTable[state.index];
+    if (diff >= s)
+    {
+      code |= 4;
+      diff -= s;
+    }
+    s >>= 1;
+    if (diff >= s)
+    {
+      code |= 2;
+      diff -= s;
+    }
+    s >>= 1;
+    if (diff >= s)
+      code |= 1;
+
+    step(state, code);
+    return code;
+  }
+
+  size_t encodeBlock(State &state, const int32_t *samples, size_t count, uint8_t *dest)
+  {
+    if (count == 0)
+      return 0;
+    if (count > 0xFFFF)
+      count = 0xFFFF;
+
+    state.predictor = clamp16(samples[0] >> 8);
+
+    dest[0] = static_cast<uint8_t>(count);
+    dest[1] = static_cast<uint8_t>(count >> 8);
+    dest[2] = static_cast<uint8_t>(state.predictor);
+    dest[3] = static_cast<uint8_t>(state.predictor >> 8);
+    dest[4] = static_cast<uint8_t>(state.index);
+    dest[5] = 0;
+
+    uint8_t *out = dest + blockHeaderSize;
+    size_t i = 1;
+    for (; i + 1 < count; i += 2)
+    {
+      uint8_t lo = quantize(state, clamp16(samples[i] >> 8));
+      uint8_t hi = quantize(state, clamp16(samples[i + 1] >> 8));
+      *out++ = static_cast<uint8_t>(lo | (hi << 4));
+    }
+    if (i < count)
+      *out++ = quantize(state, clamp16(samples[i] >> 8));
+
+    return out - dest;
+  }
+
+  size_t decode(const uint8_t *src, size_t size, float *out, size_t capacity)
+  {
+    constexpr float scale = 1.0f / 32768.0f;
+    size_t total = 0;
+    size_t offset = 0;
+
+    while (offset + blockHeaderSize <= size)
+    {
+      const uint8_t *block = src + offset;
+      size_t count = block[0] | (block[1] << 8);
+      size_t blockSize = encodedSize(count);
+      if (count == 0 || offset + blockSize > size)
+        break;
+
+      State state;
+      state.predictor = static_cast<int16_t>(block[2] | (block[3] << 8));
+      state.index = block[4] > 88 ? 88 : block[4];
+
+      if (out && total < capacity)
+        out[total] = state.predictor * scale;
+
+      const uint8_t *codes = block + blockHeaderSize;
+      for (size_t i = 1; i < count; i++)
+      {
+        uint8_t byte = codes[(i - 1) >> 1];
+        step(state, (i & 1) ? (byte & 0x0F) : (byte >> 4));
+        if (out && total + i < capacity)
+          out[total + i] = state.predictor * scale;
+      }
+
+      total += count;
+      offset += blockSize;
+    }
+
+    return total;
+  }
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Streaming IMA-ADPCM (4 bits per sample) used as an optional fragment codec.
+//
+// Every fragment is one self-contained block so a lost or coalesced fragment
+// never desynchronizes the decoder:
+//
+//   SAMPLES   | 2B (uint16 LE)  | number of samples in the block
+//   PREDICTOR | 2B (int16 LE)   | first sample, stored verbatim
+//   INDEX     | 1B              | step index for the second sample
+//   RESERVED  | 1B              | 0
+//   CODES     | (SAMPLES - 1 + 1) / 2 B | 4-bit codes, low nibble first
+//
+// The step index is carried from block to block while encoding, so the
+// adaptation does not restart at every fragment.
+namespace Adpcm
+{
+  constexpr size_t blockHeaderSize = 6;
+
+  struct State
+  {
+    int32_t predictor = 0;
+    int32_t index = 0;
+  };
+
+  constexpr size_t encodedSize(size_t samples)
+  {
+    return samples == 0 ? 0 : blockHeaderSize + samples / 2;
+  }
+
+  // Encodes signed 24-bit samples (quantized to 16 bits) into one block and
+  // returns the number of bytes written, encodedSize(count) at most.
+  size_t encodeBlock(State &state, const int32_t *samples, size_t count, uint8_t *dest);
+
+  // Decodes a sequence of concatenated blocks into [-1, 1) floats. Returns the
+  // number of samples in `src` (decoding only up to `capacity` of them), so a
+  // call with `out == nullptr` measures the output. Trailing garbage that does
+  // not form a complete block is ignored.
+  size_t decode(const uint8_t *src, size_t size, float *out, size_t capacity);
+}
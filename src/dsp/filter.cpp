@@ -0,0 +1,118 @@
+#include "dsp/filter.h"
+
+#include <cmath>
+
+namespace Filter
+{
+  static constexpr int32_t sampleMax = 0x7FFFFF;
+  static constexpr int32_t sampleMin = -0x800000;
+
+  static inline int32_t saturate24(int64_t v)
+  {
+    return v > sampleMax ? sampleMax : (v < sampleMin ? sampleMin : static_cast<int32_t>(v));
+  }
+
+  static inline int32_t toQ30(double c)
+  {
+    return static_cast<int32_t>(lround(c * (1 << 30)));
+  }
+
+  Biquad highPass(float cutoffHz, float sampleRate)
+  {
+    double w0 = 2.0 * M_PI * cutoffHz / sampleRate;
+    double alpha = sin(w0) * M_SQRT1_2; // sin(w0) / 2Q with Q = 1/sqrt(2)
+    double cosw0 = cos(w0);
+    double a0 = 1.0 + alpha;
+
+    Biquad filter;
+    filter.b0 = toQ30((1.0 + cosw0) / 2.0 / a0);
+    filter.b1 = toQ30(-(1.0 + cosw0) / a0);
+    filter.b2 = filter.b0;
+    filter.a1 = toQ30(-2.0 * cosw0 / a0);
+    filter.a2 = toQ30((1.0 - alpha) / a0);
+    return filter;
+  }
+
+  void process(const Biquad &filter, BiquadState &state, int32_t *samples, size_t count, size_t stride)
+  {
+    int32_t x1 = state.x1, x2 = state.x2;
+    int32_t y1 = state.y1, y2 = state.y2;
+    // Keep the truncated bits and feed them back (first order error
+    // shaping), otherwise a low cutoff leaves a small DC residue behind.
+    int64_t error = state.error;
+
+    for (size_t i = 0; i < count; i += stride)
+    {
+      int32_t x0 = samples[i];
+      int64_t acc = error +
+                    static_cast<int64_t>(filter.b0) * x0 +
+                    static_cast<int64_t>(filter.b1) * x1 +
+                    static_cast<int64_t>(filter.b2) * x2 -
+                    static_cast<int64_t>(filter.a1) * y1 -
+                    static_cast<int64_t>(filter.a2) * y2;
+      int32_t y0 = saturate24(acc >> 30);
+      error = acc - static_cast<int64_t>(y0) * (int64_t(1) << 30);
+      if (error < 0 || error >= (int64_t(1) << 30))
+        error = 0; // saturated, do not carry the overflow
+
+      x2 = x1;
+      x1 = x0;
+      y2 = y1;
+      y1 = y0;
+      samples[i] = y0;
+    }
+
+    state.x1 = x1;
+    state.x2 = x2;
+    state.y1 = y1;
+    state.y2 = y2;
+    state.error = static_cast<int32_t>(error);
+  }
+
+  AgcConfig defaultAgcConfig()
+  {
+    AgcConfig config;
+    config.targetPeak = static_cast<int32_t>(sampleMax * pow(10.0, RECORDER_AGC_TARGET_DB / 20.0));
+    config.maxGainQ16 = static_cast<int32_t>(65536.0 * pow(10.0, RECORDER_AGC_MAX_GAIN_DB / 20.0));
+    config.releaseShift = RECORDER_AGC_RELEASE_SHIFT;
+    return config;
+  }
+
+  int32_t agc(const AgcConfig &config, AgcState &state, int32_t *samples, size_t count)
+  {
+    if (count == 0)
+      return state.gainQ16;
+
+    int32_t peak = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+      int32_t absolute = samples[i] < 0 ? -samples[i] : samples[i];
+      if (absolute > peak)
+        peak = absolute;
+    }
+
+    int32_t from = state.gainQ16;
+    int64_t desired = peak == 0 ? config.maxGainQ16 : (static_cast<int64_t>(config.targetPeak) << 16) / peak;
+    if (desired > config.maxGainQ16)
+      desired = config.maxGainQ16;
+    if (desired < (1 << 16))
+      desired = 1 << 16; // never attenuate below unity, only undo our own gain
+
+    int32_t to = desired < from
+                     ? static_cast<int32_t>(desired)
+                     : from + static_cast<int32_t>((desired - from) >> config.releaseShift);
+    state.gainQ16 = to;
+
+    // Cut the gain at once so the loud buffer itself does not clip, ramp
+    // increases across the buffer.
+    int32_t step = to < from ? 0 : (to - from) / static_cast<int32_t>(count);
+    int32_t gain = to < from ? to : from;
+    for (size_t i = 0; i < count; i++)
+    {
+      gain += step;
+      samples[i] = saturate24((static_cast<int64_t>(samples[i]) * gain) >> 16);
+    }
+
+    return to;
+  }
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#ifndef RECORDER_HIGHPASS_HZ
+#define RECORDER_HIGHPASS_HZ 0 // DC-blocking high-pass cutoff, 0 to disable
+#endif
+
+#ifndef RECORDER_AGC
+#define RECORDER_AGC 0 // 1 to enable the automatic gain control
+#endif
+
+#ifndef RECORDER_AGC_TARGET_DB
+#define RECORDER_AGC_TARGET_DB -6 // dBFS, peak level the AGC aims for
+#endif
+
+#ifndef RECORDER_AGC_MAX_GAIN_DB
+#define RECORDER_AGC_MAX_GAIN_DB 24
+#endif
+
+#ifndef RECORDER_AGC_RELEASE_SHIFT
+#define RECORDER_AGC_RELEASE_SHIFT 4 // gain rises by 1/2^shift of the gap per buffer
+#endif
+
+// In-place conditioning of signed 24-bit samples, applied in the capture task
+// between normalization and packing. All per-sample work is integer.
+namespace Filter
+{
+  // Direct form I biquad, coefficients in Q30 (|c| < 2), a0 normalized to 1.
+  struct Biquad
+  {
+    int32_t b0, b1, b2;
+    int32_t a1, a2;
+  };
+
+  struct BiquadState
+  {
+    int32_t x1 = 0, x2 = 0;
+    int32_t y1 = 0, y2 = 0;
+    int32_t error = 0; // truncated Q30 bits, fed back into the next sample
+  };
+
+  // Second order Butterworth high-pass (RBJ cookbook), computed once in float.
+  Biquad highPass(float cutoffHz, float sampleRate);
+
+  // Filters every `stride`-th sample, so interleaved channels each get their own state.
+  void process(const Biquad &filter, BiquadState &state, int32_t *samples, size_t count, size_t stride = 1);
+
+  struct AgcConfig
+  {
+    int32_t targetPeak;  // 24-bit
+    int32_t maxGainQ16;
+    uint8_t releaseShift;
+  };
+
+  struct AgcState
+  {
+    int32_t gainQ16 = 1 << 16;
+  };
+
+  // Builds an AgcConfig from the RECORDER_AGC_* macros.
+  AgcConfig defaultAgcConfig();
+
+  // Slow peak-based AGC: the gain falls immediately when a buffer would
+  // exceed the target, otherwise it rises by a fraction of the gap, ramped
+  // linearly across the buffer to avoid zipper noise. Output is
+  // saturated to 24 bits. Returns the gain used at the end of the buffer.
+  int32_t agc(const AgcConfig &config, AgcState &state, int32_t *samples, size_t count);
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+#include <cstdint>
+
+// Small fixed point helpers shared by the dsp stages.
+namespace Fixed
+{
+  // log2 in Q8 (0 for 0). The mantissa bits below the leading one
+  // approximate the fraction linearly, within 0.09 (about 0.26 dB in power).
+  inline int32_t log2Q8(uint64_t value)
+  {
+    if (value == 0)
+      return 0;
+
+    int32_t exponent = 63 - __builtin_clzll(value);
+    uint32_t fraction = exponent >= 8 ? static_cast<uint32_t>(value >> (exponent - 8)) & 0xFF
+                                      : static_cast<uint32_t>(value << (8 - exponent)) & 0xFF;
+    return (exponent << 8) | static_cast<int32_t>(fraction);
+  }
+}
@@ -0,0 +1,286 @@
+#include "dsp/lossless.h"
+
+namespace Lossless
+{
+  struct BitWriter
+  {
+    uint8_t *data;
+    size_t capacity;
+    size_t bytes = 0;
+    uint32_t accumulator = 0;
+    uint8_t bits = 0;
+    bool overflow = false;
+
+    inline void flushByte()
+    {
+      if (bytes >= capacity)
+      {
+        overflow = true;
+        return;
+      }
+      data[bytes++] = static_cast<uint8_t>(accumulator >> 24);
+      accumulator <<= 8;
+      bits -= 8;
+    }
+
+    // Writes the low `count` (<= 24) bits of `value`. Nothing is written
+    // once the output overflowed, the bits it holds no longer drain.
+    inline void write(uint32_t value, uint8_t count)
+    {
+      if (count == 0 || overflow)
+        return;
+      accumulator |= (value & ((1u << count) - 1)) << (32 - bits - count);
+      bits += count;
+      while (bits >= 8 && !overflow)
+        flushByte();
+    }
+
+    inline void unary(uint32_t zeros)
+    {
+      if (overflow)
+        return;
+      while (zeros >= 16 && !overflow)
+      {
+        write(0, 16);
+        zeros -= 16;
+      }
+      write(1, zeros + 1);
+    }
+
+    inline void finish()
+    {
+      if (bits > 0 && !overflow)
+      {
+        bits = 8;
+        flushByte();
+      }
+    }
+  };
+
+  struct BitReader
+  {
+    const uint8_t *data;
+    size_t size;
+    size_t position = 0; // in bits
+
+    inline bool bit(uint32_t &value)
+    {
+      if (position >= size * 8)
+        return false;
+      value = (data[position >> 3] >> (7 - (position & 7))) & 1;
+      position++;
+      return true;
+    }
+
+    inline bool read(uint32_t &value, uint8_t count)
+    {
+      value = 0;
+      for (uint8_t i = 0; i < count; i++)
+      {
+        uint32_t b;
+        if (!bit(b))
+          return false;
+        value = (value << 1) | b;
+      }
+      return true;
+    }
+  };
+
+  static inline int32_t predict(const int32_t *x, size_t n, uint8_t order)
+  {
+    switch (order)
+    {
+    case 1:
+      return x[n - 1];
+    case 2:
+      return 2 * x[n - 1] - x[n - 2];
+    case 3:
+      return 3 * x[n - 1] - 3 * x[n - 2] + x[n - 3];
+    case 4:
+      return 4 * x[n - 1] - 6 * x[n - 2] + 4 * x[n - 3] - x[n - 4];
+    default:
+      return 0;
+    }
+  }
+
+  static inline uint32_t zigzag(int32_t r) { return (static_cast<uint32_t>(r) << 1) ^ static_cast<uint32_t>(r >> 31); }
+  static inline int32_t unzigzag(uint32_t u) { return static_cast<int32_t>(u >> 1) ^ -static_cast<int32_t>(u & 1); }
+
+  static inline void put24(uint8_t *dest, int32_t s)
+  {
+    dest[0] = static_cast<uint8_t>(s);
+    dest[1] = static_cast<uint8_t>(s >> 8);
+    dest[2] = static_cast<uint8_t>(s >> 16);
+  }
+
+  static inline int32_t get24(const uint8_t *src)
+  {
+    return static_cast<int32_t>((src[0] | (src[1] << 8) | (src[2] << 16)) << 8) >> 8;
+  }
+
+  static size_t writeVerbatim(const int32_t *samples, size_t count, uint8_t *dest)
+  {
+    size_t size = count * 3;
+    dest[2] = verbatim;
+    dest[3] = 0;
+    dest[4] = static_cast<uint8_t>(size);
+    dest[5] = static_cast<uint8_t>(size >> 8);
+    for (size_t i = 0; i < count; i++)
+      put24(dest + blockHeaderSize + i * 3, samples[i]);
+    return blockHeaderSize + size;
+  }
+
+  size_t encodeBlock(const int32_t *samples, size_t count, uint8_t *dest)
+  {
+    if (count == 0)
+      return 0;
+    // keep SIZE within 16 bits for the verbatim fallback
+    if (count > 0xFFFF / 3)
+      count = 0xFFFF / 3;
+
+    dest[0] = static_cast<uint8_t>(count);
+    dest[1] = static_cast<uint8_t>(count >> 8);
+    if (count <= maxOrder)
+      return writeVerbatim(samples, count, dest);
+
+    // Pass 1: zigzag residual magnitude of every order over the same range.
+    uint64_t sums[maxOrder + 1] = {0};
+    for (size_t n = maxOrder; n < count; n++)
+    {
+      for (uint8_t order = 0; order <= maxOrder; order++)
+        sums[order] += zigzag(samples[n] - predict(samples, n, order));
+    }
+
+    uint8_t order = 0;
+    for (uint8_t o = 1; o <= maxOrder; o++)
+    {
+      if (sums[o] < sums[order])
+        order = o;
+    }
+
+    // Rice parameter close to log2 of the mean zigzag residual
+    uint64_t residuals = count - maxOrder;
+    uint8_t k = 0;
+    while (k < 24 && (residuals << (k + 1)) <= sums[order])
+      k++;
+
+    // Pass 2: emit, falling back to verbatim as soon as it stops paying off.
+    const size_t limit = count * 3;
+    uint8_t *payload = dest + blockHeaderSize;
+    for (uint8_t i = 0; i < order; i++)
+      put24(payload + i * 3, samples[i]);
+
+    BitWriter writer{payload + order * 3, limit - order * 3};
+    for (size_t n = order; n < count && !writer.overflow; n++)
+    {
+      uint32_t u = zigzag(samples[n] - predict(samples, n, order));
+      uint32_t q = u >> k;
+      if (q > limit * 8)
+      {
+        writer.overflow = true;
+        break;
+      }
+      writer.unary(q);
+      if (writer.overflow)
+        break;
+      writer.write(u, k);
+    }
+    writer.finish();
+
+    if (writer.overflow)
+      return writeVerbatim(samples, count, dest);
+
+    size_t size = order * 3 + writer.bytes;
+    dest[2] = order;
+    dest[3] = k;
+    dest[4] = static_cast<uint8_t>(size);
+    dest[5] = static_cast<uint8_t>(size >> 8);
+    return blockHeaderSize + size;
+  }
+
+  size_t decode(const uint8_t *src, size_t size, float *out, size_t capacity)
+  {
+    constexpr float scale = 1.0f / 8388608.0f;
+    size_t total = 0;
+    size_t offset = 0;
+
+    while (offset + blockHeaderSize <= size)
+    {
+      const uint8_t *block = src + offset;
+      size_t count = block[0] | (block[1] << 8);
+      uint8_t order = block[2];
+      uint8_t k = block[3];
+      size_t payloadSize = block[4] | (block[5] << 8);
+      const uint8_t *payload = block + blockHeaderSize;
+
+      if (count == 0 || offset + blockHeaderSize + payloadSize > size)
+        break;
+
+      if (order == verbatim)
+      {
+        if (payloadSize < count * 3)
+          break;
+        for (size_t i = 0; i < count; i++)
+        {
+          if (out && total + i < capacity)
+            out[total + i] = get24(payload + i * 3) * scale;
+        }
+      }
+      else
+      {
+        if (order > maxOrder || k > 24 || count <= order || payloadSize < order * 3u)
+          break;
+
+        // The predictor needs the previous `order` samples, keep them locally
+        // so decoding never depends on `capacity`.
+        int32_t history[maxOrder];
+        for (uint8_t i = 0; i < order; i++)
+        {
+          history[i] = get24(payload + i * 3);
+          if (out && total + i < capacity)
+            out[total + i] = history[i] * scale;
+        }
+
+        BitReader reader{payload + order * 3, payloadSize - order * 3u};
+        bool truncated = false;
+        for (size_t n = order; n < count; n++)
+        {
+          uint32_t q = 0, b = 0, low = 0;
+          while (true)
+          {
+            if (!reader.bit(b))
+            {
+              truncated = true;
+              break;
+            }
+            if (b)
+              break;
+            q++;
+          }
+          if (truncated || !reader.read(low, k))
+          {
+            truncated = true;
+            break;
+          }
+
+          int32_t sample = unzigzag((q << k) | low) + predict(history + order, 0, order);
+          for (uint8_t i = 0; i + 1 < order; i++)
+            history[i] = history[i + 1];
+          if (order > 0)
+            history[order - 1] = sample;
+
+          if (out && total + n < capacity)
+            out[total + n] = sample * scale;
+        }
+
+        if (truncated)
+          break;
+      }
+
+      total += count;
+      offset += blockHeaderSize + payloadSize;
+    }
+
+    return total;
+  }
+}
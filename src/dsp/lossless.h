@@ -0,0 +1,39 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Lossless fragment codec: FLAC-style fixed polynomial predictor (order 0-4)
+// with a single Rice parameter per block. Works on signed 24-bit samples and
+// needs no memory beyond the fragment itself.
+//
+//   SAMPLES  | 2B (uint16 LE)      | number of samples in the block
+//   ORDER    | 1B                  | predictor order, or `verbatim`
+//   RICE     | 1B                  | Rice parameter
+//   SIZE     | 2B (uint16 LE)      | bytes following the header
+//   WARMUP   | ORDER * 3B          | first ORDER samples, 24-bit LE
+//   RESIDUAL | SIZE - ORDER * 3 B  | Rice-coded zigzag residuals, MSB first
+//
+// A verbatim block stores SAMPLES * 3 bytes of 24-bit LE PCM instead, which
+// bounds the output to maxEncodedSize() whatever the input looks like.
+namespace Lossless
+{
+  constexpr size_t blockHeaderSize = 6;
+  constexpr uint8_t maxOrder = 4;
+  constexpr uint8_t verbatim = 0xFF;
+
+  constexpr size_t maxEncodedSize(size_t samples)
+  {
+    return samples == 0 ? 0 : blockHeaderSize + samples * 3;
+  }
+
+  // Encodes signed 24-bit samples into one block and returns the number of
+  // bytes written, never more than maxEncodedSize(count).
+  size_t encodeBlock(const int32_t *samples, size_t count, uint8_t *dest);
+
+  // Decodes a sequence of concatenated blocks into [-1, 1) floats. Returns the
+  // number of samples in `src` (decoding only up to `capacity` of them), so a
+  // call with `out == nullptr` measures the output. Decoding stops at the
+  // first truncated or malformed block.
+  size_t decode(const uint8_t *src, size_t size, float *out, size_t capacity);
+}
@@ -0,0 +1,185 @@
+#include "dsp/mel.h"
+#include "dsp/fixed.h"
+
+#include <cmath>
+#include <cstring>
+
+namespace Mel
+{
+  static inline double hzToMel(double hz) { return 2595.0 * log10(1.0 + hz / 700.0); }
+  static inline double melToHz(double mel) { return 700.0 * (pow(10.0, mel / 2595.0) - 1.0); }
+
+  static inline void put16(uint8_t *dest, uint16_t v)
+  {
+    dest[0] = static_cast<uint8_t>(v);
+    dest[1] = static_cast<uint8_t>(v >> 8);
+  }
+
+  size_t writeDescriptor(const Layout &layout, uint8_t *dest)
+  {
+    memcpy(dest, "LMEL", 4);
+    put16(dest + 4, static_cast<uint16_t>(layout.sampleRate));
+    put16(dest + 6, static_cast<uint16_t>(layout.sampleRate >> 16));
+    put16(dest + 8, fftSize);
+    put16(dest + 10, layout.window);
+    put16(dest + 12, layout.hop);
+    dest[14] = bins;
+    dest[15] = stepsPerOctave;
+    return descriptorSize;
+  }
+
+  void Extractor::begin(uint32_t sampleRate)
+  {
+    current = layoutFor(sampleRate);
+    filled = 0;
+
+    for (size_t k = 0; k < fftSize / 2; k++)
+    {
+      double angle = 2.0 * M_PI * k / fftSize;
+      cosTable[k] = static_cast<int16_t>(lround(cos(angle) * 32767.0));
+      sinTable[k] = static_cast<int16_t>(lround(sin(angle) * 32767.0));
+    }
+
+    for (size_t i = 0; i < fftSize; i++)
+    {
+      double w = i < current.window ? 0.5 - 0.5 * cos(2.0 * M_PI * i / current.window) : 0.0;
+      window[i] = static_cast<int16_t>(lround(w * 32767.0));
+    }
+
+    // bins + 2 edges evenly spaced in mel between 0 and Nyquist, triangles
+    // evaluated at the FFT bin centre frequencies.
+    double maxMel = hzToMel(sampleRate / 2.0);
+    double binHz = static_cast<double>(sampleRate) / fftSize;
+    size_t used = 0;
+    for (size_t m = 0; m < bins; m++)
+    {
+      double left = melToHz(maxMel * m / (bins + 1));
+      double centre = melToHz(maxMel * (m + 1) / (bins + 1));
+      double right = melToHz(maxMel * (m + 2) / (bins + 1));
+
+      first[m] = 0;
+      length[m] = 0;
+      offset[m] = static_cast<uint16_t>(used);
+      for (size_t k = 0; k <= fftSize / 2 && used < sizeof(weights) / sizeof(weights[0]); k++)
+      {
+        double hz = k * binHz;
+        double w = hz <= left || hz >= right ? 0.0 : (hz <= centre ? (hz - left) / (centre - left) : (right - hz) / (right - centre));
+        uint16_t q = static_cast<uint16_t>(lround(w * 32768.0));
+        if (q == 0)
+        {
+          if (length[m] != 0)
+            break;
+          continue;
+        }
+        if (length[m] == 0)
+          first[m] = static_cast<uint16_t>(k);
+        weights[used++] = q;
+        length[m]++;
+      }
+    }
+  }
+
+  // Scaled iterative radix-2 DIT: every stage halves, so the output is the
+  // DFT divided by fftSize and can never overflow.
+  void Extractor::fft()
+  {
+    for (size_t i = 1, j = 0; i < fftSize; i++)
+    {
+      size_t bit = fftSize >> 1;
+      for (; j & bit; bit >>= 1)
+        j ^= bit;
+      j ^= bit;
+      if (i < j)
+      {
+        int32_t t = re[i];
+        re[i] = re[j];
+        re[j] = t;
+        t = im[i];
+        im[i] = im[j];
+        im[j] = t;
+      }
+    }
+
+    for (size_t len = 2; len <= fftSize; len <<= 1)
+    {
+      size_t half = len / 2;
+      size_t stride = fftSize / len;
+      for (size_t i = 0; i < fftSize; i += len)
+      {
+        for (size_t k = 0; k < half; k++)
+        {
+          int32_t wr = cosTable[k * stride];
+          int32_t wi = -sinTable[k * stride];
+          size_t a = i + k;
+          size_t b = a + half;
+
+          int32_t tr = static_cast<int32_t>((static_cast<int64_t>(re[b]) * wr - static_cast<int64_t>(im[b]) * wi + (1 << 14)) >> 15);
+          int32_t ti = static_cast<int32_t>((static_cast<int64_t>(re[b]) * wi + static_cast<int64_t>(im[b]) * wr + (1 << 14)) >> 15);
+
+          // rounded halving, truncation would bias quiet bins upwards
+          re[b] = (re[a] - tr + 1) >> 1;
+          im[b] = (im[a] - ti + 1) >> 1;
+          re[a] = (re[a] + tr + 1) >> 1;
+          im[a] = (im[a] + ti + 1) >> 1;
+        }
+      }
+    }
+  }
+
+  void Extractor::computeFrame(uint8_t *dest)
+  {
+    // 24-bit samples stay 24-bit: the scaled FFT never grows them and the
+    // twiddle products are computed in 64 bits.
+    for (size_t i = 0; i < fftSize; i++)
+    {
+      re[i] = i < current.window ? static_cast<int32_t>((static_cast<int64_t>(history[i]) * window[i]) >> 15) : 0;
+      im[i] = 0;
+    }
+
+    fft();
+
+    for (size_t m = 0; m < bins; m++)
+    {
+      uint64_t energy = 0;
+      const uint16_t *w = weights + offset[m];
+      for (size_t k = 0; k < length[m]; k++)
+      {
+        size_t bin = first[m] + k;
+        uint64_t power = static_cast<uint64_t>(static_cast<int64_t>(re[bin]) * re[bin] + static_cast<int64_t>(im[bin]) * im[bin]);
+        energy += (power * w[k]) >> 15;
+      }
+
+      int32_t level = (Fixed::log2Q8(energy) * stepsPerOctave + 128) >> 8;
+      dest[m] = static_cast<uint8_t>(level > 255 ? 255 : level);
+    }
+  }
+
+  size_t Extractor::process(const int32_t *samples, size_t count, uint8_t *dest, size_t capacity)
+  {
+    if (capacity < blockHeaderSize)
+      return 0;
+
+    size_t frames = 0;
+    uint8_t *out = dest + blockHeaderSize;
+    for (size_t i = 0; i < count; i++)
+    {
+      history[filled++] = samples[i];
+      if (filled < current.window)
+        continue;
+
+      if (blockHeaderSize + (frames + 1) * bins <= capacity && frames < 255)
+      {
+        computeFrame(out);
+        out += bins;
+        frames++;
+      }
+
+      memmove(history, history + current.hop, (current.window - current.hop) * sizeof(int32_t));
+      filled -= current.hop;
+    }
+
+    dest[0] = static_cast<uint8_t>(frames);
+    dest[1] = bins;
+    return blockHeaderSize + frames * bins;
+  }
+}
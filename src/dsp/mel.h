@@ -0,0 +1,110 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#ifndef RECORDER_MEL_BINS
+#define RECORDER_MEL_BINS 40
+#endif
+
+#ifndef RECORDER_MEL_FFT_SIZE
+#define RECORDER_MEL_FFT_SIZE 256 // power of two, the window is zero padded up to it
+#endif
+
+#ifndef RECORDER_MEL_WINDOW_MS
+#define RECORDER_MEL_WINDOW_MS 25
+#endif
+
+#ifndef RECORDER_MEL_HOP_MS
+#define RECORDER_MEL_HOP_MS 10
+#endif
+
+// Streaming log-mel features as a fragment codec. Portable C++, no platform
+// dependencies; the float math only runs in begin() to build the tables.
+//
+// Frames are computed every HOP samples over a Hann window of WINDOW samples
+// with a scaled radix-2 fixed-point FFT, a triangular (HTK) mel filterbank
+// and a log2 quantized to 1/4 steps (about 0.75 dB), one byte per bin:
+//
+//   FRAMES  | 1B                 | frames in this block, may be 0
+//   BINS    | 1B                 | mel bins per frame
+//   VALUES  | FRAMES * BINS B    | round(4 * log2(mel energy)), 0 for silence
+//
+// Frames run across fragment boundaries, so every block only holds the
+// frames that completed in it. The stream opens with a descriptor (see
+// writeDescriptor) in place of the WAV header.
+namespace Mel
+{
+  constexpr size_t fftSize = RECORDER_MEL_FFT_SIZE;
+  constexpr size_t bins = RECORDER_MEL_BINS;
+  constexpr size_t blockHeaderSize = 2;
+  constexpr size_t descriptorSize = 16;
+  constexpr uint8_t stepsPerOctave = 4;
+
+  static_assert((fftSize & (fftSize - 1)) == 0 && fftSize >= 16, "RECORDER_MEL_FFT_SIZE must be a power of two");
+  static_assert(bins > 0 && bins < 256, "RECORDER_MEL_BINS must fit in a byte");
+
+  struct Layout
+  {
+    uint32_t sampleRate;
+    uint16_t window;
+    uint16_t hop;
+  };
+
+  constexpr Layout layoutFor(uint32_t sampleRate)
+  {
+    uint32_t window = sampleRate * RECORDER_MEL_WINDOW_MS / 1000;
+    uint32_t hop = sampleRate * RECORDER_MEL_HOP_MS / 1000;
+    window = window > fftSize ? fftSize : (window == 0 ? 1 : window);
+    hop = hop > window ? window : (hop == 0 ? 1 : hop);
+    return Layout{sampleRate, static_cast<uint16_t>(window), static_cast<uint16_t>(hop)};
+  }
+
+  // Upper bound of a block for `samples` input samples at the given hop.
+  constexpr size_t maxEncodedSize(size_t samples, size_t hop)
+  {
+    return blockHeaderSize + (samples / hop + 1) * bins;
+  }
+
+  //   MAGIC  | 4B "LMEL"
+  //   RATE   | 4B (uint32 LE)
+  //   FFT    | 2B (uint16 LE)
+  //   WINDOW | 2B (uint16 LE) samples
+  //   HOP    | 2B (uint16 LE) samples
+  //   BINS   | 1B
+  //   STEPS  | 1B, quantization steps per log2 unit
+  size_t writeDescriptor(const Layout &layout, uint8_t *dest);
+
+  class Extractor
+  {
+  public:
+    void begin(uint32_t sampleRate);
+
+    // Feeds signed 24-bit samples and writes one block with the frames that
+    // completed, returns the block size.
+    size_t process(const int32_t *samples, size_t count, uint8_t *dest, size_t capacity);
+
+    const Layout &layout() const { return current; }
+
+  private:
+    void computeFrame(uint8_t *dest);
+    void fft();
+
+    Layout current{0, 1, 1};
+    size_t filled = 0;
+    int32_t history[fftSize];
+
+    int32_t re[fftSize];
+    int32_t im[fftSize];
+    int16_t window[fftSize];
+    int16_t cosTable[fftSize / 2];
+    int16_t sinTable[fftSize / 2];
+
+    // Triangles are stored back to back: bin m covers FFT bins
+    // [first[m], first[m] + length[m]) with weights from offset[m].
+    uint16_t first[bins];
+    uint16_t length[bins];
+    uint16_t offset[bins];
+    uint16_t weights[2 * (fftSize / 2 + 1)];
+  };
+}
@@ -0,0 +1,309 @@
+#include "dsp/nn.h"
+
+#include <cmath>
+#include <cstring>
+
+namespace Nn
+{
+  static inline int32_t bias(const Layer &layer, size_t channel)
+  {
+    int32_t value;
+    memcpy(&value, layer.bias + channel * sizeof(int32_t), sizeof(int32_t));
+    return value;
+  }
+
+  int8_t requantize(int32_t acc, int32_t multiplier, uint8_t shift, bool relu)
+  {
+    // Rounding doubling high multiply, then rounding right shift.
+    int64_t product = static_cast<int64_t>(acc) * multiplier;
+    int32_t value = static_cast<int32_t>((product + (int64_t(1) << 30)) >> 31);
+    if (shift > 0)
+      value = (value + (1 << (shift - 1))) >> shift;
+
+    int32_t low = relu ? 0 : -128;
+    return static_cast<int8_t>(value < low ? low : (value > 127 ? 127 : value));
+  }
+
+  // "Same" padding: output = ceil(input / stride), kernel centred.
+  static inline int32_t padBefore(uint16_t in, uint16_t out, uint8_t kernel, uint8_t stride)
+  {
+    int32_t total = (out - 1) * stride + kernel - in;
+    return total > 0 ? total / 2 : 0;
+  }
+
+  void conv(const Layer &layer, const int8_t *in, int8_t *out)
+  {
+    const Shape &is = layer.input, &os = layer.output;
+    int32_t padY = padBefore(is.height, os.height, layer.kernelHeight, layer.strideHeight);
+    int32_t padX = padBefore(is.width, os.width, layer.kernelWidth, layer.strideWidth);
+    size_t filterSize = static_cast<size_t>(layer.kernelHeight) * layer.kernelWidth * is.channels;
+
+    for (int32_t oy = 0; oy < os.height; oy++)
+    {
+      for (int32_t ox = 0; ox < os.width; ox++)
+      {
+        for (size_t oc = 0; oc < os.channels; oc++)
+        {
+          const int8_t *filter = layer.weights + oc * filterSize;
+          int32_t acc = bias(layer, oc);
+          for (int32_t ky = 0; ky < layer.kernelHeight; ky++)
+          {
+            int32_t iy = oy * layer.strideHeight + ky - padY;
+            if (iy < 0 || iy >= is.height)
+              continue;
+            for (int32_t kx = 0; kx < layer.kernelWidth; kx++)
+            {
+              int32_t ix = ox * layer.strideWidth + kx - padX;
+              if (ix < 0 || ix >= is.width)
+                continue;
+              const int8_t *pixel = in + (static_cast<size_t>(iy) * is.width + ix) * is.channels;
+              const int8_t *w = filter + (static_cast<size_t>(ky) * layer.kernelWidth + kx) * is.channels;
+              for (size_t ic = 0; ic < is.channels; ic++)
+                acc += static_cast<int32_t>(pixel[ic]) * w[ic];
+            }
+          }
+          *out++ = requantize(acc, layer.multiplier, layer.shift, layer.relu);
+        }
+      }
+    }
+  }
+
+  void depthwise(const Layer &layer, const int8_t *in, int8_t *out)
+  {
+    const Shape &is = layer.input, &os = layer.output;
+    int32_t padY = padBefore(is.height, os.height, layer.kernelHeight, layer.strideHeight);
+    int32_t padX = padBefore(is.width, os.width, layer.kernelWidth, layer.strideWidth);
+
+    for (int32_t oy = 0; oy < os.height; oy++)
+    {
+      for (int32_t ox = 0; ox < os.width; ox++)
+      {
+        for (size_t c = 0; c < os.channels; c++)
+        {
+          int32_t acc = bias(layer, c);
+          for (int32_t ky = 0; ky < layer.kernelHeight; ky++)
+          {
+            int32_t iy = oy * layer.strideHeight + ky - padY;
+            if (iy < 0 || iy >= is.height)
+              continue;
+            for (int32_t kx = 0; kx < layer.kernelWidth; kx++)
+            {
+              int32_t ix = ox * layer.strideWidth + kx - padX;
+              if (ix < 0 || ix >= is.width)
+                continue;
+              acc += static_cast<int32_t>(in[(static_cast<size_t>(iy) * is.width + ix) * is.channels + c]) *
+                     layer.weights[(static_cast<size_t>(ky) * layer.kernelWidth + kx) * is.channels + c];
+            }
+          }
+          *out++ = requantize(acc, layer.multiplier, layer.shift, layer.relu);
+        }
+      }
+    }
+  }
+
+  void pointwise(const Layer &layer, const int8_t *in, int8_t *out)
+  {
+    const Shape &is = layer.input, &os = layer.output;
+    size_t pixels = static_cast<size_t>(is.height) * is.width;
+
+    for (size_t p = 0; p < pixels; p++)
+    {
+      const int8_t *pixel = in + p * is.channels;
+      for (size_t oc = 0; oc < os.channels; oc++)
+      {
+        const int8_t *w = layer.weights + oc * is.channels;
+        int32_t acc = bias(layer, oc);
+        for (size_t ic = 0; ic < is.channels; ic++)
+          acc += static_cast<int32_t>(pixel[ic]) * w[ic];
+        *out++ = requantize(acc, layer.multiplier, layer.shift, layer.relu);
+      }
+    }
+  }
+
+  void averagePool(const Layer &layer, const int8_t *in, int8_t *out)
+  {
+    const Shape &is = layer.input;
+    int32_t pixels = static_cast<int32_t>(is.height) * is.width;
+
+    for (size_t c = 0; c < is.channels; c++)
+    {
+      int32_t sum = 0;
+      for (int32_t p = 0; p < pixels; p++)
+        sum += in[p * is.channels + c];
+      int32_t half = sum < 0 ? -pixels / 2 : pixels / 2;
+      out[c] = static_cast<int8_t>((sum + half) / pixels);
+    }
+  }
+
+  void dense(const Layer &layer, const int8_t *in, int8_t *out)
+  {
+    size_t inputs = layer.input.size();
+    for (size_t o = 0; o < layer.output.channels; o++)
+    {
+      const int8_t *w = layer.weights + o * inputs;
+      int32_t acc = bias(layer, o);
+      for (size_t i = 0; i < inputs; i++)
+        acc += static_cast<int32_t>(in[i]) * w[i];
+      out[o] = requantize(acc, layer.multiplier, layer.shift, layer.relu);
+    }
+  }
+
+  static inline uint16_t get16(const uint8_t *p) { return static_cast<uint16_t>(p[0] | (p[1] << 8)); }
+
+  bool Model::parse(const uint8_t *blob, size_t size)
+  {
+    count = 0;
+    labels = 0;
+    arena = 0;
+
+    const size_t headerSize = 16, layerHeaderSize = 16;
+    if (!blob || size < headerSize || memcmp(blob, "NNM1", 4) != 0)
+      return false;
+
+    Shape shape{get16(blob + 4), get16(blob + 6), 1};
+    zero = blob[8];
+    size_t layerCount = blob[9];
+    size_t labelCount = blob[10];
+    memcpy(&outputScale, blob + 12, sizeof(float));
+    if (shape.height == 0 || shape.width == 0 || layerCount == 0 || layerCount > maxLayers ||
+        labelCount > maxLabels)
+      return false;
+
+    arena = shape.size();
+    size_t offset = headerSize;
+    for (size_t i = 0; i < layerCount; i++)
+    {
+      if (offset + layerHeaderSize > size)
+        return false;
+
+      const uint8_t *p = blob + offset;
+      Layer &layer = layers[i];
+      layer.type = static_cast<LayerType>(p[0]);
+      layer.relu = p[1] & 1;
+      layer.kernelHeight = p[2];
+      layer.kernelWidth = p[3];
+      layer.strideHeight = p[4] ? p[4] : 1;
+      layer.strideWidth = p[5] ? p[5] : 1;
+      uint16_t outChannels = get16(p + 6);
+      memcpy(&layer.multiplier, p + 8, sizeof(int32_t));
+      layer.shift = p[12];
+      layer.input = shape;
+      offset += layerHeaderSize;
+
+      size_t weights = 0, biases = 0;
+      switch (layer.type)
+      {
+      case LayerType::CONV:
+      case LayerType::DEPTHWISE:
+      {
+        if (layer.kernelHeight == 0 || layer.kernelWidth == 0)
+          return false;
+        uint16_t channels = layer.type == LayerType::CONV ? outChannels : shape.channels;
+        layer.output = Shape{
+            static_cast<uint16_t>((shape.height + layer.strideHeight - 1) / layer.strideHeight),
+            static_cast<uint16_t>((shape.width + layer.strideWidth - 1) / layer.strideWidth),
+            channels};
+        weights = static_cast<size_t>(layer.kernelHeight) * layer.kernelWidth *
+                  (layer.type == LayerType::CONV ? static_cast<size_t>(outChannels) * shape.channels : shape.channels);
+        biases = channels;
+        break;
+      }
+      case LayerType::POINTWISE:
+        layer.output = Shape{shape.height, shape.width, outChannels};
+        weights = static_cast<size_t>(outChannels) * shape.channels;
+        biases = outChannels;
+        break;
+      case LayerType::AVERAGE_POOL:
+        layer.output = Shape{1, 1, shape.channels};
+        break;
+      case LayerType::DENSE:
+        layer.output = Shape{1, 1, outChannels};
+        weights = static_cast<size_t>(outChannels) * shape.size();
+        biases = outChannels;
+        break;
+      default:
+        return false;
+      }
+
+      if (layer.output.size() == 0 || offset + weights + biases * sizeof(int32_t) > size)
+        return false;
+      layer.weights = reinterpret_cast<const int8_t *>(blob + offset);
+      offset += weights;
+      layer.bias = blob + offset;
+      offset += biases * sizeof(int32_t);
+
+      shape = layer.output;
+      if (shape.size() > arena)
+        arena = shape.size();
+    }
+
+    if (labelCount != 0 && shape.size() != labelCount)
+      return false;
+
+    for (size_t i = 0; i < labelCount; i++)
+    {
+      if (offset >= size)
+        return false;
+      size_t length = blob[offset++];
+      if (length > maxLabelLength || offset + length > size)
+        return false;
+      memcpy(names[i], blob + offset, length);
+      names[i][length] = '\0';
+      offset += length;
+    }
+
+    count = layerCount;
+    labels = labelCount;
+    return true;
+  }
+
+  const int8_t *Model::run(const int8_t *input, int8_t *a, int8_t *b) const
+  {
+    const int8_t *in = input;
+    int8_t *out = a;
+    for (size_t i = 0; i < count; i++)
+    {
+      const Layer &layer = layers[i];
+      switch (layer.type)
+      {
+      case LayerType::CONV:
+        conv(layer, in, out);
+        break;
+      case LayerType::DEPTHWISE:
+        depthwise(layer, in, out);
+        break;
+      case LayerType::POINTWISE:
+        pointwise(layer, in, out);
+        break;
+      case LayerType::AVERAGE_POOL:
+        averagePool(layer, in, out);
+        break;
+      case LayerType::DENSE:
+        dense(layer, in, out);
+        break;
+      }
+      in = out;
+      out = out == a ? b : a;
+    }
+    return in;
+  }
+
+  void Model::invoke(const int8_t *input, int8_t *a, int8_t *b, float *probabilities) const
+  {
+    const int8_t *in = run(input, a, b);
+
+    // Softmax over the dequantized logits.
+    float largest = -INFINITY;
+    for (size_t i = 0; i < labels; i++)
+      largest = in[i] * outputScale > largest ? in[i] * outputScale : largest;
+
+    float total = 0;
+    for (size_t i = 0; i < labels; i++)
+    {
+      probabilities[i] = expf(in[i] * outputScale - largest);
+      total += probabilities[i];
+    }
+    for (size_t i = 0; i < labels; i++)
+      probabilities[i] /= total;
+  }
+}
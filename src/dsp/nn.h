@@ -0,0 +1,117 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Int8 inference for small audio networks on log-mel input, such as the
+// keyword spotter and the speaker pre-screen (DS-CNN style: a regular
+// convolution, depthwise + pointwise blocks, global average pool and dense
+// layers). Portable C++, no allocation: the model is parsed in place from a
+// blob and activations ping-pong between two caller buffers.
+//
+// Tensors are HWC (time, frequency, channels) int8 with a zero point of 0.
+// Every layer requantizes its int32 accumulator with a Q31 multiplier and a
+// right shift, optionally clamping at 0 (fused ReLU).
+//
+// Model blob, little-endian:
+//
+//   MAGIC   | 4B "NNM1"
+//   FRAMES  | 2B   input height (feature frames)
+//   BINS    | 2B   input width (mel bins)
+//   ZERO    | 1B   subtracted from the uint8 log-mel input
+//   LAYERS  | 1B
+//   LABELS  | 1B   0 for models with a raw output (embeddings)
+//   RESERVED| 1B
+//   SCALE   | 4B   float, real value of one output step
+//   LAYER   | LAYERS times:
+//     TYPE    | 1B   see LayerType
+//     FLAGS   | 1B   bit 0: ReLU
+//     KERNEL  | 2B   height, width
+//     STRIDE  | 2B   height, width
+//     OUT     | 2B   output channels (conv, pointwise, dense)
+//     MULT    | 4B   Q31 requantization multiplier
+//     SHIFT   | 1B   right shift after the multiplier
+//     RESERVED| 3B
+//     WEIGHTS | int8, OHWI for conv, HWC for depthwise, OI for pointwise/dense
+//     BIAS    | int32 per output channel (none for the pool)
+//   LABEL   | LABELS times: 1B length + characters
+namespace Nn
+{
+  constexpr size_t maxLayers = 16;
+  constexpr size_t maxLabels = 16;
+  constexpr size_t maxLabelLength = 23;
+
+  enum class LayerType : uint8_t
+  {
+    CONV = 1,
+    DEPTHWISE = 2,
+    POINTWISE = 3,
+    AVERAGE_POOL = 4,
+    DENSE = 5
+  };
+
+  struct Shape
+  {
+    uint16_t height;
+    uint16_t width;
+    uint16_t channels;
+
+    size_t size() const { return static_cast<size_t>(height) * width * channels; }
+  };
+
+  struct Layer
+  {
+    LayerType type;
+    bool relu;
+    uint8_t kernelHeight, kernelWidth;
+    uint8_t strideHeight, strideWidth;
+    int32_t multiplier;
+    uint8_t shift;
+    Shape input;
+    Shape output;
+    const int8_t *weights;
+    const uint8_t *bias; // int32 LE, possibly unaligned
+  };
+
+  // Kernels, exposed for testing and benchmarking on the host.
+  int8_t requantize(int32_t acc, int32_t multiplier, uint8_t shift, bool relu);
+  void conv(const Layer &layer, const int8_t *in, int8_t *out);
+  void depthwise(const Layer &layer, const int8_t *in, int8_t *out);
+  void pointwise(const Layer &layer, const int8_t *in, int8_t *out);
+  void averagePool(const Layer &layer, const int8_t *in, int8_t *out);
+  void dense(const Layer &layer, const int8_t *in, int8_t *out);
+
+  class Model
+  {
+  public:
+    // Parses `blob`, which must outlive the model. Returns false on any
+    // malformed or unsupported content.
+    bool parse(const uint8_t *blob, size_t size);
+
+    // Bytes needed by each of the two activation buffers.
+    size_t arenaSize() const { return arena; }
+
+    const Shape &input() const { return layers[0].input; }
+    size_t outputSize() const { return layers[count - 1].output.size(); }
+    uint8_t inputZero() const { return zero; }
+    float outputStep() const { return outputScale; }
+    size_t labelCount() const { return labels; }
+    const char *label(size_t index) const { return names[index]; }
+
+    // Runs the network on an int8 input of input().size() elements. `a` and
+    // `b` are arenaSize() bytes; the returned output lives in one of them.
+    const int8_t *run(const int8_t *input, int8_t *a, int8_t *b) const;
+
+    // run() followed by a softmax, one probability per label.
+    void invoke(const int8_t *input, int8_t *a, int8_t *b, float *probabilities) const;
+
+  private:
+    Layer layers[maxLayers];
+    size_t count = 0;
+    size_t labels = 0;
+    size_t arena = 0;
+    uint8_t zero = 0;
+    float outputScale = 1.0f;
+    char names[maxLabels][maxLabelLength + 1];
+  };
+}
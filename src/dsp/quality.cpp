@@ -0,0 +1,78 @@
+#include "dsp/quality.h"
+
+namespace Quality
+{
+  static inline void put16(uint8_t *dest, uint16_t v)
+  {
+    dest[0] = static_cast<uint8_t>(v);
+    dest[1] = static_cast<uint8_t>(v >> 8);
+  }
+
+  Config defaultConfig()
+  {
+    Config config;
+    config.maxClippingPermille = RECORDER_QUALITY_MAX_CLIPPING;
+    config.minSnrQ8 = RECORDER_QUALITY_MIN_SNR_DB * 256;
+    config.minVoicedMs = RECORDER_QUALITY_MIN_VOICED_MS;
+    config.maxLostMs = RECORDER_QUALITY_MAX_LOST_MS;
+    return config;
+  }
+
+  void Tracker::add(const Frame &frame)
+  {
+    samples += frame.samples;
+    clipped += frame.clipped;
+    lost += frame.lost;
+    floorQ8 += frame.floorQ8;
+    frames++;
+    if (frame.speech)
+    {
+      speechSamples += frame.samples;
+      speechLevelQ8 += frame.levelQ8;
+      speechFrames++;
+    }
+  }
+
+  Score Tracker::score(const Config &config, uint32_t samplesPerSecond) const
+  {
+    Score score{0, 0, 0, 0, 0};
+    if (samples != 0)
+      score.clippingPermille = static_cast<uint16_t>(static_cast<uint64_t>(clipped) * 1000 / samples);
+
+    if (speechFrames != 0 && frames != 0)
+    {
+      // log2 Q8 of a power ratio to dB Q8: * 10 * log10(2)
+      int64_t ratioQ8 = speechLevelQ8 / speechFrames - floorQ8 / frames;
+      int64_t snr = ratioQ8 * 771 / 256;
+      score.snrQ8 = static_cast<int16_t>(snr > INT16_MAX ? INT16_MAX : (snr < INT16_MIN ? INT16_MIN : snr));
+    }
+
+    if (samplesPerSecond != 0)
+    {
+      uint64_t ms = static_cast<uint64_t>(speechSamples) * 1000 / samplesPerSecond;
+      score.voicedMs = static_cast<uint16_t>(ms > UINT16_MAX ? UINT16_MAX : ms);
+      ms = static_cast<uint64_t>(lost) * 1000 / samplesPerSecond;
+      score.lostMs = static_cast<uint16_t>(ms > UINT16_MAX ? UINT16_MAX : ms);
+    }
+
+    if (score.clippingPermille > config.maxClippingPermille)
+      score.flags |= CLIPPED;
+    if (score.snrQ8 < config.minSnrQ8)
+      score.flags |= NOISY;
+    if (score.voicedMs < config.minVoicedMs)
+      score.flags |= SHORT;
+    if (score.lostMs > config.maxLostMs)
+      score.flags |= GAPPED;
+    return score;
+  }
+
+  size_t encode(const Score &score, uint8_t *dest)
+  {
+    put16(dest, score.clippingPermille);
+    put16(dest + 2, static_cast<uint16_t>(score.snrQ8));
+    put16(dest + 4, score.voicedMs);
+    dest[6] = score.flags;
+    put16(dest + 7, score.lostMs);
+    return encodedSize;
+  }
+}
@@ -0,0 +1,122 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#ifndef RECORDER_QUALITY_GATE
+#define RECORDER_QUALITY_GATE 1 // 1 to cancel hopeless streams, 0 to only report the scores
+#endif
+
+#ifndef RECORDER_QUALITY_MAX_CLIPPING
+#define RECORDER_QUALITY_MAX_CLIPPING 20 // clipped samples per mille
+#endif
+
+#ifndef RECORDER_QUALITY_MIN_SNR_DB
+#define RECORDER_QUALITY_MIN_SNR_DB 6 // mean speech level above the noise floor
+#endif
+
+#ifndef RECORDER_QUALITY_MIN_VOICED_MS
+#define RECORDER_QUALITY_MIN_VOICED_MS 300 // speech frames, without the VAD hangover
+#endif
+
+#ifndef RECORDER_QUALITY_MAX_LOST_MS
+#define RECORDER_QUALITY_MAX_LOST_MS 100 // audio lost to DMA overruns or a full pool
+#endif
+
+// Per-utterance quality scores, gathered in the same passes as the VAD.
+//
+// Clipping is counted per sample on the normalized (24-bit, signed) input,
+// before any conditioning. SNR and voiced duration come from the VAD
+// decisions of every frame: the mean level of the speech frames against the
+// mean noise floor, and the total length of the speech frames. Lost audio is
+// what the capture task could not deliver between frames; the stream marks
+// it with gap messages.
+//
+// The scores travel as the payload of the fragment trailer, or of the
+// cancel message when the recorder drops the utterance:
+//
+//   CLIPPING | 2B   uint16 LE, clipped samples per mille
+//   SNR      | 2B   int16 LE, dB in Q8
+//   VOICED   | 2B   uint16 LE, ms
+//   FLAGS    | 1B   see Flag, 0 when the utterance passed
+//   LOST     | 2B   uint16 LE, ms
+namespace Quality
+{
+  constexpr size_t encodedSize = 9;
+
+  // About -0.03 dBFS, INMP441 words saturate a little below full scale.
+  constexpr int32_t clipLevel = 0x7FFFFF - (0x7FFFFF >> 8);
+
+  enum Flag : uint8_t
+  {
+    CLIPPED = 1,
+    NOISY = 2,
+    SHORT = 4,
+    GAPPED = 8
+  };
+
+  // Packing detector counting clipped samples.
+  struct ClipCounter
+  {
+    uint32_t clipped = 0;
+
+    inline void operator()(int32_t sample)
+    {
+      clipped += sample >= clipLevel || sample <= -clipLevel;
+    }
+  };
+
+  // What the capture task measured on one frame (DMA buffer).
+  struct Frame
+  {
+    uint32_t samples = 0;
+    uint32_t clipped = 0;
+    bool speech = false;  // VAD decision of this frame alone
+    int32_t levelQ8 = 0;  // log2 Q8, see Vad::Decision
+    int32_t floorQ8 = 0;  // log2 Q8
+    uint32_t lost = 0;    // samples lost right before this frame
+  };
+
+  struct Config
+  {
+    uint16_t maxClippingPermille;
+    int32_t minSnrQ8;
+    uint32_t minVoicedMs;
+    uint32_t maxLostMs;
+  };
+
+  struct Score
+  {
+    uint16_t clippingPermille;
+    int16_t snrQ8;
+    uint16_t voicedMs;
+    uint8_t flags;
+    uint16_t lostMs;
+
+    bool passed() const { return flags == 0; }
+  };
+
+  // Accumulates the frames of one utterance.
+  struct Tracker
+  {
+    uint32_t samples = 0;
+    uint32_t clipped = 0;
+    uint32_t speechSamples = 0;
+    uint32_t speechFrames = 0;
+    uint32_t frames = 0;
+    uint32_t lost = 0;
+    int64_t speechLevelQ8 = 0;
+    int64_t floorQ8 = 0;
+
+    void add(const Frame &frame);
+    void reset() { *this = Tracker(); }
+
+    // `samplesPerSecond` counts every channel.
+    Score score(const Config &config, uint32_t samplesPerSecond) const;
+  };
+
+  // Builds a Config from the RECORDER_QUALITY_* macros.
+  Config defaultConfig();
+
+  size_t encode(const Score &score, uint8_t *dest);
+}
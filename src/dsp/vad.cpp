@@ -0,0 +1,78 @@
+#include "dsp/vad.h"
+#include "dsp/fixed.h"
+
+namespace Vad
+{
+  Config defaultConfig(uint32_t frameMs)
+  {
+    if (frameMs == 0)
+      frameMs = 1;
+
+    Config config;
+    config.marginQ8 = dbToQ8(RECORDER_VAD_MARGIN_DB);
+    config.minLevelQ8 = fullScaleQ8 + dbToQ8(RECORDER_VAD_MIN_LEVEL_DB);
+    config.maxZcrQ8 = RECORDER_VAD_MAX_ZCR * 256 / 100;
+    config.onsetFrames = RECORDER_VAD_ONSET_FRAMES;
+    config.hangoverFrames = (RECORDER_VAD_HANGOVER_MS + frameMs - 1) / frameMs;
+    return config;
+  }
+
+  Decision update(State &state, const Config &config, const Accumulator &frame)
+  {
+    Decision decision{state.voiced, false, 0, state.floorQ8, 0};
+    if (frame.count == 0)
+      return decision;
+
+    uint32_t energy = static_cast<uint32_t>(frame.sumSquares / frame.count);
+    int32_t level = Fixed::log2Q8(energy);
+    uint32_t zcr = (frame.crossings << 8) / frame.count;
+
+    // Slow DC tracker, used by the next frame's accumulator.
+    int32_t mean = static_cast<int32_t>(frame.sum / static_cast<int64_t>(frame.count));
+    state.dc += (mean - state.dc) >> 3;
+
+    if (!state.primed)
+    {
+      state.floorQ8 = level;
+      state.primed = true;
+    }
+
+    int32_t margin = level - state.floorQ8;
+    bool speech = level >= config.minLevelQ8 &&
+                  margin >= config.marginQ8 &&
+                  (zcr <= config.maxZcrQ8 || margin >= 2 * config.marginQ8);
+
+    // Follow the floor down immediately, but up only slowly so that speech
+    // does not drag it along; a steady noise source still wins over time.
+    if (level < state.floorQ8)
+      state.floorQ8 += (level - state.floorQ8) >> 1;
+    else
+      state.floorQ8 += (level - state.floorQ8) >> (speech ? 9 : 5);
+
+    if (speech)
+    {
+      if (state.onset < config.onsetFrames)
+        state.onset++;
+      if (state.onset >= config.onsetFrames)
+      {
+        state.voiced = true;
+        state.hangover = config.hangoverFrames;
+      }
+    }
+    else
+    {
+      state.onset = 0;
+      if (state.hangover > 0)
+        state.hangover--;
+      else
+        state.voiced = false;
+    }
+
+    decision.voiced = state.voiced;
+    decision.speech = speech;
+    decision.levelQ8 = level;
+    decision.floorQ8 = state.floorQ8;
+    decision.zcrQ8 = zcr;
+    return decision;
+  }
+}
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#ifndef RECORDER_VAD_MARGIN_DB
+#define RECORDER_VAD_MARGIN_DB 9 // frame energy above the noise floor to count as speech
+#endif
+
+#ifndef RECORDER_VAD_MIN_LEVEL_DB
+#define RECORDER_VAD_MIN_LEVEL_DB -60 // dBFS, frames quieter than this are never speech
+#endif
+
+#ifndef RECORDER_VAD_MAX_ZCR
+#define RECORDER_VAD_MAX_ZCR 40 // %, noisier frames need twice the margin
+#endif
+
+#ifndef RECORDER_VAD_ONSET_FRAMES
+#define RECORDER_VAD_ONSET_FRAMES 2 // consecutive speech frames before triggering
+#endif
+
+#ifndef RECORDER_VAD_HANGOVER_MS
+#define RECORDER_VAD_HANGOVER_MS 500 // keep voiced after the last speech frame
+#endif
+
+// Streaming voice activity detector, evaluated once per DMA buffer (frame).
+//
+// Everything is integer: the frame energy is the mean square of the
+// DC-removed samples in the log2 domain (Q8, 0 dBFS == 30 << 8), the noise
+// floor is an asymmetric tracker on that value (falls fast, rises slowly) and
+// the zero-crossing rate separates hiss from voiced speech. Onset and hangover
+// counters turn the per-frame decision into a stable voiced/unvoiced state.
+namespace Vad
+{
+  struct Config
+  {
+    int32_t marginQ8;
+    int32_t minLevelQ8;
+    uint32_t maxZcrQ8;
+    uint16_t onsetFrames;
+    uint16_t hangoverFrames;
+  };
+
+  struct State
+  {
+    int32_t dc = 0;
+    int32_t floorQ8 = 0;
+    bool primed = false;
+    bool voiced = false;
+    uint16_t onset = 0;
+    uint16_t hangover = 0;
+  };
+
+  struct Decision
+  {
+    bool voiced;
+    bool speech;     // this frame alone, before onset/hangover
+    int32_t levelQ8; // frame energy, log2 Q8
+    int32_t floorQ8; // noise floor after this frame, log2 Q8
+    uint32_t zcrQ8;  // zero crossings per sample, Q8
+  };
+
+  // Per-sample accumulator, used as a packing detector so the statistics are
+  // gathered in the same pass that normalizes or packs the buffer.
+  struct Accumulator
+  {
+    int32_t dc;
+    int64_t sum = 0;
+    uint64_t sumSquares = 0;
+    uint32_t crossings = 0;
+    uint32_t count = 0;
+    bool negative = false;
+
+    explicit Accumulator(const State &state) : dc(state.dc) {}
+
+    inline void operator()(int32_t sample)
+    {
+      sum += sample;
+      int32_t ac = (sample - dc) >> 8; // 16 bits is plenty for energy
+      sumSquares += static_cast<uint32_t>(ac * ac);
+      bool sign = ac < 0;
+      crossings += count != 0 && sign != negative;
+      negative = sign;
+      count++;
+    }
+  };
+
+  // Builds a Config from the RECORDER_VAD_* macros for a given frame length.
+  Config defaultConfig(uint32_t frameMs);
+
+  constexpr int32_t dbToQ8(int32_t db) { return db * 85; } // 256 / (10 * log10(2))
+  constexpr int32_t fullScaleQ8 = 30 << 8;                 // (2^15)^2
+
+  Decision update(State &state, const Config &config, const Accumulator &frame);
+}
@@ -1,5 +1,12 @@
 from .core.server import MqttServer
 from .core.verificator import VerificationHandler, SampleHandler
 from .core.ffi import Protocol
+from .core.templates import EdgeSpeakerTemplates
 
-__all__ = ["MqttServer", "Protocol", "VerificationHandler", "SampleHandler"]
+__all__ = [
+    "MqttServer",
+    "Protocol",
+    "VerificationHandler",
+    "SampleHandler",
+    "EdgeSpeakerTemplates",
+]
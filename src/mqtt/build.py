@@ -1,5 +1,16 @@
 import os
 
 Import("env")
-lib = SharedLibrary(target="protocol.dll", source=["protocol.cpp"])
+lib = SharedLibrary(
+    target="protocol.dll",
+    source=[
+        "protocol.cpp",
+        "frame.cpp",
+        "codec.cpp",
+        "../dsp/adpcm.cpp",
+        "../dsp/lossless.cpp",
+        "../dsp/mel.cpp",
+        "../dsp/nn.cpp",
+    ],
+)
 Default(lib)
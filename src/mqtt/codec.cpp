@@ -0,0 +1,93 @@
+#include "mqtt/protocol.h"
+#include "dsp/adpcm.h"
+#include "dsp/lossless.h"
+#include "dsp/mel.h"
+#include "dsp/nn.h"
+
+#include <cmath>
+#include <memory>
+#include <vector>
+
+extern "C"
+{
+  size_t ffi_decodeImaAdpcm(const uint8_t *src, size_t size, float *out, size_t capacity)
+  {
+    if (!src)
+      return 0;
+    return Adpcm::decode(src, size, out, capacity);
+  }
+
+  size_t ffi_decodeLossless(const uint8_t *src, size_t size, float *out, size_t capacity)
+  {
+    if (!src)
+      return 0;
+    return Lossless::decode(src, size, out, capacity);
+  }
+
+  // Speaker template of a recording, computed exactly like the recorder's
+  // pre-screen does it (see core/speaker.h): log-mel frames of the 24-bit
+  // samples, the embedding model over windows of its input height (half
+  // overlapping), every embedding L2-normalized and averaged. Returns the
+  // embedding size, writing it to `out` when `capacity` allows, or 0 when
+  // the model is invalid or the recording shorter than one window.
+  size_t ffi_speakerEmbedding(const uint8_t *model, size_t modelSize,
+                              const int32_t *samples, size_t count, uint32_t sampleRate,
+                              float *out, size_t capacity)
+  {
+    Nn::Model network;
+    if (!model || !samples || !network.parse(model, modelSize) ||
+        network.input().width != Mel::bins || network.input().channels != 1)
+      return 0;
+
+    auto extractor = std::make_unique<Mel::Extractor>();
+    extractor->begin(sampleRate);
+
+    // A block holds at most 255 frames, so feed the recording in slices.
+    size_t slice = 255 * extractor->layout().hop / 2;
+    std::vector<uint8_t> block(Mel::maxEncodedSize(slice, extractor->layout().hop));
+    std::vector<uint8_t> frames;
+    for (size_t offset = 0; offset < count; offset += slice)
+    {
+      size_t size = extractor->process(samples + offset, count - offset < slice ? count - offset : slice,
+                                       block.data(), block.size());
+      frames.insert(frames.end(), block.begin() + Mel::blockHeaderSize, block.begin() + size);
+    }
+
+    size_t height = network.input().height;
+    size_t total = frames.size() / Mel::bins;
+    size_t dims = network.outputSize();
+    if (total < height || dims == 0)
+      return 0;
+    if (!out || capacity < dims)
+      return dims;
+
+    std::vector<int8_t> input(network.input().size());
+    std::vector<int8_t> a(network.arenaSize()), b(network.arenaSize());
+    std::vector<double> sum(dims, 0.0);
+    size_t step = height / 2 == 0 ? 1 : height / 2;
+    for (size_t start = 0; start + height <= total; start += step)
+    {
+      for (size_t i = 0; i < input.size(); i++)
+      {
+        int value = frames[start * Mel::bins + i] - network.inputZero();
+        input[i] = static_cast<int8_t>(value < -128 ? -128 : (value > 127 ? 127 : value));
+      }
+
+      const int8_t *embedding = network.run(input.data(), a.data(), b.data());
+      double norm = 0.0;
+      for (size_t i = 0; i < dims; i++)
+        norm += static_cast<double>(embedding[i]) * embedding[i];
+      norm = std::sqrt(norm);
+      for (size_t i = 0; i < dims && norm > 0.0; i++)
+        sum[i] += embedding[i] / norm;
+    }
+
+    double norm = 0.0;
+    for (double v : sum)
+      norm += v * v;
+    norm = std::sqrt(norm);
+    for (size_t i = 0; i < dims; i++)
+      out[i] = norm > 0.0 ? static_cast<float>(sum[i] / norm) : 0.0f;
+    return dims;
+  }
+}
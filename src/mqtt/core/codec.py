@@ -0,0 +1,125 @@
+from dataclasses import dataclass
+import struct
+
+import numpy as np
+
+from .ffi import Protocol
+
+WAV_HEADER_SIZE = 44
+MEL_DESCRIPTOR_SIZE = 16
+
+
+@dataclass
+class MelFeatures:
+    sample_rate: int
+    fft_size: int
+    window: int
+    hop: int
+    frames: np.ndarray
+    """(frames, bins) float32, natural log of the mel band energies."""
+
+
+def _decode_native(decoder, data: bytes | bytearray | memoryview) -> np.ndarray:
+    ffi = Protocol.ffi
+
+    src = ffi.from_buffer(data)
+    count = decoder(src, len(data), ffi.NULL, 0)
+
+    out = np.empty(count, dtype=np.float32)
+    decoder(src, len(data), ffi.from_buffer("float[]", out), count)
+    return out
+
+
+def decode_ima_adpcm(data: bytes | bytearray | memoryview) -> np.ndarray:
+    """Decode concatenated IMA-ADPCM fragment blocks to float32 natively."""
+    return _decode_native(Protocol.lib.ffi_decodeImaAdpcm, data)
+
+
+def decode_lossless(data: bytes | bytearray | memoryview) -> np.ndarray:
+    """Decode concatenated lossless (fixed LPC + Rice) blocks to float32 natively."""
+    return _decode_native(Protocol.lib.ffi_decodeLossless, data)
+
+
+def decode_mel(data: bytes | bytearray | memoryview) -> MelFeatures:
+    """
+    Parse a log-mel session: the 16-byte descriptor followed by blocks of
+    [frames, bins, frames * bins quantized log2 energies].
+    """
+    mv = memoryview(data)
+    if len(mv) < MEL_DESCRIPTOR_SIZE or mv[:4].tobytes() != b"LMEL":
+        raise ValueError("Recording does not start with a log-mel descriptor")
+
+    sample_rate, fft_size, window, hop, bins, steps = struct.unpack_from(
+        "<IHHHBB", mv, 4
+    )
+    if bins == 0 or steps == 0:
+        raise ValueError(f"Invalid log-mel descriptor: bins {bins}, steps {steps}")
+
+    chunks = []
+    offset = MEL_DESCRIPTOR_SIZE
+    while offset + 2 <= len(mv):
+        frames, block_bins = mv[offset], mv[offset + 1]
+        size = frames * block_bins
+        if block_bins != bins or offset + 2 + size > len(mv):
+            raise ValueError(f"Malformed log-mel block at offset {offset}")
+        chunks.append(np.frombuffer(mv[offset + 2 : offset + 2 + size], dtype=np.uint8))
+        offset += 2 + size
+
+    quantized = np.concatenate(chunks) if chunks else np.empty(0, dtype=np.uint8)
+    frames = quantized.reshape(-1, bins).astype(np.float32) * np.float32(
+        np.log(2) / steps
+    )
+    return MelFeatures(sample_rate, fft_size, window, hop, frames)
+
+
+def float_wav(samples: np.ndarray, sample_rate: int, channels: int) -> bytearray:
+    data = samples.astype("<f4", copy=False).tobytes()
+    block_align = 4 * channels
+
+    wav = bytearray()
+    wav.extend(b"RIFF")
+    wav.extend(struct.pack("<I", 36 + len(data)))
+    wav.extend(b"WAVEfmt ")
+    wav.extend(
+        struct.pack(
+            "<IHHIIHH",
+            16,
+            3,  # WAVE_FORMAT_IEEE_FLOAT
+            channels,
+            sample_rate,
+            sample_rate * block_align,
+            block_align,
+            32,
+        )
+    )
+    wav.extend(b"data")
+    wav.extend(struct.pack("<I", len(data)))
+    wav.extend(data)
+    return wav
+
+
+def decode_recording(codec: str, data: bytes | bytearray | memoryview) -> bytearray:
+    """
+    Turn an assembled recording into a WAV the verificator can load.
+
+    The recorder always sends its WAV header first. For PCM it describes the
+    payload as is; for encoded payloads only the sample rate and channel count
+    are taken from it and the decoded samples are re-wrapped as float32 WAV.
+    """
+    if codec == Protocol.MqttAudioCodec.PCM:
+        return bytearray(data)
+
+    if len(data) < WAV_HEADER_SIZE:
+        raise ValueError(f"Recording is too short to contain a WAV header: {len(data)}")
+
+    channels, sample_rate = struct.unpack_from("<HI", data, 22)
+    payload = memoryview(data)[WAV_HEADER_SIZE:]
+
+    if codec == Protocol.MqttAudioCodec.IMA_ADPCM:
+        samples = decode_ima_adpcm(payload)
+    elif codec == Protocol.MqttAudioCodec.LOSSLESS:
+        samples = decode_lossless(payload)
+    else:
+        raise ValueError(f"Unsupported audio codec: {codec}")
+
+    return float_wav(samples, sample_rate, channels)
@@ -11,6 +11,27 @@ def _build_protocol_accessor():
     ffi.cdef("""
     const char *ffi_mqttProtocol(const char *protocolKey, const char *key);
     const char *const *ffi_mqttProtocolList(const char *protocolKey);
+
+    struct MqttFrame
+    {
+        uint8_t version;
+        uint8_t type;
+        uint8_t sequenced;
+        uint8_t intact;
+        uint32_t device;
+        uint32_t session;
+        uint32_t sequence;
+        uint32_t idOffset;
+        uint32_t idSize;
+        uint32_t payloadOffset;
+    };
+    int ffi_parseFrame(const uint8_t *src, size_t size, struct MqttFrame *out);
+
+    size_t ffi_decodeImaAdpcm(const uint8_t *src, size_t size, float *out, size_t capacity);
+    size_t ffi_decodeLossless(const uint8_t *src, size_t size, float *out, size_t capacity);
+    size_t ffi_speakerEmbedding(const uint8_t *model, size_t modelSize,
+                                const int32_t *samples, size_t count, uint32_t sampleRate,
+                                float *out, size_t capacity);
     """)
 
     lib = ffi.dlopen(str(current_dir / ".." / "protocol.dll"))
@@ -0,0 +1,46 @@
+from dataclasses import dataclass
+
+from .ffi import Protocol
+
+
+@dataclass
+class Frame:
+    """A received payload, split by its stamp (see mqtt/frame.h)."""
+
+    version: int
+    """0 for the legacy ASCII stamp."""
+    type: str
+    id: str
+    session: int
+    """Fragmented session of a compact frame, 0 when unknown."""
+    sequence: int | None
+    """Position in the session, None when the frame has none."""
+    intact: bool
+    """False when the payload does not match its CRC."""
+    data: bytes
+
+
+def parse_frame(payload: bytes) -> Frame | None:
+    """Parse a legacy or compact stamp natively, None when it is invalid."""
+    ffi = Protocol.ffi
+    out = ffi.new("struct MqttFrame *")
+    if not Protocol.lib.ffi_parseFrame(ffi.from_buffer(payload), len(payload), out):
+        return None
+
+    type = Protocol.MqttMessageType.Values[out.type]
+    if out.version == 0:
+        id = payload[out.idOffset : out.idOffset + out.idSize].decode()
+    else:
+        identifiers = Protocol.MqttIdentifier.Values
+        id = identifiers[out.device] if out.device < len(identifiers) else f"device-{out.device}"
+
+    sequence = out.sequence if out.sequenced else None
+    return Frame(
+        out.version,
+        type,
+        id,
+        out.session,
+        sequence,
+        bool(out.intact),
+        payload[out.payloadOffset :],
+    )
@@ -2,8 +2,10 @@ from concurrent.futures import ThreadPoolExecutor
 from threading import Lock
 from typing import TypedDict
 import logging
+import struct
 
 from .ffi import Protocol
+from .quality import QualityScore, decode_quality
 
 logger = logging.getLogger(__name__)
 
@@ -12,6 +14,8 @@ class AssembledMessage(TypedDict):
     data: bytearray
     type_sequence: list[str]
     header: str
+    codec: str
+    session: int
 
 
 class MessageAssembler:
@@ -21,21 +25,54 @@ class MessageAssembler:
         self._partials = {}
         self._lock = Lock()
 
-        def on_assembled(id: str, header: str, data: bytearray):
+        def on_assembled(
+            id: str,
+            header: str,
+            data: bytearray,
+            codec: str,
+            quality: QualityScore | None,
+        ):
             pass
 
         self.on_assembled = on_assembled
 
-    def add_message(self, id: str, type: str, message: bytes):
+    def add_message(
+        self,
+        id: str,
+        type: str,
+        message: bytes,
+        codec: str | None = None,
+        session: int = 0,
+    ):
         if type in [Protocol.MqttMessageType.MESSAGE]:
             logger.warning(f'Message type "{type}" should not be passed here')
             return
 
         with self._lock:
             assembled = self._partials.setdefault(
-                id, AssembledMessage(data=bytearray(), type_sequence=[], header="")
+                id,
+                AssembledMessage(
+                    data=bytearray(),
+                    type_sequence=[],
+                    header="",
+                    codec=Protocol.MqttAudioCodec.PCM,
+                    session=0,
+                ),
             )
 
+            # Compact frames name their session, so a message of another
+            # session (e.g. a replay cut short by a live one) never mixes in.
+            if (
+                type != Protocol.MqttMessageType.FRAGMENT_HEADER
+                and session != 0
+                and assembled["session"] != 0
+                and session != assembled["session"]
+            ):
+                logger.warning(
+                    f"Discarding {type!r} of session {session} for id: {id}, the partial belongs to session {assembled['session']}"
+                )
+                return
+
             match type:
                 case Protocol.MqttMessageType.FRAGMENT_HEADER:
                     if len(assembled["type_sequence"]) > 0:
@@ -46,6 +83,8 @@ class MessageAssembler:
                         assembled["data"].clear()
 
                     assembled["header"] = message.decode()
+                    assembled["codec"] = codec or Protocol.MqttAudioCodec.PCM
+                    assembled["session"] = session
                     assembled["type_sequence"].append(type)
                 case Protocol.MqttMessageType.FRAGMENT_BODY:
                     if len(assembled["type_sequence"]) == 0:
@@ -56,6 +95,19 @@ class MessageAssembler:
 
                     assembled["type_sequence"].append(type)
                     assembled["data"].extend(message)
+                case Protocol.MqttMessageType.FRAGMENT_GAP:
+                    if len(assembled["type_sequence"]) == 0:
+                        logger.warning(
+                            f"Attempting to add fragment gap to empty partial for id: {id}. Discarding message."
+                        )
+                        return
+
+                    if len(message) < 4:
+                        logger.warning(f"Fragment gap for id: {id} is too short")
+                        return
+
+                    (frames,) = struct.unpack_from("<I", message)
+                    self._conceal(id, assembled, frames)
                 case Protocol.MqttMessageType.FRAGMENT_TRAILER:
                     if len(assembled["type_sequence"]) == 0:
                         logger.warning(
@@ -72,19 +124,76 @@ class MessageAssembler:
                         )
                         return
 
-                    assembled["type_sequence"].append(type)
-                    assembled["data"].extend(message)
+                    # The trailer carries the quality scores, not audio.
+                    quality = decode_quality(message)
 
                     data = bytearray(assembled["data"])
                     header = assembled["header"]
+                    codec = assembled["codec"]
 
                     assembled["type_sequence"].clear()
                     assembled["data"].clear()
                     assembled["header"] = ""
-
-                    self._assembledCallback(id, header, data)
+                    assembled["codec"] = Protocol.MqttAudioCodec.PCM
+                    assembled["session"] = 0
+
+                    self._assembledCallback(id, header, data, codec, quality)
+                case Protocol.MqttMessageType.FRAGMENT_CANCEL:
+                    quality = decode_quality(message)
+                    logger.info(
+                        f"Partial for id: {id} cancelled by the recorder after {len(assembled['data'])} bytes, quality: {quality}"
+                    )
+                    assembled["type_sequence"].clear()
+                    assembled["data"].clear()
+                    assembled["header"] = ""
+                    assembled["codec"] = Protocol.MqttAudioCodec.PCM
+                    assembled["session"] = 0
                 case _:
                     raise ValueError(f"Invalid message type: {type}")
 
-    def _assembledCallback(self, id: str, header: str, data: bytearray):
-        self.on_assembled(id, header, data)
+    def discard(self, id: str, session: int):
+        """Drops the partial of `session`, which lost messages for good."""
+        with self._lock:
+            assembled = self._partials.get(id)
+            if assembled is None or assembled["session"] != session:
+                return
+
+            logger.warning(
+                f"Partial for id: {id} discarded after {len(assembled['data'])} bytes, session {session} lost messages"
+            )
+            assembled["type_sequence"].clear()
+            assembled["data"].clear()
+            assembled["header"] = ""
+            assembled["codec"] = Protocol.MqttAudioCodec.PCM
+            assembled["session"] = 0
+
+    def _conceal(self, id: str, assembled: AssembledMessage, frames: int):
+        """Fills a gap with silence where the stream allows it.
+
+        PCM sessions get zero frames (the block align is read from the WAV
+        header), so the timing after the gap stays right. Encoded streams
+        cannot be spliced; the gap is only counted, and the recorder flags
+        sessions that lost too much in their quality scores.
+        """
+        data = assembled["data"]
+        # Sample sessions start with the sample name, the WAV header follows it.
+        offset = data.find(b"RIFF", 0, 64) if assembled["codec"] == Protocol.MqttAudioCodec.PCM else -1
+        if offset < 0 or len(data) < offset + 44:
+            logger.warning(
+                f"[{id}] {frames} frames lost in a {assembled['codec']} stream, not concealed"
+            )
+            return
+
+        (block_align,) = struct.unpack_from("<H", data, offset + 32)
+        logger.warning(f"[{id}] {frames} frames lost, concealed with silence")
+        data.extend(bytes(frames * block_align))
+
+    def _assembledCallback(
+        self,
+        id: str,
+        header: str,
+        data: bytearray,
+        codec: str,
+        quality: QualityScore | None,
+    ):
+        self.on_assembled(id, header, data, codec, quality)
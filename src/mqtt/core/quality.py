@@ -0,0 +1,42 @@
+from dataclasses import dataclass
+import struct
+
+QUALITY_SIZE = 7
+
+CLIPPED = 1
+NOISY = 2
+SHORT = 4
+GAPPED = 8
+
+
+@dataclass
+class QualityScore:
+    """Per-utterance scores sent by the recorder, see dsp/quality.h."""
+
+    clipping: float
+    """Fraction of clipped samples."""
+    snr_db: float
+    voiced_ms: int
+    flags: int
+    lost_ms: int = 0
+    """Audio the recorder lost to DMA overruns or a full pool."""
+
+    @property
+    def passed(self) -> bool:
+        return self.flags == 0
+
+    @property
+    def reasons(self) -> list[str]:
+        names = {CLIPPED: "clipped", NOISY: "noisy", SHORT: "short", GAPPED: "gapped"}
+        return [name for flag, name in names.items() if self.flags & flag]
+
+
+def decode_quality(data: bytes | bytearray | memoryview) -> QualityScore | None:
+    """Scores from a trailer or cancel payload, None for older recorders."""
+    if len(data) < QUALITY_SIZE:
+        return None
+
+    clipping, snr, voiced, flags = struct.unpack_from("<HhHB", data)
+    # LOST came later, recorders without it never report gaps
+    (lost,) = struct.unpack_from("<H", data, 7) if len(data) >= 9 else (0,)
+    return QualityScore(clipping / 1000, snr / 256, voiced, flags, lost)
@@ -0,0 +1,186 @@
+from dataclasses import dataclass, field
+from threading import Lock, Timer, current_thread
+from typing import Callable
+import logging
+import time
+
+from .ffi import Protocol
+
+logger = logging.getLogger(__name__)
+
+JITTER_WINDOW = 0.3
+"""Seconds a gap waits for late messages before the first NACK."""
+NACK_INTERVAL = 0.5
+"""Seconds between NACKs of a gap that is still open."""
+NACK_ATTEMPTS = 3
+"""NACKs sent for a gap before its session is given up."""
+NACK_MAX = 16
+"""Sequences per NACK, the recorder's MQTT_NACK_MAX."""
+MAX_HELD = 512
+"""Messages held behind a gap before its session is given up."""
+STALE_AFTER = 30.0
+"""Seconds after which a lower session id means the device restarted."""
+
+type OnReleaseCallback = Callable[[str, int, str, bytes], None]
+type OnNackCallback = Callable[[str, int, list[int]], None]
+type OnLostCallback = Callable[[str, int], None]
+
+
+@dataclass
+class _Stream:
+    session: int
+    expected: int = 0
+    highest: int = -1
+    """Highest sequence known to exist, damaged ones included."""
+    held: dict[int, tuple[str, bytes]] = field(default_factory=dict)
+    attempts: int = 0
+    failed: bool = False
+    seen_at: float = 0.0
+    timer: Timer | None = None
+
+
+class ReorderBuffer:
+    """Puts the sequenced messages of every device's session back in order.
+
+    Messages behind a gap are held, for JITTER_WINDOW, then the missing ones
+    are asked again through on_nack, every NACK_INTERVAL. A gap that is still
+    open after NACK_ATTEMPTS loses the whole session (on_lost): its audio
+    would be verified with a hole in it. Duplicates, e.g. a resend of a
+    message that only came late, are dropped.
+
+    A lost final message has nothing behind it to show the gap, the next
+    session replaces the partial then.
+    """
+
+    def __init__(self):
+        self._streams: dict[str, _Stream] = {}
+        self._lock = Lock()
+
+        def on_release(id: str, session: int, type: str, data: bytes):
+            pass
+
+        def on_nack(id: str, session: int, sequences: list[int]):
+            pass
+
+        def on_lost(id: str, session: int):
+            pass
+
+        self.on_release: OnReleaseCallback = on_release
+        self.on_nack: OnNackCallback = on_nack
+        self.on_lost: OnLostCallback = on_lost
+
+    def add(self, id: str, session: int, sequence: int, type: str, data: bytes):
+        """Takes one message, releasing it and whatever it unblocks in order."""
+        with self._lock:
+            stream = self._stream_for(id, session, sequence, type)
+            if stream is None or stream.failed:
+                return
+
+            stream.seen_at = time.monotonic()
+            if sequence < stream.expected or sequence in stream.held:
+                logger.debug(f"[{id}] Dropping duplicate {sequence} of session {session}")
+                return
+
+            stream.held[sequence] = (type, data)
+            stream.highest = max(stream.highest, sequence)
+            while stream.expected in stream.held:
+                held_type, held_data = stream.held.pop(stream.expected)
+                stream.expected += 1
+                self.on_release(id, session, held_type, held_data)
+
+            if stream.highest < stream.expected:
+                self._disarm(stream)
+                stream.attempts = 0
+            elif len(stream.held) > MAX_HELD:
+                self._give_up(id, stream, f"{len(stream.held)} messages held")
+            elif stream.timer is None:
+                self._arm(id, stream, JITTER_WINDOW)
+
+    def damaged(self, id: str, session: int, sequence: int):
+        """Asks again right away for a message that failed its CRC."""
+        with self._lock:
+            stream = self._stream_for(id, session, sequence, "")
+            if stream is None or stream.failed:
+                return
+            if sequence < stream.expected or sequence in stream.held:
+                return
+
+            stream.seen_at = time.monotonic()
+            stream.highest = max(stream.highest, sequence)
+            self._disarm(stream)
+            self._expire_locked(id, stream)
+
+    def _stream_for(
+        self, id: str, session: int, sequence: int, type: str
+    ) -> _Stream | None:
+        stream = self._streams.get(id)
+        if stream is not None and stream.session == session:
+            return stream
+
+        opening = sequence == 0 and type == Protocol.MqttMessageType.FRAGMENT_HEADER
+        stale = (
+            stream is None
+            or session > stream.session
+            or opening
+            or time.monotonic() - stream.seen_at > STALE_AFTER
+        )
+        if not stale:
+            # a late resend of a session that is already over
+            logger.debug(f"[{id}] Dropping {type!r} of old session {session}")
+            return None
+
+        if stream is not None:
+            self._disarm(stream)
+            if stream.held:
+                logger.warning(
+                    f"[{id}] Session {stream.session} replaced by {session} with {len(stream.held)} messages held"
+                )
+        stream = _Stream(session)
+        self._streams[id] = stream
+        return stream
+
+    def _missing(self, stream: _Stream) -> list[int]:
+        missing = range(stream.expected, stream.highest + 1)
+        return [s for s in missing if s not in stream.held][:NACK_MAX]
+
+    def _arm(self, id: str, stream: _Stream, delay: float):
+        stream.timer = Timer(delay, self._expire, (id, stream))
+        stream.timer.daemon = True
+        stream.timer.start()
+
+    def _disarm(self, stream: _Stream):
+        if stream.timer is not None:
+            stream.timer.cancel()
+            stream.timer = None
+
+    def _expire(self, id: str, stream: _Stream):
+        with self._lock:
+            # a timer disarmed while it waited for the lock has been replaced
+            if stream.timer is not current_thread():
+                return
+            stream.timer = None
+            if self._streams.get(id) is stream:
+                self._expire_locked(id, stream)
+
+    def _expire_locked(self, id: str, stream: _Stream):
+        if stream.failed or stream.highest < stream.expected:
+            return
+
+        if stream.attempts >= NACK_ATTEMPTS:
+            self._give_up(id, stream, f"{self._missing(stream)} never came")
+            return
+
+        stream.attempts += 1
+        missing = self._missing(stream)
+        logger.info(
+            f"[{id}] Asking again for {missing} of session {stream.session} (attempt {stream.attempts})"
+        )
+        self.on_nack(id, stream.session, missing)
+        self._arm(id, stream, NACK_INTERVAL)
+
+    def _give_up(self, id: str, stream: _Stream, reason: str):
+        logger.warning(f"[{id}] Giving up session {stream.session}: {reason}")
+        self._disarm(stream)
+        stream.failed = True
+        stream.held.clear()
+        self.on_lost(id, stream.session)
@@ -10,6 +10,11 @@ from paho.mqtt.enums import CallbackAPIVersion
 
 from ...biometric import VerificationResult
 from .message import MessageAssembler
+from .codec import MelFeatures, decode_mel, decode_recording
+from .frame import parse_frame
+from .quality import QualityScore
+from .reorder import ReorderBuffer
+from .telemetry import Telemetry, decode_telemetry
 from .ffi import Protocol
 
 import struct
@@ -18,6 +23,11 @@ logger = logging.getLogger(__name__)
 
 type OnVerifyCallback = Callable[["MqttServer", str, bytes], None]
 type OnSampleCallback = Callable[["MqttServer", str, str, bytes], None]
+type OnFeaturesCallback = Callable[
+    ["MqttServer", str, str, str | None, MelFeatures], None
+]
+type OnConnectedCallback = Callable[["MqttServer"], None]
+type OnTelemetryCallback = Callable[["MqttServer", str, Telemetry], None]
 
 
 class MqttServer:
@@ -31,6 +41,7 @@ class MqttServer:
         self._client = mqtt.Client(CallbackAPIVersion.VERSION2)
 
         self._message_assembler = MessageAssembler()
+        self._reorder_buffer = ReorderBuffer()
 
         self._broker_host = broker_host
         self._broker_port = broker_port
@@ -44,6 +55,9 @@ class MqttServer:
         self._client.on_message = self._on_message
 
         self._message_assembler.on_assembled = self._on_assembled
+        self._reorder_buffer.on_release = self._on_fragment
+        self._reorder_buffer.on_nack = self.send_retransmit_request
+        self._reorder_buffer.on_lost = self._message_assembler.discard
 
         def default_on_verify(server: "MqttServer", id: str, data: bytes):
             pass
@@ -53,8 +67,28 @@ class MqttServer:
         ):
             pass
 
+        def default_on_features(
+            server: "MqttServer",
+            id: str,
+            header: str,
+            sample_name: str | None,
+            features: MelFeatures,
+        ):
+            logger.warning(
+                f"[{id}] Received {features.frames.shape} log-mel frames, but no feature consumer is set"
+            )
+
+        def default_on_connected(server: "MqttServer"):
+            pass
+
+        def default_on_telemetry(server: "MqttServer", id: str, report: Telemetry):
+            logger.info(f"[{id}] Telemetry: {report.summary()}")
+
         self.on_verify: OnVerifyCallback = default_on_verify
         self.on_sample: OnSampleCallback = default_on_sample
+        self.on_features: OnFeaturesCallback = default_on_features
+        self.on_connected: OnConnectedCallback = default_on_connected
+        self.on_telemetry: OnTelemetryCallback = default_on_telemetry
 
     def start_forever(self):
         self._client.connect(self._broker_host, self._broker_port, self._keepalive)
@@ -87,8 +121,17 @@ class MqttServer:
                 - Properties: {properties}
             """).strip()
         )
-        logger.info(f"Subscribing to topic: {self._recorder_topic}")
-        client.subscribe(self._recorder_topic)
+        # devices built with MQTT_SHORT_TOPICS publish on the short ones
+        topics = [
+            self._recorder_topic,
+            Protocol.MqttShortTopic.RECORDER,
+            Protocol.MqttTopic.TELEMETRY,
+            Protocol.MqttShortTopic.TELEMETRY,
+        ]
+        for topic in topics:
+            logger.info(f"Subscribing to topic: {topic}")
+            client.subscribe(topic)
+        self.on_connected(self)
 
     def _on_disconnect(
         self,
@@ -129,48 +172,88 @@ class MqttServer:
     def _on_message(self, client: mqtt.Client, userdata: Any, msg: MQTTMessage):
         """Callback for when a message is received."""
 
-        if len(msg.payload) < 6:
-            logger.error(f"Payload is too short: {len(msg.payload)}")
-            return
-
-        type = msg.payload[0:4].decode()
-        if type not in Protocol.MqttMessageType.Values:
-            logger.error(f"Invalid message type: {type}")
-            return
-
-        id_size = msg.payload[4]
-        if len(msg.payload) < 5 + id_size:
+        frame = parse_frame(msg.payload)
+        if frame is None:
             logger.error(
-                f"Payload is too short, expecting at minimum: {5 + id_size}, got: {len(msg.payload)}"
+                f"Invalid frame of {len(msg.payload)} bytes, starting with: {msg.payload[:6].hex()}"
             )
             return
 
-        id = msg.payload[5 : 5 + id_size].decode()
-        data = msg.payload[5 + id_size :]
+        id = frame.id
+        type = frame.type
+        data = frame.data
 
         metadata = dict(
             id=id,
             type=type,
+            version=frame.version,
+            session=frame.session,
+            sequence=frame.sequence,
             packet_size=len(msg.payload),
             data_size=len(data),
         )
 
+        if msg.topic in (Protocol.MqttTopic.TELEMETRY, Protocol.MqttShortTopic.TELEMETRY):
+            if type != Protocol.MqttMessageType.MESSAGE:
+                logger.error(f"Invalid telemetry message type: {type}")
+                return
+            try:
+                report = decode_telemetry(data)
+            except ValueError as e:
+                logger.error(f"[{id}] Failed to decode telemetry: {e}")
+                return
+            self.on_telemetry(self, id, report)
+            return
+
         if type == Protocol.MqttMessageType.MESSAGE:
             logger.info(f"Message received:\n{metadata}\nData:\n{data.decode()}")
             return
 
+        logger.info(f"Fragmented message received: {metadata}")
+        if frame.sequence is None:
+            self._on_fragment(id, frame.session, type, data)
+            return
+
+        if not frame.intact:
+            logger.warning(
+                f"[{id}] Message {frame.sequence} of session {frame.session} failed its CRC"
+            )
+            self._reorder_buffer.damaged(id, frame.session, frame.sequence)
+            return
+
+        self._reorder_buffer.add(id, frame.session, frame.sequence, type, data)
+
+    def _on_fragment(self, id: str, session: int, type: str, data: bytes):
+        """Handles a fragment message, in session order when it has one."""
+
         if type == Protocol.MqttMessageType.FRAGMENT_HEADER:
-            header = data.decode()
+            # header[\0codec[\0flag]], codec defaults to PCM when absent
+            header_bytes, _, rest = data.partition(b"\0")
+            codec_bytes, _, flag_bytes = rest.partition(b"\0")
+            header = header_bytes.decode()
             if header not in Protocol.MqttHeader.Values:
                 logger.error(f"Invalid header type received: {header}")
                 return
 
-            logger.info(f"Fragment header received: {metadata}")
-            self._message_assembler.add_message(id, type, header.encode())
+            codec = codec_bytes.decode() or Protocol.MqttAudioCodec.PCM
+            if codec not in Protocol.MqttAudioCodec.Values:
+                logger.error(f"Invalid audio codec received: {codec}")
+                return
+
+            flag = flag_bytes.decode() or None
+            if flag is not None and flag not in Protocol.MqttHeaderFlag.Values:
+                logger.warning(f"Ignoring unknown header flag: {flag}")
+                flag = None
+
+            logger.info(
+                f"[{id}] Fragment header of session {session}: {header}, codec: {codec}, flag: {flag}"
+            )
+            self._message_assembler.add_message(
+                id, type, header.encode(), codec=codec, session=session
+            )
             return
 
-        logger.info(f"Fragmented message received: {metadata}")
-        self._message_assembler.add_message(id, type, data)
+        self._message_assembler.add_message(id, type, data, session=session)
 
     def send_command(self, destination: str, command: str):
         logger.info(f"Sending command to controller: {command}")
@@ -203,12 +286,65 @@ class MqttServer:
 
         self._client.publish(Protocol.MqttTopic.VERIFY_RESULT, payload, retain=True)
 
-    def _on_assembled(self, id: str, header: str, data: bytearray):
+    def send_speaker_templates(self, payload: bytes):
+        logger.info(f"Sending edge speaker templates ({len(payload)} bytes)")
+
+        message = bytearray()
+        message.extend(Protocol.MqttMessageType.MESSAGE.encode())
+        message.extend(len(Protocol.MqttIdentifier.SERVER).to_bytes())
+        message.extend(Protocol.MqttIdentifier.SERVER.encode())
+        message.extend(payload)
+
+        self._client.publish(
+            Protocol.MqttTopic.SPEAKER_TEMPLATES, message, retain=True
+        )
+
+    def send_retransmit_request(self, id: str, session: int, sequences: list[int]):
+        logger.info(f"[{id}] Requesting {sequences} of session {session} again")
+
+        payload = bytearray()
+        payload.extend(Protocol.MqttMessageType.MESSAGE.encode())
+        payload.extend(len(Protocol.MqttIdentifier.SERVER).to_bytes())
+        payload.extend(Protocol.MqttIdentifier.SERVER.encode())
+        payload.extend(struct.pack("<I", session))
+        for sequence in sequences:
+            payload.extend(struct.pack("<I", sequence))
+
+        # never retained, a stale request must not reach the next connection
+        self._client.publish(Protocol.MqttTopic.RETRANSMIT, payload)
+
+    def _on_assembled(
+        self,
+        id: str,
+        header: str,
+        data: bytearray,
+        codec: str,
+        quality: QualityScore | None,
+    ):
         """Callback for when a message is assembled."""
-        logger.info(f"Message assembled, size: {len(data)}, with header: {header}.")
+        logger.info(
+            f"Message assembled, size: {len(data)}, with header: {header}, codec: {codec}, quality: {quality}."
+        )
+        if quality is not None and not quality.passed:
+            # The recorder only reports these when its gate is off.
+            logger.info(
+                f"[{id}] Skipping recording that failed the quality gate: {', '.join(quality.reasons)}"
+            )
+            return
+
         if header == Protocol.MqttHeader.VERIFY:
+            if codec == Protocol.MqttAudioCodec.MEL:
+                self._on_features(id, header, None, data)
+                return
+
+            try:
+                wav = decode_recording(codec, data)
+            except ValueError as e:
+                logger.error(f"Failed to decode recording: {e}")
+                return
+
             logger.info("Sending message to on_verify callback")
-            self.on_verify(self, id, data)
+            self.on_verify(self, id, wav)
 
         elif header == Protocol.MqttHeader.SAMPLE:
             term = next((i for i, b in enumerate(data) if b == 0x00), None)
@@ -220,7 +356,31 @@ class MqttServer:
 
             mv = memoryview(data)
             sample_name = mv[:term].tobytes().decode()
-            actual_data = mv[term + 1 :]
+            if codec == Protocol.MqttAudioCodec.MEL:
+                self._on_features(id, header, sample_name, mv[term + 1 :])
+                return
+
+            try:
+                actual_data = decode_recording(codec, mv[term + 1 :])
+            except ValueError as e:
+                logger.error(f"Failed to decode sample recording: {e}")
+                return
 
             logger.info("Sending message to on_sample callback")
             self.on_sample(self, id, sample_name, actual_data)
+
+    def _on_features(
+        self,
+        id: str,
+        header: str,
+        sample_name: str | None,
+        data: bytes | bytearray | memoryview,
+    ):
+        try:
+            features = decode_mel(data)
+        except ValueError as e:
+            logger.error(f"Failed to decode log-mel features: {e}")
+            return
+
+        logger.info("Sending features to on_features callback")
+        self.on_features(self, id, header, sample_name, features)
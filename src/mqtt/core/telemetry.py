@@ -0,0 +1,94 @@
+from dataclasses import dataclass, field
+import struct
+
+from .ffi import Protocol
+
+TELEMETRY_VERSION = 1
+
+
+@dataclass
+class TimerStats:
+    calls: int
+    total_us: int
+    max_us: int
+
+    @property
+    def mean_us(self) -> float:
+        return self.total_us / self.calls if self.calls else 0.0
+
+
+@dataclass
+class Telemetry:
+    """Periodic device report, see core/metrics.h."""
+
+    uptime_ms: int
+    heap_free: int
+    heap_min_free: int
+    heap_largest_block: int
+    phases_ms: dict[str, int] = field(default_factory=dict)
+    """Boot phase durations."""
+    counters: dict[str, int] = field(default_factory=dict)
+    """Totals since boot."""
+    timers: dict[str, TimerStats] = field(default_factory=dict)
+    """Hot-path timings since the previous report."""
+    stack_free: dict[str, int] = field(default_factory=dict)
+    """Stack high-water mark of each watched task, in bytes."""
+
+    def summary(self) -> str:
+        timers = ", ".join(
+            f"{name} {t.calls}x {t.mean_us:.0f}/{t.max_us}us"
+            for name, t in self.timers.items()
+            if t.calls
+        )
+        return (
+            f"up {self.uptime_ms / 1000:.0f}s, heap {self.heap_free} "
+            f"(min {self.heap_min_free}, block {self.heap_largest_block}), "
+            f"counters {self.counters}, timers [{timers}], stacks {self.stack_free}"
+        )
+
+
+def _names(values: list[str], count: int) -> list[str]:
+    # Newer firmware may report entries this server does not know yet.
+    return [values[i] if i < len(values) else f"#{i}" for i in range(count)]
+
+
+def decode_telemetry(data: bytes | bytearray | memoryview) -> Telemetry:
+    data = bytes(data)
+    try:
+        version, uptime, free, min_free, largest = struct.unpack_from("<BIIII", data)
+        if version != TELEMETRY_VERSION:
+            raise ValueError(f"Unsupported telemetry version: {version}")
+
+        report = Telemetry(uptime, free, min_free, largest)
+        offset = 17
+
+        count = data[offset]
+        offset += 1
+        for name in _names(Protocol.MqttTelemetryPhase.Values, count):
+            (report.phases_ms[name],) = struct.unpack_from("<I", data, offset)
+            offset += 4
+
+        count = data[offset]
+        offset += 1
+        for name in _names(Protocol.MqttTelemetryCounter.Values, count):
+            (report.counters[name],) = struct.unpack_from("<I", data, offset)
+            offset += 4
+
+        count = data[offset]
+        offset += 1
+        for name in _names(Protocol.MqttTelemetryTimer.Values, count):
+            report.timers[name] = TimerStats(*struct.unpack_from("<III", data, offset))
+            offset += 12
+
+        count = data[offset]
+        offset += 1
+        for _ in range(count):
+            length = data[offset]
+            name = data[offset + 1 : offset + 1 + length].decode(errors="replace")
+            offset += 1 + length
+            (report.stack_free[name],) = struct.unpack_from("<I", data, offset)
+            offset += 4
+    except (struct.error, IndexError) as e:
+        raise ValueError(f"Truncated telemetry report: {e}") from e
+
+    return report
@@ -0,0 +1,97 @@
+from pathlib import Path
+import io
+import logging
+import struct
+
+import numpy as np
+import torchaudio
+
+from ...biometric import AudioInput, EmbeddingSource
+from .ffi import Protocol
+
+logger = logging.getLogger(__name__)
+
+MAX_TEMPLATES = 8
+MAX_NAME_LENGTH = 23
+
+
+class EdgeSpeakerTemplates:
+    """
+    Reference templates for the recorder's speaker pre-screen (core/speaker.h).
+
+    Every enrolled sample is embedded with the same int8 model the recorder
+    runs, natively through the protocol library so the features and the
+    network match the device bit for bit. Templates are stored normalized and
+    sent as int8 vectors.
+    """
+
+    def __init__(self, model_file: Path, source: EmbeddingSource, sample_rate: int):
+        self.model = model_file.read_bytes()
+        self.source = source
+        self.sample_rate = sample_rate
+
+    def embed(self, audio: AudioInput) -> np.ndarray:
+        if isinstance(audio, (bytes, bytearray, memoryview)):
+            audio = io.BytesIO(audio)
+
+        signal, sr = torchaudio.load(audio)
+        if signal.shape[0] > 1:
+            signal = signal.mean(dim=0, keepdim=True)
+
+        if sr != self.sample_rate:
+            transform = torchaudio.transforms.Resample(
+                orig_freq=sr, new_freq=self.sample_rate
+            )
+            signal = transform(signal)
+
+        # The device features run on normalized 24-bit samples.
+        samples = np.clip(signal[0].numpy() * (1 << 23), -(1 << 23), (1 << 23) - 1)
+        samples = np.ascontiguousarray(samples.astype(np.int32))
+
+        ffi = Protocol.ffi
+        model = ffi.from_buffer(self.model)
+        src = ffi.from_buffer("int32_t[]", samples)
+        dims = Protocol.lib.ffi_speakerEmbedding(
+            model, len(self.model), src, len(samples), self.sample_rate, ffi.NULL, 0
+        )
+        if dims == 0:
+            raise ValueError("Invalid edge speaker model or recording too short")
+
+        out = np.empty(dims, dtype=np.float32)
+        Protocol.lib.ffi_speakerEmbedding(
+            model,
+            len(self.model),
+            src,
+            len(samples),
+            self.sample_rate,
+            ffi.from_buffer("float[]", out),
+            dims,
+        )
+        return out
+
+    def set_reference(self, key: str, audio: AudioInput):
+        self.source.set(key, self.embed(audio))
+
+    def remove_reference(self, key: str) -> bool:
+        return self.source.remove(key)
+
+    def payload(self) -> bytes:
+        """MqttTopic.SPEAKER_TEMPLATES payload, after the stamp."""
+        templates = list(self.source.all().items())
+        if len(templates) > MAX_TEMPLATES:
+            logger.warning(
+                f"Only the first {MAX_TEMPLATES} of {len(templates)} edge speaker templates are sent"
+            )
+            templates = templates[:MAX_TEMPLATES]
+
+        dims = len(templates[0][1]) if templates else 0
+        payload = bytearray(struct.pack("<BH", len(templates), dims))
+        for name, template in templates:
+            peak = float(np.abs(template).max()) or 1.0
+            quantized = np.round(template / peak * 127).astype(np.int8)
+
+            encoded = name.encode()[:MAX_NAME_LENGTH]
+            payload.append(len(encoded))
+            payload.extend(encoded)
+            payload.extend(quantized.tobytes())
+        return bytes(payload)
@@ -3,6 +3,7 @@ from typing import Any
 
 from .server import MqttServer
 from .ffi import Protocol
+from .templates import EdgeSpeakerTemplates
 
 from ...biometric import Verificator
 
@@ -51,8 +52,13 @@ class VerificationHandler:
 
 
 class SampleHandler:
-    def __init__(self, verificator: Verificator):
+    def __init__(
+        self,
+        verificator: Verificator,
+        edge_templates: EdgeSpeakerTemplates | None = None,
+    ):
         self.verificator = verificator
+        self.edge_templates = edge_templates
 
     def __call__(
         self, server: MqttServer, id: str, sample_name: str, data: bytes
@@ -60,3 +66,15 @@ class SampleHandler:
         logger.info(f"[{id} # {sample_name}] Storing audio sample...")
         self.verificator.embedder.set_reference(sample_name, data)
         logger.info(f"[{id} # {sample_name}] Audio sample stored")
+
+        if self.edge_templates is None:
+            return
+
+        try:
+            self.edge_templates.set_reference(sample_name, data)
+        except ValueError as e:
+            logger.error(f"[{id} # {sample_name}] Failed to compute edge template: {e}")
+            return
+
+        server.send_speaker_templates(self.edge_templates.payload())
+        logger.info(f"[{id} # {sample_name}] Edge speaker templates updated")
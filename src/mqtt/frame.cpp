@@ -0,0 +1,170 @@
+#include "mqtt/frame.h"
+#include "mqtt/protocol.h"
+
+#include <cstring>
+
+namespace Frame
+{
+  namespace
+  {
+    int indexIn(const char *const *list, const char *value, size_t size)
+    {
+      for (int i = 0; list[i]; i++)
+      {
+        if (strlen(list[i]) == size && memcmp(list[i], value, size) == 0)
+          return i;
+      }
+      return -1;
+    }
+
+    size_t countOf(const char *const *list)
+    {
+      size_t count = 0;
+      while (list[count])
+        count++;
+      return count;
+    }
+  }
+
+  int typeIndex(const char *type)
+  {
+    return indexIn(MqttMessageTypeList, type, 4);
+  }
+
+  int identifierIndex(const char *identifier)
+  {
+    return indexIn(MqttIdentifierList, identifier, strlen(identifier));
+  }
+
+  size_t writeVarint(uint32_t value, uint8_t *dest)
+  {
+    size_t size = 0;
+    while (value >= 0x80)
+    {
+      dest[size++] = static_cast<uint8_t>(value | 0x80);
+      value >>= 7;
+    }
+    dest[size++] = static_cast<uint8_t>(value);
+    return size;
+  }
+
+  size_t readVarint(const uint8_t *src, size_t size, uint32_t &value)
+  {
+    value = 0;
+    for (size_t i = 0; i < size && i < maxVarintSize; i++)
+    {
+      // the fifth byte only has 4 bits left of a 32-bit value
+      if (i == maxVarintSize - 1 && src[i] > 0x0F)
+        return 0;
+      value |= static_cast<uint32_t>(src[i] & 0x7F) << (7 * i);
+      if ((src[i] & 0x80) == 0)
+        return i + 1;
+    }
+    return 0;
+  }
+
+  uint32_t crc32(const uint8_t *src, size_t size)
+  {
+    // reflected 0xEDB88320, a nibble at a time
+    static const uint32_t table[16] = {
+        0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC,
+        0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+        0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C,
+        0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C,
+    };
+
+    uint32_t crc = 0xFFFFFFFF;
+    for (size_t i = 0; i < size; i++)
+    {
+      crc = table[(crc ^ src[i]) & 0x0F] ^ (crc >> 4);
+      crc = table[(crc ^ (src[i] >> 4)) & 0x0F] ^ (crc >> 4);
+    }
+    return ~crc;
+  }
+
+  size_t writeCompactStamp(uint8_t *dest, const char *type, uint32_t device,
+                           uint32_t session, uint32_t sequence, uint32_t crc)
+  {
+    int index = typeIndex(type);
+    if (index < 0)
+      return 0;
+
+    size_t size = 0;
+    dest[size++] = 0x80 | version << 4 | index;
+    size += writeVarint(device, dest + size);
+    size += writeVarint(session, dest + size);
+    if (session == 0)
+      return size;
+
+    size += writeVarint(sequence, dest + size);
+    for (int i = 0; i < 4; i++)
+      dest[size++] = static_cast<uint8_t>(crc >> (8 * i));
+    return size;
+  }
+}
+
+static_assert(Frame::version < 8, "The compact marker has 3 bits of version");
+
+#define _MQX(name, value) +1
+static_assert(0 MQTT_MESSAGE_TYPE_LIST <= 16, "The compact marker has 4 bits of message type");
+#undef _MQX
+
+extern "C"
+{
+  int ffi_parseFrame(const uint8_t *src, size_t size, MqttFrame *out)
+  {
+    if (!src || !out || size == 0)
+      return 0;
+
+    *out = MqttFrame{};
+    out->intact = 1;
+    if ((src[0] & 0x80) == 0)
+    {
+      // TYPE 4B, ID_SIZE 1B, ID
+      if (size < 5)
+        return 0;
+      int type = Frame::typeIndex(reinterpret_cast<const char *>(src));
+      if (type < 0 || size < 5u + src[4])
+        return 0;
+
+      out->type = type;
+      out->idOffset = 5;
+      out->idSize = src[4];
+      out->payloadOffset = 5 + src[4];
+      return 1;
+    }
+
+    out->version = (src[0] >> 4) & 0x07;
+    out->type = src[0] & 0x0F;
+    if (out->version < 1 || out->version > Frame::version || out->type >= Frame::countOf(MqttMessageTypeList))
+      return 0;
+
+    size_t offset = 1;
+    size_t read = Frame::readVarint(src + offset, size - offset, out->device);
+    if (read == 0)
+      return 0;
+    offset += read;
+
+    read = Frame::readVarint(src + offset, size - offset, out->session);
+    if (read == 0)
+      return 0;
+    offset += read;
+
+    if (out->version >= 2 && out->session != 0)
+    {
+      read = Frame::readVarint(src + offset, size - offset, out->sequence);
+      if (read == 0 || size - offset - read < 4)
+        return 0;
+      offset += read;
+
+      uint32_t crc = 0;
+      for (int i = 0; i < 4; i++)
+        crc |= static_cast<uint32_t>(src[offset++]) << (8 * i);
+      out->sequenced = 1;
+      out->intact = Frame::crc32(src + offset, size - offset) == crc;
+    }
+
+    out->payloadOffset = offset;
+    return 1;
+  }
+}
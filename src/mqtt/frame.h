@@ -0,0 +1,68 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Framing of every MQTT payload, in front of the message itself.
+//
+// Legacy stamp, what the server sends and what devices sent before:
+//   TYPE 4B (MqttMessageType, ASCII), ID_SIZE 1B, ID (MqttIdentifier)
+//
+// Compact stamp, version 2:
+//   MARKER 1B      | 1 VVV TTTT: version, then the type's index in MqttMessageType
+//   DEVICE varint   | index of the sender in MqttIdentifier
+//   SESSION varint  | fragmented session the message belongs to, 0 for none
+// and only when SESSION is not 0:
+//   SEQUENCE varint | position in the session, the header is 0
+//   CRC32 4B        | of the payload, little-endian
+// Varints are LEB128, 7 bits per byte, low bits first. Legacy types are
+// printable ASCII, so the marker's top bit tells the two apart. Version 1 is
+// version 2 without SEQUENCE and CRC32, still parsed.
+namespace Frame
+{
+  constexpr uint8_t version = 2;
+  constexpr size_t maxVarintSize = 5;
+  constexpr size_t maxCompactStampSize = 1 + 3 * maxVarintSize + 4;
+
+  // Index of the 4-character `type` in the MqttMessageType list, -1 if unknown.
+  int typeIndex(const char *type);
+
+  // Index of `identifier` in the MqttIdentifier list, -1 if unknown.
+  int identifierIndex(const char *identifier);
+
+  size_t writeVarint(uint32_t value, uint8_t *dest);
+  // Reads a varint from `src`, returns the bytes it took or 0 when it is
+  // truncated or longer than 32 bits.
+  size_t readVarint(const uint8_t *src, size_t size, uint32_t &value);
+
+  // CRC-32 (IEEE, the one of zlib) of `size` bytes.
+  uint32_t crc32(const uint8_t *src, size_t size);
+
+  // Writes a compact stamp, maxCompactStampSize bytes at most. `sequence`
+  // and `crc` are left out when `session` is 0. Returns 0 for an unknown
+  // `type`.
+  size_t writeCompactStamp(uint8_t *dest, const char *type, uint32_t device,
+                           uint32_t session, uint32_t sequence, uint32_t crc);
+}
+
+extern "C"
+{
+  // One parsed stamp, for the server side.
+  struct MqttFrame
+  {
+    uint8_t version;   // 0 for the legacy stamp
+    uint8_t type;      // index in the MqttMessageType list
+    uint8_t sequenced; // whether sequence is set and the CRC was checked
+    uint8_t intact;    // whether the payload matches its CRC, 1 when unchecked
+    uint32_t device;   // compact: index in the MqttIdentifier list
+    uint32_t session;  // compact: 0 when the message has none
+    uint32_t sequence;
+    uint32_t idOffset; // legacy: the identifier string
+    uint32_t idSize;
+    uint32_t payloadOffset;
+  };
+
+  // Parses the stamp in front of `src`, returns 1 when it is valid. A damaged
+  // payload is still valid, with `intact` cleared.
+  int ffi_parseFrame(const uint8_t *src, size_t size, MqttFrame *out);
+}
@@ -1,9 +1,18 @@
 #pragma once
 
+#include <cstddef>
+#include <cstdint>
+
 extern "C"
 {
   const char *ffi_mqttProtocol(const char *protocolKey, const char *key);
   const char *const *ffi_mqttProtocolList(const char *protocolKey);
+
+  size_t ffi_decodeImaAdpcm(const uint8_t *src, size_t size, float *out, size_t capacity);
+  size_t ffi_decodeLossless(const uint8_t *src, size_t size, float *out, size_t capacity);
+  size_t ffi_speakerEmbedding(const uint8_t *model, size_t modelSize,
+                              const int32_t *samples, size_t count, uint32_t sampleRate,
+                              float *out, size_t capacity);
 }
 
 /* -------------------------------------------------------------------------- */
@@ -14,16 +23,28 @@ extern "C"
   _MQEXPAND(MQTT_HEADER)             \
   _MQEXPAND(MQTT_MESSAGE_TYPE)       \
   _MQEXPAND(MQTT_TOPIC)              \
+  _MQEXPAND(MQTT_SHORT_TOPIC)        \
   _MQEXPAND(MQTT_CONTROLLER_COMMAND) \
-  _MQEXPAND(MQTT_IDENTIFIER)
+  _MQEXPAND(MQTT_IDENTIFIER)         \
+  _MQEXPAND(MQTT_AUDIO_CODEC)        \
+  _MQEXPAND(MQTT_HEADER_FLAG)        \
+  _MQEXPAND(MQTT_TELEMETRY_PHASE)    \
+  _MQEXPAND(MQTT_TELEMETRY_COUNTER)  \
+  _MQEXPAND(MQTT_TELEMETRY_TIMER)
 
 /* ------------------------------ Protocol Key ------------------------------ */
 
 #define MQTT_HEADER_KEY MqttHeader
 #define MQTT_MESSAGE_TYPE_KEY MqttMessageType
 #define MQTT_TOPIC_KEY MqttTopic
+#define MQTT_SHORT_TOPIC_KEY MqttShortTopic
 #define MQTT_CONTROLLER_COMMAND_KEY MqttControllerCommand
 #define MQTT_IDENTIFIER_KEY MqttIdentifier
+#define MQTT_AUDIO_CODEC_KEY MqttAudioCodec
+#define MQTT_HEADER_FLAG_KEY MqttHeaderFlag
+#define MQTT_TELEMETRY_PHASE_KEY MqttTelemetryPhase
+#define MQTT_TELEMETRY_COUNTER_KEY MqttTelemetryCounter
+#define MQTT_TELEMETRY_TIMER_KEY MqttTelemetryTimer
 
 /* ------------------------------ Protocol List ----------------------------- */
 
@@ -32,16 +53,26 @@ extern "C"
   _MQX(VERIFY, "verify") \
   _MQX(SAMPLE, "sample")
 
-#define MQTT_MESSAGE_TYPE_LIST  \
-  _MQX(MESSAGE, "msg ")         \
-  _MQX(FRAGMENT_HEADER, "head") \
-  _MQX(FRAGMENT_BODY, "frag")   \
-  _MQX(FRAGMENT_TRAILER, "end ")
-
-#define MQTT_TOPIC_LIST                                                   \
-  _MQX(RECORDER, "audio_biometric/slainless/device/recorder")             \
-  _MQX(VERIFY_RESULT, "audio_biometric/slainless/device/recorder/verify") \
-  _MQX(CONTROLLER, "audio_biometric/slainless/device/controller")
+#define MQTT_MESSAGE_TYPE_LIST   \
+  _MQX(MESSAGE, "msg ")          \
+  _MQX(FRAGMENT_HEADER, "head")  \
+  _MQX(FRAGMENT_BODY, "frag")    \
+  _MQX(FRAGMENT_TRAILER, "end ") \
+  _MQX(FRAGMENT_CANCEL, "cncl")  \
+  _MQX(FRAGMENT_GAP, "gap ")
+
+#define MQTT_TOPIC_LIST                                                           \
+  _MQX(RECORDER, "audio_biometric/slainless/device/recorder")                     \
+  _MQX(VERIFY_RESULT, "audio_biometric/slainless/device/recorder/verify")         \
+  _MQX(SPEAKER_TEMPLATES, "audio_biometric/slainless/device/recorder/templates") \
+  _MQX(RETRANSMIT, "audio_biometric/slainless/device/recorder/retransmit")        \
+  _MQX(CONTROLLER, "audio_biometric/slainless/device/controller")                 \
+  _MQX(TELEMETRY, "audio_biometric/slainless/device/telemetry")
+
+// Uplink topics of the short-topic mode, same names as in MQTT_TOPIC_LIST
+#define MQTT_SHORT_TOPIC_LIST \
+  _MQX(RECORDER, "ab/rec")    \
+  _MQX(TELEMETRY, "ab/tel")
 
 #define MQTT_CONTROLLER_COMMAND_LIST \
   _MQX(LAMP_ON, "lamp_on")           \
@@ -49,8 +80,50 @@ extern "C"
   _MQX(FAN_ON, "fan_on")             \
   _MQX(FAN_OFF, "fan_off")
 
-#define MQTT_IDENTIFIER_LIST \
-  _MQX(SERVER, "biometric-server")
+// Senders, the compact framing carries their index (see mqtt/frame.h)
+#define MQTT_IDENTIFIER_LIST       \
+  _MQX(SERVER, "biometric-server") \
+  _MQX(RECORDER, "recorder")       \
+  _MQX(CONTROLLER, "controller")
+
+// Optional second token of a fragment header, PCM when absent
+#define MQTT_AUDIO_CODEC_LIST \
+  _MQX(PCM, "pcm")            \
+  _MQX(IMA_ADPCM, "adpcm")    \
+  _MQX(LOSSLESS, "lossless")  \
+  _MQX(MEL, "mel")
+
+// Optional third token of a fragment header, after the codec
+#define MQTT_HEADER_FLAG_LIST \
+  _MQX(PRIORITY, "priority")
+
+// Entries of a telemetry report, in payload order (see core/metrics.h)
+#define MQTT_TELEMETRY_PHASE_LIST \
+  _MQX(SPIFFS, "spiffs")          \
+  _MQX(WIFI, "wifi")              \
+  _MQX(MQTT, "mqtt")              \
+  _MQX(CONFIG, "config")
+
+#define MQTT_TELEMETRY_COUNTER_LIST          \
+  _MQX(BYTES_SENT, "bytes_sent")             \
+  _MQX(PUBLISH_FAILED, "publish_failed")     \
+  _MQX(I2S_OVERRUNS, "i2s_overruns")         \
+  _MQX(WIFI_JOINS, "wifi_joins")             \
+  _MQX(WIFI_FAST_JOINS, "wifi_fast_joins")   \
+  _MQX(WIFI_JOIN_MS, "wifi_join_ms")         \
+  _MQX(SPOOLED_SESSIONS, "spooled_sessions") \
+  _MQX(SPOOL_REPLAYED, "spool_replayed")     \
+  _MQX(SPOOL_DROPPED, "spool_dropped")       \
+  _MQX(COALESCED_BODIES, "coalesced_bodies") \
+  _MQX(FRAGMENTS_RESENT, "fragments_resent") \
+  _MQX(TLS_RESUMED, "tls_resumed")
+
+#define MQTT_TELEMETRY_TIMER_LIST      \
+  _MQX(I2S_READ, "i2s_read")           \
+  _MQX(PACK, "pack")                   \
+  _MQX(PUBLISH, "publish")             \
+  _MQX(REMOTEXY, "remotexy")           \
+  _MQX(TLS_HANDSHAKE, "tls_handshake")
 
 /* -------------------------------------------------------------------------- */
 /*                              End of Definition                             */
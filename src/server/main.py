@@ -11,7 +11,13 @@ from ..biometric import (
     FileEmbeddingSource,
     Verificator,
 )
-from ..mqtt import MqttServer, Protocol, VerificationHandler, SampleHandler
+from ..mqtt import (
+    MqttServer,
+    Protocol,
+    VerificationHandler,
+    SampleHandler,
+    EdgeSpeakerTemplates,
+)
 from .api import ApiAttachment
 from .debug import DebugAttachment
 from .lifecycle import BiometricServerLifecycle
@@ -19,8 +25,18 @@ from .lifecycle import BiometricServerLifecycle
 current_dir = Path(__file__).parent
 default_embedding_file = current_dir / ".." / ".." / ".data" / "embeddings.npz"
 
+default_edge_template_file = current_dir / ".." / ".." / ".data" / "edge_templates.npz"
+
 EMBEDDING_FILE_PATH = Path(os.getenv("EMBEDDING_FILE_PATH") or default_embedding_file)
 
+# int8 speaker model of the recorder's pre-screen, the same file as its
+# /spiffs/speaker.bin. Edge templates are only computed when it is set.
+EDGE_SPEAKER_MODEL_PATH = os.getenv("EDGE_SPEAKER_MODEL_PATH")
+EDGE_TEMPLATE_FILE_PATH = Path(
+    os.getenv("EDGE_TEMPLATE_FILE_PATH") or default_edge_template_file
+)
+EDGE_SAMPLE_RATE = int(os.getenv("EDGE_SAMPLE_RATE") or 4000)
+
 MQTT_BROKER_HOST = os.getenv("MQTT_BROKER_HOST") or "localhost"
 MQTT_BROKER_PORT = int(os.getenv("MQTT_BROKER_PORT") or 1883)
 MQTT_KEEPALIVE = int(os.getenv("MQTT_KEEPALIVE") or 60)
@@ -56,7 +72,19 @@ mqtt_server = MqttServer(
 mqtt_server.on_verify = VerificationHandler(
     verificator, threshold=0.35, stop_at_unverified=False
 )
-mqtt_server.on_sample = SampleHandler(verificator)
+
+edge_templates = None
+if EDGE_SPEAKER_MODEL_PATH:
+    edge_templates = EdgeSpeakerTemplates(
+        Path(EDGE_SPEAKER_MODEL_PATH),
+        FileEmbeddingSource(EDGE_TEMPLATE_FILE_PATH),
+        EDGE_SAMPLE_RATE,
+    )
+    mqtt_server.on_connected = lambda server: server.send_speaker_templates(
+        edge_templates.payload()
+    )
+
+mqtt_server.on_sample = SampleHandler(verificator, edge_templates)
 
 api = ApiAttachment(verificator)
 debug = DebugAttachment(mqtt_server)
@@ -0,0 +1,180 @@
+#include <unity.h>
+
+#include "dsp/filter.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+static constexpr float sampleRate = 4000.0f;
+static constexpr size_t fragment = 128; // one 512 byte DMA buffer
+static constexpr size_t total = fragment * 64;
+
+static int32_t samples[total];
+static int32_t reference[total];
+
+void setUp() {}
+void tearDown() {}
+
+static void tone(float hz, float amplitude, int32_t offset)
+{
+  for (size_t i = 0; i < total; i++)
+    samples[i] = offset + static_cast<int32_t>(amplitude * 8388607.0f * std::sin(6.2831853f * hz * i / sampleRate));
+}
+
+static double mean(const int32_t *from, size_t count)
+{
+  double sum = 0;
+  for (size_t i = 0; i < count; i++)
+    sum += from[i];
+  return sum / count;
+}
+
+static int32_t peak(const int32_t *from, size_t count)
+{
+  int32_t result = 0;
+  for (size_t i = 0; i < count; i++)
+    result = std::max(result, std::abs(from[i]));
+  return result;
+}
+
+void test_buffers_filter_like_one_block()
+{
+  // the state, error term included, carries across buffers
+  Filter::Biquad filter = Filter::highPass(100.0f, sampleRate);
+  tone(440.0f, 0.3f, 200000);
+  memcpy(reference, samples, sizeof(samples));
+
+  Filter::BiquadState whole;
+  Filter::process(filter, whole, reference, total);
+
+  Filter::BiquadState buffered;
+  for (size_t offset = 0; offset < total; offset += fragment)
+    Filter::process(filter, buffered, samples + offset, fragment);
+  TEST_ASSERT_EQUAL_MEMORY(reference, samples, sizeof(samples));
+}
+
+void test_dc_is_removed()
+{
+  Filter::Biquad filter = Filter::highPass(100.0f, sampleRate);
+  Filter::BiquadState state;
+  for (size_t i = 0; i < total; i++)
+    samples[i] = 1000000;
+  for (size_t offset = 0; offset < total; offset += fragment)
+    Filter::process(filter, state, samples + offset, fragment);
+
+  double residue = mean(samples + total - fragment, fragment);
+  char message[64];
+  snprintf(message, sizeof(message), "DC residue %.3f LSB", residue);
+  TEST_MESSAGE(message);
+  TEST_ASSERT_FLOAT_WITHIN(1.0, 0.0, residue);
+}
+
+void test_passband_is_kept()
+{
+  Filter::Biquad filter = Filter::highPass(100.0f, sampleRate);
+  Filter::BiquadState state;
+  tone(1000.0f, 0.5f, 0);
+  int32_t before = peak(samples, total);
+  Filter::process(filter, state, samples, total);
+  int32_t after = peak(samples + total / 2, total / 2);
+  TEST_ASSERT_INT_WITHIN(before / 100, before, after);
+}
+
+void test_stride_keeps_channels_apart()
+{
+  Filter::Biquad filter = Filter::highPass(100.0f, sampleRate);
+  int32_t left[fragment], right[fragment];
+  for (size_t i = 0; i < fragment; i++)
+  {
+    left[i] = 300000 + static_cast<int32_t>(i * 1000);
+    right[i] = -500000 + static_cast<int32_t>(i * i);
+    samples[2 * i] = left[i];
+    samples[2 * i + 1] = right[i];
+  }
+
+  Filter::BiquadState leftState, rightState, states[2];
+  Filter::process(filter, leftState, left, fragment);
+  Filter::process(filter, rightState, right, fragment);
+  Filter::process(filter, states[0], samples, 2 * fragment, 2);
+  Filter::process(filter, states[1], samples + 1, 2 * fragment - 1, 2);
+  for (size_t i = 0; i < fragment; i++)
+  {
+    TEST_ASSERT_EQUAL(left[i], samples[2 * i]);
+    TEST_ASSERT_EQUAL(right[i], samples[2 * i + 1]);
+  }
+}
+
+void test_agc_raises_quiet_input_up_to_the_cap()
+{
+  Filter::AgcConfig config = Filter::defaultAgcConfig();
+  Filter::AgcState state;
+  tone(440.0f, 0.001f, 0);
+  int32_t gain = 0;
+  for (size_t offset = 0; offset < total; offset += fragment)
+  {
+    int32_t previous = state.gainQ16;
+    gain = Filter::agc(config, state, samples + offset, fragment);
+    TEST_ASSERT_GREATER_OR_EQUAL(previous, gain);
+  }
+  TEST_ASSERT_GREATER_THAN(1 << 16, gain);
+  TEST_ASSERT_LESS_OR_EQUAL(config.maxGainQ16, gain);
+}
+
+void test_agc_cuts_loud_input_at_once()
+{
+  Filter::AgcConfig config = Filter::defaultAgcConfig();
+  Filter::AgcState state;
+  state.gainQ16 = config.maxGainQ16;
+  tone(440.0f, 0.25f, 0);
+  int32_t gain = Filter::agc(config, state, samples, fragment);
+  TEST_ASSERT_LESS_THAN(config.maxGainQ16, gain);
+  TEST_ASSERT_LESS_OR_EQUAL(config.targetPeak, peak(samples, fragment));
+
+  // never below unity, the AGC only undoes its own gain
+  tone(440.0f, 0.9f, 0);
+  TEST_ASSERT_EQUAL(1 << 16, Filter::agc(config, state, samples, fragment));
+}
+
+// Cost of both stages per DMA buffer, against the time the buffer covers.
+void test_filter_benchmark()
+{
+  static constexpr size_t rounds = 2000;
+  Filter::Biquad filter = Filter::highPass(100.0f, sampleRate);
+  Filter::BiquadState state;
+  Filter::AgcConfig config = Filter::defaultAgcConfig();
+  Filter::AgcState agcState;
+  tone(440.0f, 0.01f, 20000);
+
+  auto start = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < rounds; i++)
+  {
+    int32_t *buffer = samples + (i % (total / fragment)) * fragment;
+    Filter::process(filter, state, buffer, fragment);
+    Filter::agc(config, agcState, buffer, fragment);
+  }
+  double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  double perBuffer = seconds / rounds * 1e6;
+  double budget = 1e6 * fragment / sampleRate;
+  char message[128];
+  snprintf(message, sizeof(message), "%.1f ns per sample, %.2f us per buffer, %.4f%% of its %.0f us",
+           perBuffer * 1e3 / fragment, perBuffer, 100 * perBuffer / budget, budget);
+  TEST_MESSAGE(message);
+}
+
+int main()
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_buffers_filter_like_one_block);
+  RUN_TEST(test_dc_is_removed);
+  RUN_TEST(test_passband_is_kept);
+  RUN_TEST(test_stride_keeps_channels_apart);
+  RUN_TEST(test_agc_raises_quiet_input_up_to_the_cap);
+  RUN_TEST(test_agc_cuts_loud_input_at_once);
+  RUN_TEST(test_filter_benchmark);
+  return UNITY_END();
+}
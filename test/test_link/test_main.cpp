@@ -0,0 +1,275 @@
+#include <unity.h>
+
+#include "core/link.h"
+
+// Scripted WiFi and broker, counting what the link asked of them.
+struct FakeDriver
+{
+  bool hasSettings = true;
+  bool wifi = false;
+  bool wifiOnJoin = true; // the join gets an IP by the next step
+  bool cachedNetwork = false;
+  bool broker = true;
+  bool subscriptions = true;
+  uint32_t jitter = 0; // picked from [0, bound), clamped
+
+  int resets = 0;
+  int joins = 0;
+  int fastJoins = 0;
+  int forgets = 0;
+  int connects = 0;
+  int subscribes = 0;
+
+  bool configured() { return hasSettings; }
+  void reset()
+  {
+    resets++;
+    wifi = false;
+  }
+  bool wifiUp() { return wifi; }
+  bool join()
+  {
+    joins++;
+    wifi = wifiOnJoin;
+    return cachedNetwork;
+  }
+  void joined(bool fast, unsigned long)
+  {
+    fastJoins += fast;
+  }
+  void forgetNetwork()
+  {
+    forgets++;
+    cachedNetwork = false;
+    wifi = false;
+  }
+  bool connect()
+  {
+    connects++;
+    return broker;
+  }
+  bool subscribe()
+  {
+    subscribes++;
+    return subscriptions;
+  }
+  uint32_t random(uint32_t bound) { return jitter < bound ? jitter : bound - 1; }
+};
+
+static FakeDriver *driver;
+static Link<FakeDriver> *link;
+static unsigned long now;
+
+void setUp()
+{
+  driver = new FakeDriver();
+  link = new Link<FakeDriver>(*driver);
+  now = 0;
+}
+
+void tearDown()
+{
+  delete link;
+  delete driver;
+}
+
+// Steps every `period` ms until the link is up, returns the steps taken or
+// -1 when it is still down after `limit` steps.
+static int stepUntilUp(int limit = 1000, unsigned long period = 100)
+{
+  for (int steps = 1; steps <= limit; steps++)
+  {
+    if (link->step(now) == LinkState::UP)
+      return steps;
+    now += period;
+  }
+  return -1;
+}
+
+void test_first_connection_goes_through_every_state()
+{
+  const LinkState expected[] = {
+      LinkState::WIFI_DOWN,
+      LinkState::WIFI_JOINING,
+      LinkState::CONNECTING,
+      LinkState::SUBSCRIBING,
+      LinkState::UP,
+  };
+  for (LinkState state : expected)
+    TEST_ASSERT_EQUAL(static_cast<int>(state), static_cast<int>(link->step(now++)));
+
+  TEST_ASSERT_EQUAL(1, driver->joins);
+  TEST_ASSERT_EQUAL(1, driver->connects);
+  TEST_ASSERT_EQUAL(1, driver->subscribes);
+  TEST_ASSERT_EQUAL(0, link->failures());
+}
+
+void test_waits_for_settings()
+{
+  driver->hasSettings = false;
+  for (int i = 0; i < 10; i++)
+    TEST_ASSERT_EQUAL(static_cast<int>(LinkState::IDLE), static_cast<int>(link->step(now++)));
+
+  driver->hasSettings = true;
+  TEST_ASSERT_GREATER_THAN(0, stepUntilUp());
+}
+
+void test_dropped_connection_reconnects_after_backoff()
+{
+  TEST_ASSERT_GREATER_THAN(0, stepUntilUp());
+
+  driver->broker = false;
+  link->dropped();
+  TEST_ASSERT_EQUAL(static_cast<int>(LinkState::DROPPED), static_cast<int>(link->state()));
+  TEST_ASSERT_EQUAL(static_cast<int>(LinkState::BACKOFF), static_cast<int>(link->step(now)));
+  TEST_ASSERT_EQUAL(1, link->failures());
+
+  // the broker comes back after a few attempts
+  int attempts = 0;
+  while (link->state() != LinkState::UP && attempts < 100)
+  {
+    if (link->state() == LinkState::CONNECTING && ++attempts == 4)
+      driver->broker = true;
+    link->step(now);
+    now += 100;
+  }
+  TEST_ASSERT_EQUAL(static_cast<int>(LinkState::UP), static_cast<int>(link->state()));
+  TEST_ASSERT_EQUAL(0, link->failures());
+}
+
+void test_backoff_doubles_up_to_the_cap()
+{
+  TEST_ASSERT_EQUAL(MQTT_BACKOFF_MIN_MS, Link<FakeDriver>::backoff(1));
+  TEST_ASSERT_EQUAL(2 * MQTT_BACKOFF_MIN_MS, Link<FakeDriver>::backoff(2));
+  TEST_ASSERT_EQUAL(4 * MQTT_BACKOFF_MIN_MS, Link<FakeDriver>::backoff(3));
+  TEST_ASSERT_EQUAL(MQTT_BACKOFF_MAX_MS, Link<FakeDriver>::backoff(20));
+  TEST_ASSERT_EQUAL(MQTT_BACKOFF_MAX_MS, Link<FakeDriver>::backoff(1000));
+}
+
+// Milliseconds the link stays in BACKOFF after the failure at `now`.
+static unsigned long backoffLength()
+{
+  unsigned long startedAt = now;
+  while (link->step(now) == LinkState::BACKOFF)
+    now++;
+  return now - startedAt;
+}
+
+void test_jitter_spreads_the_retry_over_half_the_delay()
+{
+  driver->broker = false;
+  driver->jitter = 0;
+  while (link->step(now) != LinkState::BACKOFF)
+    now++;
+  TEST_ASSERT_EQUAL(MQTT_BACKOFF_MIN_MS / 2, backoffLength());
+
+  driver->jitter = UINT32_MAX; // the largest the driver may return
+  while (link->step(now) != LinkState::BACKOFF)
+    now++;
+  uint32_t delay = Link<FakeDriver>::backoff(link->failures());
+  TEST_ASSERT_EQUAL(delay / 2 + delay / 2, backoffLength());
+}
+
+void test_join_timeout_backs_off()
+{
+  driver->wifiOnJoin = false;
+  link->step(now); // WIFI_DOWN
+  link->step(now); // WIFI_JOINING
+  now += WIFI_JOIN_TIMEOUT_MS - 1;
+  TEST_ASSERT_EQUAL(static_cast<int>(LinkState::WIFI_JOINING), static_cast<int>(link->step(now)));
+  now += 1;
+  TEST_ASSERT_EQUAL(static_cast<int>(LinkState::BACKOFF), static_cast<int>(link->step(now)));
+  TEST_ASSERT_EQUAL(1, link->failures());
+  TEST_ASSERT_EQUAL(0, driver->forgets);
+}
+
+void test_failed_fast_join_rescans_without_backoff()
+{
+  driver->cachedNetwork = true;
+  driver->wifiOnJoin = false;
+  link->step(now); // WIFI_DOWN
+  link->step(now); // WIFI_JOINING on the cached network
+  now += WIFI_FAST_JOIN_TIMEOUT_MS;
+  TEST_ASSERT_EQUAL(static_cast<int>(LinkState::WIFI_DOWN), static_cast<int>(link->step(now)));
+  TEST_ASSERT_EQUAL(1, driver->forgets);
+  TEST_ASSERT_EQUAL(0, link->failures());
+
+  driver->wifiOnJoin = true;
+  TEST_ASSERT_GREATER_THAN(0, stepUntilUp());
+  TEST_ASSERT_EQUAL(0, driver->fastJoins);
+}
+
+void test_refused_connection_after_fast_join_forgets_the_network()
+{
+  driver->cachedNetwork = true;
+  driver->broker = false;
+  while (link->step(now) != LinkState::BACKOFF)
+    now++;
+  TEST_ASSERT_EQUAL(1, driver->fastJoins);
+  TEST_ASSERT_EQUAL(1, driver->forgets);
+  TEST_ASSERT_EQUAL(1, link->failures());
+}
+
+void test_failed_subscribe_backs_off()
+{
+  driver->subscriptions = false;
+  while (link->step(now) != LinkState::BACKOFF)
+    now++;
+  TEST_ASSERT_EQUAL(1, driver->subscribes);
+
+  driver->subscriptions = true;
+  TEST_ASSERT_GREATER_THAN(0, stepUntilUp());
+}
+
+void test_wifi_lost_while_up_backs_off()
+{
+  TEST_ASSERT_GREATER_THAN(0, stepUntilUp());
+  driver->wifi = false;
+  TEST_ASSERT_EQUAL(static_cast<int>(LinkState::BACKOFF), static_cast<int>(link->step(now)));
+  TEST_ASSERT_GREATER_THAN(0, stepUntilUp());
+  TEST_ASSERT_EQUAL(2, driver->joins);
+}
+
+void test_dropped_is_ignored_outside_up()
+{
+  link->step(now); // WIFI_DOWN
+  link->dropped();
+  TEST_ASSERT_EQUAL(static_cast<int>(LinkState::WIFI_DOWN), static_cast<int>(link->state()));
+}
+
+void test_restart_starts_over_without_backoff()
+{
+  driver->broker = false;
+  for (int i = 0; i < 3; i++)
+  {
+    while (link->step(now) != LinkState::BACKOFF)
+      now++;
+    backoffLength();
+  }
+  TEST_ASSERT_GREATER_THAN(1, link->failures());
+
+  driver->broker = true;
+  link->restart();
+  TEST_ASSERT_EQUAL(static_cast<int>(LinkState::WIFI_DOWN), static_cast<int>(link->step(now)));
+  TEST_ASSERT_EQUAL(1, driver->resets);
+  TEST_ASSERT_EQUAL(0, link->failures());
+  TEST_ASSERT_EQUAL(4, stepUntilUp(1000, 0));
+}
+
+int main()
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_first_connection_goes_through_every_state);
+  RUN_TEST(test_waits_for_settings);
+  RUN_TEST(test_dropped_connection_reconnects_after_backoff);
+  RUN_TEST(test_backoff_doubles_up_to_the_cap);
+  RUN_TEST(test_jitter_spreads_the_retry_over_half_the_delay);
+  RUN_TEST(test_join_timeout_backs_off);
+  RUN_TEST(test_failed_fast_join_rescans_without_backoff);
+  RUN_TEST(test_refused_connection_after_fast_join_forgets_the_network);
+  RUN_TEST(test_failed_subscribe_backs_off);
+  RUN_TEST(test_wifi_lost_while_up_backs_off);
+  RUN_TEST(test_dropped_is_ignored_outside_up);
+  RUN_TEST(test_restart_starts_over_without_backoff);
+  return UNITY_END();
+}
@@ -0,0 +1,243 @@
+#include <unity.h>
+
+#include "dsp/lossless.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+static constexpr size_t blockSize = 128; // one 512 byte DMA buffer
+static constexpr float scale = 1.0f / 8388608.0f;
+
+static int32_t samples[blockSize];
+static uint8_t encoded[Lossless::maxEncodedSize(blockSize)];
+static float decoded[blockSize];
+
+void setUp() {}
+void tearDown() {}
+
+static void sine(int32_t *dest, size_t count, float amplitude, float period)
+{
+  for (size_t i = 0; i < count; i++)
+    dest[i] = static_cast<int32_t>(amplitude * 8388607.0f * std::sin(6.2831853f * i / period));
+}
+
+// Uniform noise in [-amplitude, amplitude], the same on every host.
+static void noise(int32_t *dest, size_t count, int32_t amplitude, uint32_t seed)
+{
+  for (size_t i = 0; i < count; i++)
+  {
+    seed = seed * 1664525u + 1013904223u;
+    dest[i] = static_cast<int32_t>((seed >> 8) % (2u * amplitude + 1)) - amplitude;
+  }
+}
+
+// Encodes `samples`, decodes them back and checks every sample came back.
+static size_t roundTrip(size_t count)
+{
+  size_t size = Lossless::encodeBlock(samples, count, encoded);
+  TEST_ASSERT_LESS_OR_EQUAL(Lossless::maxEncodedSize(count), size);
+  TEST_ASSERT_EQUAL(count, Lossless::decode(encoded, size, nullptr, 0));
+  TEST_ASSERT_EQUAL(count, Lossless::decode(encoded, size, decoded, count));
+  for (size_t i = 0; i < count; i++)
+    TEST_ASSERT_EQUAL(samples[i], static_cast<int32_t>(std::lround(decoded[i] / scale)));
+  return size;
+}
+
+void test_sine_compresses()
+{
+  sine(samples, blockSize, 0.25f, 40.0f);
+  size_t size = roundTrip(blockSize);
+  TEST_ASSERT_NOT_EQUAL(Lossless::verbatim, encoded[2]);
+  TEST_ASSERT_LESS_THAN(Lossless::maxEncodedSize(blockSize), size);
+}
+
+void test_silence()
+{
+  for (size_t i = 0; i < blockSize; i++)
+    samples[i] = 0;
+  TEST_ASSERT_LESS_THAN(32, roundTrip(blockSize));
+}
+
+void test_full_scale_noise_falls_back_to_verbatim()
+{
+  noise(samples, blockSize, 8388607, 1);
+  TEST_ASSERT_EQUAL(Lossless::maxEncodedSize(blockSize), roundTrip(blockSize));
+  TEST_ASSERT_EQUAL(Lossless::verbatim, encoded[2]);
+}
+
+void test_extremes_overflow_without_losing_samples()
+{
+  // a few spikes in silence pick a tiny Rice parameter, and their unary
+  // codes overflow the block halfway through a residual
+  for (size_t i = 0; i < blockSize; i++)
+    samples[i] = 0;
+  samples[2] = -8353;
+  samples[3] = 2780;
+  samples[74] = -630;
+  roundTrip(blockSize);
+  TEST_ASSERT_EQUAL(Lossless::verbatim, encoded[2]);
+
+  for (size_t i = 0; i < blockSize; i++)
+    samples[i] = i < blockSize - 8 ? 0 : (i % 2 ? 8388607 : -8388608);
+  roundTrip(blockSize);
+
+  for (size_t i = 0; i < blockSize; i++)
+    samples[i] = i % 2 ? 8388607 : -8388608;
+  roundTrip(blockSize);
+}
+
+void test_short_blocks()
+{
+  sine(samples, blockSize, 0.5f, 16.0f);
+  for (size_t count = 1; count <= 2 * Lossless::maxOrder; count++)
+    roundTrip(count);
+}
+
+void test_truncated_stream_stops_at_the_last_whole_block()
+{
+  sine(samples, blockSize, 0.25f, 40.0f);
+  size_t first = Lossless::encodeBlock(samples, blockSize / 2, encoded);
+  size_t second = Lossless::encodeBlock(samples + blockSize / 2, blockSize / 2, encoded + first);
+
+  TEST_ASSERT_EQUAL(blockSize, Lossless::decode(encoded, first + second, nullptr, 0));
+  TEST_ASSERT_EQUAL(blockSize / 2, Lossless::decode(encoded, first + second - 1, nullptr, 0));
+}
+
+// Encode throughput on speech-like input, against the real-time rate of
+// RECORDER_SAMPLE_RATE at 4 kHz.
+static uint32_t get32(const uint8_t *from) { return from[0] | from[1] << 8 | from[2] << 16 | static_cast<uint32_t>(from[3]) << 24; }
+
+// The first channel of a PCM WAV file as 24-bit samples at 4 kHz, empty
+// when it cannot be read. Rates that are a multiple of 4 kHz are brought
+// down by averaging.
+static std::vector<int32_t> loadWav(const char *path)
+{
+  std::vector<int32_t> result;
+  FILE *file = fopen(path, "rb");
+  if (!file)
+    return result;
+  std::vector<uint8_t> bytes;
+  uint8_t chunk[4096];
+  for (size_t read; (read = fread(chunk, 1, sizeof(chunk), file)) > 0;)
+    bytes.insert(bytes.end(), chunk, chunk + read);
+  fclose(file);
+  if (bytes.size() < 12 || memcmp(bytes.data(), "RIFF", 4) != 0 || memcmp(bytes.data() + 8, "WAVE", 4) != 0)
+    return result;
+
+  uint16_t format = 0, channels = 0, bits = 0;
+  uint32_t rate = 0;
+  for (size_t offset = 12; offset + 8 <= bytes.size();)
+  {
+    const uint8_t *header = bytes.data() + offset;
+    size_t size = get32(header + 4);
+    size_t available = bytes.size() - offset - 8;
+    if (memcmp(header, "fmt ", 4) == 0 && size >= 16 && size <= available)
+    {
+      format = header[8] | header[9] << 8;
+      channels = header[10] | header[11] << 8;
+      rate = get32(header + 12);
+      bits = header[22] | header[23] << 8;
+    }
+    else if (memcmp(header, "data", 4) == 0)
+    {
+      size_t width = bits / 8;
+      bool pcm = format == 1 || format == 0xFFFE;
+      if (!pcm || channels == 0 || (width != 2 && width != 3 && width != 4) || rate % 4000 != 0)
+        return result;
+      size_t frame = width * channels;
+      size_t factor = rate / 4000;
+      size_t frames = std::min(size, available) / frame;
+      for (size_t i = 0; i + factor <= frames; i += factor)
+      {
+        int64_t sum = 0;
+        for (size_t j = 0; j < factor; j++)
+        {
+          const uint8_t *sample = header + 8 + (i + j) * frame;
+          uint32_t word = 0;
+          for (size_t b = 0; b < width; b++)
+            word |= static_cast<uint32_t>(sample[b]) << (8 * (4 - width + b));
+          sum += static_cast<int32_t>(word) >> 8;
+        }
+        result.push_back(static_cast<int32_t>(sum / static_cast<int64_t>(factor)));
+      }
+      return result;
+    }
+    offset += 8 + size + (size & 1);
+  }
+  return result;
+}
+
+// Checks every block of `clip` comes back, then encodes it over and over
+// for at least `total` samples and reports the ratio against 24-bit PCM
+// and the cost per sample.
+static void benchmark(const char *name, const std::vector<int32_t> &clip, size_t total)
+{
+  size_t usable = clip.size() / blockSize * blockSize;
+  TEST_ASSERT_TRUE(usable > 0);
+  for (size_t offset = 0; offset < usable; offset += blockSize)
+  {
+    memcpy(samples, clip.data() + offset, sizeof(samples));
+    roundTrip(blockSize);
+  }
+
+  size_t bytes = 0, count = 0;
+  auto start = std::chrono::steady_clock::now();
+  while (count < total)
+  {
+    for (size_t offset = 0; offset < usable; offset += blockSize)
+      bytes += Lossless::encodeBlock(clip.data() + offset, blockSize, encoded);
+    count += usable;
+  }
+  double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  double perSample = seconds * 1e9 / count;
+  double bytesPerSample = static_cast<double>(bytes) / count;
+  char message[192];
+  snprintf(message, sizeof(message), "%s: ratio %.2f (%.2f bytes/sample against 3), %.1f ns per sample (%.0fx real time at 4 kHz)",
+           name, 3 / bytesPerSample, bytesPerSample, perSample, 1e9 / 4000 / perSample);
+  TEST_MESSAGE(message);
+  TEST_ASSERT_LESS_THAN(3.0, bytesPerSample);
+}
+
+// A speech clip from RECORDER_SPEECH_WAV (PCM, 16 to 32-bit, 4 kHz or a
+// multiple of it) when set, and a tone in noise either way.
+void test_encode_benchmark()
+{
+  static constexpr size_t total = 20000 * blockSize;
+  const char *path = getenv("RECORDER_SPEECH_WAV");
+  if (path)
+  {
+    std::vector<int32_t> clip = loadWav(path);
+    TEST_ASSERT_TRUE_MESSAGE(clip.size() >= blockSize, "RECORDER_SPEECH_WAV is not a usable PCM WAV file");
+    benchmark(path, clip, total);
+  }
+  else
+  {
+    TEST_MESSAGE("RECORDER_SPEECH_WAV is not set, skipping the speech clip");
+  }
+
+  std::vector<int32_t> synthetic(blockSize), voice(blockSize);
+  sine(synthetic.data(), blockSize, 0.2f, 23.0f);
+  noise(voice.data(), blockSize, 2000, 2);
+  for (size_t i = 0; i < blockSize; i++)
+    synthetic[i] += voice[i];
+  benchmark("tone in noise", synthetic, total);
+}
+
+int main()
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_sine_compresses);
+  RUN_TEST(test_silence);
+  RUN_TEST(test_full_scale_noise_falls_back_to_verbatim);
+  RUN_TEST(test_extremes_overflow_without_losing_samples);
+  RUN_TEST(test_short_blocks);
+  RUN_TEST(test_truncated_stream_stops_at_the_last_whole_block);
+  RUN_TEST(test_encode_benchmark);
+  return UNITY_END();
+}
@@ -0,0 +1,332 @@
+#include <unity.h>
+
+#include "dsp/mel.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+static constexpr uint32_t sampleRate = 4000;
+static constexpr size_t fragment = 128; // one 512 byte DMA buffer
+static constexpr size_t total = fragment * 32;
+static constexpr Mel::Layout layout = Mel::layoutFor(sampleRate);
+
+static Mel::Extractor extractor;
+static uint32_t seed = 1;
+static int32_t samples[total];
+static uint8_t block[Mel::maxEncodedSize(total, layout.hop)];
+static uint8_t streamed[Mel::maxEncodedSize(total, layout.hop)];
+
+void setUp()
+{
+  seed = 1;
+  extractor.begin(sampleRate);
+}
+
+void tearDown() {}
+
+static void tone(float hz, float amplitude)
+{
+  for (size_t i = 0; i < total; i++)
+    samples[i] = static_cast<int32_t>(amplitude * 8388607.0f * std::sin(6.2831853f * hz * i / sampleRate));
+}
+
+static double hzToMel(double hz) { return 2595.0 * std::log10(1.0 + hz / 700.0); }
+static double melToHz(double mel) { return 700.0 * (std::pow(10.0, mel / 2595.0) - 1.0); }
+
+
+static double noise()
+{
+  seed = seed * 1664525u + 1013904223u;
+  return static_cast<double>(seed >> 8) / (1u << 23) - 1.0;
+}
+
+// Voiced speech: harmonics of a gliding ~120 Hz pitch shaped by formants at
+// 500, 1500 and 1900 Hz, with a syllable-rate envelope.
+static void vowel(double level)
+{
+  double phase = 0;
+  for (size_t i = 0; i < total; i++)
+  {
+    double t = static_cast<double>(i) / sampleRate;
+    double f0 = 120.0 + 25.0 * std::sin(2 * M_PI * 3.0 * t);
+    phase += 2 * M_PI * f0 / sampleRate;
+    double sum = 0;
+    for (int h = 1; h * f0 < sampleRate / 2.0; h++)
+    {
+      double hz = h * f0;
+      double gain = 0;
+      for (double formant : {500.0, 1500.0, 1900.0})
+        gain += 1.0 / (1.0 + std::pow((hz - formant) / 120.0, 2));
+      sum += gain / h * std::sin(h * phase);
+    }
+    double envelope = 0.55 - 0.45 * std::cos(2 * M_PI * 4.0 * t);
+    samples[i] = static_cast<int32_t>(level * 8388607.0 * envelope * sum / 3.0);
+  }
+}
+
+// Unvoiced speech: white noise tilted towards the top of the band, in bursts
+// with silent gaps between them.
+static void fricative(double level)
+{
+  double previous = 0;
+  for (size_t i = 0; i < total; i++)
+  {
+    double white = noise();
+    double tilted = 0.5 * (white - previous);
+    previous = white;
+    bool burst = (i / (sampleRate / 8)) % 2 == 0;
+    samples[i] = burst ? static_cast<int32_t>(level * 8388607.0 * tilted) : 0;
+  }
+}
+
+// The quantised log-mel frames of samples[] computed in double precision:
+// a Hann-windowed DFT scaled by 1 / fftSize like the extractor's, the HTK
+// triangles at the FFT bin centres and an unrounded 4 * log2.
+static std::vector<double> reference()
+{
+  const size_t half = Mel::fftSize / 2;
+  std::vector<double> weights(Mel::bins * (half + 1));
+  double maxMel = hzToMel(sampleRate / 2.0);
+  for (size_t m = 0; m < Mel::bins; m++)
+  {
+    double left = melToHz(maxMel * m / (Mel::bins + 1));
+    double centre = melToHz(maxMel * (m + 1) / (Mel::bins + 1));
+    double right = melToHz(maxMel * (m + 2) / (Mel::bins + 1));
+    for (size_t k = 0; k <= half; k++)
+    {
+      double hz = static_cast<double>(k) * sampleRate / Mel::fftSize;
+      weights[m * (half + 1) + k] = hz <= left || hz >= right ? 0.0 : (hz <= centre ? (hz - left) / (centre - left) : (right - hz) / (right - centre));
+    }
+  }
+
+  std::vector<double> levels;
+  std::vector<double> power(half + 1);
+  for (size_t start = 0; start + layout.window <= total; start += layout.hop)
+  {
+    for (size_t k = 0; k <= half; k++)
+    {
+      double re = 0, im = 0;
+      for (size_t i = 0; i < layout.window; i++)
+      {
+        double x = samples[start + i] * (0.5 - 0.5 * std::cos(2 * M_PI * i / layout.window));
+        re += x * std::cos(2 * M_PI * k * i / Mel::fftSize);
+        im -= x * std::sin(2 * M_PI * k * i / Mel::fftSize);
+      }
+      power[k] = (re * re + im * im) / (static_cast<double>(Mel::fftSize) * Mel::fftSize);
+    }
+    for (size_t m = 0; m < Mel::bins; m++)
+    {
+      double energy = 0;
+      for (size_t k = 0; k <= half; k++)
+        energy += power[k] * weights[m * (half + 1) + k];
+      double level = energy > 1 ? Mel::stepsPerOctave * std::log2(energy) : 0;
+      levels.push_back(std::min(level, 255.0));
+    }
+  }
+  return levels;
+}
+
+// Below 16 octaves of energy the FFT's rounding at every stage dominates,
+// mostly in the two lowest bins, which speech barely reaches.
+static constexpr double noiseFloor = 16 * Mel::stepsPerOctave;
+
+struct Error
+{
+  double max = 0; // above the noise floor
+  double sum = 0;
+  size_t count = 0;
+
+  double mean() const { return count ? sum / count : 0; }
+};
+
+// Error of the extractor against the reference, in quantisation steps.
+static void compare(Error &error)
+{
+  std::vector<double> expected = reference();
+  extractor.begin(sampleRate);
+  extractor.process(samples, total, block, sizeof(block));
+  TEST_ASSERT_EQUAL(expected.size(), block[0] * Mel::bins);
+  for (size_t i = 0; i < expected.size(); i++)
+  {
+    double difference = std::fabs(block[Mel::blockHeaderSize + i] - expected[i]);
+    if (expected[i] >= noiseFloor)
+      error.max = std::max(error.max, difference);
+    error.sum += difference;
+    error.count++;
+  }
+}
+
+// Speech-like signals from -6 to -40 dBFS, the levels the recorder sees.
+static Error speechError()
+{
+  Error error;
+  for (double level : {0.5, 0.05, 0.01})
+  {
+    vowel(level);
+    compare(error);
+    fricative(level);
+    compare(error);
+  }
+  return error;
+}
+
+// Bin with the most energy in the last frame of `block`.
+static size_t loudestBin(const uint8_t *frames)
+{
+  const uint8_t *last = frames + Mel::blockHeaderSize + (frames[0] - 1) * Mel::bins;
+  size_t loudest = 0;
+  for (size_t m = 1; m < Mel::bins; m++)
+  {
+    if (last[m] > last[loudest])
+      loudest = m;
+  }
+  return loudest;
+}
+
+void test_layout_at_4_khz()
+{
+  TEST_ASSERT_EQUAL(100, layout.window);
+  TEST_ASSERT_EQUAL(40, layout.hop);
+  TEST_ASSERT_EQUAL(100, extractor.layout().window);
+}
+
+void test_descriptor()
+{
+  uint8_t descriptor[Mel::descriptorSize];
+  TEST_ASSERT_EQUAL(Mel::descriptorSize, Mel::writeDescriptor(layout, descriptor));
+  TEST_ASSERT_EQUAL_MEMORY("LMEL", descriptor, 4);
+  TEST_ASSERT_EQUAL(sampleRate, descriptor[4] | descriptor[5] << 8 | descriptor[6] << 16 | descriptor[7] << 24);
+  TEST_ASSERT_EQUAL(Mel::fftSize, descriptor[8] | descriptor[9] << 8);
+  TEST_ASSERT_EQUAL(layout.window, descriptor[10] | descriptor[11] << 8);
+  TEST_ASSERT_EQUAL(layout.hop, descriptor[12] | descriptor[13] << 8);
+  TEST_ASSERT_EQUAL(Mel::bins, descriptor[14]);
+  TEST_ASSERT_EQUAL(Mel::stepsPerOctave, descriptor[15]);
+}
+
+void test_frames_run_across_fragments()
+{
+  tone(440.0f, 0.3f);
+  size_t size = extractor.process(samples, total, block, sizeof(block));
+  size_t frames = (total - layout.window) / layout.hop + 1;
+  TEST_ASSERT_EQUAL(frames, block[0]);
+  TEST_ASSERT_EQUAL(Mel::bins, block[1]);
+  TEST_ASSERT_EQUAL(Mel::blockHeaderSize + frames * Mel::bins, size);
+
+  // the same audio a fragment at a time gives the same frames
+  extractor.begin(sampleRate);
+  size_t streamedFrames = 0;
+  for (size_t offset = 0; offset < total; offset += fragment)
+  {
+    uint8_t part[Mel::maxEncodedSize(fragment, layout.hop)];
+    size_t partSize = extractor.process(samples + offset, fragment, part, sizeof(part));
+    TEST_ASSERT_EQUAL(Mel::blockHeaderSize + part[0] * Mel::bins, partSize);
+    memcpy(streamed + streamedFrames * Mel::bins, part + Mel::blockHeaderSize, part[0] * Mel::bins);
+    streamedFrames += part[0];
+  }
+  TEST_ASSERT_EQUAL(frames, streamedFrames);
+  TEST_ASSERT_EQUAL_MEMORY(block + Mel::blockHeaderSize, streamed, frames * Mel::bins);
+}
+
+void test_silence_is_zero()
+{
+  memset(samples, 0, sizeof(samples));
+  extractor.process(samples, total, block, sizeof(block));
+  for (size_t i = 0; i < block[0] * Mel::bins; i++)
+    TEST_ASSERT_EQUAL(0, block[Mel::blockHeaderSize + i]);
+}
+
+void test_tone_lands_in_its_bin()
+{
+  const float tones[] = {250.0f, 700.0f, 1200.0f, 1800.0f};
+  for (float hz : tones)
+  {
+    extractor.begin(sampleRate);
+    tone(hz, 0.3f);
+    extractor.process(samples, total, block, sizeof(block));
+
+    // bin m is centred on mel (m + 1) / (bins + 1) of the way to Nyquist
+    double expected = hzToMel(hz) / hzToMel(sampleRate / 2.0) * (Mel::bins + 1) - 1;
+    TEST_ASSERT_FLOAT_WITHIN(1.0, expected, loudestBin(block));
+  }
+}
+
+void test_6_db_louder_is_8_steps_up()
+{
+  // twice the amplitude is four times the energy, two octaves of log2
+  tone(700.0f, 0.1f);
+  extractor.process(samples, total, block, sizeof(block));
+  size_t bin = loudestBin(block);
+  int quiet = block[Mel::blockHeaderSize + (block[0] - 1) * Mel::bins + bin];
+
+  extractor.begin(sampleRate);
+  tone(700.0f, 0.2f);
+  extractor.process(samples, total, block, sizeof(block));
+  int loud = block[Mel::blockHeaderSize + (block[0] - 1) * Mel::bins + bin];
+  TEST_ASSERT_INT_WITHIN(1, 2 * Mel::stepsPerOctave, loud - quiet);
+}
+
+void test_speech_matches_the_float_reference()
+{
+  Error error = speechError();
+  char message[128];
+  snprintf(message, sizeof(message), "error against double precision: max %.2f steps above the floor, mean %.3f over %u values",
+           error.max, error.mean(), static_cast<unsigned>(error.count));
+  TEST_MESSAGE(message);
+  // the log2 interpolation is within 0.35 steps, the rounding adds 0.5
+  TEST_ASSERT_TRUE(error.max <= 0.9);
+  TEST_ASSERT_TRUE(error.mean() <= 0.35);
+}
+
+void test_small_capacity_drops_frames_not_bytes()
+{
+  tone(440.0f, 0.3f);
+  uint8_t small[Mel::blockHeaderSize + 2 * Mel::bins + 3];
+  size_t size = extractor.process(samples, total, small, sizeof(small));
+  TEST_ASSERT_EQUAL(2, small[0]);
+  TEST_ASSERT_EQUAL(Mel::blockHeaderSize + 2 * Mel::bins, size);
+}
+
+// Frame cost, against the budget of one hop at 4 kHz, next to the error it
+// buys.
+void test_mel_benchmark()
+{
+  static constexpr size_t rounds = 50;
+  Error error = speechError();
+  vowel(0.05);
+
+  size_t frames = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < rounds; i++)
+  {
+    samples[i] ^= 1; // keep the compiler from hoisting the work
+    extractor.process(samples, total, block, sizeof(block));
+    frames += block[0];
+  }
+  double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  double perFrame = seconds / frames * 1e6;
+  char message[160];
+  snprintf(message, sizeof(message), "%.2f us per frame, %.3f%% of the %u us hop, error max %.2f / mean %.3f steps",
+           perFrame, 100 * perFrame / (1e6 * layout.hop / sampleRate), 1000000u * layout.hop / sampleRate,
+           error.max, error.mean());
+  TEST_MESSAGE(message);
+}
+
+int main()
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_layout_at_4_khz);
+  RUN_TEST(test_descriptor);
+  RUN_TEST(test_frames_run_across_fragments);
+  RUN_TEST(test_silence_is_zero);
+  RUN_TEST(test_tone_lands_in_its_bin);
+  RUN_TEST(test_6_db_louder_is_8_steps_up);
+  RUN_TEST(test_speech_matches_the_float_reference);
+  RUN_TEST(test_small_capacity_drops_frames_not_bytes);
+  RUN_TEST(test_mel_benchmark);
+  return UNITY_END();
+}
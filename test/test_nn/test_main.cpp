@@ -0,0 +1,478 @@
+#include <unity.h>
+
+#include "dsp/nn.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+void setUp() {}
+void tearDown() {}
+
+static uint32_t seed = 1;
+
+static int8_t random8(int bound = 128)
+{
+  seed = seed * 1664525u + 1013904223u;
+  return static_cast<int8_t>(static_cast<int>((seed >> 16) % (2 * bound)) - bound);
+}
+
+static void fill(std::vector<int8_t> &values, int bound = 128)
+{
+  for (auto &value : values)
+    value = random8(bound);
+}
+
+// A layer with its own weights and biases, biases stored like the blob does.
+struct TestLayer
+{
+  Nn::Layer layer;
+  std::vector<int8_t> weights;
+  std::vector<uint8_t> bias;
+  std::vector<int32_t> biases;
+
+  TestLayer(Nn::LayerType type, Nn::Shape input, uint16_t outChannels, uint8_t kernelHeight = 1,
+            uint8_t kernelWidth = 1, uint8_t strideHeight = 1, uint8_t strideWidth = 1)
+  {
+    layer = Nn::Layer{};
+    layer.type = type;
+    layer.relu = false;
+    layer.kernelHeight = kernelHeight;
+    layer.kernelWidth = kernelWidth;
+    layer.strideHeight = strideHeight;
+    layer.strideWidth = strideWidth;
+    layer.multiplier = 1 << 30; // 0.5
+    layer.shift = 6;
+    layer.input = input;
+
+    size_t weightCount = 0;
+    uint16_t height = static_cast<uint16_t>((input.height + strideHeight - 1) / strideHeight);
+    uint16_t width = static_cast<uint16_t>((input.width + strideWidth - 1) / strideWidth);
+    switch (type)
+    {
+    case Nn::LayerType::CONV:
+      layer.output = Nn::Shape{height, width, outChannels};
+      weightCount = static_cast<size_t>(outChannels) * kernelHeight * kernelWidth * input.channels;
+      break;
+    case Nn::LayerType::DEPTHWISE:
+      layer.output = Nn::Shape{height, width, input.channels};
+      weightCount = static_cast<size_t>(kernelHeight) * kernelWidth * input.channels;
+      break;
+    case Nn::LayerType::POINTWISE:
+      layer.output = Nn::Shape{input.height, input.width, outChannels};
+      weightCount = static_cast<size_t>(outChannels) * input.channels;
+      break;
+    case Nn::LayerType::AVERAGE_POOL:
+      layer.output = Nn::Shape{1, 1, input.channels};
+      break;
+    case Nn::LayerType::DENSE:
+      layer.output = Nn::Shape{1, 1, outChannels};
+      weightCount = static_cast<size_t>(outChannels) * input.size();
+      break;
+    }
+
+    weights.resize(weightCount);
+    fill(weights);
+    if (type != Nn::LayerType::AVERAGE_POOL)
+      biases.resize(layer.output.channels);
+    for (auto &value : biases)
+      value = random8() * 64;
+    setBiases();
+    layer.weights = weights.data();
+  }
+
+  void setBiases()
+  {
+    bias.resize(biases.size() * sizeof(int32_t));
+    if (!biases.empty())
+      memcpy(bias.data(), biases.data(), bias.size());
+    layer.bias = bias.data();
+  }
+};
+
+// Straight from the definitions: zero padding for "same" output sizes, int64
+// accumulators, then the kernel's own requantize (tested on its own below).
+static int32_t padBefore(int32_t in, int32_t out, int32_t kernel, int32_t stride)
+{
+  int32_t total = (out - 1) * stride + kernel - in;
+  return total > 0 ? total / 2 : 0;
+}
+
+static int8_t requantized(const Nn::Layer &layer, int64_t acc)
+{
+  TEST_ASSERT_TRUE(acc >= INT32_MIN && acc <= INT32_MAX);
+  return Nn::requantize(static_cast<int32_t>(acc), layer.multiplier, layer.shift, layer.relu);
+}
+
+static std::vector<int8_t> reference(const TestLayer &test, const std::vector<int8_t> &in)
+{
+  const Nn::Layer &layer = test.layer;
+  const Nn::Shape &is = layer.input, &os = layer.output;
+  std::vector<int8_t> out(os.size());
+  auto input = [&](int32_t y, int32_t x, int32_t c) -> int64_t
+  {
+    if (y < 0 || y >= is.height || x < 0 || x >= is.width)
+      return 0;
+    return in[(static_cast<size_t>(y) * is.width + x) * is.channels + c];
+  };
+
+  int32_t padY = padBefore(is.height, os.height, layer.kernelHeight, layer.strideHeight);
+  int32_t padX = padBefore(is.width, os.width, layer.kernelWidth, layer.strideWidth);
+  for (int32_t oy = 0; oy < os.height; oy++)
+  {
+    for (int32_t ox = 0; ox < os.width; ox++)
+    {
+      for (int32_t oc = 0; oc < os.channels; oc++)
+      {
+        int64_t acc = test.biases.empty() ? 0 : test.biases[oc];
+        size_t index = (static_cast<size_t>(oy) * os.width + ox) * os.channels + oc;
+        switch (layer.type)
+        {
+        case Nn::LayerType::CONV:
+          for (int32_t ky = 0; ky < layer.kernelHeight; ky++)
+            for (int32_t kx = 0; kx < layer.kernelWidth; kx++)
+              for (int32_t ic = 0; ic < is.channels; ic++)
+                acc += input(oy * layer.strideHeight + ky - padY, ox * layer.strideWidth + kx - padX, ic) *
+                       test.weights[((static_cast<size_t>(oc) * layer.kernelHeight + ky) * layer.kernelWidth + kx) * is.channels + ic];
+          out[index] = requantized(layer, acc);
+          break;
+        case Nn::LayerType::DEPTHWISE:
+          for (int32_t ky = 0; ky < layer.kernelHeight; ky++)
+            for (int32_t kx = 0; kx < layer.kernelWidth; kx++)
+              acc += input(oy * layer.strideHeight + ky - padY, ox * layer.strideWidth + kx - padX, oc) *
+                     test.weights[(static_cast<size_t>(ky) * layer.kernelWidth + kx) * is.channels + oc];
+          out[index] = requantized(layer, acc);
+          break;
+        case Nn::LayerType::POINTWISE:
+          for (int32_t ic = 0; ic < is.channels; ic++)
+            acc += input(oy, ox, ic) * test.weights[static_cast<size_t>(oc) * is.channels + ic];
+          out[index] = requantized(layer, acc);
+          break;
+        case Nn::LayerType::AVERAGE_POOL:
+        {
+          for (int32_t y = 0; y < is.height; y++)
+            for (int32_t x = 0; x < is.width; x++)
+              acc += input(y, x, oc);
+          out[index] = static_cast<int8_t>(std::lround(static_cast<double>(acc) / (is.height * is.width)));
+          break;
+        }
+        case Nn::LayerType::DENSE:
+          for (size_t i = 0; i < is.size(); i++)
+            acc += in[i] * test.weights[static_cast<size_t>(oc) * is.size() + i];
+          out[index] = requantized(layer, acc);
+          break;
+        }
+      }
+    }
+  }
+  return out;
+}
+
+static std::vector<int8_t> run(const TestLayer &test, const std::vector<int8_t> &in)
+{
+  std::vector<int8_t> out(test.layer.output.size() + 1, 0x55);
+  switch (test.layer.type)
+  {
+  case Nn::LayerType::CONV:
+    Nn::conv(test.layer, in.data(), out.data());
+    break;
+  case Nn::LayerType::DEPTHWISE:
+    Nn::depthwise(test.layer, in.data(), out.data());
+    break;
+  case Nn::LayerType::POINTWISE:
+    Nn::pointwise(test.layer, in.data(), out.data());
+    break;
+  case Nn::LayerType::AVERAGE_POOL:
+    Nn::averagePool(test.layer, in.data(), out.data());
+    break;
+  case Nn::LayerType::DENSE:
+    Nn::dense(test.layer, in.data(), out.data());
+    break;
+  }
+  TEST_ASSERT_EQUAL(0x55, out.back()); // nothing written past the output
+  out.pop_back();
+  return out;
+}
+
+static void check(const TestLayer &test)
+{
+  std::vector<int8_t> in(test.layer.input.size());
+  fill(in);
+  std::vector<int8_t> expected = reference(test, in);
+  std::vector<int8_t> actual = run(test, in);
+  TEST_ASSERT_EQUAL(expected.size(), actual.size());
+  TEST_ASSERT_EQUAL_MEMORY(expected.data(), actual.data(), expected.size());
+}
+
+void test_requantize_matches_float()
+{
+  const int32_t multipliers[] = {1 << 30, 1518500250, 1073741823, INT32_MAX, 12345678};
+  for (int32_t multiplier : multipliers)
+  {
+    for (uint8_t shift = 0; shift < 12; shift++)
+    {
+      for (int i = 0; i < 2000; i++)
+      {
+        seed = seed * 1664525u + 1013904223u;
+        int32_t acc = static_cast<int32_t>(seed) >> (seed % 24);
+        double real = std::ldexp(static_cast<double>(acc) * multiplier, -31 - shift);
+        int32_t expected = static_cast<int32_t>(std::max(-128.0, std::min(127.0, std::round(real))));
+        TEST_ASSERT_INT_WITHIN(1, expected, Nn::requantize(acc, multiplier, shift, false));
+      }
+    }
+  }
+}
+
+void test_requantize_rounds_and_saturates()
+{
+  // half way rounds up, in both steps
+  TEST_ASSERT_EQUAL(1, Nn::requantize(1, 1 << 30, 0, false));
+  TEST_ASSERT_EQUAL(2, Nn::requantize(3, INT32_MAX, 1, false));
+  TEST_ASSERT_EQUAL(-1, Nn::requantize(-3, INT32_MAX, 2, false));
+
+  TEST_ASSERT_EQUAL(127, Nn::requantize(INT32_MAX, INT32_MAX, 0, false));
+  TEST_ASSERT_EQUAL(-128, Nn::requantize(INT32_MIN, INT32_MAX, 0, false));
+  TEST_ASSERT_EQUAL(127, Nn::requantize(128, INT32_MAX, 0, false));
+  TEST_ASSERT_EQUAL(-128, Nn::requantize(-129, INT32_MAX, 0, false));
+
+  // fused ReLU clamps at 0, not at -128
+  TEST_ASSERT_EQUAL(0, Nn::requantize(-1000, INT32_MAX, 0, true));
+  TEST_ASSERT_EQUAL(100, Nn::requantize(100, INT32_MAX, 0, true));
+}
+
+void test_conv()
+{
+  // the first DS-CNN layer: a tall kernel, strided, odd sizes for the padding
+  check(TestLayer(Nn::LayerType::CONV, Nn::Shape{25, 13, 1}, 8, 10, 4, 2, 2));
+  check(TestLayer(Nn::LayerType::CONV, Nn::Shape{7, 9, 3}, 5, 3, 3));
+  check(TestLayer(Nn::LayerType::CONV, Nn::Shape{4, 4, 2}, 3, 1, 1, 3, 1));
+}
+
+void test_depthwise()
+{
+  check(TestLayer(Nn::LayerType::DEPTHWISE, Nn::Shape{13, 10, 16}, 0, 3, 3));
+  check(TestLayer(Nn::LayerType::DEPTHWISE, Nn::Shape{12, 7, 4}, 0, 5, 2, 2, 2));
+}
+
+void test_pointwise()
+{
+  check(TestLayer(Nn::LayerType::POINTWISE, Nn::Shape{6, 5, 24}, 17));
+  check(TestLayer(Nn::LayerType::POINTWISE, Nn::Shape{1, 1, 1}, 1));
+}
+
+void test_average_pool()
+{
+  check(TestLayer(Nn::LayerType::AVERAGE_POOL, Nn::Shape{13, 10, 16}, 0));
+  check(TestLayer(Nn::LayerType::AVERAGE_POOL, Nn::Shape{2, 2, 3}, 0));
+
+  // extremes do not overflow and halves round away from zero
+  TestLayer pool(Nn::LayerType::AVERAGE_POOL, Nn::Shape{2, 1, 3}, 0);
+  std::vector<int8_t> in = {-128, 127, -1, -128, 127, -2};
+  std::vector<int8_t> out = run(pool, in);
+  TEST_ASSERT_EQUAL(-128, out[0]);
+  TEST_ASSERT_EQUAL(127, out[1]);
+  TEST_ASSERT_EQUAL(-2, out[2]);
+}
+
+void test_dense()
+{
+  check(TestLayer(Nn::LayerType::DENSE, Nn::Shape{1, 1, 64}, 12));
+  check(TestLayer(Nn::LayerType::DENSE, Nn::Shape{3, 4, 5}, 7));
+}
+
+void test_saturation_and_relu()
+{
+  // large multipliers push most outputs to the rails, the reference agrees
+  TestLayer loud(Nn::LayerType::CONV, Nn::Shape{8, 8, 4}, 4, 3, 3);
+  loud.layer.multiplier = INT32_MAX;
+  loud.layer.shift = 0;
+  check(loud);
+
+  std::vector<int8_t> in(loud.layer.input.size(), 127);
+  std::vector<int8_t> out = run(loud, in);
+  size_t rails = 0;
+  for (int8_t value : out)
+    rails += value == 127 || value == -128;
+  TEST_ASSERT_GREATER_THAN(out.size() / 2, rails);
+
+  // biases near the int32 edge with ReLU
+  TestLayer relu(Nn::LayerType::POINTWISE, Nn::Shape{4, 4, 8}, 6);
+  relu.layer.relu = true;
+  relu.biases = {INT32_MIN / 2, INT32_MAX / 2, -1, 0, 1, -100000};
+  relu.setBiases();
+  check(relu);
+  in.assign(relu.layer.input.size(), 0);
+  fill(in);
+  out = run(relu, in);
+  for (size_t p = 0; p < 16; p++)
+  {
+    TEST_ASSERT_EQUAL(0, out[p * 6]);
+    TEST_ASSERT_EQUAL(127, out[p * 6 + 1]);
+    for (size_t c = 0; c < 6; c++)
+      TEST_ASSERT_GREATER_OR_EQUAL(0, out[p * 6 + c]);
+  }
+}
+
+// Appends `layer` to a model blob in the format Model::parse reads.
+static void append(std::vector<uint8_t> &blob, const TestLayer &test)
+{
+  const Nn::Layer &layer = test.layer;
+  uint16_t out = layer.output.channels;
+  uint8_t header[16] = {static_cast<uint8_t>(layer.type), static_cast<uint8_t>(layer.relu),
+                        layer.kernelHeight, layer.kernelWidth, layer.strideHeight, layer.strideWidth,
+                        static_cast<uint8_t>(out), static_cast<uint8_t>(out >> 8)};
+  memcpy(header + 8, &layer.multiplier, sizeof(int32_t));
+  header[12] = layer.shift;
+  blob.insert(blob.end(), header, header + sizeof(header));
+  blob.insert(blob.end(), test.weights.begin(), test.weights.end());
+  blob.insert(blob.end(), test.bias.begin(), test.bias.end());
+}
+
+// A keyword spotter the size of the one in the README: 98 frames of 40 bins,
+// conv 10x4 / 2 to 32 channels, three depthwise + pointwise blocks, pool,
+// dense to 12 labels.
+static std::vector<TestLayer> keywordSpotter()
+{
+  std::vector<TestLayer> layers;
+  layers.emplace_back(Nn::LayerType::CONV, Nn::Shape{98, 40, 1}, 32, 10, 4, 2, 2);
+  for (int i = 0; i < 3; i++)
+  {
+    layers.emplace_back(Nn::LayerType::DEPTHWISE, layers.back().layer.output, 0, 3, 3);
+    layers.emplace_back(Nn::LayerType::POINTWISE, layers.back().layer.output, 32);
+  }
+  layers.emplace_back(Nn::LayerType::AVERAGE_POOL, layers.back().layer.output, 0);
+  layers.emplace_back(Nn::LayerType::DENSE, layers.back().layer.output, 12);
+  for (auto &test : layers)
+  {
+    test.layer.relu = test.layer.type != Nn::LayerType::DENSE;
+    test.layer.weights = test.weights.data();
+    test.layer.bias = test.bias.data();
+  }
+  return layers;
+}
+
+static std::vector<uint8_t> blobFor(const std::vector<TestLayer> &layers, size_t labels)
+{
+  const Nn::Shape &input = layers.front().layer.input;
+  std::vector<uint8_t> blob = {'N', 'N', 'M', '1',
+                               static_cast<uint8_t>(input.height), static_cast<uint8_t>(input.height >> 8),
+                               static_cast<uint8_t>(input.width), static_cast<uint8_t>(input.width >> 8),
+                               0, static_cast<uint8_t>(layers.size()), static_cast<uint8_t>(labels), 0};
+  float scale = 0.125f;
+  blob.insert(blob.end(), reinterpret_cast<uint8_t *>(&scale), reinterpret_cast<uint8_t *>(&scale) + sizeof(scale));
+  for (const auto &test : layers)
+    append(blob, test);
+  for (size_t i = 0; i < labels; i++)
+  {
+    char name[8];
+    int length = snprintf(name, sizeof(name), "word%u", static_cast<unsigned>(i));
+    blob.push_back(static_cast<uint8_t>(length));
+    blob.insert(blob.end(), name, name + length);
+  }
+  return blob;
+}
+
+void test_model_runs_the_layers_in_order()
+{
+  std::vector<TestLayer> layers = keywordSpotter();
+  std::vector<uint8_t> blob = blobFor(layers, 12);
+  Nn::Model model;
+  TEST_ASSERT_TRUE(model.parse(blob.data(), blob.size()));
+  TEST_ASSERT_EQUAL(12, model.labelCount());
+  TEST_ASSERT_EQUAL_STRING("word11", model.label(11));
+  TEST_ASSERT_EQUAL(49 * 20 * 32, model.arenaSize());
+
+  std::vector<int8_t> input(model.input().size()), a(model.arenaSize()), b(model.arenaSize());
+  fill(input, 64);
+  const int8_t *output = model.run(input.data(), a.data(), b.data());
+
+  std::vector<int8_t> expected = input;
+  for (const auto &test : layers)
+    expected = reference(test, expected);
+  TEST_ASSERT_EQUAL_MEMORY(expected.data(), output, expected.size());
+
+  // a truncated blob is refused rather than read past its end
+  TEST_ASSERT_FALSE(model.parse(blob.data(), blob.size() - 40));
+}
+
+// Time per kernel and per inference of the keyword spotter above, against
+// the 200 ms it is run every (RECORDER_KWS_STRIDE_MS).
+void test_nn_benchmark()
+{
+  static constexpr size_t rounds = 20;
+  std::vector<TestLayer> layers = keywordSpotter();
+  const char *names[] = {"", "conv", "depthwise", "pointwise", "pool", "dense"};
+  double seconds[6] = {};
+  double macs[6] = {};
+
+  std::vector<int8_t> a(49 * 20 * 32), b(a.size()), input(98 * 40);
+  fill(input, 64);
+  for (size_t round = 0; round < rounds; round++)
+  {
+    input[round] ^= 1; // keep the compiler from hoisting the work
+    const int8_t *in = input.data();
+    int8_t *out = a.data();
+    for (const auto &test : layers)
+    {
+      const Nn::Layer &layer = test.layer;
+      auto start = std::chrono::steady_clock::now();
+      switch (layer.type)
+      {
+      case Nn::LayerType::CONV:
+        Nn::conv(layer, in, out);
+        break;
+      case Nn::LayerType::DEPTHWISE:
+        Nn::depthwise(layer, in, out);
+        break;
+      case Nn::LayerType::POINTWISE:
+        Nn::pointwise(layer, in, out);
+        break;
+      case Nn::LayerType::AVERAGE_POOL:
+        Nn::averagePool(layer, in, out);
+        break;
+      case Nn::LayerType::DENSE:
+        Nn::dense(layer, in, out);
+        break;
+      }
+      size_t type = static_cast<size_t>(layer.type);
+      seconds[type] += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+      // every weight is used once per output position
+      macs[type] += test.weights.empty() ? layer.input.size()
+                                         : static_cast<double>(test.weights.size()) * layer.output.size() / layer.output.channels;
+      in = out;
+      out = out == a.data() ? b.data() : a.data();
+    }
+  }
+
+  double total = 0;
+  char message[128];
+  for (size_t type = 1; type < 6; type++)
+  {
+    total += seconds[type];
+    snprintf(message, sizeof(message), "%s: %.3f ms per inference, %.0f MMAC/s", names[type],
+             seconds[type] / rounds * 1e3, macs[type] / seconds[type] / 1e6);
+    TEST_MESSAGE(message);
+  }
+  snprintf(message, sizeof(message), "inference %.2f ms, %.2f%% of the 200 ms stride", total / rounds * 1e3,
+           100 * total / rounds / 0.2);
+  TEST_MESSAGE(message);
+}
+
+int main()
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_requantize_matches_float);
+  RUN_TEST(test_requantize_rounds_and_saturates);
+  RUN_TEST(test_conv);
+  RUN_TEST(test_depthwise);
+  RUN_TEST(test_pointwise);
+  RUN_TEST(test_average_pool);
+  RUN_TEST(test_dense);
+  RUN_TEST(test_saturation_and_relu);
+  RUN_TEST(test_model_runs_the_layers_in_order);
+  RUN_TEST(test_nn_benchmark);
+  return UNITY_END();
+}
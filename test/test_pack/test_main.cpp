@@ -0,0 +1,185 @@
+#include <unity.h>
+
+#include "core/pack.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+
+static constexpr size_t count = 128; // one 512 byte DMA buffer
+
+static int32_t raw[count];
+static uint8_t packed[count * 4 + 4];
+static uint8_t expected[count * 4 + 4];
+
+void setUp()
+{
+  uint32_t seed = 1;
+  for (size_t i = 0; i < count; i++)
+  {
+    seed = seed * 1664525u + 1013904223u;
+    raw[i] = static_cast<int32_t>(seed & 0xFFFFFF00u); // left-justified 24-bit words
+  }
+  raw[0] = INT32_MIN;
+  raw[1] = static_cast<int32_t>(0x7FFFFF00);
+}
+
+void tearDown() {}
+
+// One sample at a time, for every format.
+template <typename Output, typename Input>
+static size_t packReference(const int32_t *src, size_t n, uint8_t *dest, int32_t &peak)
+{
+  for (size_t i = 0; i < n; i++)
+  {
+    int32_t sample = Input::normalize(src[i]);
+    int32_t absolute = sample < 0 ? -sample : sample;
+    if (absolute > peak)
+      peak = absolute;
+    Output::store(dest + i * Output::bytesPerSample, sample);
+  }
+  return n * Output::bytesPerSample;
+}
+
+// The baseline's Record::normalizeSamples, with its buffer size as `n`: a
+// std::function call and three byte stores per sample.
+using NormalizationCallback = std::function<void(int32_t sample)>;
+
+static void normalizeSamples(const int32_t *data, size_t n, uint8_t *dest, NormalizationCallback cb = nullptr)
+{
+  size_t bytesWritten = 0;
+  for (size_t i = 0; i < n; i++)
+  {
+    auto sample = data[i];
+    sample = sample >> 8;
+    if (cb)
+      cb(sample);
+
+    auto v = reinterpret_cast<uint8_t *>(&sample);
+    dest[bytesWritten++] = v[0];
+    dest[bytesWritten++] = v[1];
+    dest[bytesWritten++] = v[2];
+  }
+}
+
+template <typename Output>
+static void checkFormat()
+{
+  // every tail length, at every alignment of the output
+  for (size_t offset = 0; offset < 4; offset++)
+  {
+    for (size_t n = count - 4; n <= count; n++)
+    {
+      int32_t peak = 0;
+      Pack::PeakDetector detector;
+      size_t size = Pack::packSamples<Output, AudioInput::LeftJustified>(raw, n, packed + offset, detector);
+      size_t expectedSize = packReference<Output, AudioInput::LeftJustified>(raw, n, expected + offset, peak);
+      TEST_ASSERT_EQUAL(expectedSize, size);
+      TEST_ASSERT_EQUAL_MEMORY(expected + offset, packed + offset, size);
+      TEST_ASSERT_EQUAL(peak, detector.peak);
+    }
+  }
+
+  // in place, over the words it reads
+  int32_t words[count];
+  memcpy(words, raw, sizeof(words));
+  int32_t peak = 0;
+  size_t size = Pack::packSamples<Output, AudioInput::LeftJustified>(words, count, reinterpret_cast<uint8_t *>(words), Pack::NullDetector{});
+  packReference<Output, AudioInput::LeftJustified>(raw, count, expected, peak);
+  TEST_ASSERT_EQUAL_MEMORY(expected, words, size);
+}
+
+void test_pcm16() { checkFormat<AudioFormat::Pcm16>(); }
+void test_pcm24() { checkFormat<AudioFormat::Pcm24>(); }
+void test_pcm32() { checkFormat<AudioFormat::Pcm32>(); }
+void test_float32() { checkFormat<AudioFormat::Float32>(); }
+
+void test_pcm24_matches_the_baseline()
+{
+  int32_t peak = 0;
+  normalizeSamples(raw, count, expected, [&peak](int32_t sample)
+                   {
+                     int32_t absolute = abs(sample);
+                     if (absolute > peak)
+                       peak = absolute;
+                   });
+  Pack::PeakDetector detector;
+  size_t size = Pack::packSamples<AudioFormat::Pcm24, AudioInput::LeftJustified>(raw, count, packed, detector);
+  TEST_ASSERT_EQUAL(count * 3, size);
+  TEST_ASSERT_EQUAL_MEMORY(expected, packed, size);
+  TEST_ASSERT_EQUAL(peak, detector.peak);
+}
+
+void test_right_justified_sign_extends()
+{
+  int32_t words[4] = {0x00FFFFFF, 0x00800000, 0x007FFFFF, 0x12000001};
+  int32_t samples[4];
+  memcpy(samples, words, sizeof(words));
+  Pack::normalizeInPlace<AudioInput::RightJustified>(samples, 4, Pack::NullDetector{});
+  TEST_ASSERT_EQUAL(-1, samples[0]);
+  TEST_ASSERT_EQUAL(-8388608, samples[1]);
+  TEST_ASSERT_EQUAL(8388607, samples[2]);
+  TEST_ASSERT_EQUAL(1, samples[3]);
+}
+
+static constexpr size_t rounds = 200000;
+
+template <typename Output>
+static double timePack()
+{
+  Pack::PeakDetector detector;
+  auto start = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < rounds; i++)
+  {
+    raw[i % count] ^= 0x100; // keep the compiler from hoisting the work
+    Pack::packSamples<Output, AudioInput::LeftJustified>(raw, count, packed, detector);
+  }
+  double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  TEST_ASSERT_TRUE(detector.peak > 0);
+  return seconds * 1e9 / (rounds * count);
+}
+
+// Cost per sample of packing a DMA buffer with its peak, against the
+// baseline loop the streams used to go through (24-bit, with the sampler's
+// peak callback).
+void test_pack_benchmark()
+{
+  int32_t peak = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < rounds; i++)
+  {
+    raw[i % count] ^= 0x100;
+    normalizeSamples(raw, count, expected, [&peak](int32_t sample)
+                     {
+                       int32_t absolute = abs(sample);
+                       if (absolute > peak)
+                         peak = absolute;
+                     });
+  }
+  double baseline = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() * 1e9 / (rounds * count);
+  TEST_ASSERT_TRUE(peak > 0);
+
+  double pcm24 = timePack<AudioFormat::Pcm24>();
+  char message[160];
+  snprintf(message, sizeof(message), "Pcm24: %.2f ns per sample, baseline normalizeSamples %.2f ns per sample (%.1fx)",
+           pcm24, baseline, baseline / pcm24);
+  TEST_MESSAGE(message);
+  snprintf(message, sizeof(message), "Pcm16: %.2f ns per sample, Float32: %.2f ns per sample",
+           timePack<AudioFormat::Pcm16>(), timePack<AudioFormat::Float32>());
+  TEST_MESSAGE(message);
+}
+
+int main()
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_pcm16);
+  RUN_TEST(test_pcm24);
+  RUN_TEST(test_pcm32);
+  RUN_TEST(test_float32);
+  RUN_TEST(test_pcm24_matches_the_baseline);
+  RUN_TEST(test_right_justified_sign_extends);
+  RUN_TEST(test_pack_benchmark);
+  return UNITY_END();
+}
@@ -0,0 +1,231 @@
+#include <unity.h>
+
+#include "core/features.h"
+#include "core/speaker.h"
+#include "mqtt/protocol.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+static constexpr uint32_t sampleRate = 4000;
+static constexpr size_t fragment = 128; // one 512 byte DMA buffer
+static constexpr Mel::Layout layout = Mel::layoutFor(sampleRate);
+// 2048 samples are exactly one window of this many frames.
+static constexpr uint16_t frames = (16 * fragment - layout.window) / layout.hop + 1;
+
+static uint32_t seed = 1;
+
+void setUp() { seed = 1; }
+void tearDown() {}
+
+static int8_t random8()
+{
+  seed = seed * 1664525u + 1013904223u;
+  return static_cast<int8_t>(static_cast<int>((seed >> 16) % 256) - 128);
+}
+
+// Appends one layer in the blob format of dsp/nn.h, random weights and biases.
+static void layer(std::vector<uint8_t> &blob, Nn::LayerType type, size_t weights, uint16_t biases,
+                  uint16_t out = 0, uint8_t kernel = 1, bool relu = true)
+{
+  int32_t multiplier = 1 << 30;
+  uint8_t header[16] = {static_cast<uint8_t>(type), relu, kernel, kernel, 1, 1,
+                        static_cast<uint8_t>(out), static_cast<uint8_t>(out >> 8)};
+  memcpy(header + 8, &multiplier, sizeof(multiplier));
+  header[12] = 7;
+  blob.insert(blob.end(), header, header + sizeof(header));
+  for (size_t i = 0; i < weights; i++)
+    blob.push_back(static_cast<uint8_t>(random8()));
+  for (size_t i = 0; i < biases; i++)
+  {
+    int32_t bias = random8() * 16;
+    blob.insert(blob.end(), reinterpret_cast<uint8_t *>(&bias), reinterpret_cast<uint8_t *>(&bias) + sizeof(bias));
+  }
+}
+
+// An embedding model without labels: conv 3x3 to `channels`, depthwise +
+// pointwise, pool and a dense layer to `dims`.
+static std::vector<uint8_t> embeddingModel(uint16_t height, uint16_t channels, uint16_t dims)
+{
+  std::vector<uint8_t> blob = {'N', 'N', 'M', '1',
+                               static_cast<uint8_t>(height), static_cast<uint8_t>(height >> 8),
+                               Mel::bins, 0, 20, 5, 0, 0};
+  float scale = 1.0f;
+  blob.insert(blob.end(), reinterpret_cast<uint8_t *>(&scale), reinterpret_cast<uint8_t *>(&scale) + sizeof(scale));
+  layer(blob, Nn::LayerType::CONV, 9u * channels, channels, channels, 3);
+  layer(blob, Nn::LayerType::DEPTHWISE, 9u * channels, channels, 0, 3);
+  layer(blob, Nn::LayerType::POINTWISE, static_cast<size_t>(channels) * channels, channels, channels);
+  layer(blob, Nn::LayerType::AVERAGE_POOL, 0, 0);
+  layer(blob, Nn::LayerType::DENSE, static_cast<size_t>(dims) * channels, dims, dims, 1, false);
+  return blob;
+}
+
+// Steady two-tone voice at -6 dBFS, 24-bit.
+static std::vector<int32_t> voice(size_t count)
+{
+  std::vector<int32_t> samples(count);
+  for (size_t i = 0; i < count; i++)
+  {
+    float tone = 0.7f * std::sin(6.2831853f * i * 300.0f / sampleRate) +
+                 0.3f * std::sin(6.2831853f * i * 1100.0f / sampleRate);
+    samples[i] = static_cast<int32_t>(0.5f * tone * 8388607.0f);
+  }
+  return samples;
+}
+
+// The recorder's side: the capture task's extractor fed one DMA buffer at a
+// time, the screen's feature window, then the model on its input.
+struct Device
+{
+  Nn::Model model;
+  StaticArena<16384> arena;
+  FeatureWindow window;
+  Mel::Extractor extractor;
+  std::vector<int8_t> input, a, b;
+  const int8_t *embedding = nullptr;
+
+  Device(const std::vector<uint8_t> &blob)
+  {
+    TEST_ASSERT_TRUE(model.parse(blob.data(), blob.size()));
+    TEST_ASSERT_TRUE(window.begin(arena, model.input().height));
+    extractor.begin(sampleRate);
+    input.resize(model.input().size());
+    a.resize(model.arenaSize());
+    b.resize(model.arenaSize());
+  }
+
+  void record(const std::vector<int32_t> &samples)
+  {
+    uint8_t block[Mel::maxEncodedSize(fragment, layout.hop)];
+    for (size_t offset = 0; offset + fragment <= samples.size(); offset += fragment)
+    {
+      std::vector<int32_t> buffer(samples.begin() + offset, samples.begin() + offset + fragment);
+      window.push(block, extractor.process(buffer.data(), fragment, block, sizeof(block)));
+    }
+    TEST_ASSERT_TRUE(window.full());
+    window.take(input.data(), model.inputZero());
+    embedding = model.run(input.data(), a.data(), b.data());
+  }
+};
+
+// The server's side: the template of a recording, through the library call
+// mqtt/core/templates.py makes.
+static std::vector<float> serverTemplate(const std::vector<uint8_t> &blob, const std::vector<int32_t> &samples)
+{
+  size_t dims = ffi_speakerEmbedding(blob.data(), blob.size(), samples.data(), samples.size(), sampleRate, nullptr, 0);
+  TEST_ASSERT_NOT_EQUAL(0, dims);
+  std::vector<float> result(dims);
+  TEST_ASSERT_EQUAL(dims, ffi_speakerEmbedding(blob.data(), blob.size(), samples.data(), samples.size(), sampleRate,
+                                               result.data(), dims));
+  return result;
+}
+
+// Scaled to the int8 peak for the templates message, like templates.py.
+static std::vector<int8_t> quantize(const std::vector<float> &values)
+{
+  float peak = 0;
+  for (float value : values)
+    peak = std::fabs(value) > peak ? std::fabs(value) : peak;
+  std::vector<int8_t> result;
+  for (float value : values)
+    result.push_back(static_cast<int8_t>(std::lround(value / (peak == 0 ? 1 : peak) * 127)));
+  return result;
+}
+
+static float screenSimilarity(const Device &device, const std::vector<int8_t> &reference)
+{
+  size_t dims = reference.size();
+  return Speaker::similarity(device.embedding, Speaker::norm(device.embedding, dims),
+                             reference.data(), Speaker::norm(reference.data(), dims), dims);
+}
+
+void test_one_window_matches_the_device_exactly()
+{
+  std::vector<uint8_t> blob = embeddingModel(frames, 8, 32);
+  std::vector<int32_t> samples = voice(16 * fragment);
+
+  Device device(blob);
+  device.record(samples);
+  std::vector<float> reference = serverTemplate(blob, samples);
+  TEST_ASSERT_EQUAL(device.model.outputSize(), reference.size());
+
+  // the server's template is the device embedding, normalized
+  float norm = Speaker::norm(device.embedding, reference.size());
+  TEST_ASSERT_TRUE(norm > 0);
+  for (size_t i = 0; i < reference.size(); i++)
+    TEST_ASSERT_FLOAT_WITHIN(1e-6, device.embedding[i] / norm, reference[i]);
+
+  // and the screen scores the quantized template as a match
+  TEST_ASSERT_FLOAT_WITHIN(0.001, 1.0, screenSimilarity(device, quantize(reference)));
+}
+
+void test_longer_enrollment_still_matches()
+{
+  // the server averages half-overlapping windows over the whole sample,
+  // the device embeds the last window of a stream of the same voice
+  std::vector<uint8_t> blob = embeddingModel(frames, 8, 32);
+  std::vector<int32_t> samples = voice(3 * sampleRate);
+
+  Device device(blob);
+  device.record(voice(sampleRate));
+  float similarity = screenSimilarity(device, quantize(serverTemplate(blob, samples)));
+
+  char message[64];
+  snprintf(message, sizeof(message), "similarity %.4f", similarity);
+  TEST_MESSAGE(message);
+  TEST_ASSERT_GREATER_THAN(RECORDER_SPEAKER_PRIORITY, similarity);
+}
+
+void test_short_recording_has_no_template()
+{
+  std::vector<uint8_t> blob = embeddingModel(frames, 8, 32);
+  std::vector<int32_t> samples = voice(layout.window + (frames - 1) * layout.hop - 1);
+  TEST_ASSERT_EQUAL(0, ffi_speakerEmbedding(blob.data(), blob.size(), samples.data(), samples.size(), sampleRate,
+                                            nullptr, 0));
+  TEST_ASSERT_EQUAL(0, ffi_speakerEmbedding(blob.data(), 20, samples.data(), samples.size(), sampleRate,
+                                            nullptr, 0));
+}
+
+// One embedding at the size the screen allows (1 s of frames, 128 dims),
+// against the time a stream waits for it, and the server's template rate.
+void test_speaker_benchmark()
+{
+  static constexpr size_t rounds = 20;
+  uint16_t height = (sampleRate - layout.window) / layout.hop + 1;
+  std::vector<uint8_t> blob = embeddingModel(height, 32, RECORDER_SPEAKER_MAX_DIMS);
+  Device device(blob);
+  device.record(voice(32 * fragment));
+
+  auto start = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < rounds; i++)
+  {
+    device.input[i] ^= 1; // keep the compiler from hoisting the work
+    device.embedding = device.model.run(device.input.data(), device.a.data(), device.b.data());
+  }
+  double embedding = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() / rounds;
+
+  std::vector<int32_t> enrollment = voice(10 * sampleRate);
+  std::vector<float> out(RECORDER_SPEAKER_MAX_DIMS);
+  start = std::chrono::steady_clock::now();
+  ffi_speakerEmbedding(blob.data(), blob.size(), enrollment.data(), enrollment.size(), sampleRate,
+                       out.data(), out.size());
+  double server = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  char message[128];
+  snprintf(message, sizeof(message), "embedding of %u frames: %.2f ms, server template of 10 s: %.1f ms (%.0fx real time)",
+           height, embedding * 1e3, server * 1e3, 10 / server);
+  TEST_MESSAGE(message);
+}
+
+int main()
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_one_window_matches_the_device_exactly);
+  RUN_TEST(test_longer_enrollment_still_matches);
+  RUN_TEST(test_short_recording_has_no_template);
+  RUN_TEST(test_speaker_benchmark);
+  return UNITY_END();
+}
@@ -0,0 +1,238 @@
+#include <unity.h>
+
+#include "core/spool.h"
+
+#include <cstdio>
+#include <cstring>
+
+// Segments backed by temporary files. Writes fail once `budget` runs out,
+// as they would when power goes mid-session.
+struct FileFlash
+{
+  FILE *files[SPOOL_SEGMENTS] = {};
+  long budget = -1; // writes left, -1 for no limit
+
+  ~FileFlash()
+  {
+    for (FILE *file : files)
+    {
+      if (file)
+        fclose(file);
+    }
+  }
+
+  bool prepare(size_t segment, size_t size)
+  {
+    if (files[segment])
+      return true;
+    files[segment] = tmpfile();
+    if (!files[segment])
+      return false;
+
+    static const uint8_t zeros[256] = {};
+    for (size_t written = 0; written < size; written += sizeof(zeros))
+    {
+      size_t chunk = size - written < sizeof(zeros) ? size - written : sizeof(zeros);
+      if (fwrite(zeros, 1, chunk, files[segment]) != chunk)
+        return false;
+    }
+    return true;
+  }
+
+  bool read(size_t segment, size_t offset, void *dest, size_t size)
+  {
+    FILE *file = files[segment];
+    return fseek(file, offset, SEEK_SET) == 0 && fread(dest, 1, size, file) == size;
+  }
+
+  bool write(size_t segment, size_t offset, const void *src, size_t size)
+  {
+    if (budget == 0)
+      return false;
+    if (budget > 0)
+      budget--;
+
+    FILE *file = files[segment];
+    return fseek(file, offset, SEEK_SET) == 0 && fwrite(src, 1, size, file) == size && fflush(file) == 0;
+  }
+};
+
+static FileFlash *flash;
+
+void setUp()
+{
+  flash = new FileFlash();
+}
+
+void tearDown()
+{
+  delete flash;
+}
+
+static void fill(uint8_t *payload, size_t size, uint8_t seed)
+{
+  for (size_t i = 0; i < size; i++)
+    payload[i] = static_cast<uint8_t>(seed + i * 7);
+}
+
+// Spools one session of `bodies` bodies of `size` bytes.
+static bool spoolSession(Spool<FileFlash> &spool, const char *topic, size_t bodies, size_t size, uint8_t seed)
+{
+  uint8_t payload[SPOOL_MAX_RECORD];
+  if (!spool.open(topic) || !spool.append("FRHD", reinterpret_cast<const uint8_t *>("sample"), 6))
+    return false;
+  for (size_t i = 0; i < bodies; i++)
+  {
+    fill(payload, size, seed + i);
+    if (!spool.append("FRBD", payload, size))
+      return false;
+  }
+  return spool.append("FRTR", nullptr, 0) && spool.seal();
+}
+
+void test_append_seal_and_read_back()
+{
+  Spool<FileFlash> spool(*flash);
+  TEST_ASSERT_TRUE(spool.begin());
+  TEST_ASSERT_EQUAL(0, spool.pending());
+  TEST_ASSERT_TRUE(spoolSession(spool, "recorder", 3, 500, 1));
+  TEST_ASSERT_EQUAL(1, spool.pending());
+
+  int segment = spool.oldest();
+  TEST_ASSERT_TRUE(segment >= 0);
+  TEST_ASSERT_EQUAL_STRING("recorder", spool.topic(segment));
+
+  uint32_t offset = 0;
+  SpoolRecord record;
+  uint8_t payload[SPOOL_MAX_RECORD];
+  uint8_t expected[SPOOL_MAX_RECORD];
+
+  TEST_ASSERT_TRUE(spool.read(segment, offset, record, payload, sizeof(payload)));
+  TEST_ASSERT_EQUAL_STRING("FRHD", record.type);
+  TEST_ASSERT_EQUAL_MEMORY("sample", payload, 6);
+  for (size_t i = 0; i < 3; i++)
+  {
+    TEST_ASSERT_TRUE(spool.read(segment, offset, record, payload, sizeof(payload)));
+    TEST_ASSERT_EQUAL_STRING("FRBD", record.type);
+    TEST_ASSERT_EQUAL(500, record.size);
+    fill(expected, 500, 1 + i);
+    TEST_ASSERT_EQUAL_MEMORY(expected, payload, 500);
+  }
+  TEST_ASSERT_TRUE(spool.read(segment, offset, record, payload, sizeof(payload)));
+  TEST_ASSERT_EQUAL_STRING("FRTR", record.type);
+  TEST_ASSERT_EQUAL(0, record.size);
+  TEST_ASSERT_FALSE(spool.read(segment, offset, record, payload, sizeof(payload)));
+}
+
+void test_record_too_large_for_the_segment_is_refused()
+{
+  Spool<FileFlash> spool(*flash);
+  TEST_ASSERT_TRUE(spool.begin());
+  TEST_ASSERT_TRUE(spool.open("recorder"));
+
+  uint8_t payload[SPOOL_MAX_RECORD] = {};
+  TEST_ASSERT_FALSE(spool.append("FRBD", payload, SPOOL_MAX_RECORD + 1));
+  size_t appended = 0;
+  while (spool.append("FRBD", payload, sizeof(payload)))
+    appended++;
+  TEST_ASSERT_EQUAL((SPOOL_SEGMENT_SIZE - 64) / (sizeof(payload) + 6), appended);
+
+  spool.abandon();
+  TEST_ASSERT_FALSE(spool.isOpen());
+  TEST_ASSERT_EQUAL(0, spool.pending());
+}
+
+void test_sealed_sessions_survive_a_restart_oldest_first()
+{
+  {
+    Spool<FileFlash> spool(*flash);
+    TEST_ASSERT_TRUE(spool.begin());
+    TEST_ASSERT_TRUE(spoolSession(spool, "first", 1, 100, 1));
+    TEST_ASSERT_TRUE(spoolSession(spool, "second", 1, 100, 2));
+  }
+
+  Spool<FileFlash> spool(*flash);
+  TEST_ASSERT_TRUE(spool.begin());
+  TEST_ASSERT_EQUAL(2, spool.pending());
+  TEST_ASSERT_EQUAL(0, spool.discarded());
+  TEST_ASSERT_EQUAL_STRING("first", spool.topic(spool.oldest()));
+
+  // new sessions keep coming after the ones found
+  TEST_ASSERT_TRUE(spool.release(spool.oldest()));
+  TEST_ASSERT_TRUE(spoolSession(spool, "third", 1, 100, 3));
+  TEST_ASSERT_EQUAL_STRING("second", spool.topic(spool.oldest()));
+}
+
+void test_power_loss_mid_session_drops_it()
+{
+  {
+    Spool<FileFlash> spool(*flash);
+    TEST_ASSERT_TRUE(spool.begin());
+    TEST_ASSERT_TRUE(spoolSession(spool, "sealed", 2, 100, 1));
+
+    // power goes while the next session is being written
+    flash->budget = 4;
+    TEST_ASSERT_FALSE(spoolSession(spool, "cut", 8, 100, 2));
+  }
+
+  flash->budget = -1;
+  Spool<FileFlash> spool(*flash);
+  TEST_ASSERT_TRUE(spool.begin());
+  TEST_ASSERT_EQUAL(1, spool.discarded());
+  TEST_ASSERT_EQUAL(1, spool.pending());
+  TEST_ASSERT_EQUAL_STRING("sealed", spool.topic(spool.oldest()));
+
+  // the segment of the dropped session is free again
+  for (size_t i = 1; i < SPOOL_SEGMENTS; i++)
+    TEST_ASSERT_TRUE(spoolSession(spool, "next", 1, 100, i));
+  TEST_ASSERT_FALSE(spool.hasRoom());
+}
+
+void test_failed_seal_leaves_nothing_to_replay()
+{
+  Spool<FileFlash> spool(*flash);
+  TEST_ASSERT_TRUE(spool.begin());
+  TEST_ASSERT_TRUE(spool.open("recorder"));
+  TEST_ASSERT_TRUE(spool.append("FRHD", nullptr, 0));
+
+  flash->budget = 0;
+  TEST_ASSERT_FALSE(spool.seal());
+  TEST_ASSERT_FALSE(spool.isOpen());
+  TEST_ASSERT_EQUAL(0, spool.pending());
+}
+
+void test_release_frees_the_segment()
+{
+  Spool<FileFlash> spool(*flash);
+  TEST_ASSERT_TRUE(spool.begin());
+  for (size_t i = 0; i < SPOOL_SEGMENTS; i++)
+    TEST_ASSERT_TRUE(spoolSession(spool, "recorder", 1, 100, i));
+
+  // a full spool keeps its oldest sessions
+  TEST_ASSERT_FALSE(spool.hasRoom());
+  TEST_ASSERT_FALSE(spool.open("recorder"));
+
+  int segment = spool.oldest();
+  TEST_ASSERT_TRUE(spool.release(segment));
+  TEST_ASSERT_FALSE(spool.release(segment));
+  TEST_ASSERT_EQUAL(SPOOL_SEGMENTS - 1, spool.pending());
+  TEST_ASSERT_TRUE(spool.hasRoom());
+
+  // released sessions stay gone after a restart
+  Spool<FileFlash> restarted(*flash);
+  TEST_ASSERT_TRUE(restarted.begin());
+  TEST_ASSERT_EQUAL(SPOOL_SEGMENTS - 1, restarted.pending());
+  TEST_ASSERT_EQUAL(0, restarted.discarded());
+}
+
+int main()
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_append_seal_and_read_back);
+  RUN_TEST(test_record_too_large_for_the_segment_is_refused);
+  RUN_TEST(test_sealed_sessions_survive_a_restart_oldest_first);
+  RUN_TEST(test_power_loss_mid_session_drops_it);
+  RUN_TEST(test_failed_seal_leaves_nothing_to_replay);
+  RUN_TEST(test_release_frees_the_segment);
+  return UNITY_END();
+}